@@ -15,6 +15,9 @@
 #define UTILS_H_IMPLEMENTATION
 #include "../common/utils.h"
 
+#define DFTK_IMPLEMENTATION
+#include "../common/dftk/dftk.h"
+
 #define PI 3.14159265359
 
 typedef struct {
@@ -56,6 +59,510 @@ void exitWith(id obj) {
     exit(1);
 }
 
+#if defined(VALIDATE)
+// Runs grayscale_kernel once and compares the GPU output pixel by pixel with
+// the CPU port in dftk/grayscale. Build with -DVALIDATE.
+void validate_grayscale(float bias) {
+    id<MTLCommandBuffer> command_buffer = [state.command_queue commandBuffer];
+    id<MTLComputeCommandEncoder> compute_command_encoder = [command_buffer computeCommandEncoder];
+    [compute_command_encoder setComputePipelineState:state.compute_pipeline_state];
+    [compute_command_encoder setTexture:state.input_texture atIndex:0];
+    [compute_command_encoder setTexture:state.output_texture atIndex:1];
+    [compute_command_encoder setBytes:&bias length:sizeof(float) atIndex:0];
+    [compute_command_encoder dispatchThreadgroups:state.threadgroup_count threadsPerThreadgroup:state.threadgroup_size];
+    [compute_command_encoder endEncoding];
+
+    if (state.output_texture.storageMode == MTLStorageModeManaged) {
+        id<MTLBlitCommandEncoder> blit_encoder = [command_buffer blitCommandEncoder];
+        [blit_encoder synchronizeResource:state.output_texture];
+        [blit_encoder endEncoding];
+    }
+
+    [command_buffer commit];
+    [command_buffer waitUntilCompleted];
+
+    uint32_t w = (uint32_t) state.input_texture.width;
+    uint32_t h = (uint32_t) state.input_texture.height;
+    MTLRegion region = MTLRegionMake2D(0, 0, w, h);
+
+    df_cpu_texture_t input, gpu_output, cpu_output;
+    df_cpu_texture_init(&input, w, h);
+    df_cpu_texture_init(&gpu_output, w, h);
+    df_cpu_texture_init(&cpu_output, w, h);
+
+    [state.input_texture getBytes:input.data bytesPerRow:input.bytes_per_row fromRegion:region mipmapLevel:0];
+    [state.output_texture getBytes:gpu_output.data bytesPerRow:gpu_output.bytes_per_row fromRegion:region mipmapLevel:0];
+    df_grayscale(&input, &cpu_output, bias, NULL);
+
+    size_t mismatches = 0;
+    int max_diff = 0;
+    for (size_t i = 0; i < cpu_output.bytes_per_row * h; i++) {
+        int diff = abs((int) gpu_output.data[i] - (int) cpu_output.data[i]);
+        if (diff > 0) mismatches++;
+        if (diff > max_diff) max_diff = diff;
+    }
+    NSLog(@"grayscale_kernel: %zu of %zu bytes differ from the CPU port (max diff %d)", mismatches, cpu_output.bytes_per_row * h, max_diff);
+
+    df_cpu_texture_free(&input);
+    df_cpu_texture_free(&gpu_output);
+    df_cpu_texture_free(&cpu_output);
+}
+
+// Runs grayscale_kernel on RGBA16Float textures and compares the output
+// halves bit for bit with df_grayscale_f16
+void validate_grayscale_f16(float bias) {
+    uint32_t w = (uint32_t) state.input_texture.width;
+    uint32_t h = (uint32_t) state.input_texture.height;
+    MTLRegion region = MTLRegionMake2D(0, 0, w, h);
+
+    df_cpu_texture_t input;
+    df_image_f16_t input_f16, gpu_output, cpu_output;
+    df_cpu_texture_init(&input, w, h);
+    df_image_f16_init(&input_f16, w, h);
+    df_image_f16_init(&gpu_output, w, h);
+    df_image_f16_init(&cpu_output, w, h);
+    [state.input_texture getBytes:input.data bytesPerRow:input.bytes_per_row fromRegion:region mipmapLevel:0];
+    df_image_f16_from_texture(&input_f16, &input);
+
+    MTLTextureDescriptor *desc = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:MTLPixelFormatRGBA16Float width:w height:h mipmapped:NO];
+    desc.usage = MTLTextureUsageShaderRead | MTLTextureUsageShaderWrite;
+    desc.storageMode = MTLStorageModeManaged;
+    id<MTLTexture> in_texture = [app.device newTextureWithDescriptor:desc];
+    id<MTLTexture> out_texture = [app.device newTextureWithDescriptor:desc];
+    [in_texture replaceRegion:region mipmapLevel:0 withBytes:input_f16.data bytesPerRow:(size_t) w * 4 * sizeof(df_half)];
+
+    id<MTLCommandBuffer> command_buffer = [state.command_queue commandBuffer];
+    id<MTLComputeCommandEncoder> encoder = [command_buffer computeCommandEncoder];
+    [encoder setComputePipelineState:state.compute_pipeline_state];
+    [encoder setTexture:in_texture atIndex:0];
+    [encoder setTexture:out_texture atIndex:1];
+    [encoder setBytes:&bias length:sizeof(float) atIndex:0];
+    [encoder dispatchThreadgroups:state.threadgroup_count threadsPerThreadgroup:state.threadgroup_size];
+    [encoder endEncoding];
+
+    id<MTLBlitCommandEncoder> blit_encoder = [command_buffer blitCommandEncoder];
+    [blit_encoder synchronizeResource:out_texture];
+    [blit_encoder endEncoding];
+
+    [command_buffer commit];
+    [command_buffer waitUntilCompleted];
+
+    [out_texture getBytes:gpu_output.data bytesPerRow:(size_t) w * 4 * sizeof(df_half) fromRegion:region mipmapLevel:0];
+    df_grayscale_f16(&input_f16, &cpu_output, bias, NULL);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < (size_t) w * h * 4; i++) {
+        mismatches += gpu_output.data[i] != cpu_output.data[i];
+    }
+    NSLog(@"grayscale_kernel (half textures): %zu of %zu halves differ from the CPU port", mismatches, (size_t) w * h * 4);
+
+    df_cpu_texture_free(&input);
+    df_image_f16_free(&input_f16);
+    df_image_f16_free(&gpu_output);
+    df_image_f16_free(&cpu_output);
+    [in_texture release];
+    [out_texture release];
+}
+
+// Blurs the input with a 9-tap binomial on the GPU (convolve_h_kernel then
+// convolve_v_kernel through a float intermediate) and with
+// df_convolve_separable, and compares the results. They may differ by one
+// step where a value lands on a rounding boundary.
+void validate_convolve(id<MTLLibrary> library) {
+    NSError *error;
+    float taps[9] = { 1, 8, 28, 56, 70, 56, 28, 8, 1 };
+    for (int i = 0; i < 9; i++) taps[i] /= 256.0f;
+    int num_taps = 9;
+
+    id<MTLFunction> h_function = [library newFunctionWithName:@"convolve_h_kernel"];
+    id<MTLFunction> v_function = [library newFunctionWithName:@"convolve_v_kernel"];
+    if (!h_function || !v_function) {
+        exitWith(@"Convolution kernels not found!");
+    }
+    id<MTLComputePipelineState> h_state = [app.device newComputePipelineStateWithFunction:h_function error:&error];
+    id<MTLComputePipelineState> v_state = [app.device newComputePipelineStateWithFunction:v_function error:&error];
+    if (!h_state || !v_state) {
+        exitWith(error);
+    }
+
+    uint32_t w = (uint32_t) state.input_texture.width;
+    uint32_t h = (uint32_t) state.input_texture.height;
+
+    MTLTextureDescriptor *desc = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:MTLPixelFormatRGBA32Float width:w height:h mipmapped:NO];
+    desc.usage = MTLTextureUsageShaderRead | MTLTextureUsageShaderWrite;
+    desc.storageMode = MTLStorageModePrivate;
+    id<MTLTexture> intermediate = [app.device newTextureWithDescriptor:desc];
+
+    desc.pixelFormat = state.input_texture.pixelFormat;
+    desc.storageMode = MTLStorageModeManaged;
+    id<MTLTexture> output = [app.device newTextureWithDescriptor:desc];
+
+    id<MTLCommandBuffer> command_buffer = [state.command_queue commandBuffer];
+    id<MTLComputeCommandEncoder> encoder = [command_buffer computeCommandEncoder];
+    [encoder setBytes:taps length:sizeof(taps) atIndex:0];
+    [encoder setBytes:&num_taps length:sizeof(int) atIndex:1];
+
+    [encoder setComputePipelineState:h_state];
+    [encoder setTexture:state.input_texture atIndex:0];
+    [encoder setTexture:intermediate atIndex:1];
+    [encoder dispatchThreadgroups:state.threadgroup_count threadsPerThreadgroup:state.threadgroup_size];
+
+    [encoder setComputePipelineState:v_state];
+    [encoder setTexture:intermediate atIndex:0];
+    [encoder setTexture:output atIndex:1];
+    [encoder dispatchThreadgroups:state.threadgroup_count threadsPerThreadgroup:state.threadgroup_size];
+    [encoder endEncoding];
+
+    id<MTLBlitCommandEncoder> blit_encoder = [command_buffer blitCommandEncoder];
+    [blit_encoder synchronizeResource:output];
+    [blit_encoder endEncoding];
+
+    [command_buffer commit];
+    [command_buffer waitUntilCompleted];
+
+    MTLRegion region = MTLRegionMake2D(0, 0, w, h);
+    df_cpu_texture_t input, gpu_output, cpu_output;
+    df_cpu_texture_init(&input, w, h);
+    df_cpu_texture_init(&gpu_output, w, h);
+    df_cpu_texture_init(&cpu_output, w, h);
+    [state.input_texture getBytes:input.data bytesPerRow:input.bytes_per_row fromRegion:region mipmapLevel:0];
+    [output getBytes:gpu_output.data bytesPerRow:gpu_output.bytes_per_row fromRegion:region mipmapLevel:0];
+
+    df_image_f32_t source, blurred;
+    df_image_f32_init(&source, w, h);
+    df_image_f32_init(&blurred, w, h);
+    df_image_f32_from_texture(&source, &input);
+    df_convolve_separable(&source, &blurred, taps, num_taps, taps, num_taps, NULL);
+    df_image_f32_to_texture(&blurred, &cpu_output);
+
+    size_t mismatches = 0;
+    int max_diff = 0;
+    for (size_t i = 0; i < cpu_output.bytes_per_row * h; i++) {
+        int diff = abs((int) gpu_output.data[i] - (int) cpu_output.data[i]);
+        if (diff > 1) mismatches++;
+        if (diff > max_diff) max_diff = diff;
+    }
+    NSLog(@"convolve kernels: %zu of %zu bytes off by more than one from the CPU (max diff %d)", mismatches, cpu_output.bytes_per_row * h, max_diff);
+
+    df_image_f32_free(&source);
+    df_image_f32_free(&blurred);
+    df_cpu_texture_free(&input);
+    df_cpu_texture_free(&gpu_output);
+    df_cpu_texture_free(&cpu_output);
+
+    [intermediate release];
+    [output release];
+    [h_state release];
+    [v_state release];
+    [h_function release];
+    [v_function release];
+}
+
+// One box_h_kernel or box_v_kernel pass, a thread per row or column
+static void encode_box(id<MTLComputeCommandEncoder> encoder, id<MTLComputePipelineState> pipeline_state, id<MTLTexture> in, id<MTLTexture> out, int radius, NSUInteger lines) {
+    [encoder setComputePipelineState:pipeline_state];
+    [encoder setTexture:in atIndex:0];
+    [encoder setTexture:out atIndex:1];
+    [encoder setBytes:&radius length:sizeof(int) atIndex:0];
+    [encoder dispatchThreadgroups:MTLSizeMake((lines + 63) / 64, 1, 1) threadsPerThreadgroup:MTLSizeMake(64, 1, 1)];
+}
+
+// Runs a box blur and the three-box Gaussian on the GPU with box_h_kernel
+// and box_v_kernel, and compares them with df_box_blur and
+// df_gaussian_blur. The GPU runs the boxes in the same order as the CPU
+// (rows first, then columns) through float intermediates.
+void validate_blur(id<MTLLibrary> library) {
+    NSError *error;
+    id<MTLFunction> h_function = [library newFunctionWithName:@"box_h_kernel"];
+    id<MTLFunction> v_function = [library newFunctionWithName:@"box_v_kernel"];
+    if (!h_function || !v_function) {
+        exitWith(@"Box blur kernels not found!");
+    }
+    id<MTLComputePipelineState> h_state = [app.device newComputePipelineStateWithFunction:h_function error:&error];
+    id<MTLComputePipelineState> v_state = [app.device newComputePipelineStateWithFunction:v_function error:&error];
+    if (!h_state || !v_state) {
+        exitWith(error);
+    }
+
+    uint32_t w = (uint32_t) state.input_texture.width;
+    uint32_t h = (uint32_t) state.input_texture.height;
+
+    MTLTextureDescriptor *desc = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:MTLPixelFormatRGBA32Float width:w height:h mipmapped:NO];
+    desc.usage = MTLTextureUsageShaderRead | MTLTextureUsageShaderWrite;
+    desc.storageMode = MTLStorageModePrivate;
+    id<MTLTexture> a = [app.device newTextureWithDescriptor:desc];
+    id<MTLTexture> b = [app.device newTextureWithDescriptor:desc];
+
+    desc.pixelFormat = state.input_texture.pixelFormat;
+    desc.storageMode = MTLStorageModeManaged;
+    id<MTLTexture> output = [app.device newTextureWithDescriptor:desc];
+
+    MTLRegion region = MTLRegionMake2D(0, 0, w, h);
+    df_cpu_texture_t input, gpu_output, cpu_output;
+    df_cpu_texture_init(&input, w, h);
+    df_cpu_texture_init(&gpu_output, w, h);
+    df_cpu_texture_init(&cpu_output, w, h);
+    [state.input_texture getBytes:input.data bytesPerRow:input.bytes_per_row fromRegion:region mipmapLevel:0];
+
+    df_image_f32_t source, blurred;
+    df_image_f32_init(&source, w, h);
+    df_image_f32_init(&blurred, w, h);
+    df_image_f32_from_texture(&source, &input);
+
+    float sigma = 4.0f;
+    int radii[DF_GAUSSIAN_BOXES];
+    df_gaussian_box_radii(sigma, radii);
+
+    for (int gaussian = 0; gaussian < 2; gaussian++) {
+        id<MTLCommandBuffer> command_buffer = [state.command_queue commandBuffer];
+        id<MTLComputeCommandEncoder> encoder = [command_buffer computeCommandEncoder];
+        if (gaussian) {
+            encode_box(encoder, h_state, state.input_texture, a, radii[0], h);
+            encode_box(encoder, h_state, a, b, radii[1], h);
+            encode_box(encoder, h_state, b, a, radii[2], h);
+            encode_box(encoder, v_state, a, b, radii[0], w);
+            encode_box(encoder, v_state, b, a, radii[1], w);
+            encode_box(encoder, v_state, a, output, radii[2], w);
+        } else {
+            encode_box(encoder, h_state, state.input_texture, a, 6, h);
+            encode_box(encoder, v_state, a, output, 6, w);
+        }
+        [encoder endEncoding];
+
+        id<MTLBlitCommandEncoder> blit_encoder = [command_buffer blitCommandEncoder];
+        [blit_encoder synchronizeResource:output];
+        [blit_encoder endEncoding];
+
+        [command_buffer commit];
+        [command_buffer waitUntilCompleted];
+
+        [output getBytes:gpu_output.data bytesPerRow:gpu_output.bytes_per_row fromRegion:region mipmapLevel:0];
+        bool ok = gaussian ? df_gaussian_blur(&source, &blurred, sigma, NULL) : df_box_blur(&source, &blurred, 6, NULL);
+        if (!ok) {
+            NSLog(@"%s: out of memory on the CPU, skipped", gaussian ? "gaussian blur (3 boxes)" : "box blur (radius 6)");
+            continue;
+        }
+        df_image_f32_to_texture(&blurred, &cpu_output);
+
+        size_t mismatches = 0;
+        int max_diff = 0;
+        for (size_t i = 0; i < cpu_output.bytes_per_row * h; i++) {
+            int diff = abs((int) gpu_output.data[i] - (int) cpu_output.data[i]);
+            if (diff > 1) mismatches++;
+            if (diff > max_diff) max_diff = diff;
+        }
+        NSLog(@"%s: %zu of %zu bytes off by more than one from the CPU (max diff %d)", gaussian ? "gaussian blur (3 boxes)" : "box blur (radius 6)",
+              mismatches, cpu_output.bytes_per_row * h, max_diff);
+    }
+
+    df_image_f32_free(&source);
+    df_image_f32_free(&blurred);
+    df_cpu_texture_free(&input);
+    df_cpu_texture_free(&gpu_output);
+    df_cpu_texture_free(&cpu_output);
+
+    [a release];
+    [b release];
+    [output release];
+    [h_state release];
+    [v_state release];
+    [h_function release];
+    [v_function release];
+}
+
+// Builds color_matrix_kernel specialized for `kind` and checks it against
+// df_color_matrix on a copy of the input texture
+static void validate_color_matrix_kind(id<MTLLibrary> library, id<MTLBuffer> matrix_buffer, const df_color_matrix_t *cm, df_color_matrix_kind kind, const char *name) {
+    NSError *error;
+    int kind_value = (int) kind;
+
+    MTLFunctionConstantValues *constants = [[MTLFunctionConstantValues alloc] init];
+    [constants setConstantValue:&kind_value type:MTLDataTypeInt atIndex:0];
+    id<MTLFunction> function = [library newFunctionWithName:@"color_matrix_kernel" constantValues:constants error:&error];
+    if (!function) {
+        exitWith(error);
+    }
+    id<MTLComputePipelineState> pipeline_state = [app.device newComputePipelineStateWithFunction:function error:&error];
+    if (!pipeline_state) {
+        exitWith(error);
+    }
+
+    uint32_t w = (uint32_t) state.input_texture.width;
+    uint32_t h = (uint32_t) state.input_texture.height;
+
+    MTLTextureDescriptor *desc = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:state.input_texture.pixelFormat width:w height:h mipmapped:NO];
+    desc.usage = MTLTextureUsageShaderRead | MTLTextureUsageShaderWrite;
+    desc.storageMode = MTLStorageModeManaged;
+    id<MTLTexture> output = [app.device newTextureWithDescriptor:desc];
+
+    id<MTLCommandBuffer> command_buffer = [state.command_queue commandBuffer];
+    id<MTLComputeCommandEncoder> encoder = [command_buffer computeCommandEncoder];
+    [encoder setComputePipelineState:pipeline_state];
+    [encoder setTexture:state.input_texture atIndex:0];
+    [encoder setTexture:output atIndex:1];
+    [encoder setBuffer:matrix_buffer offset:0 atIndex:0];
+    [encoder dispatchThreadgroups:state.threadgroup_count threadsPerThreadgroup:state.threadgroup_size];
+    [encoder endEncoding];
+
+    id<MTLBlitCommandEncoder> blit_encoder = [command_buffer blitCommandEncoder];
+    [blit_encoder synchronizeResource:output];
+    [blit_encoder endEncoding];
+
+    [command_buffer commit];
+    [command_buffer waitUntilCompleted];
+
+    MTLRegion region = MTLRegionMake2D(0, 0, w, h);
+    df_cpu_texture_t input, gpu_output, cpu_output;
+    df_cpu_texture_init(&input, w, h);
+    df_cpu_texture_init(&gpu_output, w, h);
+    df_cpu_texture_init(&cpu_output, w, h);
+    [state.input_texture getBytes:input.data bytesPerRow:input.bytes_per_row fromRegion:region mipmapLevel:0];
+    [output getBytes:gpu_output.data bytesPerRow:gpu_output.bytes_per_row fromRegion:region mipmapLevel:0];
+    df_color_matrix(&input, &cpu_output, cm, NULL);
+
+    size_t mismatches = 0;
+    int max_diff = 0;
+    for (size_t i = 0; i < cpu_output.bytes_per_row * h; i++) {
+        int diff = abs((int) gpu_output.data[i] - (int) cpu_output.data[i]);
+        if (diff > 1) mismatches++;
+        if (diff > max_diff) max_diff = diff;
+    }
+    NSLog(@"color_matrix_kernel (%s): %zu of %zu bytes off by more than one from the CPU (max diff %d)", name, mismatches, cpu_output.bytes_per_row * h, max_diff);
+
+    df_cpu_texture_free(&input);
+    df_cpu_texture_free(&gpu_output);
+    df_cpu_texture_free(&cpu_output);
+
+    [output release];
+    [pipeline_state release];
+    [function release];
+    [constants release];
+}
+
+void validate_color_matrix(id<MTLLibrary> library) {
+    df_color_matrix_t matrices[3];
+    df_color_matrix_hue_rotate(&matrices[0], 1.0f);
+    df_color_matrix_t swizzle;
+    df_color_matrix_swizzle(&swizzle, 2, 1, 0, 3);
+    df_color_matrix_multiply(&matrices[0], &swizzle, &matrices[0]);
+    matrices[0].m[3][0] = 0.25f;
+    df_color_matrix_sepia(&matrices[1]);
+    df_color_matrix_luma(&matrices[2], 0.2126f, 0.7152f, 0.0722f);
+
+    const char *names[3] = { "general", "identity alpha", "luma" };
+    for (int i = 0; i < 3; i++) {
+        df_color_matrix_kind kind = df_color_matrix_classify(&matrices[i]);
+        id<MTLBuffer> matrix_buffer = [app.device newBufferWithBytes:&matrices[i] length:sizeof(df_color_matrix_t) options:MTLResourceOptionCPUCacheModeDefault];
+        validate_color_matrix_kind(library, matrix_buffer, &matrices[i], kind, names[kind]);
+        [matrix_buffer release];
+    }
+}
+
+// Runs histogram_kernel (or histogram_atomic_kernel), then stats_kernel,
+// returns the GPU time in milliseconds and fills `stats`
+static double gpu_image_stats(id<MTLComputePipelineState> histogram_state, id<MTLComputePipelineState> stats_state, df_image_stats_t *stats) {
+    uint32_t w = (uint32_t) state.input_texture.width;
+    uint32_t h = (uint32_t) state.input_texture.height;
+    NSUInteger num_groups = state.threadgroup_count.width * state.threadgroup_count.height;
+
+    id<MTLBuffer> histogram = [app.device newBufferWithLength:sizeof(stats->histogram) options:MTLResourceStorageModeShared];
+    id<MTLBuffer> partials = [app.device newBufferWithLength:num_groups * 12 * sizeof(uint32_t) options:MTLResourceStorageModeShared];
+    memset(histogram.contents, 0, sizeof(stats->histogram));
+
+    id<MTLCommandBuffer> command_buffer = [state.command_queue commandBuffer];
+    id<MTLComputeCommandEncoder> encoder = [command_buffer computeCommandEncoder];
+    [encoder setTexture:state.input_texture atIndex:0];
+    [encoder setComputePipelineState:histogram_state];
+    [encoder setBuffer:histogram offset:0 atIndex:0];
+    [encoder dispatchThreadgroups:state.threadgroup_count threadsPerThreadgroup:state.threadgroup_size];
+    [encoder setComputePipelineState:stats_state];
+    [encoder setBuffer:partials offset:0 atIndex:0];
+    [encoder dispatchThreadgroups:state.threadgroup_count threadsPerThreadgroup:state.threadgroup_size];
+    [encoder endEncoding];
+    [command_buffer commit];
+    [command_buffer waitUntilCompleted];
+
+    memcpy(stats->histogram, histogram.contents, sizeof(stats->histogram));
+
+    const uint32_t *p = (const uint32_t *) partials.contents;
+    uint64_t sum[4] = { 0, 0, 0, 0 };
+    memset(stats->min, 0xff, 4);
+    memset(stats->max, 0, 4);
+    for (NSUInteger i = 0; i < num_groups; i++, p += 12) {
+        for (int c = 0; c < 4; c++) {
+            stats->min[c] = p[c] < stats->min[c] ? (uint8_t) p[c] : stats->min[c];
+            stats->max[c] = p[4 + c] > stats->max[c] ? (uint8_t) p[4 + c] : stats->max[c];
+            sum[c] += p[8 + c];
+        }
+    }
+    stats->count = (uint64_t) w * h;
+    for (int c = 0; c < 4; c++) {
+        stats->mean[c] = (float) ((double) sum[c] / (double) stats->count);
+    }
+
+    [histogram release];
+    [partials release];
+
+    return (command_buffer.GPUEndTime - command_buffer.GPUStartTime) * 1e3;
+}
+
+// Compares the GPU reductions with df_image_stats and times the privatized
+// histogram against the naive atomic one on both sides
+void validate_image_stats(id<MTLLibrary> library) {
+    NSError *error;
+    NSString *names[3] = { @"histogram_kernel", @"histogram_atomic_kernel", @"stats_kernel" };
+    id<MTLComputePipelineState> states[3];
+    for (int i = 0; i < 3; i++) {
+        id<MTLFunction> function = [library newFunctionWithName:names[i]];
+        if (!function) {
+            exitWith(@"Statistics kernels not found!");
+        }
+        states[i] = [app.device newComputePipelineStateWithFunction:function error:&error];
+        if (!states[i]) {
+            exitWith(error);
+        }
+        [function release];
+    }
+
+    uint32_t w = (uint32_t) state.input_texture.width;
+    uint32_t h = (uint32_t) state.input_texture.height;
+    df_cpu_texture_t input;
+    df_cpu_texture_init(&input, w, h);
+    [state.input_texture getBytes:input.data bytesPerRow:input.bytes_per_row fromRegion:MTLRegionMake2D(0, 0, w, h) mipmapLevel:0];
+
+    df_image_stats_t gpu_stats, gpu_atomic_stats, cpu_stats;
+    double gpu_ms = gpu_image_stats(states[0], states[2], &gpu_stats);
+    double gpu_atomic_ms = gpu_image_stats(states[1], states[2], &gpu_atomic_stats);
+
+    NSDate *start = [NSDate date];
+    bool ok = df_image_stats(&input, &cpu_stats, NULL);
+    double cpu_ms = -[start timeIntervalSinceNow] * 1e3;
+    start = [NSDate date];
+    ok = df_image_stats_atomic(&input, &cpu_stats, NULL) && ok;
+    double cpu_atomic_ms = -[start timeIntervalSinceNow] * 1e3;
+    if (!ok) {
+        NSLog(@"image stats: out of memory on the CPU, skipped");
+        df_cpu_texture_free(&input);
+        for (int i = 0; i < 3; i++) {
+            [states[i] release];
+        }
+        return;
+    }
+
+    bool histograms_match = memcmp(gpu_stats.histogram, cpu_stats.histogram, sizeof(cpu_stats.histogram)) == 0
+        && memcmp(gpu_atomic_stats.histogram, cpu_stats.histogram, sizeof(cpu_stats.histogram)) == 0;
+    bool min_max_match = memcmp(gpu_stats.min, cpu_stats.min, 4) == 0 && memcmp(gpu_stats.max, cpu_stats.max, 4) == 0;
+    NSLog(@"image stats: histograms %@, min/max %@, mean r %.3f vs %.3f", histograms_match ? @"match" : @"DIFFER",
+          min_max_match ? @"match" : @"DIFFER", gpu_stats.mean[0], cpu_stats.mean[0]);
+    NSLog(@"image stats: GPU %.3f ms (atomic %.3f ms), CPU %.3f ms (atomic %.3f ms)", gpu_ms, gpu_atomic_ms, cpu_ms, cpu_atomic_ms);
+
+    df_cpu_texture_free(&input);
+    for (int i = 0; i < 3; i++) {
+        [states[i] release];
+    }
+}
+#endif
+
 void init() {
     NSError *error;
 
@@ -132,6 +639,13 @@ void init() {
     state.threadgroup_count.width = (state.input_texture.width + state.threadgroup_size.width - 1) / state.threadgroup_size.width;
     state.threadgroup_count.height = (state.input_texture.height + state.threadgroup_size.height - 1) / state.threadgroup_size.height;
     state.threadgroup_count.depth = 1;
+
+#if defined(VALIDATE)
+    validate_convolve(library);
+    validate_blur(library);
+    validate_color_matrix(library);
+    validate_image_stats(library);
+#endif
     
     [texture_desc release];
     [vertex_desc release];
@@ -140,6 +654,11 @@ void init() {
     [fragment_function release];
     [kernel_function release];
     [library release];
+
+#if defined(VALIDATE)
+    validate_grayscale(0.25f);
+    validate_grayscale_f16(0.25f);
+#endif
 }
 
 double t = 0;
@@ -47,3 +47,229 @@ grayscale_kernel(texture2d<half, access::read> in_texture [[ texture(0) ]],
     half gray = dot(input_color.rgb, kRec709Luma + half3((half)*bias, (half)*bias, (half)*bias));
     out_texture.write(half4(gray, gray, gray, 1.0), gid);
 }
+
+// Separable convolution, one kernel per direction. Taps are centred
+// (taps[num_taps / 2] weighs the pixel itself) and reads are clamped to the
+// edge, matching df_convolve_separable on the CPU. Run the horizontal pass
+// into a float texture and the vertical pass out of it.
+kernel void
+convolve_h_kernel(texture2d<float, access::read> in_texture [[ texture(0) ]],
+                  texture2d<float, access::write> out_texture [[ texture(1) ]],
+                  constant float *taps [[ buffer(0) ]], constant int &num_taps [[ buffer(1) ]],
+                  uint2 gid [[ thread_position_in_grid ]]) {
+
+    if (gid.x >= out_texture.get_width() || gid.y >= out_texture.get_height()) {
+        return;
+    }
+
+    int last = int(in_texture.get_width()) - 1;
+    float4 sum = 0;
+    for (int k = 0; k < num_taps; k++) {
+        int x = clamp(int(gid.x) + k - num_taps / 2, 0, last);
+        sum = fma(in_texture.read(uint2(x, gid.y)), taps[k], sum);
+    }
+    out_texture.write(sum, gid);
+}
+
+kernel void
+convolve_v_kernel(texture2d<float, access::read> in_texture [[ texture(0) ]],
+                  texture2d<float, access::write> out_texture [[ texture(1) ]],
+                  constant float *taps [[ buffer(0) ]], constant int &num_taps [[ buffer(1) ]],
+                  uint2 gid [[ thread_position_in_grid ]]) {
+
+    if (gid.x >= out_texture.get_width() || gid.y >= out_texture.get_height()) {
+        return;
+    }
+
+    int last = int(in_texture.get_height()) - 1;
+    float4 sum = 0;
+    for (int k = 0; k < num_taps; k++) {
+        int y = clamp(int(gid.y) + k - num_taps / 2, 0, last);
+        sum = fma(in_texture.read(uint2(gid.x, y)), taps[k], sum);
+    }
+    out_texture.write(sum, gid);
+}
+
+// Sliding-window box blur of 2 * radius + 1, edges clamped, matching
+// df_box_blur. One thread walks a whole row (box_h_kernel) or column
+// (box_v_kernel) with a running sum, so the cost per pixel doesn't depend
+// on the radius. Three of each, radii from df_gaussian_box_radii, give
+// df_gaussian_blur.
+kernel void
+box_h_kernel(texture2d<float, access::read> in_texture [[ texture(0) ]],
+             texture2d<float, access::write> out_texture [[ texture(1) ]],
+             constant int &radius [[ buffer(0) ]],
+             uint y [[ thread_position_in_grid ]]) {
+
+    if (y >= out_texture.get_height()) {
+        return;
+    }
+
+    int last = int(in_texture.get_width()) - 1;
+    float scale = 1.0 / float(2 * radius + 1);
+    float4 sum = 0;
+    for (int k = -radius; k <= radius; k++) {
+        sum += in_texture.read(uint2(clamp(k, 0, last), y));
+    }
+    for (int x = 0; x <= last; x++) {
+        out_texture.write(sum * scale, uint2(x, y));
+        sum += in_texture.read(uint2(min(x + radius + 1, last), y)) - in_texture.read(uint2(max(x - radius, 0), y));
+    }
+}
+
+kernel void
+box_v_kernel(texture2d<float, access::read> in_texture [[ texture(0) ]],
+             texture2d<float, access::write> out_texture [[ texture(1) ]],
+             constant int &radius [[ buffer(0) ]],
+             uint x [[ thread_position_in_grid ]]) {
+
+    if (x >= out_texture.get_width()) {
+        return;
+    }
+
+    int last = int(in_texture.get_height()) - 1;
+    float scale = 1.0 / float(2 * radius + 1);
+    float4 sum = 0;
+    for (int k = -radius; k <= radius; k++) {
+        sum += in_texture.read(uint2(x, clamp(k, 0, last)));
+    }
+    for (int y = 0; y <= last; y++) {
+        out_texture.write(sum * scale, uint2(x, y));
+        sum += in_texture.read(uint2(x, min(y + radius + 1, last))) - in_texture.read(uint2(x, max(y - radius, 0)));
+    }
+}
+
+// Colour matrix, laid out like df_color_matrix_t. Bound once as a buffer
+// rather than set per frame.
+struct ColorMatrix {
+    float4 rows[4];
+    float4 offset;
+};
+
+// Values of df_color_matrix_kind. The pipeline is specialized on the kind,
+// so the compiler removes the terms a given kind never needs.
+constant int kColorMatrixKind [[ function_constant(0) ]];
+constant bool kColorMatrixGeneral = kColorMatrixKind == 0;
+constant bool kColorMatrixLuma = kColorMatrixKind == 2;
+
+kernel void
+color_matrix_kernel(texture2d<float, access::read> in_texture [[ texture(0) ]],
+                    texture2d<float, access::write> out_texture [[ texture(1) ]],
+                    constant ColorMatrix &cm [[ buffer(0) ]],
+                    uint2 gid [[ thread_position_in_grid ]]) {
+
+    if (gid.x >= out_texture.get_width() || gid.y >= out_texture.get_height()) {
+        return;
+    }
+
+    float4 c = in_texture.read(gid);
+    float4 out;
+
+    if (kColorMatrixGeneral) {
+        out = float4(dot(cm.rows[0], c), dot(cm.rows[1], c), dot(cm.rows[2], c), dot(cm.rows[3], c)) + cm.offset;
+    } else if (kColorMatrixLuma) {
+        float luma = dot(cm.rows[0].rgb, c.rgb) + cm.offset.r;
+        out = float4(luma, luma, luma, c.a);
+    } else {
+        out = float4(dot(cm.rows[0].rgb, c.rgb), dot(cm.rows[1].rgb, c.rgb), dot(cm.rows[2].rgb, c.rgb), 0) + float4(cm.offset.rgb, 0);
+        out.a = c.a;
+    }
+    out_texture.write(out, gid);
+}
+
+// Per-channel 256-bin histogram. Each threadgroup counts into bins in
+// threadgroup memory and merges them into the device histogram once, so
+// device atomics are per group and bin rather than per pixel.
+kernel void
+histogram_kernel(texture2d<float, access::read> in_texture [[ texture(0) ]],
+                 device atomic_uint *histogram [[ buffer(0) ]],
+                 uint2 gid [[ thread_position_in_grid ]],
+                 uint index [[ thread_index_in_threadgroup ]],
+                 uint2 group_size [[ threads_per_threadgroup ]]) {
+
+    threadgroup atomic_uint bins[4 * 256];
+    uint threads = group_size.x * group_size.y;
+
+    for (uint i = index; i < 4 * 256; i += threads) {
+        atomic_store_explicit(&bins[i], 0, memory_order_relaxed);
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (gid.x < in_texture.get_width() && gid.y < in_texture.get_height()) {
+        uint4 v = uint4(round(in_texture.read(gid) * 255));
+        for (uint c = 0; c < 4; c++) {
+            atomic_fetch_add_explicit(&bins[c * 256 + v[c]], 1, memory_order_relaxed);
+        }
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    for (uint i = index; i < 4 * 256; i += threads) {
+        uint count = atomic_load_explicit(&bins[i], memory_order_relaxed);
+        if (count) {
+            atomic_fetch_add_explicit(&histogram[i], count, memory_order_relaxed);
+        }
+    }
+}
+
+// The naive version: every pixel goes straight to the device bins
+kernel void
+histogram_atomic_kernel(texture2d<float, access::read> in_texture [[ texture(0) ]],
+                        device atomic_uint *histogram [[ buffer(0) ]],
+                        uint2 gid [[ thread_position_in_grid ]]) {
+
+    if (gid.x >= in_texture.get_width() || gid.y >= in_texture.get_height()) {
+        return;
+    }
+
+    uint4 v = uint4(round(in_texture.read(gid) * 255));
+    for (uint c = 0; c < 4; c++) {
+        atomic_fetch_add_explicit(&histogram[c * 256 + v[c]], 1, memory_order_relaxed);
+    }
+}
+
+struct StatsPartial {
+    uint4 min;
+    uint4 max;
+    uint4 sum;
+};
+
+// Min, max and sum per channel, reduced within each SIMD group, then across
+// the SIMD groups of the threadgroup through threadgroup memory. Each
+// threadgroup writes one partial; the few partials are summed on the CPU.
+kernel void
+stats_kernel(texture2d<float, access::read> in_texture [[ texture(0) ]],
+             device StatsPartial *partials [[ buffer(0) ]],
+             uint2 gid [[ thread_position_in_grid ]],
+             uint2 group_id [[ threadgroup_position_in_grid ]],
+             uint2 groups [[ threadgroups_per_grid ]],
+             uint lane [[ thread_index_in_simdgroup ]],
+             uint simd_id [[ simdgroup_index_in_threadgroup ]],
+             uint num_simds [[ simdgroups_per_threadgroup ]]) {
+
+    threadgroup uint4 group_min[32];
+    threadgroup uint4 group_max[32];
+    threadgroup uint4 group_sum[32];
+
+    // No early return: every thread has to reach the barrier
+    bool inside = gid.x < in_texture.get_width() && gid.y < in_texture.get_height();
+    uint4 v = inside ? uint4(round(in_texture.read(gid) * 255)) : uint4(0);
+
+    uint4 lo = simd_min(inside ? v : uint4(255));
+    uint4 hi = simd_max(v);
+    uint4 sum = simd_sum(v);
+    if (lane == 0) {
+        group_min[simd_id] = lo;
+        group_max[simd_id] = hi;
+        group_sum[simd_id] = sum;
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (simd_id == 0) {
+        lo = simd_min(lane < num_simds ? group_min[lane] : uint4(255));
+        hi = simd_max(lane < num_simds ? group_max[lane] : uint4(0));
+        sum = simd_sum(lane < num_simds ? group_sum[lane] : uint4(0));
+        if (lane == 0) {
+            partials[group_id.y * groups.x + group_id.x] = { lo, hi, sum };
+        }
+    }
+}
@@ -15,6 +15,9 @@
 #define UTILS_H_IMPLEMENTATION
 #include "../common/utils.h"
 
+#define DFTK_IMPLEMENTATION
+#include "../common/dftk/dftk.h"
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "../common/stb_image_write.h"
 
@@ -0,0 +1,311 @@
+#include <math.h>
+#include <string.h>
+#include "color_matrix.h"
+#include "simd.h"
+
+#define DF_COLOR_MATRIX_TILE_WIDTH 64
+#define DF_COLOR_MATRIX_TILE_HEIGHT 16
+
+static const float df_luma_weights[3] = { 0.2126f, 0.7152f, 0.0722f };
+
+void df_color_matrix_identity(df_color_matrix_t *cm) {
+    memset(cm, 0, sizeof(*cm));
+    for (int i = 0; i < 4; i++) {
+        cm->m[i][i] = 1;
+    }
+}
+
+// Lerps between the Rec. 709 luma (0) and the original colour (1)
+void df_color_matrix_saturation(df_color_matrix_t *cm, float saturation) {
+    df_color_matrix_identity(cm);
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            cm->m[i][j] = (1 - saturation) * df_luma_weights[j] + (i == j ? saturation : 0);
+        }
+    }
+}
+
+// Rotation around the grey axis that keeps luma, as in the SVG/CSS
+// hue-rotate filter
+void df_color_matrix_hue_rotate(df_color_matrix_t *cm, float radians) {
+    float c = cosf(radians), s = sinf(radians);
+    static const float cos_part[3][3] = {
+        {  0.7874f, -0.7152f, -0.0722f },
+        { -0.2126f,  0.2848f, -0.0722f },
+        { -0.2126f, -0.7152f,  0.9278f },
+    };
+    static const float sin_part[3][3] = {
+        { -0.2126f, -0.7152f,  0.9278f },
+        {  0.143f,   0.140f,  -0.283f  },
+        { -0.7874f,  0.7152f,  0.0722f },
+    };
+
+    df_color_matrix_identity(cm);
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            cm->m[i][j] = df_luma_weights[j] + c * cos_part[i][j] + s * sin_part[i][j];
+        }
+    }
+}
+
+void df_color_matrix_sepia(df_color_matrix_t *cm) {
+    static const float sepia[3][3] = {
+        { 0.393f, 0.769f, 0.189f },
+        { 0.349f, 0.686f, 0.168f },
+        { 0.272f, 0.534f, 0.131f },
+    };
+
+    df_color_matrix_identity(cm);
+    for (int i = 0; i < 3; i++) {
+        memcpy(cm->m[i], sepia[i], sizeof(sepia[i]));
+    }
+}
+
+// r = g = b = r * wr + g * wg + b * wb, alpha kept
+void df_color_matrix_luma(df_color_matrix_t *cm, float r, float g, float b) {
+    df_color_matrix_identity(cm);
+    for (int i = 0; i < 3; i++) {
+        cm->m[i][0] = r;
+        cm->m[i][1] = g;
+        cm->m[i][2] = b;
+    }
+}
+
+// Output channel i takes input channel (r, g, b, a)[i], e.g. 2, 1, 0, 3
+// swaps red and blue
+void df_color_matrix_swizzle(df_color_matrix_t *cm, int r, int g, int b, int a) {
+    int source[4] = { r, g, b, a };
+    memset(cm, 0, sizeof(*cm));
+    for (int i = 0; i < 4; i++) {
+        cm->m[i][source[i] & 3] = 1;
+    }
+}
+
+// out = a * b, i.e. b applied first. `out` may alias either input.
+void df_color_matrix_multiply(df_color_matrix_t *out, const df_color_matrix_t *a, const df_color_matrix_t *b) {
+    df_color_matrix_t r;
+    for (int i = 0; i < 4; i++) {
+        r.offset[i] = a->offset[i];
+        for (int j = 0; j < 4; j++) {
+            r.m[i][j] = 0;
+            for (int k = 0; k < 4; k++) {
+                r.m[i][j] += a->m[i][k] * b->m[k][j];
+            }
+            r.offset[i] += a->m[i][j] * b->offset[j];
+        }
+    }
+    *out = r;
+}
+
+df_color_matrix_kind df_color_matrix_classify(const df_color_matrix_t *cm) {
+    const float (*m)[4] = cm->m;
+
+    bool identity_alpha = m[3][0] == 0 && m[3][1] == 0 && m[3][2] == 0 && m[3][3] == 1 && cm->offset[3] == 0
+        && m[0][3] == 0 && m[1][3] == 0 && m[2][3] == 0;
+    if (!identity_alpha) {
+        return DFColorMatrixGeneral;
+    }
+
+    for (int i = 1; i < 3; i++) {
+        if (memcmp(m[i], m[0], 3 * sizeof(float)) != 0 || cm->offset[i] != cm->offset[0]) {
+            return DFColorMatrixIdentityAlpha;
+        }
+    }
+    return DFColorMatrixLuma;
+}
+
+// The one implementation, inlined into a copy per kind: with `kind` a
+// constant the compiler folds the branches away and drops the unused terms.
+// Four pixels are transposed into channel vectors so each output channel is
+// a short chain of multiply-adds.
+static inline __attribute__((always_inline)) void df_color_matrix_apply_kind(const df_color_matrix_t *cm, float *px, uint32_t n, const df_color_matrix_kind kind) {
+    df_f32x4 w[4][4], o[4];
+    for (int i = 0; i < 4; i++) {
+        o[i] = df_f32x4_splat(cm->offset[i]);
+        for (int j = 0; j < 4; j++) {
+            w[i][j] = df_f32x4_splat(cm->m[i][j]);
+        }
+    }
+
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4, px += 16) {
+        df_f32x4 r = df_f32x4_load(px), g = df_f32x4_load(px + 4), b = df_f32x4_load(px + 8), a = df_f32x4_load(px + 12);
+        df_f32x4_transpose(&r, &g, &b, &a);
+
+        df_f32x4 out[4];
+        int rows = kind == DFColorMatrixLuma ? 1 : (kind == DFColorMatrixIdentityAlpha ? 3 : 4);
+        for (int c = 0; c < rows; c++) {
+            df_f32x4 v = df_f32x4_madd(w[c][0], r, o[c]);
+            v = df_f32x4_madd(w[c][1], g, v);
+            v = df_f32x4_madd(w[c][2], b, v);
+            if (kind == DFColorMatrixGeneral) {
+                v = df_f32x4_madd(w[c][3], a, v);
+            }
+            out[c] = v;
+        }
+        if (kind == DFColorMatrixLuma) {
+            out[1] = out[2] = out[0];
+        }
+        if (kind != DFColorMatrixGeneral) {
+            out[3] = a;
+        }
+
+        df_f32x4_transpose(&out[0], &out[1], &out[2], &out[3]);
+        df_f32x4_store(px, out[0]);
+        df_f32x4_store(px + 4, out[1]);
+        df_f32x4_store(px + 8, out[2]);
+        df_f32x4_store(px + 12, out[3]);
+    }
+
+    for (; i < n; i++, px += 4) {
+        float in[4] = { px[0], px[1], px[2], px[3] };
+        for (int c = 0; c < 4; c++) {
+            px[c] = cm->offset[c] + cm->m[c][0] * in[0] + cm->m[c][1] * in[1] + cm->m[c][2] * in[2] + cm->m[c][3] * in[3];
+        }
+    }
+}
+
+static void df_color_matrix_apply_general(const df_color_matrix_t *cm, float *px, uint32_t n) {
+    df_color_matrix_apply_kind(cm, px, n, DFColorMatrixGeneral);
+}
+
+static void df_color_matrix_apply_identity_alpha(const df_color_matrix_t *cm, float *px, uint32_t n) {
+    df_color_matrix_apply_kind(cm, px, n, DFColorMatrixIdentityAlpha);
+}
+
+static void df_color_matrix_apply_luma(const df_color_matrix_t *cm, float *px, uint32_t n) {
+    df_color_matrix_apply_kind(cm, px, n, DFColorMatrixLuma);
+}
+
+// Applies `cm` to `count` float RGBA pixels in place. `kind` must be what
+// df_color_matrix_classify returns for `cm` (or DFColorMatrixGeneral).
+void df_color_matrix_apply(const df_color_matrix_t *cm, df_color_matrix_kind kind, float *pixels, uint32_t count) {
+    switch (kind) {
+        case DFColorMatrixGeneral: df_color_matrix_apply_general(cm, pixels, count); break;
+        case DFColorMatrixIdentityAlpha: df_color_matrix_apply_identity_alpha(cm, pixels, count); break;
+        case DFColorMatrixLuma: df_color_matrix_apply_luma(cm, pixels, count); break;
+    }
+}
+
+typedef struct {
+    const df_cpu_texture_t *in;
+    df_cpu_texture_t *out;
+    const df_color_matrix_t *cm;
+    df_color_matrix_kind kind;
+} df_color_matrix_args_t;
+
+static void df_color_matrix_group(const df_threadgroup_t *group, void *data) {
+    df_color_matrix_args_t *a = (df_color_matrix_args_t *) data;
+    float px[DF_COLOR_MATRIX_TILE_WIDTH * 4];
+    uint32_t x0 = group->origin.width, n = group->size.width;
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        const uint8_t *src = a->in->data + y * a->in->bytes_per_row + x0 * 4;
+        for (uint32_t i = 0; i < 4 * n; i++) {
+            px[i] = src[i] * (1.0f / 255.0f);
+        }
+
+        df_color_matrix_apply(a->cm, a->kind, px, n);
+
+        uint8_t *dst = a->out->data + y * a->out->bytes_per_row + x0 * 4;
+        for (uint32_t i = 0; i < 4 * n; i++) {
+            dst[i] = (uint8_t) nearbyintf(fminf(fmaxf(px[i], 0.0f), 1.0f) * 255.0f);
+        }
+    }
+}
+
+// CPU port of color_matrix_kernel. The matrix is classified once per call,
+// not per pixel.
+void df_color_matrix(const df_cpu_texture_t *in, df_cpu_texture_t *out, const df_color_matrix_t *cm, df_dispatcher_t *dispatcher) {
+    df_color_matrix_args_t args = { in, out, cm, df_color_matrix_classify(cm) };
+    df_dispatch_threads(dispatcher, df_size3(in->width, in->height, 1), df_size3(DF_COLOR_MATRIX_TILE_WIDTH, DF_COLOR_MATRIX_TILE_HEIGHT, 1), df_color_matrix_group, &args);
+}
+
+typedef struct {
+    const df_color_matrix_t *cm;
+    df_color_matrix_kind kind;
+} df_color_matrix_f16_args_t;
+
+static void df_color_matrix_f16_pixels(void *ctx, float *px, uint32_t count) {
+    df_color_matrix_f16_args_t *a = (df_color_matrix_f16_args_t *) ctx;
+    df_color_matrix_apply(a->cm, a->kind, px, count);
+}
+
+// Half storage, fp32 arithmetic; `out` may be `in`
+void df_color_matrix_f16(const df_image_f16_t *in, df_image_f16_t *out, const df_color_matrix_t *cm, df_dispatcher_t *dispatcher) {
+    df_color_matrix_f16_args_t args = { cm, df_color_matrix_classify(cm) };
+    df_image_f16_map(in, out, df_color_matrix_f16_pixels, &args, dispatcher);
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+void df_color_matrix_test(void) {
+    df_color_matrix_t cm, swap;
+
+    df_color_matrix_identity(&cm);
+    assert(df_color_matrix_classify(&cm) == DFColorMatrixIdentityAlpha);
+    df_color_matrix_luma(&cm, df_luma_weights[0], df_luma_weights[1], df_luma_weights[2]);
+    assert(df_color_matrix_classify(&cm) == DFColorMatrixLuma);
+    df_color_matrix_saturation(&cm, 0);
+    assert(df_color_matrix_classify(&cm) == DFColorMatrixLuma);
+    df_color_matrix_hue_rotate(&cm, 1.0f);
+    assert(df_color_matrix_classify(&cm) == DFColorMatrixIdentityAlpha);
+    df_color_matrix_swizzle(&swap, 3, 2, 1, 0);
+    assert(df_color_matrix_classify(&swap) == DFColorMatrixGeneral);
+
+    // Hue rotation keeps greys grey
+    float grey[4] = { 0.5f, 0.5f, 0.5f, 1 };
+    df_color_matrix_apply(&cm, DFColorMatrixIdentityAlpha, grey, 1);
+    assert(fabsf(grey[0] - 0.5f) < 1e-3f && fabsf(grey[1] - 0.5f) < 1e-3f && fabsf(grey[2] - 0.5f) < 1e-3f);
+
+    // Swizzling twice is the identity
+    df_color_matrix_multiply(&cm, &swap, &swap);
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            assert(cm.m[i][j] == (i == j ? 1.0f : 0.0f));
+        }
+    }
+
+    // Every specialization matches the general path bit for bit, including
+    // the scalar tail
+    df_color_matrix_t matrices[3];
+    df_color_matrix_sepia(&matrices[0]);
+    df_color_matrix_luma(&matrices[1], 0.3f, 0.59f, 0.11f);
+    matrices[1].offset[0] = matrices[1].offset[1] = matrices[1].offset[2] = 0.1f;
+    df_color_matrix_saturation(&matrices[2], 1.7f);
+
+    float pixels[4 * 11], general[4 * 11];
+    for (int k = 0; k < 3; k++) {
+        for (int i = 0; i < 4 * 11; i++) {
+            pixels[i] = general[i] = (float) ((i * 37) % 101) / 100.0f;
+        }
+        df_color_matrix_kind kind = df_color_matrix_classify(&matrices[k]);
+        assert(kind != DFColorMatrixGeneral);
+        df_color_matrix_apply(&matrices[k], kind, pixels, 11);
+        df_color_matrix_apply(&matrices[k], DFColorMatrixGeneral, general, 11);
+        assert(memcmp(pixels, general, sizeof(pixels)) == 0);
+    }
+
+    df_cpu_texture_t in, out;
+    df_cpu_texture_init(&in, 37, 21);
+    df_cpu_texture_init(&out, 37, 21);
+    for (size_t i = 0; i < in.bytes_per_row * in.height; i++) {
+        in.data[i] = (uint8_t) (i * 13);
+    }
+    df_color_matrix_swizzle(&swap, 2, 1, 0, 3);
+    df_color_matrix(&in, &out, &swap, NULL);
+    for (uint32_t y = 0; y < in.height; y++) {
+        const uint8_t *a = in.data + y * in.bytes_per_row, *b = out.data + y * out.bytes_per_row;
+        for (uint32_t x = 0; x < in.width; x++) {
+            assert(b[4 * x] == a[4 * x + 2] && b[4 * x + 1] == a[4 * x + 1] && b[4 * x + 2] == a[4 * x] && b[4 * x + 3] == a[4 * x + 3]);
+        }
+    }
+    df_cpu_texture_free(&in);
+    df_cpu_texture_free(&out);
+
+    printf("color_matrix: passed!\n");
+}
+#endif
@@ -0,0 +1,43 @@
+#if !defined(DFTK_COLOR_MATRIX_H)
+#define DFTK_COLOR_MATRIX_H
+
+#include <stdint.h>
+#include "cpu_texture.h"
+#include "dispatch.h"
+#include "image_f16.h"
+
+// 4x4 colour matrix plus offset over RGBA in [0, 1]. The layout matches the
+// ColorMatrix struct in 07-compute-image-processing/shaders.metal so the
+// same bytes can be uploaded to a MTLBuffer.
+typedef struct {
+    float m[4][4];        // m[row][col], out[i] = sum_j m[i][j] * in[j]
+    float offset[4];
+} df_color_matrix_t;
+
+// Shapes with a specialized code path, both on the CPU and as function
+// constants of color_matrix_kernel. Results are identical to the general
+// path; the specializations only skip multiplications by 0 and 1.
+typedef enum {
+    DFColorMatrixGeneral,
+    DFColorMatrixIdentityAlpha,   // Alpha passes through, RGB ignores alpha
+    DFColorMatrixLuma,            // Identity alpha and r = g = b = dot(rgb, w) + o
+} df_color_matrix_kind;
+
+void df_color_matrix_identity(df_color_matrix_t *cm);
+void df_color_matrix_saturation(df_color_matrix_t *cm, float saturation);
+void df_color_matrix_hue_rotate(df_color_matrix_t *cm, float radians);
+void df_color_matrix_sepia(df_color_matrix_t *cm);
+void df_color_matrix_luma(df_color_matrix_t *cm, float r, float g, float b);
+void df_color_matrix_swizzle(df_color_matrix_t *cm, int r, int g, int b, int a);
+void df_color_matrix_multiply(df_color_matrix_t *out, const df_color_matrix_t *a, const df_color_matrix_t *b);
+
+df_color_matrix_kind df_color_matrix_classify(const df_color_matrix_t *cm);
+void df_color_matrix_apply(const df_color_matrix_t *cm, df_color_matrix_kind kind, float *pixels, uint32_t count);
+void df_color_matrix(const df_cpu_texture_t *in, df_cpu_texture_t *out, const df_color_matrix_t *cm, df_dispatcher_t *dispatcher);
+void df_color_matrix_f16(const df_image_f16_t *in, df_image_f16_t *out, const df_color_matrix_t *cm, df_dispatcher_t *dispatcher);
+
+#ifdef TEST
+void df_color_matrix_test(void);
+#endif
+
+#endif
@@ -0,0 +1,423 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "convolve.h"
+#include "simd.h"
+
+#define DF_CONVOLVE_TILE 64
+
+static inline const float *df_image_row(const df_image_f32_t *image, int y) {
+    y = y < 0 ? 0 : (y >= (int) image->height ? (int) image->height - 1 : y);
+    return image->data + (size_t) y * image->width * 4;
+}
+
+// Copies pixels [x0, x0 + n) of row `y` into `dst`, replicating the edge
+// pixels for x outside the image
+static void df_load_row_clamped(const df_image_f32_t *in, int y, int x0, int n, float *dst) {
+    const float *row = df_image_row(in, y);
+    int width = (int) in->width;
+
+    int i = 0;
+    for (; i < n && x0 + i < 0; i++) {
+        df_f32x4_store(dst + 4 * i, df_f32x4_load(row));
+    }
+
+    int inside_end = width - x0 < n ? width - x0 : n;
+    if (inside_end > i) {
+        memcpy(dst + 4 * i, row + 4 * (x0 + i), (size_t) (inside_end - i) * 4 * sizeof(float));
+        i = inside_end;
+    }
+
+    for (; i < n; i++) {
+        df_f32x4_store(dst + 4 * i, df_f32x4_load(row + 4 * (width - 1)));
+    }
+}
+
+typedef struct {
+    const df_image_f32_t *in;
+    df_image_f32_t *out;
+    const float *taps;
+    int num_taps;
+    int radius;               // Box radius, or (num_taps - 1) / 2
+} df_convolve_args_t;
+
+static void df_convolve_h_group(const df_threadgroup_t *group, void *data) {
+    df_convolve_args_t *a = (df_convolve_args_t *) data;
+    int c = a->num_taps / 2;
+    int x0 = (int) group->origin.width, n = (int) group->size.width;
+    float row[(DF_CONVOLVE_TILE + DF_CONVOLVE_MAX_TAPS) * 4];
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        df_load_row_clamped(a->in, (int) y, x0 - c, n + 2 * c, row);
+        float *out = a->out->data + ((size_t) y * a->out->width + x0) * 4;
+
+        for (int x = 0; x < n; x++) {
+            const float *p = row + 4 * x;
+            df_f32x4 acc = df_f32x4_splat(0);
+            for (int k = 0; k < a->num_taps; k++) {
+                acc = df_f32x4_madd(df_f32x4_load(p + 4 * k), df_f32x4_splat(a->taps[k]), acc);
+            }
+            df_f32x4_store(out + 4 * x, acc);
+        }
+    }
+}
+
+static void df_convolve_v_group(const df_threadgroup_t *group, void *data) {
+    df_convolve_args_t *a = (df_convolve_args_t *) data;
+    int c = a->num_taps / 2;
+    uint32_t x0 = group->origin.width, n = group->size.width;
+
+    for (int y = (int) group->origin.height; y < (int) (group->origin.height + group->size.height); y++) {
+        float *out = a->out->data + ((size_t) y * a->out->width + x0) * 4;
+
+        // Tap-outer so each input row segment is streamed through once
+        for (uint32_t x = 0; x < n; x++) {
+            df_f32x4_store(out + 4 * x, df_f32x4_splat(0));
+        }
+        for (int k = 0; k < a->num_taps; k++) {
+            const float *in = df_image_row(a->in, y + k - c) + 4 * x0;
+            df_f32x4 w = df_f32x4_splat(a->taps[k]);
+            for (uint32_t x = 0; x < n; x++) {
+                df_f32x4_store(out + 4 * x, df_f32x4_madd(df_f32x4_load(in + 4 * x), w, df_f32x4_load(out + 4 * x)));
+            }
+        }
+    }
+}
+
+static bool df_convolve_taps_valid(int num_taps) {
+    return num_taps >= 1 && num_taps <= DF_CONVOLVE_MAX_TAPS && num_taps % 2 == 1;
+}
+
+// Separable convolution with centred, odd-length tap arrays (the centre tap
+// is taps[num_taps / 2]). `out` must not alias `in`. False, with `out`
+// untouched, for an even or out of range tap count.
+bool df_convolve_separable(const df_image_f32_t *in, df_image_f32_t *out, const float *taps_x, int num_taps_x, const float *taps_y, int num_taps_y, df_dispatcher_t *dispatcher) {
+    if (!df_convolve_taps_valid(num_taps_x) || !df_convolve_taps_valid(num_taps_y)) {
+        return false;
+    }
+
+    df_image_f32_t tmp;
+    if (!df_image_f32_init(&tmp, in->width, in->height)) {
+        return false;
+    }
+
+    df_size3_t grid = df_size3(in->width, in->height, 1);
+    df_size3_t tile = df_size3(DF_CONVOLVE_TILE, DF_CONVOLVE_TILE, 1);
+
+    df_convolve_args_t h = { in, &tmp, taps_x, num_taps_x };
+    df_dispatch_threads(dispatcher, grid, tile, df_convolve_h_group, &h);
+
+    df_convolve_args_t v = { &tmp, out, taps_y, num_taps_y };
+    df_dispatch_threads(dispatcher, grid, tile, df_convolve_v_group, &v);
+
+    df_image_f32_free(&tmp);
+    return true;
+}
+
+// Horizontal box of `radius` over pixels [x0, x0 + n) of row `y`, with a
+// running sum: one add and one subtract per pixel whatever the radius
+void df_box_blur_row(const df_image_f32_t *in, uint32_t y, uint32_t x0, uint32_t n, int radius, float *dst) {
+    int width = (int) in->width;
+    const float *row = df_image_row(in, (int) y);
+    df_f32x4 scale = df_f32x4_splat(1.0f / (2 * radius + 1));
+
+#define DF_PX(x) df_f32x4_load(row + 4 * ((x) < 0 ? 0 : ((x) >= width ? width - 1 : (x))))
+
+    df_f32x4 acc = df_f32x4_splat(0);
+    for (int k = (int) x0 - radius; k <= (int) x0 + radius; k++) {
+        acc = df_f32x4_add(acc, DF_PX(k));
+    }
+
+    for (int x = (int) x0; x < (int) (x0 + n); x++) {
+        df_f32x4_store(dst + 4 * (x - x0), df_f32x4_mul(acc, scale));
+        acc = df_f32x4_add(acc, df_f32x4_sub(DF_PX(x + radius + 1), DF_PX(x - radius)));
+    }
+
+#undef DF_PX
+}
+
+// Vertical box over a tile: columns [x0, x0 + n), rows [y0, y0 + rows).
+// A row of running sums slides down the tile; `dst` receives `rows` rows of
+// `n` pixels.
+void df_box_blur_column_tile(const df_image_f32_t *in, uint32_t x0, uint32_t n, uint32_t y0, uint32_t rows, int radius, float *dst) {
+    df_f32x4 scale = df_f32x4_splat(1.0f / (2 * radius + 1));
+    float acc[DF_CONVOLVE_TILE * 4];
+
+    for (uint32_t x = 0; x < n; x++) {
+        df_f32x4_store(acc + 4 * x, df_f32x4_splat(0));
+    }
+    for (int k = (int) y0 - radius; k <= (int) y0 + radius; k++) {
+        const float *row = df_image_row(in, k) + 4 * x0;
+        for (uint32_t x = 0; x < n; x++) {
+            df_f32x4_store(acc + 4 * x, df_f32x4_add(df_f32x4_load(acc + 4 * x), df_f32x4_load(row + 4 * x)));
+        }
+    }
+
+    for (uint32_t y = 0; y < rows; y++) {
+        const float *add = df_image_row(in, (int) (y0 + y) + radius + 1) + 4 * x0;
+        const float *sub = df_image_row(in, (int) (y0 + y) - radius) + 4 * x0;
+        float *out = dst + (size_t) y * n * 4;
+
+        for (uint32_t x = 0; x < n; x++) {
+            df_f32x4 s = df_f32x4_load(acc + 4 * x);
+            df_f32x4_store(out + 4 * x, df_f32x4_mul(s, scale));
+            df_f32x4_store(acc + 4 * x, df_f32x4_add(s, df_f32x4_sub(df_f32x4_load(add + 4 * x), df_f32x4_load(sub + 4 * x))));
+        }
+    }
+}
+
+static void df_box_h_group(const df_threadgroup_t *group, void *data) {
+    df_convolve_args_t *a = (df_convolve_args_t *) data;
+    uint32_t x0 = group->origin.width;
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        float *out = a->out->data + ((size_t) y * a->out->width + x0) * 4;
+        df_box_blur_row(a->in, y, x0, group->size.width, a->radius, out);
+    }
+}
+
+static void df_box_v_group(const df_threadgroup_t *group, void *data) {
+    df_convolve_args_t *a = (df_convolve_args_t *) data;
+    uint32_t x0 = group->origin.width, n = group->size.width;
+    float tile[DF_CONVOLVE_TILE * DF_CONVOLVE_TILE * 4];
+
+    df_box_blur_column_tile(a->in, x0, n, group->origin.height, group->size.height, a->radius, tile);
+
+    for (uint32_t y = 0; y < group->size.height; y++) {
+        float *out = a->out->data + ((size_t) (group->origin.height + y) * a->out->width + x0) * 4;
+        memcpy(out, tile + (size_t) y * n * 4, (size_t) n * 4 * sizeof(float));
+    }
+}
+
+// O(1) per pixel box blur of size 2 * radius + 1. `out` must not alias `in`.
+// False, with `out` untouched, for a negative radius or when out of memory.
+bool df_box_blur(const df_image_f32_t *in, df_image_f32_t *out, int radius, df_dispatcher_t *dispatcher) {
+    if (radius < 0) {
+        return false;
+    }
+
+    df_image_f32_t tmp;
+    if (!df_image_f32_init(&tmp, in->width, in->height)) {
+        return false;
+    }
+
+    df_size3_t grid = df_size3(in->width, in->height, 1);
+    df_size3_t tile = df_size3(DF_CONVOLVE_TILE, DF_CONVOLVE_TILE, 1);
+
+    df_convolve_args_t h = { in, &tmp, NULL, 0, radius };
+    df_dispatch_threads(dispatcher, grid, tile, df_box_h_group, &h);
+
+    df_convolve_args_t v = { &tmp, out, NULL, 0, radius };
+    df_dispatch_threads(dispatcher, grid, tile, df_box_v_group, &v);
+
+    df_image_f32_free(&tmp);
+    return true;
+}
+
+// Radii of DF_GAUSSIAN_BOXES successive boxes whose combined variance best
+// matches sigma^2 (Kovesi, "Fast almost-Gaussian filtering")
+void df_gaussian_box_radii(float sigma, int radii[DF_GAUSSIAN_BOXES]) {
+    int n = DF_GAUSSIAN_BOXES;
+    float ideal = sqrtf(12 * sigma * sigma / n + 1);
+    int wl = (int) floorf(ideal);
+    if (wl % 2 == 0) wl--;
+    if (wl < 1) wl = 1;
+    int wu = wl + 2;
+    int m = (int) roundf((12 * sigma * sigma - n * wl * wl - 4 * n * wl - 3 * n) / (-4.0f * wl - 4));
+
+    for (int i = 0; i < n; i++) {
+        radii[i] = ((i < m ? wl : wu) - 1) / 2;
+    }
+}
+
+typedef struct {
+    const df_image_f32_t *in;
+    df_image_f32_t *out;
+    const int *radii;
+    _Atomic bool failed;     // A row buffer couldn't be allocated
+} df_gaussian_args_t;
+
+// Every horizontal box of the Gaussian on one row before moving to the
+// next, the intermediate rows ping-ponging between two row buffers
+static void df_gaussian_h_group(const df_threadgroup_t *group, void *data) {
+    df_gaussian_args_t *a = (df_gaussian_args_t *) data;
+    uint32_t width = a->in->width;
+    float *buffer = (float *) malloc((size_t) width * 8 * sizeof(float));
+    if (!buffer) {
+        atomic_store(&a->failed, true);
+        return;
+    }
+    df_image_f32_t rows[2] = { { buffer, width, 1 }, { buffer + (size_t) width * 4, width, 1 } };
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        const df_image_f32_t *src = a->in;
+        uint32_t src_y = y;
+        for (int i = 0; i < DF_GAUSSIAN_BOXES; i++) {
+            float *dst = i == DF_GAUSSIAN_BOXES - 1 ? a->out->data + (size_t) y * width * 4 : rows[i % 2].data;
+            df_box_blur_row(src, src_y, 0, width, a->radii[i], dst);
+            src = &rows[i % 2];
+            src_y = 0;
+        }
+    }
+
+    free(buffer);
+}
+
+// Gaussian approximated by three box blurs. The horizontal boxes are chained
+// row by row, so they read the input and write one image; the vertical ones
+// need whole columns and run as three tiled passes. False for a sigma that
+// isn't positive or when out of memory.
+bool df_gaussian_blur(const df_image_f32_t *in, df_image_f32_t *out, float sigma, df_dispatcher_t *dispatcher) {
+    if (!(sigma > 0)) {
+        return false;
+    }
+
+    int radii[DF_GAUSSIAN_BOXES];
+    df_gaussian_box_radii(sigma, radii);
+
+    df_image_f32_t a, b;
+    if (!df_image_f32_init(&a, in->width, in->height)) {
+        return false;
+    }
+    if (!df_image_f32_init(&b, in->width, in->height)) {
+        df_image_f32_free(&a);
+        return false;
+    }
+
+    df_size3_t grid = df_size3(in->width, in->height, 1);
+    df_size3_t tile = df_size3(DF_CONVOLVE_TILE, DF_CONVOLVE_TILE, 1);
+
+    // One thread per row, in groups of rows
+    df_gaussian_args_t rows = { in, &a, radii };
+    atomic_init(&rows.failed, false);
+    df_dispatch_threads(dispatcher, df_size3(1, in->height, 1), df_size3(1, 16, 1), df_gaussian_h_group, &rows);
+
+    bool ok = !atomic_load(&rows.failed);
+    if (ok) {
+        df_convolve_args_t pass = { &a, &b, NULL, 0, radii[0] };
+        df_dispatch_threads(dispatcher, grid, tile, df_box_v_group, &pass);
+        pass = (df_convolve_args_t) { &b, &a, NULL, 0, radii[1] };
+        df_dispatch_threads(dispatcher, grid, tile, df_box_v_group, &pass);
+        pass = (df_convolve_args_t) { &a, out, NULL, 0, radii[2] };
+        df_dispatch_threads(dispatcher, grid, tile, df_box_v_group, &pass);
+    }
+
+    df_image_f32_free(&a);
+    df_image_f32_free(&b);
+    return ok;
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+// Direct 2D evaluation of a separable filter, for checking the tiled passes
+static float df_convolve_reference(const df_image_f32_t *in, int x, int y, int c, const float *tx, int nx, const float *ty, int ny) {
+    float sum = 0;
+    for (int j = 0; j < ny; j++) {
+        for (int i = 0; i < nx; i++) {
+            int sx = x + i - nx / 2, sy = y + j - ny / 2;
+            sx = sx < 0 ? 0 : (sx >= (int) in->width ? (int) in->width - 1 : sx);
+            sy = sy < 0 ? 0 : (sy >= (int) in->height ? (int) in->height - 1 : sy);
+            sum += tx[i] * ty[j] * in->data[((size_t) sy * in->width + sx) * 4 + c];
+        }
+    }
+    return sum;
+}
+
+void df_convolve_test(void) {
+    df_image_f32_t in, out, box;
+    uint32_t w = 150, h = 97;
+    df_image_f32_init(&in, w, h);
+    df_image_f32_init(&out, w, h);
+    df_image_f32_init(&box, w, h);
+    for (size_t i = 0; i < (size_t) w * h * 4; i++) {
+        in.data[i] = (float) ((i * 7919) % 256) / 255.0f;
+    }
+
+    float tx[5] = { 0.1f, 0.2f, 0.4f, 0.2f, 0.1f };
+    float ty[3] = { 0.25f, 0.5f, 0.25f };
+    assert(df_convolve_separable(&in, &out, tx, 5, ty, 3, NULL));
+    for (int y = 0; y < (int) h; y += 7) {
+        for (int x = 0; x < (int) w; x += 3) {
+            for (int c = 0; c < 4; c++) {
+                float expected = df_convolve_reference(&in, x, y, c, tx, 5, ty, 3);
+                assert(fabsf(out.data[((size_t) y * w + x) * 4 + c] - expected) < 1e-5f);
+            }
+        }
+    }
+
+    // The sliding-window box equals a convolution with uniform taps
+    int radius = 6;
+    float taps[13];
+    for (int i = 0; i < 13; i++) taps[i] = 1.0f / 13;
+    assert(df_convolve_separable(&in, &out, taps, 13, taps, 13, NULL));
+    assert(df_box_blur(&in, &box, radius, NULL));
+    for (size_t i = 0; i < (size_t) w * h * 4; i++) {
+        assert(fabsf(out.data[i] - box.data[i]) < 1e-4f);
+    }
+
+    // Three boxes should land close to the requested variance
+    int radii[DF_GAUSSIAN_BOXES];
+    df_gaussian_box_radii(4.0f, radii);
+    float variance = 0;
+    for (int i = 0; i < DF_GAUSSIAN_BOXES; i++) {
+        int size = 2 * radii[i] + 1;
+        variance += (size * size - 1) / 12.0f;
+    }
+    assert(fabsf(variance - 16.0f) < 2.0f);
+
+    // The chained row boxes and the column passes give the same image as
+    // the three boxes run one after the other
+    df_image_f32_t chained;
+    df_image_f32_init(&chained, w, h);
+    assert(df_box_blur(&in, &box, radii[0], NULL));
+    assert(df_box_blur(&box, &chained, radii[1], NULL));
+    assert(df_box_blur(&chained, &box, radii[2], NULL));
+    assert(df_gaussian_blur(&in, &out, 4.0f, NULL));
+    for (size_t i = 0; i < (size_t) w * h * 4; i++) {
+        assert(fabsf(out.data[i] - box.data[i]) < 1e-5f);
+    }
+
+    // and close to a true Gaussian away from the edges
+    float gauss[33], total = 0;
+    for (int i = 0; i < 33; i++) {
+        gauss[i] = expf(-(i - 16) * (i - 16) / 32.0f);
+        total += gauss[i];
+    }
+    for (int i = 0; i < 33; i++) gauss[i] /= total;
+    assert(df_convolve_separable(&in, &chained, gauss, 33, gauss, 33, NULL));
+    float max_error = 0;
+    for (uint32_t y = 16; y < h - 16; y++) {
+        for (uint32_t x = 16; x < w - 16; x++) {
+            for (int c = 0; c < 4; c++) {
+                size_t i = ((size_t) y * w + x) * 4 + c;
+                max_error = fmaxf(max_error, fabsf(out.data[i] - chained.data[i]));
+            }
+        }
+    }
+    assert(max_error < 0.002f);
+    df_image_f32_free(&chained);
+
+    // Even tap counts have no centre and are rejected
+    memset(box.data, 0, (size_t) w * h * 4 * sizeof(float));
+    assert(!df_convolve_separable(&in, &box, taps, 4, taps, 13, NULL));
+    assert(!df_convolve_separable(&in, &box, taps, 13, taps, 0, NULL));
+    assert(!df_convolve_separable(&in, &box, taps, DF_CONVOLVE_MAX_TAPS + 2, taps, 13, NULL));
+
+    // So are a negative radius and a sigma that isn't positive
+    assert(!df_box_blur(&in, &box, -1, NULL));
+    assert(!df_gaussian_blur(&in, &box, 0, NULL));
+    assert(!df_gaussian_blur(&in, &box, -2, NULL));
+    assert(!df_gaussian_blur(&in, &box, NAN, NULL));
+    assert(box.data[0] == 0 && box.data[(size_t) w * h * 4 - 1] == 0);
+
+    df_image_f32_free(&in);
+    df_image_f32_free(&out);
+    df_image_f32_free(&box);
+
+    printf("convolve: passed!\n");
+}
+#endif
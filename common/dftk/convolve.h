@@ -0,0 +1,31 @@
+#if !defined(DFTK_CONVOLVE_H)
+#define DFTK_CONVOLVE_H
+
+#include "cpu_texture.h"
+#include "dispatch.h"
+
+// Neighbourhood filters over float RGBA images, edges clamped. Every pass
+// works on 64x64 tiles plus a halo of the filter radius so a tile's input
+// rows stay in cache, and the inner loops process one RGBA pixel per SIMD
+// operation. Matching Metal kernels (convolve_h_kernel, convolve_v_kernel,
+// and box_h_kernel, box_v_kernel for the box and Gaussian blurs) live in
+// 07-compute-image-processing/shaders.metal.
+
+#define DF_CONVOLVE_MAX_TAPS 255
+#define DF_GAUSSIAN_BOXES 3
+
+bool df_convolve_separable(const df_image_f32_t *in, df_image_f32_t *out, const float *taps_x, int num_taps_x, const float *taps_y, int num_taps_y, df_dispatcher_t *dispatcher);
+bool df_box_blur(const df_image_f32_t *in, df_image_f32_t *out, int radius, df_dispatcher_t *dispatcher);
+bool df_gaussian_blur(const df_image_f32_t *in, df_image_f32_t *out, float sigma, df_dispatcher_t *dispatcher);
+void df_gaussian_box_radii(float sigma, int radii[DF_GAUSSIAN_BOXES]);
+
+// Tile building blocks, also used by the filter graph to fuse per-pixel
+// filters into a blur's last pass
+void df_box_blur_row(const df_image_f32_t *in, uint32_t y, uint32_t x0, uint32_t n, int radius, float *dst);
+void df_box_blur_column_tile(const df_image_f32_t *in, uint32_t x0, uint32_t n, uint32_t y0, uint32_t rows, int radius, float *dst);
+
+#ifdef TEST
+void df_convolve_test(void);
+#endif
+
+#endif
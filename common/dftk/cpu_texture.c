@@ -0,0 +1,50 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu_texture.h"
+
+bool df_cpu_texture_init(df_cpu_texture_t *texture, uint32_t width, uint32_t height) {
+    texture->width = width;
+    texture->height = height;
+    texture->bytes_per_row = (size_t) width * 4;
+    texture->data = (uint8_t *) calloc(texture->bytes_per_row, height);
+    return texture->data != NULL;
+}
+
+void df_cpu_texture_free(df_cpu_texture_t *texture) {
+    free(texture->data);
+    memset(texture, 0, sizeof(*texture));
+}
+
+bool df_image_f32_init(df_image_f32_t *image, uint32_t width, uint32_t height) {
+    image->width = width;
+    image->height = height;
+    image->data = (float *) calloc((size_t) width * height * 4, sizeof(float));
+    return image->data != NULL;
+}
+
+void df_image_f32_free(df_image_f32_t *image) {
+    free(image->data);
+    memset(image, 0, sizeof(*image));
+}
+
+// Both must have the same size
+void df_image_f32_from_texture(df_image_f32_t *image, const df_cpu_texture_t *texture) {
+    for (uint32_t y = 0; y < texture->height; y++) {
+        const uint8_t *in = texture->data + y * texture->bytes_per_row;
+        float *out = image->data + (size_t) y * image->width * 4;
+        for (uint32_t i = 0; i < texture->width * 4; i++) {
+            out[i] = in[i] * (1.0f / 255.0f);
+        }
+    }
+}
+
+void df_image_f32_to_texture(const df_image_f32_t *image, df_cpu_texture_t *texture) {
+    for (uint32_t y = 0; y < texture->height; y++) {
+        const float *in = image->data + (size_t) y * image->width * 4;
+        uint8_t *out = texture->data + y * texture->bytes_per_row;
+        for (uint32_t i = 0; i < texture->width * 4; i++) {
+            out[i] = (uint8_t) nearbyintf(fminf(fmaxf(in[i], 0.0f), 1.0f) * 255.0f);
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#if !defined(DFTK_CPU_TEXTURE_H)
+#define DFTK_CPU_TEXTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A CPU-side stand-in for a RGBA8Unorm MTLTexture, used by the CPU ports
+// of the compute kernels
+typedef struct {
+    uint8_t *data;
+    uint32_t width;
+    uint32_t height;
+    size_t bytes_per_row;
+} df_cpu_texture_t;
+
+// Tightly packed float RGBA pixels, the intermediate format between CPU
+// kernels that need more precision than 8 bits
+typedef struct {
+    float *data;
+    uint32_t width;
+    uint32_t height;
+} df_image_f32_t;
+
+bool df_cpu_texture_init(df_cpu_texture_t *texture, uint32_t width, uint32_t height);
+void df_cpu_texture_free(df_cpu_texture_t *texture);
+bool df_image_f32_init(df_image_f32_t *image, uint32_t width, uint32_t height);
+void df_image_f32_free(df_image_f32_t *image);
+void df_image_f32_from_texture(df_image_f32_t *image, const df_cpu_texture_t *texture);
+void df_image_f32_to_texture(const df_image_f32_t *image, df_cpu_texture_t *texture);
+
+#endif
@@ -1,7 +1,53 @@
 #include "math.h"
 #include "camera.h"
+#include "thread_pool.h"
+#include "dispatch.h"
+#include "lz4.h"
+#include "texture_file.h"
+#include "simd.h"
+#include "mipmap.h"
+#include "hash.h"
+#include "texture_cache.h"
+#include "cpu_texture.h"
+#include "tile_stream.h"
+#include "half.h"
+#include "image_f16.h"
+#include "grayscale.h"
+#include "convolve.h"
+#include "color_matrix.h"
+#include "filter_graph.h"
+#include "image_stats.h"
+#include "resample.h"
+#include "tiled_image.h"
+#include "raster.h"
+#include "sampler.h"
+#include "overlay.h"
+#include "render_graph.h"
+#include "image_diff.h"
 
 #if defined(DFTK_IMPLEMENTATION)
 #include "math.c"
 #include "camera.c"
+#include "thread_pool.c"
+#include "dispatch.c"
+#include "lz4.c"
+#include "texture_file.c"
+#include "mipmap.c"
+#include "hash.c"
+#include "texture_cache.c"
+#include "cpu_texture.c"
+#include "tile_stream.c"
+#include "image_f16.c"
+#include "grayscale.c"
+#include "convolve.c"
+#include "color_matrix.c"
+#include "filter_graph.c"
+#include "image_stats.c"
+#include "resample.c"
+#include "tiled_image.c"
+#include "raster.c"
+#include "sampler.c"
+#include "overlay.c"
+#include "render_graph.c"
+#include "image_diff.c"
 #endif
@@ -0,0 +1,352 @@
+#include <stdlib.h>
+#include <string.h>
+#include "dispatch.h"
+#include "thread_pool.h"
+
+#define DF_RANGE(begin, end) ((uint64_t) (begin) | ((uint64_t) (end) << 32))
+#define DF_RANGE_BEGIN(r) ((uint32_t) (r))
+#define DF_RANGE_END(r) ((uint32_t) ((r) >> 32))
+
+static void df_dispatch_run_group(df_dispatcher_t *d, uint32_t index, uint32_t worker) {
+    df_size3_t count = d->threadgroup_count;
+    df_size3_t tg = d->threads_per_threadgroup;
+
+    df_threadgroup_t group;
+    group.threadgroup_position_in_grid.width = index % count.width;
+    group.threadgroup_position_in_grid.height = (index / count.width) % count.height;
+    group.threadgroup_position_in_grid.depth = index / (count.width * count.height);
+    group.threads_per_threadgroup = tg;
+    group.origin.width = group.threadgroup_position_in_grid.width * tg.width;
+    group.origin.height = group.threadgroup_position_in_grid.height * tg.height;
+    group.origin.depth = group.threadgroup_position_in_grid.depth * tg.depth;
+    group.size.width = d->grid.width - group.origin.width < tg.width ? d->grid.width - group.origin.width : tg.width;
+    group.size.height = d->grid.height - group.origin.height < tg.height ? d->grid.height - group.origin.height : tg.height;
+    group.size.depth = d->grid.depth - group.origin.depth < tg.depth ? d->grid.depth - group.origin.depth : tg.depth;
+    group.worker = worker;
+
+    d->fn(&group, d->args);
+}
+
+// Takes the next group from the front of the worker's own range
+static bool df_dispatch_pop(df_steal_range_t *own, uint32_t *index) {
+    uint64_t r = atomic_load(&own->range);
+    for (;;) {
+        uint32_t begin = DF_RANGE_BEGIN(r), end = DF_RANGE_END(r);
+        if (begin >= end) {
+            return false;
+        }
+        if (atomic_compare_exchange_weak(&own->range, &r, DF_RANGE(begin + 1, end))) {
+            *index = begin;
+            return true;
+        }
+    }
+}
+
+// Moves the back half of the fullest other range into the worker's own
+static bool df_dispatch_steal(df_dispatcher_t *d, uint32_t worker) {
+    for (;;) {
+        int victim = -1;
+        uint32_t most = 0;
+        for (int i = 0; i < d->num_workers; i++) {
+            uint64_t r = atomic_load(&d->ranges[i].range);
+            uint32_t left = DF_RANGE_END(r) > DF_RANGE_BEGIN(r) ? DF_RANGE_END(r) - DF_RANGE_BEGIN(r) : 0;
+            if (i != (int) worker && left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+
+        if (victim < 0) {
+            return false;
+        }
+
+        uint64_t r = atomic_load(&d->ranges[victim].range);
+        uint32_t begin = DF_RANGE_BEGIN(r), end = DF_RANGE_END(r);
+        if (begin >= end) {
+            continue;
+        }
+
+        // A single remaining group is taken whole
+        uint32_t mid = begin + (end - begin) / 2;
+        if (atomic_compare_exchange_strong(&d->ranges[victim].range, &r, DF_RANGE(begin, mid))) {
+            atomic_store(&d->ranges[worker].range, DF_RANGE(mid, end));
+            atomic_fetch_add(&d->steals, 1);
+            return true;
+        }
+    }
+}
+
+static void df_dispatch_work(df_dispatcher_t *d, uint32_t worker) {
+    uint32_t index;
+    do {
+        while (df_dispatch_pop(&d->ranges[worker], &index)) {
+            df_dispatch_run_group(d, index, worker);
+        }
+    } while (df_dispatch_steal(d, worker));
+}
+
+typedef struct {
+    df_dispatcher_t *dispatcher;
+    uint32_t worker;
+} df_dispatch_worker_t;
+
+static void *df_dispatch_worker(void *data) {
+    df_dispatch_worker_t *w = (df_dispatch_worker_t *) data;
+    df_dispatcher_t *d = w->dispatcher;
+    uint32_t worker = w->worker;
+    free(w);
+
+    uint64_t seen = 0;
+    pthread_mutex_lock(&d->mutex);
+    for (;;) {
+        while (d->generation == seen && !d->stop) {
+            pthread_cond_wait(&d->start, &d->mutex);
+        }
+        if (d->stop) {
+            break;
+        }
+        seen = d->generation;
+        pthread_mutex_unlock(&d->mutex);
+
+        df_dispatch_work(d, worker);
+
+        pthread_mutex_lock(&d->mutex);
+        if (--d->running == 0) {
+            pthread_cond_signal(&d->done);
+        }
+    }
+    pthread_mutex_unlock(&d->mutex);
+
+    return NULL;
+}
+
+// `num_workers` <= 0 means one per core. The thread calling
+// df_dispatch_threads counts as a worker, so num_workers - 1 threads are
+// started.
+bool df_dispatcher_init(df_dispatcher_t *d, int num_workers) {
+    memset(d, 0, sizeof(*d));
+
+    if (num_workers <= 0) {
+        num_workers = df_cpu_count();
+    }
+
+    d->ranges = (df_steal_range_t *) aligned_alloc(_Alignof(df_steal_range_t), num_workers * sizeof(df_steal_range_t));
+    d->threads = (pthread_t *) calloc(num_workers, sizeof(pthread_t));
+    if (!d->ranges || !d->threads) {
+        free(d->ranges);
+        free(d->threads);
+        return false;
+    }
+    for (int i = 0; i < num_workers; i++) {
+        atomic_init(&d->ranges[i].range, 0);
+    }
+
+    pthread_mutex_init(&d->mutex, NULL);
+    pthread_cond_init(&d->start, NULL);
+    pthread_cond_init(&d->done, NULL);
+
+    d->num_workers = 1;
+    for (int i = 1; i < num_workers; i++) {
+        df_dispatch_worker_t *w = (df_dispatch_worker_t *) malloc(sizeof(df_dispatch_worker_t));
+        *w = (df_dispatch_worker_t) { d, (uint32_t) i };
+        if (pthread_create(&d->threads[i], NULL, df_dispatch_worker, w) != 0) {
+            free(w);
+            break;
+        }
+        d->num_workers++;
+    }
+
+    return true;
+}
+
+void df_dispatcher_deinit(df_dispatcher_t *d) {
+    pthread_mutex_lock(&d->mutex);
+    d->stop = true;
+    pthread_cond_broadcast(&d->start);
+    pthread_mutex_unlock(&d->mutex);
+
+    for (int i = 1; i < d->num_workers; i++) {
+        pthread_join(d->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&d->mutex);
+    pthread_cond_destroy(&d->start);
+    pthread_cond_destroy(&d->done);
+    free(d->threads);
+    free(d->ranges);
+    memset(d, 0, sizeof(*d));
+}
+
+static df_dispatcher_t df_shared_dispatcher;
+static pthread_once_t df_shared_dispatcher_once = PTHREAD_ONCE_INIT;
+
+static void df_shared_dispatcher_create(void) {
+    df_dispatcher_init(&df_shared_dispatcher, 0);
+}
+
+df_dispatcher_t *df_dispatcher_shared(void) {
+    pthread_once(&df_shared_dispatcher_once, df_shared_dispatcher_create);
+    return &df_shared_dispatcher;
+}
+
+// The CPU equivalent of dispatchThreads:threadsPerThreadgroup:. Blocks until
+// every group has run. `dispatcher` may be NULL for the shared one. Kernels
+// must not dispatch on the same dispatcher, and no other thread may use it
+// until this returns.
+void df_dispatch_threads(df_dispatcher_t *d, df_size3_t grid, df_size3_t threads_per_threadgroup, df_kernel_fn fn, void *args) {
+    if (!d) {
+        d = df_dispatcher_shared();
+    }
+
+    df_size3_t tg = threads_per_threadgroup;
+    if (grid.width == 0 || grid.height == 0 || grid.depth == 0 || tg.width == 0 || tg.height == 0 || tg.depth == 0) {
+        return;
+    }
+
+    d->fn = fn;
+    d->args = args;
+    d->grid = grid;
+    d->threads_per_threadgroup = tg;
+    d->threadgroup_count.width = (grid.width + tg.width - 1) / tg.width;
+    d->threadgroup_count.height = (grid.height + tg.height - 1) / tg.height;
+    d->threadgroup_count.depth = (grid.depth + tg.depth - 1) / tg.depth;
+
+    uint64_t total = (uint64_t) d->threadgroup_count.width * d->threadgroup_count.height * d->threadgroup_count.depth;
+    int n = d->num_workers;
+    for (int i = 0; i < n; i++) {
+        atomic_store(&d->ranges[i].range, DF_RANGE(total * i / n, total * (i + 1) / n));
+    }
+
+    if (n > 1) {
+        pthread_mutex_lock(&d->mutex);
+        d->running = n - 1;
+        d->generation++;
+        pthread_cond_broadcast(&d->start);
+        pthread_mutex_unlock(&d->mutex);
+    }
+
+    df_dispatch_work(d, 0);
+
+    if (n > 1) {
+        pthread_mutex_lock(&d->mutex);
+        while (d->running > 0) {
+            pthread_cond_wait(&d->done, &d->mutex);
+        }
+        pthread_mutex_unlock(&d->mutex);
+    }
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+
+typedef struct {
+    df_size3_t grid;
+    df_size3_t tg;
+    _Atomic int *runs;         // Per group
+    _Atomic int *threads;      // Per thread_position_in_grid
+    _Atomic int workers[8];    // Groups run by each worker
+    df_dispatcher_t *dispatcher;
+    size_t steals;             // Steals before the dispatch
+    bool block;                // Hold worker 0 until another worker steals
+} df_dispatch_test_t;
+
+static void df_dispatch_test_kernel(const df_threadgroup_t *group, void *args) {
+    df_dispatch_test_t *t = (df_dispatch_test_t *) args;
+    df_size3_t p = group->threadgroup_position_in_grid;
+    uint32_t groups_x = (t->grid.width + t->tg.width - 1) / t->tg.width;
+    uint32_t groups_y = (t->grid.height + t->tg.height - 1) / t->tg.height;
+    uint32_t index = (p.depth * groups_y + p.height) * groups_x + p.width;
+
+    assert(group->worker < 8);
+    assert(group->size.width >= 1 && group->size.width <= t->tg.width);
+    assert(group->origin.width + group->size.width <= t->grid.width);
+    assert(group->origin.height + group->size.height <= t->grid.height);
+    assert(group->origin.depth + group->size.depth <= t->grid.depth);
+    atomic_fetch_add(&t->runs[index], 1);
+    atomic_fetch_add(&t->workers[group->worker], 1);
+
+    for (uint32_t z = 0; z < group->size.depth; z++) {
+        for (uint32_t y = 0; y < group->size.height; y++) {
+            for (uint32_t x = 0; x < group->size.width; x++) {
+                size_t i = ((size_t) (group->origin.depth + z) * t->grid.height + group->origin.height + y) * t->grid.width + group->origin.width + x;
+                atomic_fetch_add(&t->threads[i], 1);
+            }
+        }
+    }
+
+    // Group 0 starts worker 0's range. Holding it there leaves the rest of
+    // that range for the other workers to steal once theirs run out; if
+    // group 0 itself was stolen, the steal has already happened.
+    if (t->block && index == 0) {
+        while (atomic_load(&t->dispatcher->steals) == t->steals) {
+            sched_yield();
+        }
+    }
+}
+
+void df_dispatch_test(void) {
+    // Grids that don't divide into their groups, including a single
+    // group and fewer groups than workers
+    df_size3_t grids[][2] = {
+        { { 100, 37, 1 }, { 16, 8, 1 } },
+        { { 1, 1, 1 }, { 8, 8, 1 } },
+        { { 3, 1, 1 }, { 1, 1, 1 } },
+        { { 257, 129, 3 }, { 32, 16, 2 } },
+        { { 40, 40, 1 }, { 40, 40, 1 } },
+    };
+
+    int worker_counts[] = { 1, 3, 4 };
+    for (int w = 0; w < 3; w++) {
+        df_dispatcher_t d;
+        assert(df_dispatcher_init(&d, worker_counts[w]) && d.num_workers == worker_counts[w]);
+
+        for (int g = 0; g < 5; g++) {
+            for (int uneven = 0; uneven < 2; uneven++) {
+                df_dispatch_test_t t = { grids[g][0], grids[g][1] };
+                size_t groups = (size_t) ((t.grid.width + t.tg.width - 1) / t.tg.width) * ((t.grid.height + t.tg.height - 1) / t.tg.height) *
+                                ((t.grid.depth + t.tg.depth - 1) / t.tg.depth);
+                size_t threads = (size_t) t.grid.width * t.grid.height * t.grid.depth;
+                t.runs = (_Atomic int *) calloc(groups, sizeof(_Atomic int));
+                t.threads = (_Atomic int *) calloc(threads, sizeof(_Atomic int));
+                assert(t.runs && t.threads);
+
+                // Blocking only works when worker 0 has a group left to steal
+                t.dispatcher = &d;
+                t.steals = atomic_load(&d.steals);
+                t.block = uneven && d.num_workers > 1 && groups / d.num_workers >= 2;
+                df_dispatch_threads(&d, t.grid, t.tg, df_dispatch_test_kernel, &t);
+
+                // Every group and every thread exactly once
+                for (size_t i = 0; i < groups; i++) {
+                    assert(atomic_load(&t.runs[i]) == 1);
+                }
+                for (size_t i = 0; i < threads; i++) {
+                    assert(atomic_load(&t.threads[i]) == 1);
+                }
+                int total = 0;
+                for (int i = 0; i < 8; i++) {
+                    total += atomic_load(&t.workers[i]);
+                }
+                assert(total == (int) groups);
+
+                if (t.block) {
+                    assert(atomic_load(&d.steals) > t.steals);
+                }
+
+                free(t.runs);
+                free(t.threads);
+            }
+        }
+
+        // An empty grid runs nothing
+        df_dispatch_threads(&d, df_size3(0, 10, 1), df_size3(8, 8, 1), df_dispatch_test_kernel, NULL);
+        df_dispatcher_deinit(&d);
+    }
+
+    printf("dispatch: passed!\n");
+}
+
+#endif
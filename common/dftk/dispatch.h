@@ -0,0 +1,82 @@
+#if !defined(DFTK_DISPATCH_H)
+#define DFTK_DISPATCH_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Runs compute kernels on the CPU with Metal's grid model: the grid is cut
+// into threadgroups (tiles) of `threads_per_threadgroup`, and the kernel is
+// called once per threadgroup with the range of thread_position_in_grid
+// values it covers. Groups on the grid's edge are clipped, so kernels need
+// no bounds checks of their own.
+//
+// Groups are handed out as contiguous ranges, one range per worker, so each
+// worker walks neighbouring tiles. A worker that runs out steals the back
+// half of the largest remaining range.
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+} df_size3_t;
+
+typedef struct {
+    df_size3_t threadgroup_position_in_grid;
+    df_size3_t threads_per_threadgroup;
+    df_size3_t origin;        // thread_position_in_grid of the group's first thread
+    df_size3_t size;          // Threads of this group inside the grid
+    uint32_t worker;          // Which worker runs the group, in [0, num_workers)
+} df_threadgroup_t;
+
+typedef void (*df_kernel_fn)(const df_threadgroup_t *group, void *args);
+
+// A worker's remaining groups, [begin, end) packed as begin | end << 32.
+// Aligned to its own cache line, so workers don't share one.
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;
+} df_steal_range_t;
+
+typedef struct {
+    pthread_t *threads;
+    int num_workers;              // Worker threads + the dispatching thread
+    df_steal_range_t *ranges;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;          // Bumped for every dispatch to wake the workers
+    int running;                  // Workers still busy with the current dispatch
+    bool stop;
+
+    // The current dispatch
+    df_kernel_fn fn;
+    void *args;
+    df_size3_t grid;
+    df_size3_t threads_per_threadgroup;
+    df_size3_t threadgroup_count;
+
+    _Atomic size_t steals;        // Successful steals, for load-balance diagnostics
+} df_dispatcher_t;
+
+static inline df_size3_t df_size3(uint32_t width, uint32_t height, uint32_t depth) {
+    df_size3_t s = { width, height, depth };
+    return s;
+}
+
+bool df_dispatcher_init(df_dispatcher_t *dispatcher, int num_workers);
+void df_dispatcher_deinit(df_dispatcher_t *dispatcher);
+df_dispatcher_t *df_dispatcher_shared(void);
+
+// Blocks until every group has run. A dispatcher runs one dispatch at a
+// time: calls on the same dispatcher must not overlap, whether nested from
+// a kernel or made concurrently from different threads. Use one dispatcher
+// per thread that dispatches.
+void df_dispatch_threads(df_dispatcher_t *dispatcher, df_size3_t grid, df_size3_t threads_per_threadgroup, df_kernel_fn fn, void *args);
+
+#ifdef TEST
+void df_dispatch_test(void);
+#endif
+
+#endif
@@ -0,0 +1,386 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "convolve.h"
+#include "filter_graph.h"
+#include "simd.h"
+
+#define DF_FILTER_TILE_WIDTH 64
+#define DF_FILTER_TILE_HEIGHT 16
+
+static const float df_rec709_luma[3] = { 0.2126f, 0.7152f, 0.0722f };
+
+void df_filter_graph_init(df_filter_graph_t *graph) {
+    memset(graph, 0, sizeof(*graph));
+}
+
+// False when the graph is full or for a blur with a negative radius
+bool df_filter_graph_add(df_filter_graph_t *graph, df_filter_t filter) {
+    if (graph->num_nodes >= DF_FILTER_GRAPH_MAX_NODES || (filter.type == DFFilterBoxBlur && filter.radius < 0)) {
+        return false;
+    }
+    graph->nodes[graph->num_nodes++] = filter;
+    return true;
+}
+
+bool df_filter_graph_add_grayscale(df_filter_graph_t *graph, float bias) {
+    df_filter_t f = { .type = DFFilterGrayscale, .bias = bias };
+    return df_filter_graph_add(graph, f);
+}
+
+bool df_filter_graph_add_bias(df_filter_graph_t *graph, float bias) {
+    df_filter_t f = { .type = DFFilterBias, .bias = bias };
+    return df_filter_graph_add(graph, f);
+}
+
+bool df_filter_graph_add_threshold(df_filter_graph_t *graph, float threshold) {
+    df_filter_t f = { .type = DFFilterThreshold, .threshold = threshold };
+    return df_filter_graph_add(graph, f);
+}
+
+bool df_filter_graph_add_color_matrix(df_filter_graph_t *graph, const df_color_matrix_t *matrix) {
+    df_filter_t f = { .type = DFFilterColorMatrix, .color_matrix = *matrix, .color_matrix_kind = df_color_matrix_classify(matrix) };
+    return df_filter_graph_add(graph, f);
+}
+
+bool df_filter_graph_add_box_blur(df_filter_graph_t *graph, int radius) {
+    df_filter_t f = { .type = DFFilterBoxBlur, .radius = radius };
+    return df_filter_graph_add(graph, f);
+}
+
+static bool df_filter_is_pointwise(const df_filter_t *f) {
+    return f->type != DFFilterBoxBlur;
+}
+
+// A pass: an optional neighbourhood filter followed by a run of fused
+// per-pixel filters
+typedef struct {
+    const df_filter_t *neighbourhood;
+    const df_filter_t *pointwise;
+    int num_pointwise;
+} df_filter_pass_t;
+
+static int df_filter_graph_passes(const df_filter_graph_t *graph, df_filter_pass_t *passes) {
+    int n = 0;
+    for (int i = 0; i < graph->num_nodes; ) {
+        df_filter_pass_t pass = {0};
+        if (!df_filter_is_pointwise(&graph->nodes[i])) {
+            pass.neighbourhood = &graph->nodes[i++];
+        }
+        pass.pointwise = &graph->nodes[i];
+        while (i < graph->num_nodes && df_filter_is_pointwise(&graph->nodes[i])) {
+            pass.num_pointwise++;
+            i++;
+        }
+        passes[n++] = pass;
+    }
+    return n;
+}
+
+// How many passes over the image the graph takes after fusion
+int df_filter_graph_num_passes(const df_filter_graph_t *graph) {
+    df_filter_pass_t passes[DF_FILTER_GRAPH_MAX_NODES];
+    return df_filter_graph_passes(graph, passes);
+}
+
+// The input or output of a pass: the caller's RGBA8 texture or a float
+// RGBA intermediate
+typedef struct {
+    const df_cpu_texture_t *texture;
+    df_cpu_texture_t *out_texture;
+    float *pixels;
+    uint32_t width;
+    uint32_t height;
+} df_filter_surface_t;
+
+static void df_filter_load(const df_filter_surface_t *s, uint32_t x, uint32_t y, uint32_t n, float *dst) {
+    if (s->pixels) {
+        memcpy(dst, s->pixels + ((size_t) y * s->width + x) * 4, n * 4 * sizeof(float));
+        return;
+    }
+
+    const uint8_t *p = s->texture->data + y * s->texture->bytes_per_row + x * 4;
+    for (uint32_t i = 0; i < 4 * n; i++) {
+        dst[i] = p[i] * (1.0f / 255.0f);
+    }
+}
+
+static void df_filter_store(const df_filter_surface_t *s, uint32_t x, uint32_t y, uint32_t n, const float *src) {
+    if (s->pixels) {
+        memcpy(s->pixels + ((size_t) y * s->width + x) * 4, src, n * 4 * sizeof(float));
+        return;
+    }
+
+    uint8_t *p = s->out_texture->data + y * s->out_texture->bytes_per_row + x * 4;
+    for (uint32_t i = 0; i < 4 * n; i++) {
+        p[i] = (uint8_t) nearbyintf(fminf(fmaxf(src[i], 0.0f), 1.0f) * 255.0f);
+    }
+}
+
+static void df_filter_apply(const df_filter_t *f, float *px, uint32_t n) {
+    switch (f->type) {
+        case DFFilterGrayscale: {
+            float w0 = df_rec709_luma[0] + f->bias, w1 = df_rec709_luma[1] + f->bias, w2 = df_rec709_luma[2] + f->bias;
+            for (uint32_t i = 0; i < n; i++, px += 4) {
+                float gray = px[0] * w0 + px[1] * w1 + px[2] * w2;
+                px[0] = px[1] = px[2] = gray;
+                px[3] = 1;
+            }
+        } break;
+
+        case DFFilterBias: {
+            df_f32x4 b = df_f32x4_set(f->bias, f->bias, f->bias, 0);
+            for (uint32_t i = 0; i < n; i++, px += 4) {
+                df_f32x4_store(px, df_f32x4_add(df_f32x4_load(px), b));
+            }
+        } break;
+
+        case DFFilterThreshold:
+            for (uint32_t i = 0; i < n; i++, px += 4) {
+                float luma = px[0] * df_rec709_luma[0] + px[1] * df_rec709_luma[1] + px[2] * df_rec709_luma[2];
+                px[0] = px[1] = px[2] = luma >= f->threshold ? 1.0f : 0.0f;
+            }
+            break;
+
+        case DFFilterColorMatrix:
+            df_color_matrix_apply(&f->color_matrix, f->color_matrix_kind, px, n);
+            break;
+
+        case DFFilterBoxBlur:
+            break;
+    }
+}
+
+typedef struct {
+    const df_filter_pass_t *pass;
+    df_filter_surface_t src;
+    df_filter_surface_t dst;
+    float *tmp;           // Horizontal blur result, float RGBA
+    _Atomic bool failed;  // A blur span couldn't be allocated
+} df_filter_args_t;
+
+static void df_filter_pointwise_group(const df_threadgroup_t *group, void *data) {
+    df_filter_args_t *a = (df_filter_args_t *) data;
+    float px[DF_FILTER_TILE_WIDTH * 4];
+    uint32_t x = group->origin.width, n = group->size.width;
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        df_filter_load(&a->src, x, y, n, px);
+        for (int i = 0; i < a->pass->num_pointwise; i++) {
+            df_filter_apply(&a->pass->pointwise[i], px, n);
+        }
+        df_filter_store(&a->dst, x, y, n, px);
+    }
+}
+
+static void df_filter_blur_h_group(const df_threadgroup_t *group, void *data) {
+    df_filter_args_t *a = (df_filter_args_t *) data;
+    int r = a->pass->neighbourhood->radius;
+    int width = (int) a->src.width;
+    int x0 = (int) group->origin.width, n = (int) group->size.width;
+    int lo = x0 - r < 0 ? 0 : x0 - r;
+    int hi = x0 + n + r > width ? width : x0 + n + r;
+
+    // The loaded span ends exactly where the image does or covers the whole
+    // halo, so clamping to the span is clamping to the image
+    df_image_f32_t span = { (float *) malloc((size_t) (hi - lo) * 4 * sizeof(float)), (uint32_t) (hi - lo), 1 };
+    if (!span.data) {
+        atomic_store(&a->failed, true);
+        return;
+    }
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        df_filter_load(&a->src, (uint32_t) lo, y, span.width, span.data);
+        df_box_blur_row(&span, 0, (uint32_t) (x0 - lo), (uint32_t) n, r, a->tmp + ((size_t) y * width + x0) * 4);
+    }
+
+    free(span.data);
+}
+
+// Vertical blur, then the pass's per-pixel filters on the result
+static void df_filter_blur_v_group(const df_threadgroup_t *group, void *data) {
+    df_filter_args_t *a = (df_filter_args_t *) data;
+    df_image_f32_t tmp = { a->tmp, a->src.width, a->src.height };
+    uint32_t x0 = group->origin.width, n = group->size.width;
+    float px[DF_FILTER_TILE_WIDTH * DF_FILTER_TILE_HEIGHT * 4];
+
+    df_box_blur_column_tile(&tmp, x0, n, group->origin.height, group->size.height, a->pass->neighbourhood->radius, px);
+
+    for (uint32_t y = 0; y < group->size.height; y++) {
+        float *row = px + (size_t) y * n * 4;
+        for (int i = 0; i < a->pass->num_pointwise; i++) {
+            df_filter_apply(&a->pass->pointwise[i], row, n);
+        }
+        df_filter_store(&a->dst, x0, group->origin.height + y, n, row);
+    }
+}
+
+// Runs the chain from `in` to `out` (same size, may not alias). Returns
+// false if the sizes differ or memory runs out, leaving `out` unspecified.
+bool df_filter_graph_run(const df_filter_graph_t *graph, const df_cpu_texture_t *in, df_cpu_texture_t *out, df_dispatcher_t *dispatcher) {
+    if (in->width != out->width || in->height != out->height) {
+        return false;
+    }
+
+    uint32_t w = in->width, h = in->height;
+    size_t floats = (size_t) w * h * 4;
+
+    df_filter_pass_t passes[DF_FILTER_GRAPH_MAX_NODES];
+    int num_passes = df_filter_graph_passes(graph, passes);
+
+    if (num_passes == 0) {
+        for (uint32_t y = 0; y < h; y++) {
+            memcpy(out->data + y * out->bytes_per_row, in->data + y * in->bytes_per_row, (size_t) w * 4);
+        }
+        return true;
+    }
+
+    bool blurs = false;
+    for (int i = 0; i < num_passes; i++) {
+        blurs = blurs || passes[i].neighbourhood;
+    }
+
+    // Ping-pong float intermediates between passes
+    float *intermediate[2] = {
+        num_passes > 1 ? (float *) malloc(floats * sizeof(float)) : NULL,
+        num_passes > 2 ? (float *) malloc(floats * sizeof(float)) : NULL,
+    };
+    float *tmp = blurs ? (float *) malloc(floats * sizeof(float)) : NULL;
+    if ((num_passes > 1 && !intermediate[0]) || (num_passes > 2 && !intermediate[1]) || (blurs && !tmp)) {
+        free(intermediate[0]);
+        free(intermediate[1]);
+        free(tmp);
+        return false;
+    }
+
+    df_size3_t grid = df_size3(w, h, 1);
+    df_size3_t tile = df_size3(DF_FILTER_TILE_WIDTH, DF_FILTER_TILE_HEIGHT, 1);
+
+    bool ok = true;
+    for (int i = 0; i < num_passes && ok; i++) {
+        df_filter_args_t args = { &passes[i] };
+        args.src = (df_filter_surface_t) { in, NULL, i > 0 ? intermediate[(i - 1) % 2] : NULL, w, h };
+        args.dst = (df_filter_surface_t) { NULL, out, i < num_passes - 1 ? intermediate[i % 2] : NULL, w, h };
+        args.tmp = tmp;
+        atomic_init(&args.failed, false);
+
+        if (passes[i].neighbourhood) {
+            df_dispatch_threads(dispatcher, grid, tile, df_filter_blur_h_group, &args);
+            ok = !atomic_load(&args.failed);
+            if (ok) {
+                df_dispatch_threads(dispatcher, grid, tile, df_filter_blur_v_group, &args);
+            }
+        } else {
+            df_dispatch_threads(dispatcher, grid, tile, df_filter_pointwise_group, &args);
+        }
+    }
+
+    free(intermediate[0]);
+    free(intermediate[1]);
+    free(tmp);
+
+    return ok;
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+void df_filter_graph_test(void) {
+    df_cpu_texture_t in, out;
+    df_cpu_texture_init(&in, 100, 37);
+    df_cpu_texture_init(&out, 100, 37);
+    for (size_t i = 0; i < in.bytes_per_row * in.height; i++) {
+        in.data[i] = (uint8_t) (i * 13);
+    }
+
+    df_filter_graph_t graph;
+    df_filter_graph_init(&graph);
+    df_filter_graph_add_bias(&graph, 0.1f);
+    df_filter_graph_add_grayscale(&graph, 0);
+    df_filter_graph_add_box_blur(&graph, 2);
+    df_filter_graph_add_threshold(&graph, 0.5f);
+    assert(!df_filter_graph_add_box_blur(&graph, -1) && graph.num_nodes == 4);
+    assert(df_filter_graph_num_passes(&graph) == 2);
+    assert(df_filter_graph_run(&graph, &in, &out, NULL));
+
+    for (size_t i = 0; i < (size_t) out.width * out.height; i++) {
+        uint8_t *p = out.data + 4 * i;
+        assert((p[0] == 0 || p[0] == 255) && p[0] == p[1] && p[1] == p[2] && p[3] == 255);
+    }
+
+    // Fused chains against each filter applied to the whole image in turn.
+    // Pointwise runs do the same float operations either way, so they match
+    // exactly; blurs may sum in a different order.
+    for (size_t i = 0; i < in.bytes_per_row * in.height; i++) {
+        in.data[i] = (uint8_t) (i * 13 + (i >> 7));
+    }
+    df_color_matrix_t sepia;
+    df_color_matrix_sepia(&sepia);
+    for (int chain = 0; chain < 2; chain++) {
+        df_filter_graph_init(&graph);
+        if (chain == 0) {
+            df_filter_graph_add_bias(&graph, -0.05f);
+            df_filter_graph_add_color_matrix(&graph, &sepia);
+            df_filter_graph_add_grayscale(&graph, 0.01f);
+            df_filter_graph_add_threshold(&graph, 0.4f);
+        } else {
+            df_filter_graph_add_bias(&graph, 0.1f);
+            df_filter_graph_add_box_blur(&graph, 3);
+            df_filter_graph_add_color_matrix(&graph, &sepia);
+            df_filter_graph_add_box_blur(&graph, 1);
+            df_filter_graph_add_grayscale(&graph, 0);
+            df_filter_graph_add_bias(&graph, -0.2f);
+        }
+        assert(df_filter_graph_num_passes(&graph) == 1 + 2 * chain);
+        assert(df_filter_graph_run(&graph, &in, &out, NULL));
+
+        df_image_f32_t image, tmp;
+        df_image_f32_init(&image, in.width, in.height);
+        df_image_f32_init(&tmp, in.width, in.height);
+        df_image_f32_from_texture(&image, &in);
+        for (int i = 0; i < graph.num_nodes; i++) {
+            if (graph.nodes[i].type == DFFilterBoxBlur) {
+                assert(df_box_blur(&image, &tmp, graph.nodes[i].radius, NULL));
+                df_image_f32_t swap = image;
+                image = tmp;
+                tmp = swap;
+            } else {
+                df_filter_apply(&graph.nodes[i], image.data, in.width * in.height);
+            }
+        }
+        df_cpu_texture_t expected;
+        df_cpu_texture_init(&expected, in.width, in.height);
+        df_image_f32_to_texture(&image, &expected);
+
+        int max_diff = 0;
+        for (uint32_t y = 0; y < in.height; y++) {
+            for (uint32_t x = 0; x < in.width * 4; x++) {
+                int d = abs(out.data[y * out.bytes_per_row + x] - expected.data[y * expected.bytes_per_row + x]);
+                max_diff = d > max_diff ? d : max_diff;
+            }
+        }
+        assert(max_diff <= chain);
+
+        df_cpu_texture_free(&expected);
+        df_image_f32_free(&image);
+        df_image_f32_free(&tmp);
+    }
+
+    // A constant image is a fixed point of the blur
+    memset(in.data, 128, in.bytes_per_row * in.height);
+    df_filter_graph_init(&graph);
+    df_filter_graph_add_box_blur(&graph, 5);
+    df_filter_graph_run(&graph, &in, &out, NULL);
+    for (size_t i = 0; i < out.bytes_per_row * out.height; i++) {
+        assert(out.data[i] == 128);
+    }
+
+    df_cpu_texture_free(&in);
+    df_cpu_texture_free(&out);
+
+    printf("filter_graph: passed!\n");
+}
+#endif
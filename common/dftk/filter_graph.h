@@ -0,0 +1,57 @@
+#if !defined(DFTK_FILTER_GRAPH_H)
+#define DFTK_FILTER_GRAPH_H
+
+#include <stdbool.h>
+#include "color_matrix.h"
+#include "cpu_texture.h"
+#include "dispatch.h"
+
+// A chain of image filters. Runs of per-pixel filters are fused: each tile
+// is loaded once, every filter in the run is applied to it while it sits in
+// L1, and it is stored once. Only neighbourhood filters (blur) need the
+// whole previous image, so only they start a new pass and materialize an
+// intermediate. Filters compute in fp32 on RGBA values in [0, 1].
+
+#define DF_FILTER_GRAPH_MAX_NODES 16
+
+typedef enum {
+    DFFilterGrayscale,    // rgb = dot(rgb, kRec709Luma + bias), a = 1
+    DFFilterBias,         // rgb += bias
+    DFFilterThreshold,    // rgb = luma >= threshold ? 1 : 0
+    DFFilterColorMatrix,  // rgba = m * rgba + offset
+    DFFilterBoxBlur,      // Box blur of the given radius (neighbourhood)
+} df_filter_type;
+
+typedef struct {
+    df_filter_type type;
+    union {
+        float bias;
+        float threshold;
+        int radius;
+        struct {
+            df_color_matrix_t color_matrix;
+            df_color_matrix_kind color_matrix_kind;
+        };
+    };
+} df_filter_t;
+
+typedef struct {
+    df_filter_t nodes[DF_FILTER_GRAPH_MAX_NODES];
+    int num_nodes;
+} df_filter_graph_t;
+
+void df_filter_graph_init(df_filter_graph_t *graph);
+bool df_filter_graph_add(df_filter_graph_t *graph, df_filter_t filter);
+bool df_filter_graph_add_grayscale(df_filter_graph_t *graph, float bias);
+bool df_filter_graph_add_bias(df_filter_graph_t *graph, float bias);
+bool df_filter_graph_add_threshold(df_filter_graph_t *graph, float threshold);
+bool df_filter_graph_add_color_matrix(df_filter_graph_t *graph, const df_color_matrix_t *matrix);
+bool df_filter_graph_add_box_blur(df_filter_graph_t *graph, int radius);
+int df_filter_graph_num_passes(const df_filter_graph_t *graph);
+bool df_filter_graph_run(const df_filter_graph_t *graph, const df_cpu_texture_t *in, df_cpu_texture_t *out, df_dispatcher_t *dispatcher);
+
+#ifdef TEST
+void df_filter_graph_test(void);
+#endif
+
+#endif
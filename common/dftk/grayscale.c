@@ -0,0 +1,317 @@
+#include <math.h>
+#include "grayscale.h"
+#include "half.h"
+#include "simd.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DF_GRAYSCALE_AVX2 1
+#endif
+
+#if defined(__aarch64__)
+#define DF_GRAYSCALE_NEON 1
+#endif
+
+// kRec709Luma + half3(bias), as halves
+static void df_grayscale_weights(float bias, float w[3]) {
+    static const float luma[3] = { 0.2126f, 0.7152f, 0.0722f };
+    float b = df_round_half(bias);
+    for (int i = 0; i < 3; i++) {
+        w[i] = df_round_half(df_round_half(luma[i]) + b);
+    }
+}
+
+static inline uint8_t df_grayscale_pixel(const uint8_t *p, const float w[3]) {
+    float r = df_round_half(p[0] / 255.0f);
+    float g = df_round_half(p[1] / 255.0f);
+    float b = df_round_half(p[2] / 255.0f);
+
+    float sum = df_round_half(df_round_half(r * w[0]) + df_round_half(g * w[1]));
+    float gray = df_round_half(sum + df_round_half(b * w[2]));
+
+    // half -> RGBA8Unorm on write: clamp, scale, round to nearest even
+    return (uint8_t) nearbyintf(fminf(fmaxf(gray, 0.0f), 1.0f) * 255.0f);
+}
+
+// One invocation, with the same arguments as the Metal kernel
+void df_grayscale_kernel_ref(const df_cpu_texture_t *in, df_cpu_texture_t *out, uint32_t gid_x, uint32_t gid_y, float bias) {
+    float w[3];
+    df_grayscale_weights(bias, w);
+
+    const uint8_t *p = in->data + gid_y * in->bytes_per_row + gid_x * 4;
+    uint8_t *o = out->data + gid_y * out->bytes_per_row + gid_x * 4;
+    uint8_t gray = df_grayscale_pixel(p, w);
+    o[0] = o[1] = o[2] = gray;
+    o[3] = 255;
+}
+
+// Scalar reference over the whole grid
+void df_grayscale_ref(const df_cpu_texture_t *in, df_cpu_texture_t *out, float bias) {
+    for (uint32_t y = 0; y < in->height; y++) {
+        for (uint32_t x = 0; x < in->width; x++) {
+            df_grayscale_kernel_ref(in, out, x, y, bias);
+        }
+    }
+}
+
+#if defined(DF_GRAYSCALE_AVX2)
+
+#define DF_RH256(v) _mm256_cvtph_ps(_mm256_cvtps_ph((v), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC))
+
+// 8 pixels per iteration; returns how many pixels were processed
+__attribute__((target("avx2,f16c")))
+static uint32_t df_grayscale_row_avx2(const uint8_t *in, uint8_t *out, uint32_t width, const float w[3]) {
+    __m256 w0 = _mm256_set1_ps(w[0]);
+    __m256 w1 = _mm256_set1_ps(w[1]);
+    __m256 w2 = _mm256_set1_ps(w[2]);
+    __m256 k255 = _mm256_set1_ps(255.0f);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256i mask = _mm256_set1_epi32(0xff);
+    __m256i alpha = _mm256_set1_epi32((int) 0xff000000);
+
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *) (in + 4 * x));
+
+        __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(p, mask));
+        __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 8), mask));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 16), mask));
+
+        r = DF_RH256(_mm256_div_ps(r, k255));
+        g = DF_RH256(_mm256_div_ps(g, k255));
+        b = DF_RH256(_mm256_div_ps(b, k255));
+
+        __m256 sum = DF_RH256(_mm256_add_ps(DF_RH256(_mm256_mul_ps(r, w0)), DF_RH256(_mm256_mul_ps(g, w1))));
+        __m256 gray = DF_RH256(_mm256_add_ps(sum, DF_RH256(_mm256_mul_ps(b, w2))));
+
+        gray = _mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(gray, zero), one), k255);
+        __m256i v = _mm256_cvtps_epi32(gray);
+        v = _mm256_or_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 8)), _mm256_or_si256(_mm256_slli_epi32(v, 16), alpha));
+
+        _mm256_storeu_si256((__m256i *) (out + 4 * x), v);
+    }
+
+    return x;
+}
+
+// Checked once; the row functions run on every dispatcher worker
+static bool df_avx2_supported;
+static pthread_once_t df_avx2_once = PTHREAD_ONCE_INIT;
+
+static void df_avx2_detect(void) {
+    df_avx2_supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+}
+
+static bool df_has_avx2(void) {
+    pthread_once(&df_avx2_once, df_avx2_detect);
+    return df_avx2_supported;
+}
+
+#endif
+
+#if defined(DF_GRAYSCALE_NEON)
+
+static inline float32x4_t df_rh_neon(float32x4_t v) {
+    return vcvt_f32_f16(vcvt_f16_f32(v));
+}
+
+static inline uint32x4_t df_grayscale_neon(uint16x4_t r16, uint16x4_t g16, uint16x4_t b16, const float w[3]) {
+    float32x4_t k255 = vdupq_n_f32(255.0f);
+    float32x4_t r = df_rh_neon(vdivq_f32(vcvtq_f32_u32(vmovl_u16(r16)), k255));
+    float32x4_t g = df_rh_neon(vdivq_f32(vcvtq_f32_u32(vmovl_u16(g16)), k255));
+    float32x4_t b = df_rh_neon(vdivq_f32(vcvtq_f32_u32(vmovl_u16(b16)), k255));
+
+    float32x4_t sum = df_rh_neon(vaddq_f32(df_rh_neon(vmulq_n_f32(r, w[0])), df_rh_neon(vmulq_n_f32(g, w[1]))));
+    float32x4_t gray = df_rh_neon(vaddq_f32(sum, df_rh_neon(vmulq_n_f32(b, w[2]))));
+
+    gray = vmulq_f32(vminq_f32(vmaxq_f32(gray, vdupq_n_f32(0)), vdupq_n_f32(1)), k255);
+    return vcvtnq_u32_f32(gray);
+}
+
+// 8 pixels per iteration; returns how many pixels were processed
+static uint32_t df_grayscale_row_neon(const uint8_t *in, uint8_t *out, uint32_t width, const float w[3]) {
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x4_t p = vld4_u8(in + 4 * x);
+        uint16x8_t r = vmovl_u8(p.val[0]);
+        uint16x8_t g = vmovl_u8(p.val[1]);
+        uint16x8_t b = vmovl_u8(p.val[2]);
+
+        uint32x4_t lo = df_grayscale_neon(vget_low_u16(r), vget_low_u16(g), vget_low_u16(b), w);
+        uint32x4_t hi = df_grayscale_neon(vget_high_u16(r), vget_high_u16(g), vget_high_u16(b), w);
+        uint8x8_t gray = vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+
+        uint8x8x4_t o = {{ gray, gray, gray, vdup_n_u8(255) }};
+        vst4_u8(out + 4 * x, o);
+    }
+    return x;
+}
+
+#endif
+
+typedef struct {
+    const df_cpu_texture_t *in;
+    df_cpu_texture_t *out;
+    float w[3];
+} df_grayscale_args_t;
+
+// One threadgroup: a run of SIMD rows over the group's columns
+static void df_grayscale_group(const df_threadgroup_t *group, void *args) {
+    df_grayscale_args_t *a = (df_grayscale_args_t *) args;
+    uint32_t x0 = group->origin.width;
+    uint32_t width = group->size.width;
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        const uint8_t *in = a->in->data + y * a->in->bytes_per_row + x0 * 4;
+        uint8_t *out = a->out->data + y * a->out->bytes_per_row + x0 * 4;
+        uint32_t x = 0;
+
+#if defined(DF_GRAYSCALE_AVX2)
+        if (df_has_avx2()) {
+            x = df_grayscale_row_avx2(in, out, width, a->w);
+        }
+#elif defined(DF_GRAYSCALE_NEON)
+        x = df_grayscale_row_neon(in, out, width, a->w);
+#endif
+
+        for (; x < width; x++) {
+            uint8_t gray = df_grayscale_pixel(in + 4 * x, a->w);
+            out[4*x+0] = out[4*x+1] = out[4*x+2] = gray;
+            out[4*x+3] = 255;
+        }
+    }
+}
+
+// SIMD version dispatched over 64x16 threadgroups (NULL `dispatcher` for
+// the shared one). Produces exactly the same bytes as df_grayscale_ref.
+void df_grayscale(const df_cpu_texture_t *in, df_cpu_texture_t *out, float bias, df_dispatcher_t *dispatcher) {
+    df_grayscale_args_t args = { in, out };
+    df_grayscale_weights(bias, args.w);
+    df_dispatch_threads(dispatcher, df_size3(in->width, in->height, 1), df_size3(64, 16, 1), df_grayscale_group, &args);
+}
+
+static inline void df_grayscale_f16_pixel(float *p, const float w[3]) {
+    float sum = df_round_half(df_round_half(p[0] * w[0]) + df_round_half(p[1] * w[1]));
+    float gray = df_round_half(sum + df_round_half(p[2] * w[2]));
+    p[0] = p[1] = p[2] = gray;
+    p[3] = 1;
+}
+
+#if defined(DF_GRAYSCALE_AVX2)
+
+#define DF_RH128(v) _mm_cvtph_ps(_mm_cvtps_ph((v), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC))
+
+// One pixel per __m128: the three products in one multiply, then the sums
+// on broadcast lanes
+__attribute__((target("avx2,f16c")))
+static void df_grayscale_f16_row_avx2(float *px, uint32_t width, const float w[3]) {
+    __m128 wv = _mm_setr_ps(w[0], w[1], w[2], 0);
+    __m128 one = _mm_set1_ps(1.0f);
+
+    for (uint32_t x = 0; x < width; x++, px += 4) {
+        __m128 p = DF_RH128(_mm_mul_ps(_mm_loadu_ps(px), wv));
+        __m128 sum = DF_RH128(_mm_add_ps(_mm_shuffle_ps(p, p, 0x00), _mm_shuffle_ps(p, p, 0x55)));
+        __m128 gray = DF_RH128(_mm_add_ps(sum, _mm_shuffle_ps(p, p, 0xaa)));
+        _mm_storeu_ps(px, _mm_blend_ps(gray, one, 0x8));
+    }
+}
+
+#endif
+
+#if defined(DF_GRAYSCALE_NEON)
+
+static void df_grayscale_f16_row_neon(float *px, uint32_t width, const float w[3]) {
+    float wv[4] = { w[0], w[1], w[2], 0 };
+    float32x4_t weights = vld1q_f32(wv);
+
+    for (uint32_t x = 0; x < width; x++, px += 4) {
+        float32x4_t p = df_rh_neon(vmulq_f32(vld1q_f32(px), weights));
+        float32x4_t sum = df_rh_neon(vaddq_f32(vdupq_laneq_f32(p, 0), vdupq_laneq_f32(p, 1)));
+        float32x4_t gray = df_rh_neon(vaddq_f32(sum, vdupq_laneq_f32(p, 2)));
+        vst1q_f32(px, vsetq_lane_f32(1.0f, gray, 3));
+    }
+}
+
+#endif
+
+static void df_grayscale_f16_pixels(void *ctx, float *px, uint32_t count) {
+    const float *w = (const float *) ctx;
+
+#if defined(DF_GRAYSCALE_AVX2)
+    if (df_has_avx2()) {
+        df_grayscale_f16_row_avx2(px, count, w);
+        return;
+    }
+#elif defined(DF_GRAYSCALE_NEON)
+    df_grayscale_f16_row_neon(px, count, w);
+    return;
+#endif
+
+    for (uint32_t x = 0; x < count; x++) {
+        df_grayscale_f16_pixel(px + 4 * x, w);
+    }
+}
+
+// The input is already half, so only the arithmetic needs rounding
+void df_grayscale_f16(const df_image_f16_t *in, df_image_f16_t *out, float bias, df_dispatcher_t *dispatcher) {
+    float w[3];
+    df_grayscale_weights(bias, w);
+    df_image_f16_map(in, out, df_grayscale_f16_pixels, w, dispatcher);
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void df_grayscale_test(void) {
+    df_cpu_texture_t in, ref, out;
+    uint32_t w = 453, h = 61;
+    df_cpu_texture_init(&in, w, h);
+    df_cpu_texture_init(&ref, w, h);
+    df_cpu_texture_init(&out, w, h);
+
+    for (size_t i = 0; i < in.bytes_per_row * h; i++) {
+        in.data[i] = (uint8_t) rand();
+    }
+
+    for (float bias = -0.5f; bias <= 0.5f; bias += 0.125f) {
+        df_grayscale_ref(&in, &ref, bias);
+        df_grayscale(&in, &out, bias, NULL);
+        assert(memcmp(ref.data, out.data, ref.bytes_per_row * h) == 0);
+    }
+
+    // Through half images the result is the same after quantizing, and the
+    // halves themselves match the scalar evaluation
+    df_image_f16_t in_f16, out_f16;
+    df_image_f16_init(&in_f16, w, h);
+    df_image_f16_init(&out_f16, w, h);
+    df_image_f16_from_texture(&in_f16, &in);
+    for (float bias = -0.5f; bias <= 0.5f; bias += 0.125f) {
+        df_grayscale_ref(&in, &ref, bias);
+        df_grayscale_f16(&in_f16, &out_f16, bias, NULL);
+        df_image_f16_to_texture(&out_f16, &out);
+        assert(memcmp(ref.data, out.data, ref.bytes_per_row * h) == 0);
+
+        float weights[3];
+        df_grayscale_weights(bias, weights);
+        for (size_t i = 0; i < (size_t) w * h; i += 17) {
+            float p[4];
+            for (int c = 0; c < 4; c++) p[c] = df_half_to_float(in_f16.data[4 * i + c]);
+            df_grayscale_f16_pixel(p, weights);
+            for (int c = 0; c < 4; c++) assert(df_float_to_half(p[c]) == out_f16.data[4 * i + c]);
+        }
+    }
+    df_image_f16_free(&in_f16);
+    df_image_f16_free(&out_f16);
+
+    df_cpu_texture_free(&in);
+    df_cpu_texture_free(&ref);
+    df_cpu_texture_free(&out);
+
+    printf("grayscale: passed!\n");
+}
+#endif
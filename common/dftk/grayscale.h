@@ -0,0 +1,31 @@
+#if !defined(DFTK_GRAYSCALE_H)
+#define DFTK_GRAYSCALE_H
+
+#include "cpu_texture.h"
+#include "dispatch.h"
+#include "image_f16.h"
+
+// CPU port of `grayscale_kernel` (07-compute-image-processing/shaders.metal):
+//
+//   half gray = dot(in.rgb, kRec709Luma + half3(bias));
+//   out = half4(gray, gray, gray, 1);
+//
+// Every intermediate is rounded to half like the GPU does. The dot product
+// is evaluated as ((r*w.r + g*w.g) + b*w.b) with each operation rounded
+// separately, so a GPU that fuses it into FMAs may differ by one unit in
+// the last place of the half result on a few pixels.
+
+void df_grayscale_kernel_ref(const df_cpu_texture_t *in, df_cpu_texture_t *out, uint32_t gid_x, uint32_t gid_y, float bias);
+void df_grayscale_ref(const df_cpu_texture_t *in, df_cpu_texture_t *out, float bias);
+void df_grayscale(const df_cpu_texture_t *in, df_cpu_texture_t *out, float bias, df_dispatcher_t *dispatcher);
+
+// Half in, half out, as grayscale_kernel on RGBA16Float textures. The
+// output halves are the ones the GPU writes, not just the same after
+// quantizing to 8 bits.
+void df_grayscale_f16(const df_image_f16_t *in, df_image_f16_t *out, float bias, df_dispatcher_t *dispatcher);
+
+#ifdef TEST
+void df_grayscale_test(void);
+#endif
+
+#endif
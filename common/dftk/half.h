@@ -0,0 +1,68 @@
+#if !defined(DFTK_HALF_H)
+#define DFTK_HALF_H
+
+#include <stdint.h>
+#include <string.h>
+
+// IEEE 754 binary16 conversions with round-to-nearest-even, bit exact with
+// F16C/NEON conversions and with the GPU's float -> half conversion. Used
+// to reproduce Metal `half` arithmetic on the CPU.
+
+typedef uint16_t df_half;
+
+static inline df_half df_float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+
+    if (abs >= 0x7f800000) {
+        return (df_half) (sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0)); // Inf / NaN
+    }
+    if (abs >= 0x477ff000) {
+        return (df_half) (sign | 0x7c00); // >= 65520 rounds to Inf
+    }
+    if (abs < 0x38800000) {
+        // Subnormal or zero: adding 0.5 lines the float ulp up with the
+        // half subnormal ulp (2^-24), so the FPU does the rounding
+        float a;
+        memcpy(&a, &abs, sizeof(a));
+        a += 0.5f;
+        uint32_t r;
+        memcpy(&r, &a, sizeof(r));
+        return (df_half) (sign | (r - 0x3f000000));
+    }
+
+    // Normal: rebias the exponent and round the 13 dropped mantissa bits
+    uint32_t odd = (abs >> 13) & 1;
+    abs += 0xc8000fff + odd;
+    return (df_half) (sign | (abs >> 13));
+}
+
+static inline float df_half_to_float(df_half h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+
+    if (exp == 0) {
+        float f = mant * (1.0f / 16777216.0f); // mant * 2^-24, exact
+        return sign ? -f : f;
+    } else if (exp == 31) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// The nearest half value, as a float
+static inline float df_round_half(float f) {
+    return df_half_to_float(df_float_to_half(f));
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include <string.h>
+#include "hash.h"
+
+#define DF_HASH_P1 11400714785074694791ULL
+#define DF_HASH_P2 14029467366897019727ULL
+#define DF_HASH_P3 1609587929392839161ULL
+#define DF_HASH_P4 9650029242287828579ULL
+#define DF_HASH_P5 2870177450012600261ULL
+
+static uint64_t df_hash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t df_hash_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t df_hash_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t df_hash_round(uint64_t acc, uint64_t input) {
+    acc += input * DF_HASH_P2;
+    acc = df_hash_rotl(acc, 31);
+    return acc * DF_HASH_P1;
+}
+
+static uint64_t df_hash_merge(uint64_t acc, uint64_t v) {
+    acc ^= df_hash_round(0, v);
+    return acc * DF_HASH_P1 + DF_HASH_P4;
+}
+
+uint64_t df_hash64(const void *data, size_t size, uint64_t seed) {
+    const uint8_t *p = (const uint8_t *) data;
+    const uint8_t *end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + DF_HASH_P1 + DF_HASH_P2;
+        uint64_t v2 = seed + DF_HASH_P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - DF_HASH_P1;
+
+        do {
+            v1 = df_hash_round(v1, df_hash_read64(p));
+            v2 = df_hash_round(v2, df_hash_read64(p + 8));
+            v3 = df_hash_round(v3, df_hash_read64(p + 16));
+            v4 = df_hash_round(v4, df_hash_read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+
+        h = df_hash_rotl(v1, 1) + df_hash_rotl(v2, 7) + df_hash_rotl(v3, 12) + df_hash_rotl(v4, 18);
+        h = df_hash_merge(h, v1);
+        h = df_hash_merge(h, v2);
+        h = df_hash_merge(h, v3);
+        h = df_hash_merge(h, v4);
+    } else {
+        h = seed + DF_HASH_P5;
+    }
+
+    h += (uint64_t) size;
+
+    while (end - p >= 8) {
+        h ^= df_hash_round(0, df_hash_read64(p));
+        h = df_hash_rotl(h, 27) * DF_HASH_P1 + DF_HASH_P4;
+        p += 8;
+    }
+
+    if (end - p >= 4) {
+        h ^= (uint64_t) df_hash_read32(p) * DF_HASH_P1;
+        h = df_hash_rotl(h, 23) * DF_HASH_P2 + DF_HASH_P3;
+        p += 4;
+    }
+
+    while (p < end) {
+        h ^= (*p++) * DF_HASH_P5;
+        h = df_hash_rotl(h, 11) * DF_HASH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= DF_HASH_P2;
+    h ^= h >> 29;
+    h *= DF_HASH_P3;
+    h ^= h >> 32;
+
+    return h;
+}
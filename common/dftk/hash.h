@@ -0,0 +1,10 @@
+#if !defined(DFTK_HASH_H)
+#define DFTK_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH64, used to key caches by content
+uint64_t df_hash64(const void *data, size_t size, uint64_t seed);
+
+#endif
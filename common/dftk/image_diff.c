@@ -0,0 +1,105 @@
+#include <math.h>
+#include <string.h>
+#include "image_diff.h"
+#include "mipmap.h"
+
+static float df_lab_f(float t) {
+    return t > 216.0f / 24389 ? cbrtf(t) : (24389.0f / 27 * t + 16) / 116;
+}
+
+static void df_srgb8_to_lab(const uint8_t *p, const float *to_linear, float lab[3]) {
+    float r = to_linear[p[0]], g = to_linear[p[1]], b = to_linear[p[2]];
+
+    // Linear sRGB to XYZ, divided by the D65 white point
+    float x = (0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f;
+    float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+    float z = (0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f;
+
+    float fx = df_lab_f(x), fy = df_lab_f(y), fz = df_lab_f(z);
+    lab[0] = 116 * fy - 16;
+    lab[1] = 500 * (fx - fy);
+    lab[2] = 200 * (fy - fz);
+}
+
+bool df_image_diff(const df_cpu_texture_t *a, const df_cpu_texture_t *b, float threshold, df_image_diff_t *diff) {
+    memset(diff, 0, sizeof(*diff));
+    if (a->width != b->width || a->height != b->height) {
+        return false;
+    }
+
+    const float *to_linear = df_srgb_to_linear_lut();
+    double sum = 0;
+    for (uint32_t y = 0; y < a->height; y++) {
+        const uint8_t *pa = a->data + y * a->bytes_per_row;
+        const uint8_t *pb = b->data + y * b->bytes_per_row;
+        for (uint32_t x = 0; x < a->width; x++, pa += 4, pb += 4) {
+            // Most pixels of a render match its golden exactly
+            if (pa[0] == pb[0] && pa[1] == pb[1] && pa[2] == pb[2]) {
+                continue;
+            }
+            float la[3], lb[3];
+            df_srgb8_to_lab(pa, to_linear, la);
+            df_srgb8_to_lab(pb, to_linear, lb);
+            float d = sqrtf((la[0] - lb[0]) * (la[0] - lb[0]) + (la[1] - lb[1]) * (la[1] - lb[1]) + (la[2] - lb[2]) * (la[2] - lb[2]));
+            sum += d;
+            diff->over += d > threshold;
+            if (d > diff->max_delta_e) {
+                diff->max_delta_e = d;
+                diff->max_x = x;
+                diff->max_y = y;
+            }
+        }
+    }
+    diff->count = (uint64_t) a->width * a->height;
+    diff->mean_delta_e = diff->count ? (float) (sum / diff->count) : 0;
+    return true;
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+void df_image_diff_test(void) {
+    df_cpu_texture_t a, b, c;
+    df_cpu_texture_init(&a, 16, 8);
+    df_cpu_texture_init(&b, 16, 8);
+    df_cpu_texture_init(&c, 8, 16);
+    for (uint32_t i = 0; i < 16 * 8 * 4; i++) {
+        a.data[i] = b.data[i] = (uint8_t) (i * 7);
+    }
+    df_image_diff_t diff;
+
+    // Identical images, and images of different sizes
+    assert(df_image_diff(&a, &b, DF_IMAGE_DIFF_JND, &diff));
+    assert(diff.max_delta_e == 0 && diff.mean_delta_e == 0 && diff.over == 0 && diff.count == 128);
+    assert(!df_image_diff(&a, &c, DF_IMAGE_DIFF_JND, &diff));
+
+    // White against black is L* 100 apart; alpha doesn't count
+    uint8_t *p = b.data + 3 * b.bytes_per_row + 5 * 4;
+    memcpy(p, (uint8_t[4]) { 255, 255, 255, 255 }, 4);
+    memcpy(a.data + 3 * a.bytes_per_row + 5 * 4, (uint8_t[4]) { 0, 0, 0, 0 }, 4);
+    b.data[7] ^= 0xff;
+    assert(df_image_diff(&a, &b, DF_IMAGE_DIFF_JND, &diff));
+    assert(fabsf(diff.max_delta_e - 100) < 0.05f && diff.over == 1 && diff.max_x == 5 && diff.max_y == 3);
+    assert(fabsf(diff.mean_delta_e - diff.max_delta_e / 128) < 1e-4f);
+
+    // One step of 8-bit grey is below a just noticeable difference,
+    // pure red against pure green far above
+    memcpy(p, (uint8_t[4]) { 1, 1, 1, 255 }, 4);
+    for (int v = 0; v < 255; v++) {
+        memcpy(a.data + 3 * a.bytes_per_row + 5 * 4, (uint8_t[4]) { (uint8_t) v, (uint8_t) v, (uint8_t) v, 255 }, 4);
+        memcpy(p, (uint8_t[4]) { (uint8_t) (v + 1), (uint8_t) (v + 1), (uint8_t) (v + 1), 255 }, 4);
+        assert(df_image_diff(&a, &b, DF_IMAGE_DIFF_JND, &diff) && diff.over == 0 && diff.max_delta_e > 0);
+    }
+    memcpy(a.data, (uint8_t[4]) { 255, 0, 0, 255 }, 4);
+    memcpy(b.data, (uint8_t[4]) { 0, 255, 0, 255 }, 4);
+    assert(df_image_diff(&a, &b, DF_IMAGE_DIFF_JND, &diff) && diff.over == 1 && diff.max_delta_e > 100);
+
+    df_cpu_texture_free(&a);
+    df_cpu_texture_free(&b);
+    df_cpu_texture_free(&c);
+    printf("image_diff: passed!\n");
+}
+
+#endif
@@ -0,0 +1,32 @@
+#if !defined(DFTK_IMAGE_DIFF_H)
+#define DFTK_IMAGE_DIFF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cpu_texture.h"
+
+// Perceptual difference of two sRGB-encoded RGBA8 images, for comparing
+// renders against golden images. Pixels are compared in CIELAB (D65) by
+// their CIE76 delta E, the Euclidean distance in L*a*b*: about 2.3 is a
+// just noticeable difference, so a rounding step or a dithered edge scores
+// well below it while a wrong colour scores far above. Alpha is ignored.
+
+#define DF_IMAGE_DIFF_JND 2.3f
+
+typedef struct {
+    float max_delta_e;
+    float mean_delta_e;
+    uint64_t over;            // Pixels with a delta E above the threshold
+    uint64_t count;           // Pixels compared
+    uint32_t max_x;           // Where max_delta_e is
+    uint32_t max_y;
+} df_image_diff_t;
+
+// False if the sizes differ
+bool df_image_diff(const df_cpu_texture_t *a, const df_cpu_texture_t *b, float threshold, df_image_diff_t *diff);
+
+#ifdef TEST
+void df_image_diff_test(void);
+#endif
+
+#endif
@@ -0,0 +1,225 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image_f16.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DF_IMAGE_F16_F16C 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define DF_IMAGE_F16_NEON 1
+#endif
+
+#define DF_IMAGE_F16_TILE_WIDTH 64
+#define DF_IMAGE_F16_TILE_HEIGHT 16
+
+bool df_image_f16_init(df_image_f16_t *image, uint32_t width, uint32_t height) {
+    image->width = width;
+    image->height = height;
+    image->data = (df_half *) calloc((size_t) width * height * 4, sizeof(df_half));
+    return image->data != NULL;
+}
+
+void df_image_f16_free(df_image_f16_t *image) {
+    free(image->data);
+    memset(image, 0, sizeof(*image));
+}
+
+#if defined(DF_IMAGE_F16_F16C)
+
+static bool df_f16c_supported;
+static pthread_once_t df_f16c_once = PTHREAD_ONCE_INIT;
+
+static void df_f16c_detect(void) {
+    df_f16c_supported = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+}
+
+static bool df_has_f16c(void) {
+    pthread_once(&df_f16c_once, df_f16c_detect);
+    return df_f16c_supported;
+}
+
+// 8 values per iteration; return how many were converted
+__attribute__((target("avx,f16c")))
+static size_t df_half_to_float_f16c(const df_half *src, float *dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (src + i))));
+    }
+    return i;
+}
+
+__attribute__((target("avx,f16c")))
+static size_t df_float_to_half_f16c(const float *src, df_half *dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128((__m128i *) (dst + i), h);
+    }
+    return i;
+}
+
+#endif
+
+void df_half_to_float_row(const df_half *src, float *dst, size_t count) {
+    size_t i = 0;
+#if defined(DF_IMAGE_F16_F16C)
+    if (df_has_f16c()) {
+        i = df_half_to_float_f16c(src, dst, count);
+    }
+#elif defined(DF_IMAGE_F16_NEON)
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = df_half_to_float(src[i]);
+    }
+}
+
+void df_float_to_half_row(const float *src, df_half *dst, size_t count) {
+    size_t i = 0;
+#if defined(DF_IMAGE_F16_F16C)
+    if (df_has_f16c()) {
+        i = df_float_to_half_f16c(src, dst, count);
+    }
+#elif defined(DF_IMAGE_F16_NEON)
+    for (; i + 4 <= count; i += 4) {
+        vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = df_float_to_half(src[i]);
+    }
+}
+
+// RGBA8Unorm -> half the way a texture2d<half> read converts it. Both must
+// have the same size.
+void df_image_f16_from_texture(df_image_f16_t *image, const df_cpu_texture_t *texture) {
+    float row[DF_IMAGE_F16_TILE_WIDTH * 4];
+
+    for (uint32_t y = 0; y < texture->height; y++) {
+        const uint8_t *in = texture->data + y * texture->bytes_per_row;
+        df_half *out = image->data + (size_t) y * image->width * 4;
+
+        for (uint32_t x = 0; x < texture->width * 4; x += DF_IMAGE_F16_TILE_WIDTH * 4) {
+            uint32_t n = texture->width * 4 - x < DF_IMAGE_F16_TILE_WIDTH * 4 ? texture->width * 4 - x : DF_IMAGE_F16_TILE_WIDTH * 4;
+            for (uint32_t i = 0; i < n; i++) {
+                row[i] = in[x + i] / 255.0f;
+            }
+            df_float_to_half_row(row, out + x, n);
+        }
+    }
+}
+
+// half -> RGBA8Unorm as on a texture write: clamp, scale, round to nearest even
+void df_image_f16_to_texture(const df_image_f16_t *image, df_cpu_texture_t *texture) {
+    float row[DF_IMAGE_F16_TILE_WIDTH * 4];
+
+    for (uint32_t y = 0; y < texture->height; y++) {
+        const df_half *in = image->data + (size_t) y * image->width * 4;
+        uint8_t *out = texture->data + y * texture->bytes_per_row;
+
+        for (uint32_t x = 0; x < texture->width * 4; x += DF_IMAGE_F16_TILE_WIDTH * 4) {
+            uint32_t n = texture->width * 4 - x < DF_IMAGE_F16_TILE_WIDTH * 4 ? texture->width * 4 - x : DF_IMAGE_F16_TILE_WIDTH * 4;
+            df_half_to_float_row(in + x, row, n);
+            for (uint32_t i = 0; i < n; i++) {
+                out[x + i] = (uint8_t) nearbyintf(fminf(fmaxf(row[i], 0.0f), 1.0f) * 255.0f);
+            }
+        }
+    }
+}
+
+typedef struct {
+    const df_image_f16_t *in;
+    df_image_f16_t *out;
+    df_pixel_fn fn;
+    void *ctx;
+} df_image_f16_map_args_t;
+
+static void df_image_f16_map_group(const df_threadgroup_t *group, void *data) {
+    df_image_f16_map_args_t *a = (df_image_f16_map_args_t *) data;
+    float px[DF_IMAGE_F16_TILE_WIDTH * 4];
+    uint32_t x0 = group->origin.width, n = group->size.width;
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        df_half_to_float_row(a->in->data + ((size_t) y * a->in->width + x0) * 4, px, (size_t) n * 4);
+        a->fn(a->ctx, px, n);
+        df_float_to_half_row(px, a->out->data + ((size_t) y * a->out->width + x0) * 4, (size_t) n * 4);
+    }
+}
+
+// Runs a per-pixel operation over 64x16 tiles, fp16 in memory and fp32 in
+// registers. `out` may be `in`.
+void df_image_f16_map(const df_image_f16_t *in, df_image_f16_t *out, df_pixel_fn fn, void *ctx, df_dispatcher_t *dispatcher) {
+    df_image_f16_map_args_t args = { in, out, fn, ctx };
+    df_dispatch_threads(dispatcher, df_size3(in->width, in->height, 1), df_size3(DF_IMAGE_F16_TILE_WIDTH, DF_IMAGE_F16_TILE_HEIGHT, 1), df_image_f16_map_group, &args);
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+static void df_image_f16_test_scale(void *ctx, float *px, uint32_t n) {
+    for (uint32_t i = 0; i < 4 * n; i++) {
+        px[i] *= *(float *) ctx;
+    }
+}
+
+void df_image_f16_test(void) {
+    // Row conversions agree with the scalar ones on every half (the SIMD
+    // body and the scalar tail both get exercised)
+    static df_half halves[65536 + 3];
+    static float floats[65536 + 3];
+    static df_half back[65536 + 3];
+    for (uint32_t i = 0; i < 65536 + 3; i++) {
+        halves[i] = (df_half) i;
+    }
+    df_half_to_float_row(halves, floats, 65536 + 3);
+    df_float_to_half_row(floats, back, 65536 + 3);
+    for (uint32_t i = 0; i < 65536 + 3; i++) {
+        // F16C quiets signalling NaNs, so only check NaNs are kept NaN
+        float f = df_half_to_float(halves[i]);
+        bool nan = (halves[i] & 0x7c00) == 0x7c00 && (halves[i] & 0x3ff);
+        assert(nan ? floats[i] != floats[i] : memcmp(&f, &floats[i], sizeof(f)) == 0);
+        assert(nan || back[i] == halves[i]);
+    }
+    for (uint32_t i = 0; i < 1000; i++) {
+        floats[i] = (float) i * 0.001234f - 0.3f;
+    }
+    df_float_to_half_row(floats, back, 1000);
+    for (uint32_t i = 0; i < 1000; i++) {
+        assert(back[i] == df_float_to_half(floats[i]));
+    }
+
+    // RGBA8 -> half -> RGBA8 is lossless
+    df_cpu_texture_t texture, result;
+    df_image_f16_t image;
+    df_cpu_texture_init(&texture, 131, 19);
+    df_cpu_texture_init(&result, 131, 19);
+    df_image_f16_init(&image, 131, 19);
+    for (size_t i = 0; i < texture.bytes_per_row * texture.height; i++) {
+        texture.data[i] = (uint8_t) (i * 31);
+    }
+    df_image_f16_from_texture(&image, &texture);
+    df_image_f16_to_texture(&image, &result);
+    assert(memcmp(texture.data, result.data, texture.bytes_per_row * texture.height) == 0);
+
+    float half_scale = 0.5f;
+    df_image_f16_map(&image, &image, df_image_f16_test_scale, &half_scale, NULL);
+    for (size_t i = 0; i < (size_t) 131 * 19 * 4; i++) {
+        assert(image.data[i] == df_float_to_half(df_round_half(texture.data[i] / 255.0f) * 0.5f));
+    }
+
+    df_cpu_texture_free(&texture);
+    df_cpu_texture_free(&result);
+    df_image_f16_free(&image);
+
+    printf("image_f16: passed!\n");
+}
+#endif
@@ -0,0 +1,36 @@
+#if !defined(DFTK_IMAGE_F16_H)
+#define DFTK_IMAGE_F16_H
+
+#include <stddef.h>
+#include "cpu_texture.h"
+#include "dispatch.h"
+#include "half.h"
+
+// Tightly packed half-precision RGBA, the CPU counterpart of a
+// RGBA16Float texture / texture2d<half>. Storage is fp16 to halve the
+// memory traffic of df_image_f32_t; kernels convert whole rows to fp32
+// (F16C on x86, NEON on ARM), compute there and convert back with
+// round-to-nearest-even, which is what the GPU does on a half write.
+
+typedef struct {
+    df_half *data;
+    uint32_t width;
+    uint32_t height;
+} df_image_f16_t;
+
+// Per-pixel operation on `count` float RGBA pixels, in place
+typedef void (*df_pixel_fn)(void *ctx, float *pixels, uint32_t count);
+
+bool df_image_f16_init(df_image_f16_t *image, uint32_t width, uint32_t height);
+void df_image_f16_free(df_image_f16_t *image);
+void df_half_to_float_row(const df_half *src, float *dst, size_t count);
+void df_float_to_half_row(const float *src, df_half *dst, size_t count);
+void df_image_f16_from_texture(df_image_f16_t *image, const df_cpu_texture_t *texture);
+void df_image_f16_to_texture(const df_image_f16_t *image, df_cpu_texture_t *texture);
+void df_image_f16_map(const df_image_f16_t *in, df_image_f16_t *out, df_pixel_fn fn, void *ctx, df_dispatcher_t *dispatcher);
+
+#ifdef TEST
+void df_image_f16_test(void);
+#endif
+
+#endif
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include "image_stats.h"
+
+#define DF_IMAGE_STATS_TILE_WIDTH 256
+#define DF_IMAGE_STATS_TILE_HEIGHT 16
+
+// One worker's share of the reduction, aligned so neighbouring workers never
+// write the same cache line
+typedef struct {
+    _Alignas(64) uint32_t histogram[4][256];
+    uint64_t sum[4];
+    uint8_t min[4];
+    uint8_t max[4];
+} df_image_stats_partial_t;
+
+typedef struct {
+    const df_cpu_texture_t *texture;
+    df_image_stats_partial_t *partials;
+} df_image_stats_args_t;
+
+static void df_image_stats_group(const df_threadgroup_t *group, void *data) {
+    df_image_stats_args_t *a = (df_image_stats_args_t *) data;
+    df_image_stats_partial_t *p = &a->partials[group->worker];
+
+    // Sums of a row fit in 32 bits, min/max stay in registers for the tile
+    uint8_t lo[4] = { p->min[0], p->min[1], p->min[2], p->min[3] };
+    uint8_t hi[4] = { p->max[0], p->max[1], p->max[2], p->max[3] };
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        const uint8_t *px = a->texture->data + y * a->texture->bytes_per_row + group->origin.width * 4;
+        uint32_t sum[4] = { 0, 0, 0, 0 };
+
+        for (uint32_t x = 0; x < group->size.width; x++, px += 4) {
+            for (int c = 0; c < 4; c++) {
+                p->histogram[c][px[c]]++;
+                sum[c] += px[c];
+                lo[c] = px[c] < lo[c] ? px[c] : lo[c];
+                hi[c] = px[c] > hi[c] ? px[c] : hi[c];
+            }
+        }
+
+        for (int c = 0; c < 4; c++) {
+            p->sum[c] += sum[c];
+        }
+    }
+
+    memcpy(p->min, lo, 4);
+    memcpy(p->max, hi, 4);
+}
+
+static void df_image_stats_finish(df_image_stats_t *stats, const uint64_t sum[4], uint64_t count) {
+    stats->count = count;
+    for (int c = 0; c < 4; c++) {
+        stats->mean[c] = count ? (float) ((double) sum[c] / (double) count) : 0;
+    }
+}
+
+// False, with `stats` untouched, when out of memory
+bool df_image_stats(const df_cpu_texture_t *texture, df_image_stats_t *stats, df_dispatcher_t *dispatcher) {
+    if (!dispatcher) {
+        dispatcher = df_dispatcher_shared();
+    }
+
+    int n = dispatcher->num_workers;
+    df_image_stats_partial_t *partials = (df_image_stats_partial_t *) aligned_alloc(64, (size_t) n * sizeof(df_image_stats_partial_t));
+    if (!partials) {
+        return false;
+    }
+    memset(partials, 0, (size_t) n * sizeof(df_image_stats_partial_t));
+    for (int i = 0; i < n; i++) {
+        memset(partials[i].min, 0xff, 4);
+    }
+
+    df_image_stats_args_t args = { texture, partials };
+    df_dispatch_threads(dispatcher, df_size3(texture->width, texture->height, 1), df_size3(DF_IMAGE_STATS_TILE_WIDTH, DF_IMAGE_STATS_TILE_HEIGHT, 1), df_image_stats_group, &args);
+
+    // Merge the partials
+    uint64_t sum[4] = { 0, 0, 0, 0 };
+    memset(stats, 0, sizeof(*stats));
+    memset(stats->min, 0xff, 4);
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < 4; c++) {
+            for (int b = 0; b < 256; b++) {
+                stats->histogram[c][b] += partials[i].histogram[c][b];
+            }
+            sum[c] += partials[i].sum[c];
+            stats->min[c] = partials[i].min[c] < stats->min[c] ? partials[i].min[c] : stats->min[c];
+            stats->max[c] = partials[i].max[c] > stats->max[c] ? partials[i].max[c] : stats->max[c];
+        }
+    }
+    df_image_stats_finish(stats, sum, (uint64_t) texture->width * texture->height);
+
+    free(partials);
+    return true;
+}
+
+typedef struct {
+    const df_cpu_texture_t *texture;
+    _Atomic uint32_t histogram[4][256];
+    _Atomic uint64_t sum[4];
+    _Atomic uint32_t min[4];
+    _Atomic uint32_t max[4];
+} df_image_stats_atomic_args_t;
+
+static void df_image_stats_atomic_group(const df_threadgroup_t *group, void *data) {
+    df_image_stats_atomic_args_t *a = (df_image_stats_atomic_args_t *) data;
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        const uint8_t *px = a->texture->data + y * a->texture->bytes_per_row + group->origin.width * 4;
+        for (uint32_t x = 0; x < group->size.width; x++, px += 4) {
+            for (int c = 0; c < 4; c++) {
+                uint32_t v = px[c];
+                atomic_fetch_add_explicit(&a->histogram[c][v], 1, memory_order_relaxed);
+                atomic_fetch_add_explicit(&a->sum[c], v, memory_order_relaxed);
+
+                uint32_t m = atomic_load_explicit(&a->min[c], memory_order_relaxed);
+                while (v < m && !atomic_compare_exchange_weak_explicit(&a->min[c], &m, v, memory_order_relaxed, memory_order_relaxed));
+                m = atomic_load_explicit(&a->max[c], memory_order_relaxed);
+                while (v > m && !atomic_compare_exchange_weak_explicit(&a->max[c], &m, v, memory_order_relaxed, memory_order_relaxed));
+            }
+        }
+    }
+}
+
+bool df_image_stats_atomic(const df_cpu_texture_t *texture, df_image_stats_t *stats, df_dispatcher_t *dispatcher) {
+    df_image_stats_atomic_args_t *args = (df_image_stats_atomic_args_t *) calloc(1, sizeof(df_image_stats_atomic_args_t));
+    if (!args) {
+        return false;
+    }
+    args->texture = texture;
+    for (int c = 0; c < 4; c++) {
+        atomic_store(&args->min[c], 255);
+    }
+
+    df_dispatch_threads(dispatcher, df_size3(texture->width, texture->height, 1), df_size3(DF_IMAGE_STATS_TILE_WIDTH, DF_IMAGE_STATS_TILE_HEIGHT, 1), df_image_stats_atomic_group, args);
+
+    uint64_t sum[4];
+    for (int c = 0; c < 4; c++) {
+        for (int b = 0; b < 256; b++) {
+            stats->histogram[c][b] = atomic_load(&args->histogram[c][b]);
+        }
+        sum[c] = atomic_load(&args->sum[c]);
+        stats->min[c] = (uint8_t) atomic_load(&args->min[c]);
+        stats->max[c] = (uint8_t) atomic_load(&args->max[c]);
+    }
+    df_image_stats_finish(stats, sum, (uint64_t) texture->width * texture->height);
+
+    free(args);
+    return true;
+}
+
+// Smallest level with at least `fraction` of the pixels at or below it
+uint8_t df_image_stats_percentile(const df_image_stats_t *stats, int channel, float fraction) {
+    uint64_t target = (uint64_t) ((double) fraction * (double) stats->count);
+    uint64_t seen = 0;
+    for (int b = 0; b < 256; b++) {
+        seen += stats->histogram[channel][b];
+        if (seen > target || (seen == target && target > 0)) {
+            return (uint8_t) b;
+        }
+    }
+    return 255;
+}
+
+// Auto levels: a colour matrix that stretches each RGB channel so the
+// darkest and brightest `clip` fraction of pixels saturate. Alpha is left
+// alone, so the result takes the identity-alpha fast path.
+void df_image_stats_levels(const df_image_stats_t *stats, float clip, df_color_matrix_t *cm) {
+    df_color_matrix_identity(cm);
+    for (int c = 0; c < 3; c++) {
+        int lo = df_image_stats_percentile(stats, c, clip);
+        int hi = df_image_stats_percentile(stats, c, 1 - clip);
+        if (hi <= lo) {
+            continue;
+        }
+        float scale = 255.0f / (float) (hi - lo);
+        cm->m[c][c] = scale;
+        cm->offset[c] = -(float) lo / 255.0f * scale;
+    }
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+void df_image_stats_test(void) {
+    df_cpu_texture_t texture;
+    df_cpu_texture_init(&texture, 300, 77);
+    for (uint32_t y = 0; y < texture.height; y++) {
+        for (uint32_t x = 0; x < texture.width * 4; x++) {
+            texture.data[y * texture.bytes_per_row + x] = (uint8_t) (40 + (x * 7 + y * 3) % 150);
+        }
+    }
+
+    df_image_stats_t stats, atomic_stats;
+    assert(df_image_stats(&texture, &stats, NULL));
+    assert(df_image_stats_atomic(&texture, &atomic_stats, NULL));
+    assert(memcmp(&stats, &atomic_stats, sizeof(stats)) == 0);
+
+    // Against a serial pass
+    for (int c = 0; c < 4; c++) {
+        uint32_t histogram[256] = { 0 };
+        uint64_t sum = 0;
+        for (uint32_t y = 0; y < texture.height; y++) {
+            for (uint32_t x = 0; x < texture.width; x++) {
+                uint8_t v = texture.data[y * texture.bytes_per_row + x * 4 + c];
+                histogram[v]++;
+                sum += v;
+            }
+        }
+        assert(memcmp(histogram, stats.histogram[c], sizeof(histogram)) == 0);
+        assert(stats.min[c] == 40 && stats.max[c] == 189);
+        assert(stats.mean[c] == (float) ((double) sum / (300.0 * 77.0)));
+    }
+
+    df_color_matrix_t cm;
+    df_image_stats_levels(&stats, 0, &cm);
+    assert(df_color_matrix_classify(&cm) == DFColorMatrixIdentityAlpha);
+    float px[4] = { 40 / 255.0f, 189 / 255.0f, 0.5f, 0.5f };
+    df_color_matrix_apply(&cm, DFColorMatrixGeneral, px, 1);
+    assert(px[0] > -1e-5f && px[0] < 1e-5f && px[1] > 1 - 1e-5f && px[1] < 1 + 1e-5f && px[3] == 0.5f);
+
+    df_cpu_texture_free(&texture);
+
+    printf("image_stats: passed!\n");
+}
+#endif
@@ -0,0 +1,34 @@
+#if !defined(DFTK_IMAGE_STATS_H)
+#define DFTK_IMAGE_STATS_H
+
+#include <stdint.h>
+#include "color_matrix.h"
+#include "cpu_texture.h"
+#include "dispatch.h"
+
+// Per-channel histograms, min/max and mean of an RGBA8 image, the inputs to
+// auto-exposure and levels. df_image_stats reduces hierarchically: every
+// worker accumulates into its own privatized partial (no atomics, no shared
+// cache lines), and the partials are merged once at the end.
+// df_image_stats_atomic is the naive version with one set of shared atomic
+// bins, kept as the baseline for tools/bench. The Metal equivalents are
+// histogram_kernel and stats_kernel in 07-compute-image-processing.
+
+typedef struct {
+    uint32_t histogram[4][256];
+    uint8_t min[4];
+    uint8_t max[4];
+    float mean[4];            // In [0, 255]
+    uint64_t count;           // Pixels
+} df_image_stats_t;
+
+bool df_image_stats(const df_cpu_texture_t *texture, df_image_stats_t *stats, df_dispatcher_t *dispatcher);
+bool df_image_stats_atomic(const df_cpu_texture_t *texture, df_image_stats_t *stats, df_dispatcher_t *dispatcher);
+uint8_t df_image_stats_percentile(const df_image_stats_t *stats, int channel, float fraction);
+void df_image_stats_levels(const df_image_stats_t *stats, float clip, df_color_matrix_t *cm);
+
+#ifdef TEST
+void df_image_stats_test(void);
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdint.h>
+#include <string.h>
+#include "lz4.h"
+
+#define DF_LZ4_MIN_MATCH 4
+#define DF_LZ4_LAST_LITERALS 5      // The block must end with at least 5 literals
+#define DF_LZ4_MF_LIMIT 12          // The last match must start at least 12 bytes before the end
+#define DF_LZ4_MAX_OFFSET 65535
+#define DF_LZ4_HASH_BITS 12
+
+static uint32_t df_lz4_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t df_lz4_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - DF_LZ4_HASH_BITS);
+}
+
+static uint8_t *df_lz4_write_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+size_t df_lz4_compress_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+// Returns the compressed size, or 0 when `dst_capacity` is smaller than
+// df_lz4_compress_bound(src_size)
+size_t df_lz4_compress(const void *src, size_t src_size, void *dst, size_t dst_capacity) {
+    if (dst_capacity < df_lz4_compress_bound(src_size)) {
+        return 0;
+    }
+
+    const uint8_t *in = (const uint8_t *) src;
+    uint8_t *op = (uint8_t *) dst;
+
+    int32_t table[1 << DF_LZ4_HASH_BITS];
+    for (int i = 0; i < (1 << DF_LZ4_HASH_BITS); i++) table[i] = -1;
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t match_limit = src_size > DF_LZ4_MF_LIMIT ? src_size - DF_LZ4_MF_LIMIT : 0;
+
+    while (ip < match_limit) {
+        uint32_t seq = df_lz4_read32(in + ip);
+        uint32_t h = df_lz4_hash(seq);
+        int32_t ref = table[h];
+        table[h] = (int32_t) ip;
+
+        if (ref < 0 || ip - (size_t) ref > DF_LZ4_MAX_OFFSET || df_lz4_read32(in + ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        size_t len = DF_LZ4_MIN_MATCH;
+        while (ip + len < src_size - DF_LZ4_LAST_LITERALS && in[ref + len] == in[ip + len]) {
+            len++;
+        }
+
+        size_t literals = ip - anchor;
+        size_t match_code = len - DF_LZ4_MIN_MATCH;
+        uint8_t *token = op++;
+        *token = (uint8_t) (((literals >= 15 ? 15 : literals) << 4) | (match_code >= 15 ? 15 : match_code));
+
+        if (literals >= 15) op = df_lz4_write_length(op, literals - 15);
+        memcpy(op, in + anchor, literals);
+        op += literals;
+
+        size_t offset = ip - (size_t) ref;
+        *op++ = (uint8_t) (offset & 0xff);
+        *op++ = (uint8_t) (offset >> 8);
+
+        if (match_code >= 15) op = df_lz4_write_length(op, match_code - 15);
+
+        ip += len;
+        anchor = ip;
+    }
+
+    size_t literals = src_size - anchor;
+    *op++ = (uint8_t) ((literals >= 15 ? 15 : literals) << 4);
+    if (literals >= 15) op = df_lz4_write_length(op, literals - 15);
+    memcpy(op, in + anchor, literals);
+    op += literals;
+
+    return (size_t) (op - (uint8_t *) dst);
+}
+
+// Returns the decompressed size, or -1 if the input is malformed or does not fit in `dst`
+long df_lz4_decompress(const void *src, size_t src_size, void *dst, size_t dst_capacity) {
+    const uint8_t *ip = (const uint8_t *) src;
+    const uint8_t *in_end = ip + src_size;
+    uint8_t *out = (uint8_t *) dst;
+    uint8_t *op = out;
+    uint8_t *out_end = out + dst_capacity;
+
+    while (ip < in_end) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= in_end) return -1;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+
+        if ((size_t) (in_end - ip) < literals || (size_t) (out_end - op) < literals) return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        if (ip >= in_end) break;
+
+        if (in_end - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - out)) return -1;
+
+        size_t len = token & 15;
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= in_end) return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += DF_LZ4_MIN_MATCH;
+
+        if ((size_t) (out_end - op) < len) return -1;
+
+        // Matches may overlap the bytes they produce, so copy forwards one byte at a time
+        const uint8_t *match = op - offset;
+        for (size_t i = 0; i < len; i++) op[i] = match[i];
+        op += len;
+    }
+
+    return (long) (op - out);
+}
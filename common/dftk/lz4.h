@@ -0,0 +1,13 @@
+#if !defined(DFTK_LZ4_H)
+#define DFTK_LZ4_H
+
+#include <stddef.h>
+
+// LZ4 block format (no frame header), compatible with LZ4_compress_default
+// and LZ4_decompress_safe.
+
+size_t df_lz4_compress_bound(size_t size);
+size_t df_lz4_compress(const void *src, size_t src_size, void *dst, size_t dst_capacity);
+long df_lz4_decompress(const void *src, size_t src_size, void *dst, size_t dst_capacity);
+
+#endif
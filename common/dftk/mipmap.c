@@ -0,0 +1,453 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mipmap.h"
+#include "simd.h"
+
+#define DF_KAISER_RADIUS 3.0f   // Filter support in destination pixels
+#define DF_KAISER_ALPHA 4.0f
+
+// sRGB <-> linear conversion tables. The inverse table is indexed by the
+// linear value quantized to 16 bits, which is fine enough to round-trip
+// every 8-bit sRGB value.
+static float df_srgb_to_linear_table[256];
+static uint8_t df_linear_to_srgb_table[65536];
+static pthread_once_t df_srgb_tables_once = PTHREAD_ONCE_INIT;
+
+static void df_srgb_tables_init(void) {
+    for (int i = 0; i < 256; i++) {
+        float c = i / 255.0f;
+        df_srgb_to_linear_table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i < 65536; i++) {
+        float l = i / 65535.0f;
+        float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+        df_linear_to_srgb_table[i] = (uint8_t) (c * 255.0f + 0.5f);
+    }
+}
+
+const float *df_srgb_to_linear_lut(void) {
+    pthread_once(&df_srgb_tables_once, df_srgb_tables_init);
+    return df_srgb_to_linear_table;
+}
+
+const uint8_t *df_linear_to_srgb_lut(void) {
+    pthread_once(&df_srgb_tables_once, df_srgb_tables_init);
+    return df_linear_to_srgb_table;
+}
+
+uint32_t df_mip_level_count(uint32_t width, uint32_t height) {
+    uint32_t size = width > height ? width : height;
+    uint32_t count = 1;
+    while (size > 1) {
+        size >>= 1;
+        count++;
+    }
+    return count;
+}
+
+typedef struct {
+    const uint8_t *src;
+    uint32_t src_width;
+    uint32_t src_height;
+    uint32_t src_pitch;
+    uint8_t *dst;
+    uint32_t dst_width;
+    uint32_t dst_pitch;
+} df_mip_box_job_t;
+
+// Non-sRGB box filter straight on the 8-bit values: (a + b + c + d + 2) / 4
+static void df_mip_box_rows(void *ctx, size_t begin, size_t end) {
+    df_mip_box_job_t *job = (df_mip_box_job_t *) ctx;
+
+    for (size_t y = begin; y < end; y++) {
+        uint32_t y0 = (uint32_t) (2 * y);
+        uint32_t y1 = y0 + 1 < job->src_height ? y0 + 1 : y0;
+        const uint8_t *r0 = job->src + (size_t) y0 * job->src_pitch;
+        const uint8_t *r1 = job->src + (size_t) y1 * job->src_pitch;
+        uint8_t *out = job->dst + y * job->dst_pitch;
+
+        uint32_t x = 0;
+
+        // Full pairs of source pixels, four destination pixels at a time
+#if defined(DF_SIMD_SSE2)
+        for (; x + 4 <= job->src_width / 2; x += 4) {
+            __m128i zero = _mm_setzero_si128();
+            __m128i a0 = _mm_loadu_si128((const __m128i *) (r0 + 8 * x));
+            __m128i a1 = _mm_loadu_si128((const __m128i *) (r0 + 8 * x + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i *) (r1 + 8 * x));
+            __m128i b1 = _mm_loadu_si128((const __m128i *) (r1 + 8 * x + 16));
+
+            __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+            __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+            __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+            __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+            __m128i t0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+            __m128i t1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+            t0 = _mm_srli_epi16(_mm_add_epi16(t0, _mm_set1_epi16(2)), 2);
+            t1 = _mm_srli_epi16(_mm_add_epi16(t1, _mm_set1_epi16(2)), 2);
+
+            _mm_storeu_si128((__m128i *) (out + 4 * x), _mm_packus_epi16(t0, t1));
+        }
+#elif defined(DF_SIMD_NEON)
+        for (; x + 4 <= job->src_width / 2; x += 4) {
+            // De-interleave even and odd source pixels
+            uint32x4x2_t a = vld2q_u32((const uint32_t *) (r0 + 8 * x));
+            uint32x4x2_t b = vld2q_u32((const uint32_t *) (r1 + 8 * x));
+            uint8x16_t ae = vreinterpretq_u8_u32(a.val[0]), ao = vreinterpretq_u8_u32(a.val[1]);
+            uint8x16_t be = vreinterpretq_u8_u32(b.val[0]), bo = vreinterpretq_u8_u32(b.val[1]);
+
+            uint16x8_t lo = vaddl_u8(vget_low_u8(ae), vget_low_u8(ao));
+            lo = vaddw_u8(vaddw_u8(lo, vget_low_u8(be)), vget_low_u8(bo));
+            uint16x8_t hi = vaddl_u8(vget_high_u8(ae), vget_high_u8(ao));
+            hi = vaddw_u8(vaddw_u8(hi, vget_high_u8(be)), vget_high_u8(bo));
+
+            vst1q_u8(out + 4 * x, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+        }
+#endif
+
+        for (; x < job->dst_width; x++) {
+            uint32_t x0 = 2 * x;
+            uint32_t x1 = x0 + 1 < job->src_width ? x0 + 1 : x0;
+            for (int c = 0; c < 4; c++) {
+                out[4*x+c] = (uint8_t) ((r0[4*x0+c] + r0[4*x1+c] + r1[4*x0+c] + r1[4*x1+c] + 2) >> 2);
+            }
+        }
+    }
+}
+
+// Per destination pixel list of source indices and normalized weights
+typedef struct {
+    int taps;
+    int *indices;    // dst_size * taps
+    float *weights;  // dst_size * taps
+} df_mip_weights_t;
+
+static float df_bessel_i0(float x) {
+    float sum = 1, term = 1;
+    for (int k = 1; k < 20; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static float df_kaiser(float t) {
+    if (fabsf(t) >= DF_KAISER_RADIUS) return 0;
+
+    float r = t / DF_KAISER_RADIUS;
+    float window = df_bessel_i0(DF_KAISER_ALPHA * sqrtf(1 - r * r)) / df_bessel_i0(DF_KAISER_ALPHA);
+    float sinc = t == 0 ? 1 : sinf((float) M_PI * t) / ((float) M_PI * t);
+    return sinc * window;
+}
+
+static void df_mip_weights_free(df_mip_weights_t *w) {
+    free(w->indices);
+    free(w->weights);
+    w->indices = NULL;
+    w->weights = NULL;
+}
+
+static bool df_mip_weights_init(df_mip_weights_t *w, uint32_t src_size, uint32_t dst_size, df_mip_filter filter) {
+    float scale = (float) src_size / dst_size;
+    float support = filter == DFMipFilterBox ? scale / 2 : DF_KAISER_RADIUS * scale;
+
+    w->taps = (int) ceilf(2 * support) + 1;
+    w->indices = (int *) malloc(dst_size * w->taps * sizeof(int));
+    w->weights = (float *) malloc(dst_size * w->taps * sizeof(float));
+    if (!w->indices || !w->weights) {
+        df_mip_weights_free(w);
+        return false;
+    }
+
+    for (uint32_t x = 0; x < dst_size; x++) {
+        float center = (x + 0.5f) * scale;
+        int first = (int) floorf(center - support);
+        float total = 0;
+
+        for (int k = 0; k < w->taps; k++) {
+            int i = first + k;
+            float weight;
+            if (filter == DFMipFilterBox) {
+                // Coverage of source pixel [i, i+1] by the footprint
+                float lo = fmaxf((float) i, center - support);
+                float hi = fminf((float) (i + 1), center + support);
+                weight = hi > lo ? hi - lo : 0;
+            } else {
+                weight = df_kaiser((i + 0.5f - center) / scale);
+            }
+
+            w->indices[x * w->taps + k] = i < 0 ? 0 : (i >= (int) src_size ? (int) src_size - 1 : i);
+            w->weights[x * w->taps + k] = weight;
+            total += weight;
+        }
+
+        for (int k = 0; k < w->taps; k++) {
+            w->weights[x * w->taps + k] /= total;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    const df_texture_level_t *src;
+    df_texture_level_t *dst;
+    bool srgb;
+    df_mip_weights_t horizontal;
+    df_mip_weights_t vertical;
+    float *tmp;       // src height rows of dst width float4 pixels
+    _Atomic bool failed;  // A row buffer couldn't be allocated
+} df_mip_filter_job_t;
+
+static df_f32x4 df_mip_load(const uint8_t *p, bool srgb) {
+    if (srgb) {
+        return df_f32x4_set(df_srgb_to_linear_table[p[0]], df_srgb_to_linear_table[p[1]], df_srgb_to_linear_table[p[2]], p[3] / 255.0f);
+    }
+    return df_f32x4_mul(df_f32x4_set(p[0], p[1], p[2], p[3]), df_f32x4_splat(1 / 255.0f));
+}
+
+static void df_mip_store(uint8_t *p, df_f32x4 v, bool srgb) {
+    float c[4];
+    v = df_f32x4_min(df_f32x4_max(v, df_f32x4_splat(0)), df_f32x4_splat(1));
+    df_f32x4_store(c, v);
+
+    for (int i = 0; i < 3; i++) {
+        p[i] = srgb ? df_linear_to_srgb_table[(int) (c[i] * 65535.0f + 0.5f)] : (uint8_t) (c[i] * 255.0f + 0.5f);
+    }
+    p[3] = (uint8_t) (c[3] * 255.0f + 0.5f);
+}
+
+static void df_mip_filter_rows_h(void *ctx, size_t begin, size_t end) {
+    df_mip_filter_job_t *job = (df_mip_filter_job_t *) ctx;
+    const df_mip_weights_t *w = &job->horizontal;
+    uint32_t src_width = job->src->width;
+    uint32_t dst_width = job->dst->width;
+
+    float *row = (float *) malloc(src_width * 4 * sizeof(float));
+    if (!row) {
+        atomic_store(&job->failed, true);
+        return;
+    }
+
+    for (size_t y = begin; y < end; y++) {
+        const uint8_t *in = job->src->data + y * job->src->bytes_per_row;
+        for (uint32_t x = 0; x < src_width; x++) {
+            df_f32x4_store(row + 4 * x, df_mip_load(in + 4 * x, job->srgb));
+        }
+
+        float *out = job->tmp + y * dst_width * 4;
+        for (uint32_t x = 0; x < dst_width; x++) {
+            const int *indices = w->indices + x * w->taps;
+            const float *weights = w->weights + x * w->taps;
+            df_f32x4 acc = df_f32x4_splat(0);
+            for (int k = 0; k < w->taps; k++) {
+                acc = df_f32x4_madd(df_f32x4_load(row + 4 * indices[k]), df_f32x4_splat(weights[k]), acc);
+            }
+            df_f32x4_store(out + 4 * x, acc);
+        }
+    }
+
+    free(row);
+}
+
+static void df_mip_filter_rows_v(void *ctx, size_t begin, size_t end) {
+    df_mip_filter_job_t *job = (df_mip_filter_job_t *) ctx;
+    const df_mip_weights_t *w = &job->vertical;
+    uint32_t dst_width = job->dst->width;
+
+    for (size_t y = begin; y < end; y++) {
+        const int *indices = w->indices + y * w->taps;
+        const float *weights = w->weights + y * w->taps;
+        uint8_t *out = (uint8_t *) job->dst->data + y * job->dst->bytes_per_row;
+
+        for (uint32_t x = 0; x < dst_width; x++) {
+            df_f32x4 acc = df_f32x4_splat(0);
+            for (int k = 0; k < w->taps; k++) {
+                const float *in = job->tmp + ((size_t) indices[k] * dst_width + x) * 4;
+                acc = df_f32x4_madd(df_f32x4_load(in), df_f32x4_splat(weights[k]), acc);
+            }
+            df_mip_store(out + 4 * x, acc, job->srgb);
+        }
+    }
+}
+
+static bool df_mip_downsample(const df_texture_level_t *src, df_texture_level_t *dst, bool srgb, df_mip_filter filter, df_thread_pool_t *pool) {
+    if (filter == DFMipFilterBox && !srgb) {
+        df_mip_box_job_t job = { src->data, src->width, src->height, src->bytes_per_row, (uint8_t *) dst->data, dst->width, dst->bytes_per_row };
+        df_parallel_for(pool, dst->height, 16, df_mip_box_rows, &job);
+        return true;
+    }
+
+    // Everything else goes through the separable float filter, in linear space for sRGB
+    df_mip_filter_job_t job = { src, dst, srgb };
+    atomic_init(&job.failed, false);
+    bool ok = df_mip_weights_init(&job.horizontal, src->width, dst->width, filter);
+    ok = df_mip_weights_init(&job.vertical, src->height, dst->height, filter) && ok;
+    job.tmp = (float *) malloc((size_t) src->height * dst->width * 4 * sizeof(float));
+    ok = ok && job.tmp;
+
+    if (ok) {
+        df_parallel_for(pool, src->height, 16, df_mip_filter_rows_h, &job);
+        ok = !atomic_load(&job.failed);
+    }
+    if (ok) {
+        df_parallel_for(pool, dst->height, 16, df_mip_filter_rows_v, &job);
+    }
+
+    free(job.tmp);
+    df_mip_weights_free(&job.horizontal);
+    df_mip_weights_free(&job.vertical);
+    return ok;
+}
+
+// Fills levels[1 .. level_count-1] from the RGBA8 pixels in levels[0],
+// each level downsampled from the previous one. The new levels are
+// tightly packed and share one allocation, released by df_mipmap_free.
+// `pool` may be NULL to use the shared pool. Returns false, with no levels
+// allocated, if memory runs out.
+bool df_mipmap_generate(df_texture_level_t *levels, uint32_t level_count, bool srgb, df_mip_filter filter, df_thread_pool_t *pool) {
+    if (level_count == 0 || level_count > df_mip_level_count(levels[0].width, levels[0].height)) {
+        return false;
+    }
+    if (srgb) {
+        pthread_once(&df_srgb_tables_once, df_srgb_tables_init);
+    }
+
+    size_t total = 0;
+    uint32_t w = levels[0].width, h = levels[0].height;
+    for (uint32_t i = 1; i < level_count; i++) {
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+        levels[i] = (df_texture_level_t) { NULL, w, h, w * 4 };
+        total += (size_t) w * h * 4;
+    }
+
+    if (level_count == 1) {
+        return true;
+    }
+
+    uint8_t *data = (uint8_t *) malloc(total);
+    if (!data) {
+        return false;
+    }
+
+    uint8_t *next = data;
+    for (uint32_t i = 1; i < level_count; i++) {
+        levels[i].data = next;
+        next += (size_t) levels[i].bytes_per_row * levels[i].height;
+        if (!df_mip_downsample(&levels[i - 1], &levels[i], srgb, filter, pool)) {
+            free(data);
+            for (uint32_t j = 1; j < level_count; j++) {
+                levels[j].data = NULL;
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void df_mipmap_free(df_texture_level_t *levels, uint32_t level_count) {
+    if (level_count > 1) {
+        free((void *) levels[1].data);
+        levels[1].data = NULL;
+    }
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+void df_mipmap_test(void) {
+    assert(df_mip_level_count(1, 1) == 1 && df_mip_level_count(256, 256) == 9 && df_mip_level_count(37, 23) == 6);
+
+    // The SIMD box rows against the scalar formula, on sizes with and
+    // without a full SIMD step and with odd edges. Odd sizes drop their last
+    // row and column, except a size of 1 which is repeated.
+    uint32_t sizes[][2] = { { 64, 32 }, { 37, 23 }, { 9, 1 }, { 1, 7 }, { 18, 18 } };
+    uint32_t seed = 1;
+    for (int s = 0; s < 5; s++) {
+        uint32_t width = sizes[s][0], height = sizes[s][1];
+        uint32_t pitch = width * 4 + 12;
+        uint8_t *pixels = (uint8_t *) malloc((size_t) pitch * height);
+        for (size_t i = 0; i < (size_t) pitch * height; i++) {
+            seed = seed * 1664525 + 1013904223;
+            pixels[i] = (uint8_t) (seed >> 24);
+        }
+
+        df_texture_level_t levels[DF_TEXTURE_FILE_MAX_LEVELS] = { { pixels, width, height, pitch } };
+        uint32_t count = df_mip_level_count(width, height);
+        assert(df_mipmap_generate(levels, count, false, DFMipFilterBox, NULL));
+        for (uint32_t l = 1; l < count; l++) {
+            const df_texture_level_t *src = &levels[l - 1], *dst = &levels[l];
+            assert(dst->width == (src->width > 1 ? src->width / 2 : 1) && dst->height == (src->height > 1 ? src->height / 2 : 1));
+            for (uint32_t y = 0; y < dst->height; y++) {
+                const uint8_t *r0 = src->data + 2 * y * src->bytes_per_row;
+                const uint8_t *r1 = src->height > 1 ? r0 + src->bytes_per_row : r0;
+                for (uint32_t x = 0; x < dst->width; x++) {
+                    uint32_t x0 = 2 * x, x1 = src->width > 1 ? x0 + 1 : x0;
+                    for (int c = 0; c < 4; c++) {
+                        int expected = (r0[4*x0+c] + r0[4*x1+c] + r1[4*x0+c] + r1[4*x1+c] + 2) / 4;
+                        assert(dst->data[y * dst->bytes_per_row + 4 * x + c] == expected);
+                    }
+                }
+            }
+        }
+        df_mipmap_free(levels, count);
+        free(pixels);
+    }
+
+    // A black and white checker averages to half the light: 188 in sRGB,
+    // where averaging the encoded values would give 128. Alpha is linear.
+    uint8_t checker[16] = { 0, 0, 0, 0, 255, 255, 255, 255, 255, 255, 255, 255, 0, 0, 0, 0 };
+    for (int f = 0; f < 2; f++) {
+        df_mip_filter filter = f ? DFMipFilterKaiser : DFMipFilterBox;
+        df_texture_level_t levels[2] = { { checker, 2, 2, 8 } };
+        assert(df_mipmap_generate(levels, 2, true, filter, NULL));
+        assert(levels[1].data[0] == 188 && levels[1].data[1] == 188 && levels[1].data[2] == 188 && levels[1].data[3] == 128);
+        df_mipmap_free(levels, 2);
+        assert(df_mipmap_generate(levels, 2, false, filter, NULL));
+        assert(levels[1].data[0] == 128 && levels[1].data[3] == 128);
+        df_mipmap_free(levels, 2);
+    }
+
+    // Kaiser weights sum to one, edges included, so a flat image stays flat
+    uint32_t dims[][2] = { { 64, 32 }, { 37, 18 }, { 5, 2 }, { 3, 1 } };
+    for (int d = 0; d < 4; d++) {
+        df_mip_weights_t w;
+        df_mip_weights_init(&w, dims[d][0], dims[d][1], DFMipFilterKaiser);
+        for (uint32_t x = 0; x < dims[d][1]; x++) {
+            float total = 0;
+            for (int k = 0; k < w.taps; k++) {
+                total += w.weights[x * w.taps + k];
+                assert(w.indices[x * w.taps + k] >= 0 && w.indices[x * w.taps + k] < (int) dims[d][0]);
+            }
+            assert(fabsf(total - 1) < 1e-5f);
+        }
+        df_mip_weights_free(&w);
+    }
+
+    uint8_t *flat = (uint8_t *) malloc(37 * 23 * 4);
+    for (int i = 0; i < 37 * 23 * 4; i++) {
+        flat[i] = (uint8_t) (i % 4 == 3 ? 255 : 90 + 30 * (i % 4));
+    }
+    for (int srgb = 0; srgb < 2; srgb++) {
+        df_texture_level_t levels[DF_TEXTURE_FILE_MAX_LEVELS] = { { flat, 37, 23, 37 * 4 } };
+        uint32_t count = df_mip_level_count(37, 23);
+        assert(df_mipmap_generate(levels, count, srgb, DFMipFilterKaiser, NULL));
+        for (uint32_t l = 1; l < count; l++) {
+            for (uint32_t i = 0; i < levels[l].width * levels[l].height * 4; i++) {
+                assert(levels[l].data[i] == flat[i % 4]);
+            }
+        }
+        df_mipmap_free(levels, count);
+    }
+    free(flat);
+
+    printf("mipmap: passed!\n");
+}
+
+#endif
@@ -0,0 +1,27 @@
+#if !defined(DFTK_MIPMAP_H)
+#define DFTK_MIPMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "texture_file.h"
+#include "thread_pool.h"
+
+typedef enum {
+    DFMipFilterBox,     // 2x2 average, exact for power-of-two sizes
+    DFMipFilterKaiser,  // Kaiser windowed sinc, sharper and less aliasing
+} df_mip_filter;
+
+uint32_t df_mip_level_count(uint32_t width, uint32_t height);
+bool df_mipmap_generate(df_texture_level_t *levels, uint32_t level_count, bool srgb, df_mip_filter filter, df_thread_pool_t *pool);
+void df_mipmap_free(df_texture_level_t *levels, uint32_t level_count);
+
+// sRGB <-> linear lookup tables, also used by the resampler. The inverse
+// table is indexed by the linear value scaled to [0, 65535].
+const float *df_srgb_to_linear_lut(void);
+const uint8_t *df_linear_to_srgb_lut(void);
+
+#ifdef TEST
+void df_mipmap_test(void);
+#endif
+
+#endif
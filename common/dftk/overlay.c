@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+#include "overlay.h"
+
+void df_overlay_init(df_overlay_t *overlay) {
+    memset(overlay, 0, sizeof(*overlay));
+}
+
+void df_overlay_free(df_overlay_t *overlay) {
+    free(overlay->vertices);
+    memset(overlay, 0, sizeof(*overlay));
+}
+
+void df_overlay_reset(df_overlay_t *overlay) {
+    overlay->count = 0;
+}
+
+// Room for `n` more vertices, doubling the arena as it fills up
+static df_overlay_vertex_t *df_overlay_push(df_overlay_t *overlay, uint32_t n) {
+    if (overlay->count + n > overlay->capacity) {
+        size_t capacity = overlay->capacity ? overlay->capacity : 256;
+        while (capacity < overlay->count + n) {
+            capacity *= 2;
+        }
+        df_overlay_vertex_t *grown = (df_overlay_vertex_t *) realloc(overlay->vertices, capacity * sizeof(df_overlay_vertex_t));
+        if (!grown) {
+            return NULL;
+        }
+        overlay->vertices = grown;
+        overlay->capacity = capacity;
+    }
+    df_overlay_vertex_t *v = overlay->vertices + overlay->count;
+    overlay->count += n;
+    return v;
+}
+
+void df_overlay_line(df_overlay_t *overlay, float x0, float y0, float x1, float y1, const float color[4]) {
+    df_overlay_vertex_t *v = df_overlay_push(overlay, 2);
+    if (!v) {
+        return;
+    }
+    v[0] = (df_overlay_vertex_t) { { x0, y0 }, { color[0], color[1], color[2], color[3] } };
+    v[1] = (df_overlay_vertex_t) { { x1, y1 }, { color[0], color[1], color[2], color[3] } };
+}
+
+// Four lines going round, so each corner is drawn once
+void df_overlay_rect(df_overlay_t *overlay, float x, float y, float w, float h, const float color[4]) {
+    const float corners[5][2] = { { x, y }, { x + w, y }, { x + w, y + h }, { x, y + h }, { x, y } };
+    df_overlay_vertex_t *v = df_overlay_push(overlay, 8);
+    if (!v) {
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        v[2 * i] = (df_overlay_vertex_t) { { corners[i][0], corners[i][1] }, { color[0], color[1], color[2], color[3] } };
+        v[2 * i + 1] = (df_overlay_vertex_t) { { corners[i + 1][0], corners[i + 1][1] }, { color[0], color[1], color[2], color[3] } };
+    }
+}
+
+// The samples' vertex_shader: pixels to clip space, y down
+static void df_overlay_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const df_overlay_vertex_t *in = (const df_overlay_vertex_t *) vertex;
+    const uint32_t *viewport = (const uint32_t *) uniforms;
+    position[0] = in->position[0] / (viewport[0] * 0.5f) - 1;
+    position[1] = 1 - in->position[1] / (viewport[1] * 0.5f);
+    position[2] = 0;
+    position[3] = 1;
+    memcpy(varyings, in->color, sizeof(in->color));
+}
+
+static bool df_overlay_fragment(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    (void) uniforms;
+    (void) depth;
+    memcpy(color, varyings, 4 * sizeof(float));
+    return true;
+}
+
+static const df_raster_pipeline_t df_overlay_pipeline = { df_overlay_vertex, df_overlay_fragment, 4 };
+
+void df_overlay_draw(df_overlay_t *overlay, df_raster_t *raster) {
+    overlay->viewport[0] = raster->pass.target->color.width;
+    overlay->viewport[1] = raster->pass.target->color.height;
+    df_raster_draw_primitives(raster, &df_overlay_pipeline, DFPrimitiveTypeLine, overlay->vertices, sizeof(df_overlay_vertex_t),
+                              0, overlay->count, overlay->viewport, NULL);
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+void df_overlay_test(void) {
+    df_render_target_t target;
+    df_render_target_init(&target, 64, 64, 1, false, false);
+    df_raster_t raster;
+    assert(df_raster_init(&raster, NULL));
+    df_render_pass_t pass = { &target, DFLoadActionClear, { 0, 0, 0, 0 } };
+    df_overlay_t overlay;
+    df_overlay_init(&overlay);
+
+    // A 10x6 outline through pixel centres and a horizontal line, in one
+    // draw: the outline's 28 pixels and the line's 20
+    const float red[4] = { 1, 0, 0, 1 }, green[4] = { 0, 1, 0, 1 };
+    df_overlay_rect(&overlay, 4.5f, 4.5f, 9, 5, red);
+    df_overlay_line(&overlay, 20.5f, 30.5f, 40.5f, 30.5f, green);
+    assert(overlay.count == 10);
+    df_raster_begin(&raster, &pass);
+    df_overlay_draw(&overlay, &raster);
+    df_raster_end(&raster);
+    assert(raster.num_draws == 1);
+
+    uint32_t reds = 0, greens = 0;
+    for (uint32_t y = 0; y < 64; y++) {
+        for (uint32_t x = 0; x < 64; x++) {
+            const uint8_t *p = target.color.data + y * target.color.bytes_per_row + x * 4;
+            bool edge = (x == 4 || x == 13 || y == 4 || y == 9) && x >= 4 && x <= 13 && y >= 4 && y <= 9;
+            assert((p[0] == 255) == edge);
+            reds += p[0] == 255;
+            greens += p[1] == 255 && y == 30 && x >= 20 && x < 40;
+        }
+    }
+    assert(reds == 28 && greens == 20);
+
+    // Thousands of boxes grow the arena, and a reset keeps it
+    for (int i = 0; i < 5000; i++) {
+        df_overlay_rect(&overlay, (float) (i % 60), (float) (i % 50), 3, 3, green);
+    }
+    size_t capacity = overlay.capacity;
+    assert(overlay.count == 10 + 5000 * 8 && capacity >= overlay.count);
+    df_overlay_reset(&overlay);
+    assert(overlay.count == 0 && overlay.capacity == capacity);
+
+    df_overlay_free(&overlay);
+    df_raster_deinit(&raster);
+    df_render_target_free(&target);
+    printf("overlay: passed!\n");
+}
+
+#endif
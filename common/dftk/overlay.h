@@ -0,0 +1,44 @@
+#if !defined(DFTK_OVERLAY_H)
+#define DFTK_OVERLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "raster.h"
+
+// Immediate-mode overlay for debug boxes and selections: lines and
+// rectangle outlines are appended to one vertex arena over the frame and
+// drawn as a single line list. Positions are pixels from the top-left
+// corner. The vertex layout is the samples' Vertex { float2 position;
+// float4 color; }, so the arena can also be copied into an MTLBuffer and
+// drawn with MTLPrimitiveTypeLine.
+
+typedef struct {
+    float position[2];
+    float color[4];
+} df_overlay_vertex_t;
+
+typedef struct {
+    df_overlay_vertex_t *vertices; // Two per line
+    uint32_t count;
+    size_t capacity;
+    uint32_t viewport[2];          // Vertex uniforms of the last draw
+} df_overlay_t;
+
+void df_overlay_init(df_overlay_t *overlay);
+void df_overlay_free(df_overlay_t *overlay);
+
+// Empties the arena for a new frame, keeping its storage
+void df_overlay_reset(df_overlay_t *overlay);
+
+void df_overlay_line(df_overlay_t *overlay, float x0, float y0, float x1, float y1, const float color[4]);
+void df_overlay_rect(df_overlay_t *overlay, float x, float y, float w, float h, const float color[4]);
+
+// Draws everything added since the reset into the current pass, without
+// depth testing
+void df_overlay_draw(df_overlay_t *overlay, df_raster_t *raster);
+
+#ifdef TEST
+void df_overlay_test(void);
+#endif
+
+#endif
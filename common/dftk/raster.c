@@ -0,0 +1,2034 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mipmap.h"
+#include "raster.h"
+#include "simd.h"
+
+#define DF_RASTER_ONE (1 << DF_RASTER_SUBPIXEL_BITS)
+#define DF_RASTER_HALF (DF_RASTER_ONE / 2)
+#define DF_RASTER_SMALL 4          // Bounding box, in pixels, below which blocks don't pay
+#define DF_RASTER_BLOCK_PIXELS (DF_RASTER_BLOCK_SIZE * DF_RASTER_BLOCK_SIZE)
+
+// Standard 4x sample positions, from the pixel centre in sub-pixel units
+static const int32_t df_raster_samples[DF_RASTER_MAX_SAMPLES][2] = {
+    { -32, -96 }, { 96, -32 }, { -96, 32 }, { 32, 96 },
+};
+
+// How far samples reach from the pixel centre
+#define DF_RASTER_SAMPLE_REACH 96
+
+// Largest |coordinate| in pixels a vertex may have after the viewport
+// transform. Keeps edge function products well inside 64 bits.
+#define DF_RASTER_GUARD_BAND 16384.0f
+
+// Smallest w left by clipping, for projections without a near plane
+#define DF_RASTER_MIN_W 1e-6f
+
+// Flags an assembled triangle for clipping
+#define DF_RASTER_CLIP 0x80000000u
+
+// Grows `*data` to hold at least `needed` elements of `size` bytes
+static bool df_raster_reserve(void **data, size_t *capacity, size_t needed, size_t size) {
+    if (needed <= *capacity) {
+        return true;
+    }
+
+    size_t n = *capacity ? *capacity : 64;
+    while (n < needed) {
+        n *= 2;
+    }
+
+    void *grown = realloc(*data, n * size);
+    if (!grown) {
+        return false;
+    }
+    *data = grown;
+    *capacity = n;
+    return true;
+}
+
+bool df_render_target_init(df_render_target_t *target, uint32_t width, uint32_t height, uint32_t sample_count, bool depth, bool srgb) {
+    memset(target, 0, sizeof(*target));
+    if (sample_count != 1 && sample_count != DF_RASTER_MAX_SAMPLES) {
+        return false;
+    }
+    if (!df_cpu_texture_init(&target->color, width, height)) {
+        return false;
+    }
+    target->srgb = srgb;
+    target->sample_count = sample_count;
+
+    if (depth) {
+        target->depth = (float *) malloc((size_t) width * height * sample_count * sizeof(float));
+        if (!target->depth) {
+            df_render_target_free(target);
+            return false;
+        }
+    }
+    if (sample_count > 1) {
+        size_t tiles = (size_t) ((width + DF_RASTER_TILE_SIZE - 1) / DF_RASTER_TILE_SIZE) * ((height + DF_RASTER_TILE_SIZE - 1) / DF_RASTER_TILE_SIZE);
+        target->msaa = (df_msaa_tile_t *) calloc(tiles, sizeof(df_msaa_tile_t));
+        if (!target->msaa) {
+            df_render_target_free(target);
+            return false;
+        }
+    }
+    return true;
+}
+
+void df_render_target_free(df_render_target_t *target) {
+    if (target->msaa) {
+        size_t tiles = (size_t) ((target->color.width + DF_RASTER_TILE_SIZE - 1) / DF_RASTER_TILE_SIZE) *
+                       ((target->color.height + DF_RASTER_TILE_SIZE - 1) / DF_RASTER_TILE_SIZE);
+        for (size_t i = 0; i < tiles; i++) {
+            free(target->msaa[i].samples);
+        }
+        free(target->msaa);
+    }
+    df_cpu_texture_free(&target->color);
+    free(target->depth);
+    target->depth = NULL;
+    target->msaa = NULL;
+}
+
+bool df_raster_init(df_raster_t *raster, df_thread_pool_t *pool) {
+    memset(raster, 0, sizeof(*raster));
+    raster->pool = pool ? pool : df_thread_pool_shared();
+    return raster->pool != NULL;
+}
+
+void df_raster_deinit(df_raster_t *raster) {
+    for (uint32_t i = 0; i < raster->bins_capacity; i++) {
+        free(raster->bins[i].triangles);
+    }
+    free(raster->bins);
+    free(raster->draws);
+    free(raster->triangles);
+    free(raster->varyings);
+    free(raster->vertices);
+    free(raster->assembled);
+    free(raster->cache_batch);
+    free(raster->cache_slot);
+    free(raster->fetch);
+    free(raster->slots);
+    free(raster->hiz);
+    memset(raster, 0, sizeof(*raster));
+}
+
+// False when out of memory for the tile bins: the pass then has no tiles,
+// so its draws and df_raster_end() do nothing
+bool df_raster_begin(df_raster_t *raster, const df_render_pass_t *pass) {
+    const df_cpu_texture_t *color = &pass->target->color;
+
+    raster->pass = *pass;
+    raster->tiles_x = (color->width + DF_RASTER_TILE_SIZE - 1) / DF_RASTER_TILE_SIZE;
+    raster->tiles_y = (color->height + DF_RASTER_TILE_SIZE - 1) / DF_RASTER_TILE_SIZE;
+    raster->num_draws = 0;
+    raster->num_triangles = 0;
+    raster->num_varyings = 0;
+    raster->cache_hits = 0;
+    raster->cache_misses = 0;
+
+    // Bins keep their storage from frame to frame
+    uint32_t num_bins = raster->tiles_x * raster->tiles_y;
+    if (num_bins > raster->bins_capacity) {
+        df_raster_bin_t *bins = (df_raster_bin_t *) realloc(raster->bins, num_bins * sizeof(df_raster_bin_t));
+        if (!bins) {
+            raster->tiles_x = raster->tiles_y = 0;
+            return false;
+        }
+        raster->bins = bins;
+        memset(raster->bins + raster->bins_capacity, 0, (num_bins - raster->bins_capacity) * sizeof(df_raster_bin_t));
+        raster->bins_capacity = num_bins;
+    }
+    for (uint32_t i = 0; i < num_bins; i++) {
+        raster->bins[i].count = 0;
+    }
+
+    raster->hiz_stride = (color->width + DF_RASTER_BLOCK_SIZE - 1) / DF_RASTER_BLOCK_SIZE;
+    size_t num_blocks = (size_t) raster->hiz_stride * ((color->height + DF_RASTER_BLOCK_SIZE - 1) / DF_RASTER_BLOCK_SIZE);
+    if (pass->target->depth && !df_raster_reserve((void **) &raster->hiz, &raster->hiz_capacity, 2 * num_blocks, sizeof(float))) {
+        raster->hiz_disabled = true;
+    }
+
+    return true;
+}
+
+typedef struct {
+    const df_raster_pipeline_t *pipeline;
+    const uint8_t *vertices;
+    size_t stride;
+    const uint32_t *fetch;    // Vertex of each output, NULL to read them in order
+    const void *uniforms;
+    float *out;
+    size_t out_stride;
+} df_raster_vertex_job_t;
+
+static void df_raster_vertex_range(void *ctx, size_t begin, size_t end) {
+    const df_raster_vertex_job_t *job = (const df_raster_vertex_job_t *) ctx;
+    for (size_t i = begin; i < end; i++) {
+        float *out = job->out + i * job->out_stride;
+        size_t vertex = job->fetch ? job->fetch[i] : i;
+        job->pipeline->vertex(job->vertices + vertex * job->stride, job->uniforms, out, out + 4);
+    }
+}
+
+// Pixels [x0, x1) x [y0, y1) with a sample inside the triangle's bounding
+// box, samples reaching `reach` sub-pixel units from the pixel centre,
+// clamped to the rectangle [rx0, rx1) x [ry0, ry1)
+static void df_raster_bounds(const df_raster_triangle_t *t, int reach, int rx0, int ry0, int rx1, int ry1,
+                             int *x0, int *y0, int *x1, int *y1) {
+    int32_t min_x = t->x[0], max_x = t->x[0], min_y = t->y[0], max_y = t->y[0];
+    for (int i = 1; i < 3; i++) {
+        min_x = t->x[i] < min_x ? t->x[i] : min_x;
+        max_x = t->x[i] > max_x ? t->x[i] : max_x;
+        min_y = t->y[i] < min_y ? t->y[i] : min_y;
+        max_y = t->y[i] > max_y ? t->y[i] : max_y;
+    }
+    int bx0 = (min_x - DF_RASTER_HALF - reach + DF_RASTER_ONE - 1) >> DF_RASTER_SUBPIXEL_BITS;
+    int bx1 = ((max_x - DF_RASTER_HALF + reach) >> DF_RASTER_SUBPIXEL_BITS) + 1;
+    int by0 = (min_y - DF_RASTER_HALF - reach + DF_RASTER_ONE - 1) >> DF_RASTER_SUBPIXEL_BITS;
+    int by1 = ((max_y - DF_RASTER_HALF + reach) >> DF_RASTER_SUBPIXEL_BITS) + 1;
+    *x0 = bx0 > rx0 ? bx0 : rx0;
+    *y0 = by0 > ry0 ? by0 : ry0;
+    *x1 = bx1 < rx1 ? bx1 : rx1;
+    *y1 = by1 < ry1 ? by1 : ry1;
+}
+
+static void df_raster_bin(df_raster_t *raster, uint32_t index, int x0, int y0, int x1, int y1) {
+    int tx0 = x0 / DF_RASTER_TILE_SIZE, tx1 = x1 / DF_RASTER_TILE_SIZE;
+    int ty0 = y0 / DF_RASTER_TILE_SIZE, ty1 = y1 / DF_RASTER_TILE_SIZE;
+
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            df_raster_bin_t *bin = &raster->bins[ty * raster->tiles_x + tx];
+            if (bin->count == bin->capacity) {
+                uint32_t capacity = bin->capacity ? bin->capacity * 2 : 64;
+                uint32_t *grown = (uint32_t *) realloc(bin->triangles, capacity * sizeof(uint32_t));
+                if (!grown) {
+                    continue;
+                }
+                bin->triangles = grown;
+                bin->capacity = capacity;
+            }
+            bin->triangles[bin->count++] = index;
+        }
+    }
+}
+
+// Viewport transform, snapping to the sub-pixel grid and binning. Vertices
+// are the vertex stage output: position, then varyings, with w > 0 and
+// within the guard band.
+static void df_raster_setup(df_raster_t *raster, uint32_t draw, const float *v[3], int num_varyings) {
+    const df_cpu_texture_t *color = &raster->pass.target->color;
+    const df_raster_pipeline_t *pipeline = raster->draws[draw].pipeline;
+    float half_width = color->width * 0.5f, half_height = color->height * 0.5f;
+    df_raster_triangle_t t;
+    float inv_w[3];
+
+    for (int i = 0; i < 3; i++) {
+        inv_w[i] = 1.0f / v[i][3];
+        float x = (v[i][0] * inv_w[i] + 1) * half_width;
+        float y = (1 - v[i][1] * inv_w[i]) * half_height;
+        t.x[i] = (int32_t) lrintf(x * DF_RASTER_ONE);
+        t.y[i] = (int32_t) lrintf(y * DF_RASTER_ONE);
+        t.z[i] = v[i][2] * inv_w[i];
+        t.inv_w[i] = inv_w[i];
+    }
+
+    // Assembly culled faces already, but snapping can still flip or flatten
+    // a tiny triangle. With y down, counter-clockwise has a negative area.
+    int64_t area = (int64_t) (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (int64_t) (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+    bool front = (area < 0) == (pipeline->front_facing == DFWindingCounterClockwise);
+    df_cull_mode cull_mode = raster->draws[draw].cull_mode;
+    if (area == 0 || (cull_mode == DFCullModeFront && front) || (cull_mode == DFCullModeBack && !front)) {
+        return;
+    }
+
+    // One winding for the rasterizer, so every edge function is positive inside
+    int order[3] = { 0, 1, 2 };
+    if (area < 0) {
+        order[1] = 2;
+        order[2] = 1;
+        df_raster_triangle_t s = t;
+        for (int i = 0; i < 3; i++) {
+            t.x[i] = s.x[order[i]];
+            t.y[i] = s.y[order[i]];
+            t.z[i] = s.z[order[i]];
+            t.inv_w[i] = s.inv_w[order[i]];
+        }
+    }
+
+    int x0, y0, x1, y1;
+    int reach = raster->pass.target->sample_count > 1 ? DF_RASTER_SAMPLE_REACH : 0;
+    df_raster_bounds(&t, reach, 0, 0, (int) color->width, (int) color->height, &x0, &y0, &x1, &y1);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    size_t num_floats = (size_t) 3 * num_varyings;
+    if (!df_raster_reserve((void **) &raster->triangles, &raster->triangles_capacity, raster->num_triangles + 1, sizeof(df_raster_triangle_t)) ||
+        !df_raster_reserve((void **) &raster->varyings, &raster->varyings_capacity, raster->num_varyings + num_floats, sizeof(float))) {
+        return;
+    }
+
+    t.draw = draw;
+    t.varyings = (uint32_t) raster->num_varyings;
+    float *varyings = raster->varyings + raster->num_varyings;
+    for (int i = 0; i < 3; i++) {
+        const float *in = v[order[i]] + 4;
+        float w = inv_w[order[i]];
+        for (int j = 0; j < num_varyings; j++) {
+            varyings[i * num_varyings + j] = in[j] * w;
+        }
+    }
+    raster->num_varyings += num_floats;
+
+    uint32_t index = raster->num_triangles++;
+    raster->triangles[index] = t;
+    df_raster_bin(raster, index, x0, y0, x1 - 1, y1 - 1);
+}
+
+// Sutherland-Hodgman clipping of a triangle in clip space, against the near
+// plane, w > 0 and the guard band, then setup of the resulting fan. Varyings
+// are interpolated linearly in clip space, which keeps them perspective
+// correct.
+static void df_raster_clip(df_raster_t *raster, uint32_t draw, const float *v[3], int num_varyings) {
+    enum { MAX_VERTICES = 3 + 6, MAX_FLOATS = 4 + DF_RASTER_MAX_VARYINGS };
+    const df_cpu_texture_t *color = &raster->pass.target->color;
+    float gx = DF_RASTER_GUARD_BAND / (color->width * 0.5f) - 1;
+    float gy = DF_RASTER_GUARD_BAND / (color->height * 0.5f) - 1;
+    // Distance to each plane: dot with (x, y, z, w) plus a constant
+    const float planes[6][5] = {
+        { 0, 0, 1, 0, 0 },
+        { 0, 0, 0, 1, -DF_RASTER_MIN_W },
+        { -1, 0, 0, gx, 0 },
+        { 1, 0, 0, gx, 0 },
+        { 0, -1, 0, gy, 0 },
+        { 0, 1, 0, gy, 0 },
+    };
+    int num_floats = 4 + num_varyings;
+    float buffers[2][MAX_VERTICES][MAX_FLOATS];
+    float (*in)[MAX_FLOATS] = buffers[0], (*out)[MAX_FLOATS] = buffers[1];
+    int n = 3;
+    for (int i = 0; i < 3; i++) {
+        memcpy(in[i], v[i], num_floats * sizeof(float));
+    }
+
+    for (int p = 0; p < 6 && n >= 3; p++) {
+        const float *plane = planes[p];
+        float d[MAX_VERTICES];
+        bool outside = false;
+        for (int i = 0; i < n; i++) {
+            d[i] = plane[0] * in[i][0] + plane[1] * in[i][1] + plane[2] * in[i][2] + plane[3] * in[i][3] + plane[4];
+            outside = outside || !(d[i] >= 0);
+        }
+        if (!outside) {
+            continue;
+        }
+
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            int j = i + 1 < n ? i + 1 : 0;
+            if (d[i] >= 0) {
+                memcpy(out[m++], in[i], num_floats * sizeof(float));
+            }
+            if ((d[i] >= 0) != (d[j] >= 0)) {
+                float t = d[i] / (d[i] - d[j]);
+                for (int k = 0; k < num_floats; k++) {
+                    out[m][k] = in[i][k] + (in[j][k] - in[i][k]) * t;
+                }
+                m++;
+            }
+        }
+        float (*swap)[MAX_FLOATS] = in;
+        in = out;
+        out = swap;
+        n = m;
+    }
+
+    for (int i = 1; i + 1 < n; i++) {
+        const float *fan[3] = { in[0], in[i], in[i + 1] };
+        df_raster_setup(raster, draw, fan, num_varyings);
+    }
+}
+
+// Primitive assembly of `count` triangles of a draw, vertex k of triangle i
+// being vertex stage output slots[3 * i + k], or 3 * i + k without slots.
+// Four triangles at a time, it rejects the ones outside a frustum plane and
+// culls faces and zero-area triangles by the sign of the determinant of
+// their (x, y, w), which is the sign of their screen area while w > 0. The
+// ones reaching behind the near plane or out of the guard band are flagged
+// for clipping. Survivors are compacted in order into raster->assembled,
+// then set up and binned.
+static void df_raster_assemble(df_raster_t *raster, uint32_t draw, const uint32_t *slots, uint32_t count) {
+    const df_raster_pipeline_t *pipeline = raster->draws[draw].pipeline;
+    const df_cpu_texture_t *color = &raster->pass.target->color;
+    int num_varyings = pipeline->num_varyings;
+    size_t out_stride = 4 + (size_t) num_varyings;
+    if (!df_raster_reserve((void **) &raster->assembled, &raster->assembled_capacity, count, sizeof(uint32_t))) {
+        return;
+    }
+
+    const df_f32x4 zero = df_f32x4_splat(0), min_w = df_f32x4_splat(DF_RASTER_MIN_W);
+    const df_f32x4 gx = df_f32x4_splat(DF_RASTER_GUARD_BAND / (color->width * 0.5f) - 1);
+    const df_f32x4 gy = df_f32x4_splat(DF_RASTER_GUARD_BAND / (color->height * 0.5f) - 1);
+    bool ccw = pipeline->front_facing == DFWindingCounterClockwise;
+    uint32_t num_assembled = 0;
+
+    for (uint32_t first = 0; first < count; first += 4) {
+        uint32_t lanes = count - first < 4 ? count - first : 4;
+        df_f32x4 x[3], y[3], z[3], w[3];
+        int reject = 0, behind = 0, guard = 0;
+        for (int k = 0; k < 3; k++) {
+            df_f32x4 p[4];
+            for (uint32_t i = 0; i < 4; i++) {
+                uint32_t t = first + (i < lanes ? i : 0);
+                size_t slot = slots ? slots[3 * t + k] : 3 * t + k;
+                p[i] = df_f32x4_load(raster->vertices + slot * out_stride);
+            }
+            df_f32x4_transpose(&p[0], &p[1], &p[2], &p[3]);
+            x[k] = p[0];
+            y[k] = p[1];
+            z[k] = p[2];
+            w[k] = p[3];
+
+            // Outcodes: a plane rejects the triangle if all 3 vertices are past it
+            int outside[6] = {
+                df_f32x4_less_mask(w[k], x[k]), df_f32x4_less_mask(x[k], df_f32x4_sub(zero, w[k])),
+                df_f32x4_less_mask(w[k], y[k]), df_f32x4_less_mask(y[k], df_f32x4_sub(zero, w[k])),
+                df_f32x4_less_mask(w[k], z[k]), df_f32x4_less_mask(z[k], zero),
+            };
+            int all = 0;
+            for (int c = 0; c < 6; c++) {
+                all |= outside[c] << (4 * c);
+            }
+            reject = k == 0 ? all : reject & all;
+            behind |= outside[5] | df_f32x4_less_mask(w[k], min_w);
+            guard |= df_f32x4_less_mask(df_f32x4_mul(gx, w[k]), x[k]) | df_f32x4_less_mask(x[k], df_f32x4_mul(df_f32x4_sub(zero, gx), w[k])) |
+                     df_f32x4_less_mask(df_f32x4_mul(gy, w[k]), y[k]) | df_f32x4_less_mask(y[k], df_f32x4_mul(df_f32x4_sub(zero, gy), w[k]));
+        }
+        reject = (reject | reject >> 4 | reject >> 8 | reject >> 12 | reject >> 16 | reject >> 20) & 0xf;
+
+        df_f32x4 det = df_f32x4_mul(w[0], df_f32x4_sub(df_f32x4_mul(x[1], y[2]), df_f32x4_mul(x[2], y[1])));
+        det = df_f32x4_sub(det, df_f32x4_mul(y[0], df_f32x4_sub(df_f32x4_mul(x[1], w[2]), df_f32x4_mul(x[2], w[1]))));
+        det = df_f32x4_add(det, df_f32x4_mul(x[0], df_f32x4_sub(df_f32x4_mul(y[1], w[2]), df_f32x4_mul(y[2], w[1]))));
+        int front = ccw ? df_f32x4_less_mask(zero, det) : df_f32x4_less_mask(det, zero);
+        int back = ccw ? df_f32x4_less_mask(det, zero) : df_f32x4_less_mask(zero, det);
+        df_cull_mode cull_mode = raster->draws[draw].cull_mode;
+        int visible = cull_mode == DFCullModeBack ? front : cull_mode == DFCullModeFront ? back : front | back;
+
+        // The determinant means nothing for triangles reaching behind the eye
+        int keep = (visible | behind) & ~reject & ((1 << lanes) - 1);
+        int clip = behind | guard;
+        for (uint32_t i = 0; i < lanes; i++) {
+            if (keep & (1 << i)) {
+                raster->assembled[num_assembled++] = (first + i) | (clip & (1 << i) ? DF_RASTER_CLIP : 0);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < num_assembled; i++) {
+        uint32_t t = raster->assembled[i] & ~DF_RASTER_CLIP;
+        const float *v[3];
+        for (int k = 0; k < 3; k++) {
+            v[k] = raster->vertices + (slots ? slots[3 * t + k] : 3 * t + k) * out_stride;
+        }
+        if (raster->assembled[i] & DF_RASTER_CLIP) {
+            df_raster_clip(raster, draw, v, num_varyings);
+        } else {
+            df_raster_setup(raster, draw, v, num_varyings);
+        }
+    }
+}
+
+// Runs the vertex stage over `count` vertices, in parallel for big draws,
+// and records the draw. Returns its index, or -1.
+static int64_t df_raster_transform(df_raster_t *raster, const df_raster_pipeline_t *pipeline,
+                                   const void *vertices, size_t stride, const uint32_t *fetch, size_t count,
+                                   const void *vertex_uniforms, const void *fragment_uniforms) {
+    if (raster->tiles_x == 0 || !df_raster_reserve((void **) &raster->draws, &raster->draws_capacity, raster->num_draws + 1, sizeof(df_raster_draw_t))) {
+        return -1;
+    }
+
+    size_t out_stride = 4 + (size_t) pipeline->num_varyings;
+    if (!df_raster_reserve((void **) &raster->vertices, &raster->vertices_capacity, count * out_stride, sizeof(float))) {
+        return -1;
+    }
+    df_raster_vertex_job_t job = {
+        pipeline, (const uint8_t *) vertices, stride, fetch, vertex_uniforms, raster->vertices, out_stride,
+    };
+    df_parallel_for(raster->pool, count, 1024, df_raster_vertex_range, &job);
+
+    uint32_t draw = raster->num_draws++;
+    raster->draws[draw] = (df_raster_draw_t) { pipeline, vertex_uniforms, fragment_uniforms, pipeline->cull_mode };
+    return draw;
+}
+
+void df_raster_draw(df_raster_t *raster, const df_raster_pipeline_t *pipeline,
+                    const void *vertices, size_t stride, uint32_t vertex_start, uint32_t vertex_count,
+                    const void *vertex_uniforms, const void *fragment_uniforms) {
+    int num_varyings = pipeline->num_varyings;
+    if (num_varyings < 0 || num_varyings > DF_RASTER_MAX_VARYINGS || vertex_count < 3) {
+        return;
+    }
+
+    int64_t draw = df_raster_transform(raster, pipeline, (const uint8_t *) vertices + (size_t) vertex_start * stride, stride,
+                                       NULL, vertex_count, vertex_uniforms, fragment_uniforms);
+    if (draw < 0) {
+        return;
+    }
+
+    df_raster_assemble(raster, (uint32_t) draw, NULL, vertex_count / 3);
+}
+
+// Lines become quads one pixel across their minor axis, built in clip space
+// after the vertex stage so that clipping applies to them like to any
+// triangle. The ends of a segment going left or up move a sub-pixel step
+// forward: with the top-left rule that makes every segment cover its first
+// pixel but not its last, whichever way it goes.
+static void df_raster_draw_lines(df_raster_t *raster, const df_raster_pipeline_t *pipeline, bool strip,
+                                 const void *vertices, size_t stride, uint32_t vertex_start, uint32_t vertex_count,
+                                 const void *vertex_uniforms, const void *fragment_uniforms) {
+    int num_varyings = pipeline->num_varyings;
+    if (num_varyings < 0 || num_varyings > DF_RASTER_MAX_VARYINGS || vertex_count < 2) {
+        return;
+    }
+
+    int64_t draw = df_raster_transform(raster, pipeline, (const uint8_t *) vertices + (size_t) vertex_start * stride, stride,
+                                       NULL, vertex_count, vertex_uniforms, fragment_uniforms);
+    if (draw < 0) {
+        return;
+    }
+    raster->draws[draw].cull_mode = DFCullModeNone;
+
+    uint32_t segments = strip ? vertex_count - 1 : vertex_count / 2;
+    size_t out_stride = 4 + (size_t) num_varyings;
+    if (!df_raster_reserve((void **) &raster->vertices, &raster->vertices_capacity, (vertex_count + 4 * (size_t) segments) * out_stride, sizeof(float)) ||
+        !df_raster_reserve((void **) &raster->slots, &raster->slots_capacity, 6 * (size_t) segments, sizeof(uint32_t))) {
+        return;
+    }
+
+    // Half a pixel and a sub-pixel step, in NDC
+    const df_cpu_texture_t *color = &raster->pass.target->color;
+    float half_x = 1.0f / color->width, half_y = 1.0f / color->height;
+    float step_x = 2.0f / (color->width * DF_RASTER_ONE), step_y = 2.0f / (color->height * DF_RASTER_ONE);
+
+    for (uint32_t i = 0; i < segments; i++) {
+        const float *a = raster->vertices + (size_t) (strip ? i : 2 * i) * out_stride;
+        const float *b = a + out_stride;
+        uint32_t first = vertex_count + 4 * i;
+        float *quad = raster->vertices + (size_t) first * out_stride;
+
+        // Screen direction, scaled by w0 * w1 so that it stays meaningful
+        // for ends behind the eye. Screen y goes down.
+        float dx = (b[0] * a[3] - a[0] * b[3]) * color->width;
+        float dy = (a[1] * b[3] - b[1] * a[3]) * color->height;
+        float wide[2], shift[2];
+        if (fabsf(dx) >= fabsf(dy)) {
+            wide[0] = 0;
+            wide[1] = half_y;
+            shift[0] = dx < 0 ? step_x : 0;
+            shift[1] = 0;
+        } else {
+            wide[0] = half_x;
+            wide[1] = 0;
+            shift[0] = 0;
+            shift[1] = dy < 0 ? -step_y : 0;
+        }
+
+        for (int k = 0; k < 4; k++) {
+            const float *end = k < 2 ? a : b;
+            float side = k & 1 ? 1.0f : -1.0f;
+            float *v = quad + k * out_stride;
+            memcpy(v, end, out_stride * sizeof(float));
+            v[0] += (shift[0] + side * wide[0]) * end[3];
+            v[1] += (shift[1] + side * wide[1]) * end[3];
+        }
+
+        uint32_t *slots = raster->slots + 6 * i;
+        slots[0] = first;
+        slots[1] = first + 2;
+        slots[2] = first + 3;
+        slots[3] = first;
+        slots[4] = first + 3;
+        slots[5] = first + 1;
+    }
+
+    df_raster_assemble(raster, (uint32_t) draw, raster->slots, 2 * segments);
+}
+
+void df_raster_draw_primitives(df_raster_t *raster, const df_raster_pipeline_t *pipeline, df_primitive_type type,
+                               const void *vertices, size_t stride, uint32_t vertex_start, uint32_t vertex_count,
+                               const void *vertex_uniforms, const void *fragment_uniforms) {
+    switch (type) {
+        case DFPrimitiveTypeLine:
+        case DFPrimitiveTypeLineStrip:
+            df_raster_draw_lines(raster, pipeline, type == DFPrimitiveTypeLineStrip, vertices, stride, vertex_start, vertex_count,
+                                 vertex_uniforms, fragment_uniforms);
+            break;
+        case DFPrimitiveTypeTriangle:
+            df_raster_draw(raster, pipeline, vertices, stride, vertex_start, vertex_count, vertex_uniforms, fragment_uniforms);
+            break;
+    }
+}
+
+static uint32_t df_raster_next_batch(df_raster_t *raster) {
+    if (++raster->batch == 0) {
+        memset(raster->cache_batch, 0, 65536 * sizeof(uint32_t));
+        raster->batch = 1;
+    }
+    return raster->batch;
+}
+
+void df_raster_draw_indexed(df_raster_t *raster, const df_raster_pipeline_t *pipeline,
+                            const void *vertices, size_t stride, const uint16_t *indices, uint32_t index_count, uint32_t base_vertex,
+                            const void *vertex_uniforms, const void *fragment_uniforms) {
+    int num_varyings = pipeline->num_varyings;
+    if (num_varyings < 0 || num_varyings > DF_RASTER_MAX_VARYINGS || index_count < 3) {
+        return;
+    }
+    index_count -= index_count % 3;
+
+    if (!raster->cache_batch) {
+        raster->cache_batch = (uint32_t *) calloc(65536, sizeof(uint32_t));
+        raster->cache_slot = (uint32_t *) malloc(65536 * sizeof(uint32_t));
+        if (!raster->cache_batch || !raster->cache_slot) {
+            free(raster->cache_batch);
+            free(raster->cache_slot);
+            raster->cache_batch = raster->cache_slot = NULL;
+            return;
+        }
+    }
+    if (!df_raster_reserve((void **) &raster->fetch, &raster->fetch_capacity, index_count, sizeof(uint32_t)) ||
+        !df_raster_reserve((void **) &raster->slots, &raster->slots_capacity, index_count, sizeof(uint32_t))) {
+        return;
+    }
+
+    // Each vertex goes through the vertex stage once per batch. A triangle
+    // that would take the batch past its size starts a new one, so triangles
+    // never straddle batches, and batches of a draw are transformed together.
+    uint32_t batch = df_raster_next_batch(raster), batch_size = 0, count = 0;
+    for (uint32_t i = 0; i < index_count; i += 3) {
+        uint32_t misses = 0;
+        for (int k = 0; k < 3; k++) {
+            misses += raster->cache_batch[indices[i + k]] != batch;
+        }
+        if (batch_size + misses > DF_RASTER_VERTEX_BATCH) {
+            batch = df_raster_next_batch(raster);
+            batch_size = 0;
+        }
+        for (int k = 0; k < 3; k++) {
+            uint16_t index = indices[i + k];
+            if (raster->cache_batch[index] == batch) {
+                raster->cache_hits++;
+            } else {
+                raster->cache_batch[index] = batch;
+                raster->cache_slot[index] = count;
+                raster->fetch[count++] = base_vertex + index;
+                raster->cache_misses++;
+                batch_size++;
+            }
+            raster->slots[i + k] = raster->cache_slot[index];
+        }
+    }
+
+    int64_t draw = df_raster_transform(raster, pipeline, vertices, stride, raster->fetch, count, vertex_uniforms, fragment_uniforms);
+    if (draw < 0) {
+        return;
+    }
+
+    df_raster_assemble(raster, (uint32_t) draw, raster->slots, index_count / 3);
+}
+
+static inline void df_raster_pack(const float color[4], bool srgb, const uint8_t *srgb_lut, uint8_t *out) {
+    uint32_t pixel = df_f32x4_to_unorm8(df_f32x4_load(color));
+    if (srgb) {
+        pixel &= 0xff000000u;
+        for (int c = 0; c < 3; c++) {
+            float l = color[c] > 0 ? (color[c] < 1 ? color[c] : 1) : 0;
+            pixel |= (uint32_t) srgb_lut[(int) (l * 65535.0f + 0.5f)] << (8 * c);
+        }
+    }
+    memcpy(out, &pixel, 4);
+}
+
+static inline bool df_raster_depth_passes(df_compare_function compare, float z, float stored) {
+    switch (compare) {
+        case DFCompareNever: return false;
+        case DFCompareLess: return z < stored;
+        case DFCompareEqual: return z == stored;
+        case DFCompareLessEqual: return z <= stored;
+        case DFCompareGreater: return z > stored;
+        case DFCompareNotEqual: return z != stored;
+        case DFCompareGreaterEqual: return z >= stored;
+        case DFCompareAlways: return true;
+    }
+    return true;
+}
+
+// df_raster_depth_passes for the 4 samples of a pixel, as a mask
+static inline int df_raster_depth_mask(df_compare_function compare, df_f32x4 z, const float *stored) {
+    df_f32x4 d = df_f32x4_load(stored);
+    switch (compare) {
+        case DFCompareLess: return df_f32x4_less_mask(z, d);
+        case DFCompareLessEqual: return df_f32x4_less_equal_mask(z, d);
+        case DFCompareGreater: return df_f32x4_less_mask(d, z);
+        case DFCompareGreaterEqual: return df_f32x4_less_equal_mask(d, z);
+        default: break;
+    }
+
+    float values[4];
+    df_f32x4_store(values, z);
+    int mask = 0;
+    for (int i = 0; i < 4; i++) {
+        mask |= df_raster_depth_passes(compare, values[i], stored[i]) << i;
+    }
+    return mask;
+}
+
+// Top-left fill rule: a pixel centre exactly on an edge belongs to the
+// triangle only if that edge is a top edge (horizontal, interior below) or
+// a left edge. Edges shared by two triangles are then drawn exactly once.
+static inline bool df_raster_is_top_left(int32_t dx, int32_t dy) {
+    return dy < 0 || (dy == 0 && dx > 0);
+}
+
+// The three edge functions of a triangle, E(x, y) = c + x * step_x +
+// y * step_y at the centre of pixel (x, y). Edge e is the one opposite
+// vertex e, so E is (twice) the area weighting vertex e. The fill rule is
+// folded into `bias`: a pixel is inside when every E + bias >= 0.
+typedef struct {
+    int64_t c[3];
+    int64_t step_x[3];
+    int64_t step_y[3];
+    int64_t bias[3];
+    int64_t block_min[3];     // Smallest and largest E at any sample of an
+    int64_t block_max[3];     // 8x8 block, relative to its first pixel
+    int64_t sample[3][DF_RASTER_MAX_SAMPLES]; // E at each sample, relative to the pixel centre
+    bool narrow;              // Any E across an 8x8 block fits in 32 bits
+} df_raster_edges_t;
+
+// Depth of the tile being drawn: the target's, or tile-local scratch for a
+// pass that neither loads nor stores it
+typedef struct {
+    float *data;
+    size_t pitch;             // Floats per row
+    int x;                    // Pixel stored at data[0]
+    int y;
+    uint32_t samples;
+} df_raster_depth_t;
+
+static inline float *df_raster_depth_at(const df_raster_depth_t *depth, int x, int y) {
+    return depth->data + (size_t) (y - depth->y) * depth->pitch + (size_t) (x - depth->x) * depth->samples;
+}
+
+// What the fragment loop needs to know about the triangle being drawn
+typedef struct {
+    const df_raster_triangle_t *t;
+    const df_raster_draw_t *draw;
+    df_render_target_t *target;
+    const float *varyings;
+    int num_varyings;
+    bool depth_test;
+    bool depth_write;
+    const uint8_t *srgb_lut;
+    float inv_area;
+    bool perspective;         // False when w is the same at every vertex
+    float w;                  // That w otherwise
+    float b_dx[3];            // Barycentric steps for one pixel in x / y
+    float b_dy[3];
+    bool late_z;
+    bool hiz_test;            // Blocks can be rejected on the Hi-Z bounds
+    float *hiz;               // NULL when Hi-Z is off
+    uint32_t hiz_stride;
+    float z_dx;               // Depth plane steps, for block bounds
+    float z_dy;
+    float z_min;
+    float z_max;
+    float block_lo;           // Sample extent of a block from its first pixel centre
+    float block_hi;
+    bool msaa;
+    float sample_z[DF_RASTER_MAX_SAMPLES]; // Depth at each sample, relative to the pixel centre
+    float sample_z_reach;     // Largest |sample_z|
+    df_msaa_tile_t *msaa_tile;
+    int tile_x;
+    int tile_y;
+    df_raster_depth_t depth;
+} df_raster_shader_t;
+
+// Edge functions for samples up to `reach` sub-pixel units from the centre
+static void df_raster_edges(const df_raster_triangle_t *t, int reach, df_raster_edges_t *edges) {
+    const int64_t lo = -reach, hi = (DF_RASTER_BLOCK_SIZE - 1) * DF_RASTER_ONE + reach;
+    const int64_t limit = INT32_MAX / (2 * DF_RASTER_BLOCK_SIZE);
+
+    edges->narrow = true;
+    for (int e = 0; e < 3; e++) {
+        int a = (e + 1) % 3, b = (e + 2) % 3;
+        int32_t dx = t->x[b] - t->x[a], dy = t->y[b] - t->y[a];
+        int64_t sx = -(int64_t) dy * DF_RASTER_ONE, sy = (int64_t) dx * DF_RASTER_ONE;
+        edges->step_x[e] = sx;
+        edges->step_y[e] = sy;
+        edges->c[e] = (int64_t) dx * (DF_RASTER_HALF - t->y[a]) - (int64_t) dy * (DF_RASTER_HALF - t->x[a]);
+        edges->bias[e] = df_raster_is_top_left(dx, dy) ? 0 : -1;
+        edges->block_min[e] = (dy > 0 ? -dy * hi : -dy * lo) + (dx < 0 ? dx * hi : dx * lo);
+        edges->block_max[e] = (dy > 0 ? -dy * lo : -dy * hi) + (dx < 0 ? dx * lo : dx * hi);
+        for (int i = 0; i < DF_RASTER_MAX_SAMPLES; i++) {
+            edges->sample[e][i] = -(int64_t) dy * df_raster_samples[i][0] + (int64_t) dx * df_raster_samples[i][1];
+        }
+        edges->narrow = edges->narrow && llabs(sx) + llabs(sy) < limit;
+    }
+}
+
+// Varyings at barycentrics (b0, b1, b2) of the screen-space triangle.
+// Perspective-correct: varyings / w and 1 / w are linear in screen space.
+// With the same w at every vertex that is a constant.
+static inline void df_raster_interpolate(const df_raster_shader_t *s, float b0, float b1, float b2, float *out) {
+    const df_raster_triangle_t *t = s->t;
+    const float *v = s->varyings;
+    int n = s->num_varyings;
+
+    float w = s->perspective ? 1.0f / (b0 * t->inv_w[0] + b1 * t->inv_w[1] + b2 * t->inv_w[2]) : s->w;
+    b0 *= w;
+    b1 *= w;
+    b2 *= w;
+    int j = 0;
+    for (df_f32x4 w0 = df_f32x4_splat(b0), w1 = df_f32x4_splat(b1), w2 = df_f32x4_splat(b2); j + 4 <= n; j += 4) {
+        df_f32x4 r = df_f32x4_mul(w0, df_f32x4_load(v + j));
+        r = df_f32x4_madd(w1, df_f32x4_load(v + n + j), r);
+        df_f32x4_store(out + j, df_f32x4_madd(w2, df_f32x4_load(v + 2 * n + j), r));
+    }
+    for (; j < n; j++) {
+        out[j] = b0 * v[j] + b1 * v[n + j] + b2 * v[2 * n + j];
+    }
+}
+
+// Appends the change of the varyings one pixel right and one pixel down:
+// the forward differences a 2x2 quad gives its top-left pixel on the GPU
+static void df_raster_derivatives(const df_raster_shader_t *s, float b0, float b1, float b2, float *varyings) {
+    int n = s->num_varyings;
+    float *dx = varyings + n, *dy = varyings + 2 * n;
+    df_raster_interpolate(s, b0 + s->b_dx[0], b1 + s->b_dx[1], b2 + s->b_dx[2], dx);
+    df_raster_interpolate(s, b0 + s->b_dy[0], b1 + s->b_dy[1], b2 + s->b_dy[2], dy);
+    for (int j = 0; j < n; j++) {
+        dx[j] -= varyings[j];
+        dy[j] -= varyings[j];
+    }
+}
+
+// Shades the pixels of row y set in `mask`, bit i being pixel x + i, from
+// the barycentrics at x and their step along the row. Returns whether any
+// depth was written.
+static inline bool df_raster_shade(const df_raster_shader_t *s, int x, int y, int mask, const float b[3], const float b_dx[3]) {
+    const df_raster_triangle_t *t = s->t;
+    const df_raster_pipeline_t *pipeline = s->draw->pipeline;
+    const void *uniforms = s->draw->fragment_uniforms;
+    df_render_target_t *target = s->target;
+    uint8_t *color_row = target->color.data + (size_t) y * target->color.bytes_per_row + (size_t) x * 4;
+    float *depth_row = s->depth_test ? df_raster_depth_at(&s->depth, x, y) : NULL;
+    float *hiz_row = s->hiz ? s->hiz + (size_t) (y / DF_RASTER_BLOCK_SIZE) * s->hiz_stride * 2 : NULL;
+    bool written = false;
+
+    while (mask) {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        float b0 = b[0] + i * b_dx[0], b1 = b[1] + i * b_dx[1], b2 = b[2] + i * b_dx[2];
+        float z = b0 * t->z[0] + b1 * t->z[1] + b2 * t->z[2];
+        if (z < 0 || z > 1) {
+            continue;
+        }
+        if (depth_row && !s->late_z && !df_raster_depth_passes(pipeline->depth_compare, z, depth_row[i])) {
+            continue;
+        }
+
+        float varyings[3 * DF_RASTER_MAX_VARYINGS];
+        df_raster_interpolate(s, b0, b1, b2, varyings);
+        if (pipeline->derivatives) {
+            df_raster_derivatives(s, b0, b1, b2, varyings);
+        }
+
+        float color[4];
+        if (!pipeline->fragment(varyings, uniforms, color, &z)) {
+            continue;
+        }
+        if (s->late_z) {
+            z = z > 0 ? (z < 1 ? z : 1) : 0;
+            if (depth_row && !df_raster_depth_passes(pipeline->depth_compare, z, depth_row[i])) {
+                continue;
+            }
+        }
+
+        df_raster_pack(color, target->srgb, s->srgb_lut, color_row + i * 4);
+        if (s->depth_write) {
+            depth_row[i] = z;
+            written = true;
+            if (hiz_row) {
+                float *bounds = hiz_row + (x + i) / DF_RASTER_BLOCK_SIZE * 2;
+                bounds[0] = z < bounds[0] ? z : bounds[0];
+                bounds[1] = z > bounds[1] ? z : bounds[1];
+            }
+        }
+    }
+    return written;
+}
+
+// Gives the block at (bx, by) per-sample storage, each sample starting from
+// the pixel's colour. Returns its slot, 0 when out of memory.
+static uint32_t df_raster_msaa_expand(df_msaa_tile_t *tile, const df_render_target_t *target, int bx, int by, int block) {
+    if (tile->count == tile->capacity) {
+        uint32_t capacity = tile->capacity ? tile->capacity * 2 : 4;
+        uint32_t *grown = (uint32_t *) realloc(tile->samples, (size_t) capacity * DF_RASTER_BLOCK_PIXELS * DF_RASTER_MAX_SAMPLES * sizeof(uint32_t));
+        if (!grown) {
+            return 0;
+        }
+        tile->samples = grown;
+        tile->capacity = capacity;
+    }
+
+    uint32_t *samples = tile->samples + (size_t) tile->count * DF_RASTER_BLOCK_PIXELS * DF_RASTER_MAX_SAMPLES;
+    memset(samples, 0, DF_RASTER_BLOCK_PIXELS * DF_RASTER_MAX_SAMPLES * sizeof(uint32_t));
+    int x1 = bx + DF_RASTER_BLOCK_SIZE < (int) target->color.width ? bx + DF_RASTER_BLOCK_SIZE : (int) target->color.width;
+    int y1 = by + DF_RASTER_BLOCK_SIZE < (int) target->color.height ? by + DF_RASTER_BLOCK_SIZE : (int) target->color.height;
+    for (int y = by; y < y1; y++) {
+        const uint8_t *row = target->color.data + (size_t) y * target->color.bytes_per_row;
+        for (int x = bx; x < x1; x++) {
+            uint32_t pixel;
+            memcpy(&pixel, row + (size_t) x * 4, 4);
+            uint32_t *out = samples + ((y - by) * DF_RASTER_BLOCK_SIZE + x - bx) * DF_RASTER_MAX_SAMPLES;
+            out[0] = out[1] = out[2] = out[3] = pixel;
+        }
+    }
+    tile->slot[block] = (uint8_t) ++tile->count;
+    return tile->count;
+}
+
+// Writes `color` to the samples of pixel (x, y) set in `mask`. Fully covered
+// pixels of compressed blocks keep them compressed.
+static inline void df_raster_msaa_write(const df_raster_shader_t *s, int x, int y, int mask, uint32_t color) {
+    df_msaa_tile_t *tile = s->msaa_tile;
+    int px = x - s->tile_x, py = y - s->tile_y;
+    int block = py / DF_RASTER_BLOCK_SIZE * (DF_RASTER_TILE_SIZE / DF_RASTER_BLOCK_SIZE) + px / DF_RASTER_BLOCK_SIZE;
+    uint32_t slot = tile->slot[block];
+
+    if (!slot) {
+        if (mask == 0xf) {
+            memcpy(s->target->color.data + (size_t) y * s->target->color.bytes_per_row + (size_t) x * 4, &color, 4);
+            return;
+        }
+        slot = df_raster_msaa_expand(tile, s->target, x - px % DF_RASTER_BLOCK_SIZE, y - py % DF_RASTER_BLOCK_SIZE, block);
+        if (!slot) {
+            return;
+        }
+    }
+
+    uint32_t *samples = tile->samples + ((size_t) (slot - 1) * DF_RASTER_BLOCK_PIXELS +
+                                         (py % DF_RASTER_BLOCK_SIZE) * DF_RASTER_BLOCK_SIZE + px % DF_RASTER_BLOCK_SIZE) * DF_RASTER_MAX_SAMPLES;
+    for (int i = 0; i < DF_RASTER_MAX_SAMPLES; i++) {
+        if (mask & (1 << i)) {
+            samples[i] = color;
+        }
+    }
+}
+
+// df_raster_shade with 4 samples: `cover` has the samples of pixel x + i in
+// bits 4i to 4i + 3. The fragment stage runs once for each pixel with a
+// sample passing the depth test, at the pixel centre.
+static inline bool df_raster_shade_msaa(const df_raster_shader_t *s, int x, int y, uint32_t cover, const float b[3], const float b_dx[3]) {
+    const df_raster_triangle_t *t = s->t;
+    const df_raster_pipeline_t *pipeline = s->draw->pipeline;
+    const void *uniforms = s->draw->fragment_uniforms;
+    float *depth_row = s->depth_test ? df_raster_depth_at(&s->depth, x, y) : NULL;
+    float *hiz_row = s->hiz ? s->hiz + (size_t) (y / DF_RASTER_BLOCK_SIZE) * s->hiz_stride * 2 : NULL;
+    const df_f32x4 zero = df_f32x4_splat(0), one = df_f32x4_splat(1), offsets = df_f32x4_load(s->sample_z);
+    bool written = false;
+
+    while (cover) {
+        int i = __builtin_ctz(cover) / DF_RASTER_MAX_SAMPLES;
+        int covered = (cover >> (DF_RASTER_MAX_SAMPLES * i)) & 0xf;
+        cover &= ~(0xfu << (DF_RASTER_MAX_SAMPLES * i));
+
+        // Depth clipping and the early test, all samples at once
+        float b0 = b[0] + i * b_dx[0], b1 = b[1] + i * b_dx[1], b2 = b[2] + i * b_dx[2];
+        float z = b0 * t->z[0] + b1 * t->z[1] + b2 * t->z[2];
+        float *depth = depth_row ? depth_row + i * DF_RASTER_MAX_SAMPLES : NULL;
+        df_f32x4 sample_z = df_f32x4_add(df_f32x4_splat(z), offsets);
+        int passed = covered & df_f32x4_less_equal_mask(zero, sample_z) & df_f32x4_less_equal_mask(sample_z, one);
+        if (passed && depth && !s->late_z) {
+            passed &= df_raster_depth_mask(pipeline->depth_compare, sample_z, depth);
+        }
+        if (!passed) {
+            continue;
+        }
+
+        float varyings[3 * DF_RASTER_MAX_VARYINGS];
+        df_raster_interpolate(s, b0, b1, b2, varyings);
+        if (pipeline->derivatives) {
+            df_raster_derivatives(s, b0, b1, b2, varyings);
+        }
+
+        float color[4];
+        if (!pipeline->fragment(varyings, uniforms, color, &z)) {
+            continue;
+        }
+        float reach = s->sample_z_reach;
+        if (s->late_z) {
+            // Fragment depth is per pixel, so every sample gets it
+            z = z > 0 ? (z < 1 ? z : 1) : 0;
+            sample_z = df_f32x4_splat(z);
+            reach = 0;
+            if (depth && !(passed &= df_raster_depth_mask(pipeline->depth_compare, sample_z, depth))) {
+                continue;
+            }
+        }
+
+        uint32_t pixel;
+        df_raster_pack(color, s->target->srgb, s->srgb_lut, (uint8_t *) &pixel);
+        df_raster_msaa_write(s, x + i, y, passed, pixel);
+        if (s->depth_write) {
+            if (passed == 0xf) {
+                df_f32x4_store(depth, sample_z);
+            } else {
+                float values[DF_RASTER_MAX_SAMPLES];
+                df_f32x4_store(values, sample_z);
+                for (int j = 0; j < DF_RASTER_MAX_SAMPLES; j++) {
+                    depth[j] = passed & (1 << j) ? values[j] : depth[j];
+                }
+            }
+            if (hiz_row) {
+                float *bounds = hiz_row + (x + i) / DF_RASTER_BLOCK_SIZE * 2;
+                bounds[0] = z - reach < bounds[0] ? z - reach : bounds[0];
+                bounds[1] = z + reach > bounds[1] ? z + reach : bounds[1];
+            }
+            written = true;
+        }
+    }
+    return written;
+}
+
+// Exact Hi-Z bounds of the block at (bx, by), clipped to [bx, x1) x [by, y1)
+static void df_raster_hiz_update(float *hiz, uint32_t hiz_stride, const df_raster_depth_t *depth, int bx, int by, int x1, int y1) {
+    size_t end = (size_t) (x1 - bx) * depth->samples;
+    df_f32x4 lo4 = df_f32x4_splat(INFINITY), hi4 = df_f32x4_splat(-INFINITY);
+    float lo = INFINITY, hi = -INFINITY;
+    for (int y = by; y < y1; y++) {
+        const float *row = df_raster_depth_at(depth, bx, y);
+        size_t i = 0;
+        for (; i + 4 <= end; i += 4) {
+            df_f32x4 d = df_f32x4_load(row + i);
+            lo4 = df_f32x4_min(lo4, d);
+            hi4 = df_f32x4_max(hi4, d);
+        }
+        for (; i < end; i++) {
+            lo = row[i] < lo ? row[i] : lo;
+            hi = row[i] > hi ? row[i] : hi;
+        }
+    }
+    float l[4], h[4];
+    df_f32x4_store(l, lo4);
+    df_f32x4_store(h, hi4);
+    for (int i = 0; i < 4; i++) {
+        lo = l[i] < lo ? l[i] : lo;
+        hi = h[i] > hi ? h[i] : hi;
+    }
+    float *bounds = hiz + ((size_t) (by / DF_RASTER_BLOCK_SIZE) * hiz_stride + bx / DF_RASTER_BLOCK_SIZE) * 2;
+    bounds[0] = lo;
+    bounds[1] = hi;
+}
+
+// Whether no fragment of the triangle in the block at (bx, by) can pass the
+// depth test, from the depth plane's range over the block (widened a little
+// for rounding) against the block's Hi-Z bounds
+static inline bool df_raster_hiz_rejects(const df_raster_shader_t *s, const float b[3], int bx, int by) {
+    const float epsilon = 1e-5f;
+    const df_raster_triangle_t *t = s->t;
+    float z = b[0] * t->z[0] + b[1] * t->z[1] + b[2] * t->z[2];
+    float dx0 = s->z_dx * s->block_lo, dx1 = s->z_dx * s->block_hi;
+    float dy0 = s->z_dy * s->block_lo, dy1 = s->z_dy * s->block_hi;
+    float lo = z + fminf(dx0, dx1) + fminf(dy0, dy1) - epsilon;
+    float hi = z + fmaxf(dx0, dx1) + fmaxf(dy0, dy1) + epsilon;
+    lo = lo > s->z_min ? lo : s->z_min;
+    hi = hi < s->z_max ? hi : s->z_max;
+
+    const float *bounds = s->hiz + ((size_t) (by / DF_RASTER_BLOCK_SIZE) * s->hiz_stride + bx / DF_RASTER_BLOCK_SIZE) * 2;
+    switch (s->draw->pipeline->depth_compare) {
+        case DFCompareLess: return lo >= bounds[1];
+        case DFCompareLessEqual: return lo > bounds[1];
+        case DFCompareGreater: return hi <= bounds[0];
+        case DFCompareGreaterEqual: return hi < bounds[0];
+        default: return false;
+    }
+}
+
+// Bit i of `mask` to bit 4i
+static inline uint32_t df_raster_spread(uint32_t mask) {
+    mask = (mask | mask << 12) & 0x000f000fu;
+    mask = (mask | mask << 6) & 0x03030303u;
+    return (mask | mask << 3) & 0x11111111u;
+}
+
+// The rows of a 4x block, from the edge functions at its first pixel
+static bool df_raster_block_msaa(const df_raster_shader_t *s, const df_raster_edges_t *edges, const int64_t e[3], int crossing,
+                                 float b[3], int bx, int by, int x1, int y1) {
+    uint32_t columns = df_raster_spread((1u << (x1 - bx)) - 1) * 0xf;
+    bool written = false;
+
+    if (!crossing) {
+        for (int y = by; y < y1; y++, b[0] += s->b_dy[0], b[1] += s->b_dy[1], b[2] += s->b_dy[2]) {
+            written |= df_raster_shade_msaa(s, bx, y, columns, b, s->b_dx);
+        }
+    } else if (edges->narrow) {
+        // As in the single sample case, each sample being the pixel
+        // centre's vectors plus a constant
+        df_i32x4 left[3], right[3], step[3], offset[3][DF_RASTER_MAX_SAMPLES];
+        int n = 0;
+        for (int i = 0; i < 3; i++) {
+            if (crossing & (1 << i)) {
+                int32_t sx = (int32_t) edges->step_x[i];
+                left[n] = df_i32x4_add(df_i32x4_splat((int32_t) e[i]), df_i32x4_set(0, sx, 2 * sx, 3 * sx));
+                right[n] = df_i32x4_add(left[n], df_i32x4_splat(4 * sx));
+                step[n] = df_i32x4_splat((int32_t) edges->step_y[i]);
+                for (int j = 0; j < DF_RASTER_MAX_SAMPLES; j++) {
+                    offset[n][j] = df_i32x4_splat((int32_t) edges->sample[i][j]);
+                }
+                n++;
+            }
+        }
+
+        for (int y = by; y < y1; y++, b[0] += s->b_dy[0], b[1] += s->b_dy[1], b[2] += s->b_dy[2]) {
+            uint32_t cover = 0;
+            for (int j = 0; j < DF_RASTER_MAX_SAMPLES; j++) {
+                df_i32x4 l = df_i32x4_add(left[0], offset[0][j]), r = df_i32x4_add(right[0], offset[0][j]);
+                for (int i = 1; i < n; i++) {
+                    l = df_i32x4_or(l, df_i32x4_add(left[i], offset[i][j]));
+                    r = df_i32x4_or(r, df_i32x4_add(right[i], offset[i][j]));
+                }
+                int outside = df_i32x4_sign_mask(l) | df_i32x4_sign_mask(r) << 4;
+                cover |= df_raster_spread(~outside & 0xff) << j;
+            }
+            written |= df_raster_shade_msaa(s, bx, y, cover & columns, b, s->b_dx);
+
+            for (int i = 0; i < n; i++) {
+                left[i] = df_i32x4_add(left[i], step[i]);
+                right[i] = df_i32x4_add(right[i], step[i]);
+            }
+        }
+    } else {
+        for (int y = by; y < y1; y++, b[0] += s->b_dy[0], b[1] += s->b_dy[1], b[2] += s->b_dy[2]) {
+            uint32_t cover = 0;
+            for (int x = 0; x < x1 - bx; x++) {
+                for (int j = 0; j < DF_RASTER_MAX_SAMPLES; j++) {
+                    bool inside = true;
+                    for (int i = 0; i < 3; i++) {
+                        if (crossing & (1 << i)) {
+                            inside = inside && e[i] + (y - by) * edges->step_y[i] + x * edges->step_x[i] + edges->sample[i][j] >= 0;
+                        }
+                    }
+                    cover |= (uint32_t) inside << (DF_RASTER_MAX_SAMPLES * x + j);
+                }
+            }
+            written |= df_raster_shade_msaa(s, bx, y, cover, b, s->b_dx);
+        }
+    }
+    return written;
+}
+
+// One 8x8 block at (bx, by), clipped to [bx, x1) x [by, y1). The edge
+// functions at the corner pixels bound the whole block: if one edge is
+// negative at all four the block is skipped, if every edge is non-negative
+// at all four it is filled without per-pixel tests. Otherwise only the
+// edges crossing the block are evaluated, 8 pixels per step.
+static void df_raster_block(const df_raster_shader_t *s, const df_raster_edges_t *edges, int bx, int by, int x1, int y1) {
+    int64_t e[3];
+    int crossing = 0;
+    for (int i = 0; i < 3; i++) {
+        e[i] = edges->c[i] + bx * edges->step_x[i] + by * edges->step_y[i] + edges->bias[i];
+        if (e[i] + edges->block_max[i] < 0) {
+            return;
+        }
+        if (e[i] + edges->block_min[i] < 0) {
+            crossing |= 1 << i;
+        }
+    }
+
+    float b[3];
+    for (int i = 0; i < 3; i++) {
+        b[i] = (float) (e[i] - edges->bias[i]) * s->inv_area;
+    }
+    if (s->hiz_test && df_raster_hiz_rejects(s, b, bx, by)) {
+        return;
+    }
+
+    int columns = (1 << (x1 - bx)) - 1;
+    bool written = false;
+    if (s->msaa) {
+        written = df_raster_block_msaa(s, edges, e, crossing, b, bx, by, x1, y1);
+    } else if (!crossing) {
+        for (int y = by; y < y1; y++, b[0] += s->b_dy[0], b[1] += s->b_dy[1], b[2] += s->b_dy[2]) {
+            written |= df_raster_shade(s, bx, y, columns, b, s->b_dx);
+        }
+    } else if (edges->narrow) {
+        // Every value of a crossing edge inside the block lies between its
+        // corner values, so it fits in 32 bits: 8 pixels in two vectors,
+        // stepped a row at a time
+        df_i32x4 left[3], right[3], step[3];
+        int n = 0;
+        for (int i = 0; i < 3; i++) {
+            if (crossing & (1 << i)) {
+                int32_t sx = (int32_t) edges->step_x[i];
+                left[n] = df_i32x4_add(df_i32x4_splat((int32_t) e[i]), df_i32x4_set(0, sx, 2 * sx, 3 * sx));
+                right[n] = df_i32x4_add(left[n], df_i32x4_splat(4 * sx));
+                step[n++] = df_i32x4_splat((int32_t) edges->step_y[i]);
+            }
+        }
+
+        for (int y = by; y < y1; y++, b[0] += s->b_dy[0], b[1] += s->b_dy[1], b[2] += s->b_dy[2]) {
+            df_i32x4 l = left[0], r = right[0];
+            for (int i = 1; i < n; i++) {
+                l = df_i32x4_or(l, left[i]);
+                r = df_i32x4_or(r, right[i]);
+            }
+            int outside = df_i32x4_sign_mask(l) | df_i32x4_sign_mask(r) << 4;
+            written |= df_raster_shade(s, bx, y, ~outside & columns, b, s->b_dx);
+
+            for (int i = 0; i < n; i++) {
+                left[i] = df_i32x4_add(left[i], step[i]);
+                right[i] = df_i32x4_add(right[i], step[i]);
+            }
+        }
+    } else {
+        for (int y = by; y < y1; y++, b[0] += s->b_dy[0], b[1] += s->b_dy[1], b[2] += s->b_dy[2]) {
+            int outside = 0;
+            for (int i = 0; i < 3; i++) {
+                if (crossing & (1 << i)) {
+                    int64_t row = e[i] + (y - by) * edges->step_y[i];
+                    for (int x = 0; x < DF_RASTER_BLOCK_SIZE; x++) {
+                        outside |= (row + x * edges->step_x[i] < 0) << x;
+                    }
+                }
+            }
+            written |= df_raster_shade(s, bx, y, ~outside & columns, b, s->b_dx);
+        }
+    }
+
+    // Writes only widen the bounds; tighten them again so later triangles
+    // behind this one get rejected
+    if (written && s->hiz) {
+        df_raster_hiz_update(s->hiz, s->hiz_stride, &s->depth, bx, by, x1, y1);
+    }
+}
+
+// Triangles covering a handful of pixels, tested one by one: cheaper than
+// classifying the blocks around them
+static void df_raster_small(const df_raster_shader_t *s, const df_raster_edges_t *edges, int x0, int y0, int x1, int y1) {
+    int64_t e[3];
+    float b[3];
+    for (int i = 0; i < 3; i++) {
+        e[i] = edges->c[i] + x0 * edges->step_x[i] + y0 * edges->step_y[i] + edges->bias[i];
+        b[i] = (float) (e[i] - edges->bias[i]) * s->inv_area;
+    }
+
+    for (int y = y0; y < y1; y++, b[0] += s->b_dy[0], b[1] += s->b_dy[1], b[2] += s->b_dy[2]) {
+        uint32_t inside = 0;
+        int64_t e0 = e[0], e1 = e[1], e2 = e[2];
+        for (int x = 0; x < x1 - x0; x++, e0 += edges->step_x[0], e1 += edges->step_x[1], e2 += edges->step_x[2]) {
+            if (s->msaa) {
+                for (int j = 0; j < DF_RASTER_MAX_SAMPLES; j++) {
+                    int64_t any = (e0 + edges->sample[0][j]) | (e1 + edges->sample[1][j]) | (e2 + edges->sample[2][j]);
+                    inside |= (uint32_t) (any >= 0) << (DF_RASTER_MAX_SAMPLES * x + j);
+                }
+            } else {
+                inside |= (uint32_t) ((e0 | e1 | e2) >= 0) << x;
+            }
+        }
+        if (s->msaa) {
+            df_raster_shade_msaa(s, x0, y, inside, b, s->b_dx);
+        } else {
+            df_raster_shade(s, x0, y, (int) inside, b, s->b_dx);
+        }
+
+        e[0] += edges->step_y[0];
+        e[1] += edges->step_y[1];
+        e[2] += edges->step_y[2];
+    }
+}
+
+// Rasterizes one binned triangle inside the tile [tx0, tx1) x [ty0, ty1),
+// block by block. Tiles start on a block boundary.
+static void df_raster_triangle(const df_raster_t *raster, const df_raster_triangle_t *t, int tx0, int ty0, int tx1, int ty1,
+                               const df_raster_depth_t *depth, const uint8_t *srgb_lut) {
+    df_render_target_t *target = raster->pass.target;
+    int reach = target->sample_count > 1 ? DF_RASTER_SAMPLE_REACH : 0;
+    int x0, y0, x1, y1;
+    df_raster_bounds(t, reach, tx0, ty0, tx1, ty1, &x0, &y0, &x1, &y1);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    const df_raster_draw_t *draw = &raster->draws[t->draw];
+    bool depth_test = draw->pipeline->depth_test && target->depth;
+    int64_t area = (int64_t) (t->x[1] - t->x[0]) * (t->y[2] - t->y[0]) - (int64_t) (t->x[2] - t->x[0]) * (t->y[1] - t->y[0]);
+    df_raster_shader_t shader = {
+        t, draw, target, raster->varyings + t->varyings, draw->pipeline->num_varyings,
+        depth_test, depth_test && draw->pipeline->depth_write, srgb_lut, 1.0f / (float) area,
+        t->inv_w[0] != t->inv_w[1] || t->inv_w[0] != t->inv_w[2], 1.0f / t->inv_w[0],
+    };
+    df_raster_edges_t edges;
+    df_raster_edges(t, reach, &edges);
+    for (int i = 0; i < 3; i++) {
+        shader.b_dx[i] = (float) edges.step_x[i] * shader.inv_area;
+        shader.b_dy[i] = (float) edges.step_y[i] * shader.inv_area;
+    }
+
+    df_compare_function compare = draw->pipeline->depth_compare;
+    if (depth_test && compare == DFCompareNever) {
+        return;
+    }
+    shader.depth = *depth;
+    shader.late_z = draw->pipeline->writes_depth;
+    shader.hiz = target->depth && !raster->hiz_disabled ? raster->hiz : NULL;
+    shader.hiz_test = depth_test && shader.hiz && !shader.late_z &&
+                      (compare == DFCompareLess || compare == DFCompareLessEqual || compare == DFCompareGreater || compare == DFCompareGreaterEqual);
+    shader.hiz_stride = raster->hiz_stride;
+    shader.z_dx = shader.b_dx[0] * t->z[0] + shader.b_dx[1] * t->z[1] + shader.b_dx[2] * t->z[2];
+    shader.z_dy = shader.b_dy[0] * t->z[0] + shader.b_dy[1] * t->z[1] + shader.b_dy[2] * t->z[2];
+    shader.z_min = fminf(t->z[0], fminf(t->z[1], t->z[2]));
+    shader.z_max = fmaxf(t->z[0], fmaxf(t->z[1], t->z[2]));
+    shader.block_lo = -(float) reach / DF_RASTER_ONE;
+    shader.block_hi = DF_RASTER_BLOCK_SIZE - 1 + (float) reach / DF_RASTER_ONE;
+    shader.msaa = target->sample_count > 1;
+    if (shader.msaa) {
+        for (int i = 0; i < DF_RASTER_MAX_SAMPLES; i++) {
+            shader.sample_z[i] = (shader.z_dx * df_raster_samples[i][0] + shader.z_dy * df_raster_samples[i][1]) / DF_RASTER_ONE;
+            shader.sample_z_reach = fmaxf(shader.sample_z_reach, fabsf(shader.sample_z[i]));
+        }
+        shader.msaa_tile = &target->msaa[(ty0 / DF_RASTER_TILE_SIZE) * raster->tiles_x + tx0 / DF_RASTER_TILE_SIZE];
+        shader.tile_x = tx0;
+        shader.tile_y = ty0;
+    }
+
+    if (x1 - x0 <= DF_RASTER_SMALL && y1 - y0 <= DF_RASTER_SMALL) {
+        df_raster_small(&shader, &edges, x0, y0, x1, y1);
+        return;
+    }
+
+    const int mask = ~(DF_RASTER_BLOCK_SIZE - 1);
+    for (int by = y0 & mask; by < y1; by += DF_RASTER_BLOCK_SIZE) {
+        int block_y1 = by + DF_RASTER_BLOCK_SIZE < ty1 ? by + DF_RASTER_BLOCK_SIZE : ty1;
+        for (int bx = x0 & mask; bx < x1; bx += DF_RASTER_BLOCK_SIZE) {
+            int block_x1 = bx + DF_RASTER_BLOCK_SIZE < tx1 ? bx + DF_RASTER_BLOCK_SIZE : tx1;
+            df_raster_block(&shader, &edges, bx, by, block_x1, block_y1);
+        }
+    }
+}
+
+// Averages the 4 samples of each of `count` pixels. sRGB samples are
+// averaged in linear space, like the GPU resolve of an sRGB format.
+static void df_raster_resolve_pixels(const uint32_t *samples, uint8_t *out, int count, bool srgb,
+                                     const float *to_linear, const uint8_t *to_srgb) {
+    int i = 0;
+    if (srgb) {
+        for (; i < count; i++, samples += DF_RASTER_MAX_SAMPLES) {
+            df_f32x4 sum = df_f32x4_splat(0);
+            for (int j = 0; j < DF_RASTER_MAX_SAMPLES; j++) {
+                uint32_t p = samples[j];
+                sum = df_f32x4_add(sum, df_f32x4_set(to_linear[p & 0xff], to_linear[(p >> 8) & 0xff], to_linear[(p >> 16) & 0xff], (p >> 24) / 255.0f));
+            }
+            float color[4];
+            df_f32x4_store(color, df_f32x4_mul(sum, df_f32x4_splat(0.25f)));
+            df_raster_pack(color, true, to_srgb, out + 4 * i);
+        }
+        return;
+    }
+
+    // Two pixels, 8 samples, per step
+#if defined(DF_SIMD_SSE2)
+    for (; i + 2 <= count; i += 2, samples += 2 * DF_RASTER_MAX_SAMPLES) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i a = _mm_loadu_si128((const __m128i *) samples);
+        __m128i b = _mm_loadu_si128((const __m128i *) (samples + DF_RASTER_MAX_SAMPLES));
+        __m128i sa = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero));
+        __m128i sb = _mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero));
+        __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(sa, sb), _mm_unpackhi_epi64(sa, sb));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+        _mm_storel_epi64((__m128i *) (out + 4 * i), _mm_packus_epi16(sum, sum));
+    }
+#elif defined(DF_SIMD_NEON)
+    for (; i + 2 <= count; i += 2, samples += 2 * DF_RASTER_MAX_SAMPLES) {
+        uint8x16_t a = vld1q_u8((const uint8_t *) samples);
+        uint8x16_t b = vld1q_u8((const uint8_t *) (samples + DF_RASTER_MAX_SAMPLES));
+        uint16x8_t sa = vaddl_u8(vget_low_u8(a), vget_high_u8(a));
+        uint16x8_t sb = vaddl_u8(vget_low_u8(b), vget_high_u8(b));
+        uint16x8_t sum = vcombine_u16(vadd_u16(vget_low_u16(sa), vget_high_u16(sa)), vadd_u16(vget_low_u16(sb), vget_high_u16(sb)));
+        vst1_u8(out + 4 * i, vrshrn_n_u16(sum, 2));
+    }
+#endif
+    for (; i < count; i++, samples += DF_RASTER_MAX_SAMPLES) {
+        const uint8_t *bytes = (const uint8_t *) samples;
+        for (int c = 0; c < 4; c++) {
+            out[4 * i + c] = (uint8_t) ((bytes[c] + bytes[4 + c] + bytes[8 + c] + bytes[12 + c] + 2) >> 2);
+        }
+    }
+}
+
+// Resolves the expanded blocks of a tile into the colour texture. Blocks
+// whose samples agree again go back to compressed, and the rest are packed
+// at the start of the tile's storage.
+static void df_raster_resolve(df_render_target_t *target, df_msaa_tile_t *tile, int tx0, int ty0, int tx1, int ty1) {
+    const float *to_linear = target->srgb ? df_srgb_to_linear_lut() : NULL;
+    const uint8_t *to_srgb = target->srgb ? df_linear_to_srgb_lut() : NULL;
+    const size_t block_samples = DF_RASTER_BLOCK_PIXELS * DF_RASTER_MAX_SAMPLES;
+    const int blocks_x = DF_RASTER_TILE_SIZE / DF_RASTER_BLOCK_SIZE;
+
+    // In storage order, so packing never overwrites a block not yet seen
+    int owner[DF_RASTER_TILE_BLOCKS];
+    for (int block = 0; block < DF_RASTER_TILE_BLOCKS; block++) {
+        if (tile->slot[block]) {
+            owner[tile->slot[block] - 1] = block;
+        }
+    }
+
+    uint32_t count = 0;
+    for (uint32_t slot = 0; slot < tile->count; slot++) {
+        int block = owner[slot];
+        int bx = tx0 + block % blocks_x * DF_RASTER_BLOCK_SIZE, by = ty0 + block / blocks_x * DF_RASTER_BLOCK_SIZE;
+        int x1 = bx + DF_RASTER_BLOCK_SIZE < tx1 ? bx + DF_RASTER_BLOCK_SIZE : tx1;
+        int y1 = by + DF_RASTER_BLOCK_SIZE < ty1 ? by + DF_RASTER_BLOCK_SIZE : ty1;
+        const uint32_t *samples = tile->samples + slot * block_samples;
+
+        bool uniform = true;
+        for (int y = by; y < y1; y++) {
+            const uint32_t *row = samples + (size_t) (y - by) * DF_RASTER_BLOCK_SIZE * DF_RASTER_MAX_SAMPLES;
+            df_raster_resolve_pixels(row, target->color.data + (size_t) y * target->color.bytes_per_row + (size_t) bx * 4,
+                                     x1 - bx, target->srgb, to_linear, to_srgb);
+            for (int i = 0; uniform && i < (x1 - bx) * DF_RASTER_MAX_SAMPLES; i += DF_RASTER_MAX_SAMPLES) {
+                uniform = row[i] == row[i + 1] && row[i] == row[i + 2] && row[i] == row[i + 3];
+            }
+        }
+
+        if (uniform) {
+            tile->slot[block] = 0;
+        } else {
+            if (slot != count) {
+                memmove(tile->samples + count * block_samples, samples, block_samples * sizeof(uint32_t));
+            }
+            tile->slot[block] = (uint8_t) ++count;
+        }
+    }
+    tile->count = count;
+}
+
+static void df_raster_tiles(void *ctx, size_t begin, size_t end) {
+    const df_raster_t *raster = (const df_raster_t *) ctx;
+    const df_render_pass_t *pass = &raster->pass;
+    df_render_target_t *target = pass->target;
+    const uint8_t *srgb_lut = df_linear_to_srgb_lut();
+
+    uint8_t clear[4];
+    df_raster_pack(pass->clear_color, target->srgb, srgb_lut, clear);
+
+    // Depth that is neither loaded nor stored never leaves the tile, like
+    // memoryless depth on a tiled GPU
+    float scratch[DF_RASTER_TILE_SIZE * DF_RASTER_TILE_SIZE * DF_RASTER_MAX_SAMPLES];
+    bool memoryless = pass->depth_load != DFLoadActionLoad && pass->depth_store == DFStoreActionDontCare;
+
+    for (size_t tile = begin; tile < end; tile++) {
+        int tx0 = (int) (tile % raster->tiles_x) * DF_RASTER_TILE_SIZE;
+        int ty0 = (int) (tile / raster->tiles_x) * DF_RASTER_TILE_SIZE;
+        int tx1 = tx0 + DF_RASTER_TILE_SIZE < (int) target->color.width ? tx0 + DF_RASTER_TILE_SIZE : (int) target->color.width;
+        int ty1 = ty0 + DF_RASTER_TILE_SIZE < (int) target->color.height ? ty0 + DF_RASTER_TILE_SIZE : (int) target->color.height;
+
+        df_msaa_tile_t *msaa = target->msaa ? &target->msaa[tile] : NULL;
+        if (msaa && pass->color_load == DFLoadActionClear) {
+            msaa->count = 0;
+            memset(msaa->slot, 0, sizeof(msaa->slot));
+        }
+
+        uint32_t samples = target->sample_count;
+        df_raster_depth_t depth = { target->depth, (size_t) target->color.width * samples, 0, 0, samples };
+        if (memoryless) {
+            depth = (df_raster_depth_t) { scratch, (size_t) (tx1 - tx0) * samples, tx0, ty0, samples };
+        }
+        for (int y = ty0; y < ty1; y++) {
+            if (pass->color_load == DFLoadActionClear) {
+                uint8_t *row = target->color.data + (size_t) y * target->color.bytes_per_row + (size_t) tx0 * 4;
+                for (int x = tx0; x < tx1; x++, row += 4) {
+                    memcpy(row, clear, 4);
+                }
+            }
+            if (pass->depth_load == DFLoadActionClear && target->depth) {
+                float *row = df_raster_depth_at(&depth, tx0, y);
+                for (size_t i = 0; i < (size_t) (tx1 - tx0) * samples; i++) {
+                    row[i] = pass->clear_depth;
+                }
+            }
+        }
+
+        // Hi-Z starts from the cleared value or from the loaded depth. Depth
+        // that wasn't loaded can be anything, so its bounds are unknown.
+        if (target->depth && !raster->hiz_disabled) {
+            for (int by = ty0; by < ty1; by += DF_RASTER_BLOCK_SIZE) {
+                for (int bx = tx0; bx < tx1; bx += DF_RASTER_BLOCK_SIZE) {
+                    if (pass->depth_load != DFLoadActionLoad) {
+                        float *bounds = raster->hiz + ((size_t) (by / DF_RASTER_BLOCK_SIZE) * raster->hiz_stride + bx / DF_RASTER_BLOCK_SIZE) * 2;
+                        bool clear = pass->depth_load == DFLoadActionClear;
+                        bounds[0] = clear ? pass->clear_depth : -INFINITY;
+                        bounds[1] = clear ? pass->clear_depth : INFINITY;
+                        continue;
+                    }
+                    int x1 = bx + DF_RASTER_BLOCK_SIZE < tx1 ? bx + DF_RASTER_BLOCK_SIZE : tx1;
+                    int y1 = by + DF_RASTER_BLOCK_SIZE < ty1 ? by + DF_RASTER_BLOCK_SIZE : ty1;
+                    df_raster_hiz_update(raster->hiz, raster->hiz_stride, &depth, bx, by, x1, y1);
+                }
+            }
+        }
+
+        const df_raster_bin_t *bin = &raster->bins[tile];
+        for (uint32_t i = 0; i < bin->count; i++) {
+            df_raster_triangle(raster, &raster->triangles[bin->triangles[i]], tx0, ty0, tx1, ty1, &depth, srgb_lut);
+        }
+        if (msaa) {
+            df_raster_resolve(target, msaa, tx0, ty0, tx1, ty1);
+        }
+    }
+}
+
+void df_raster_end(df_raster_t *raster) {
+    df_parallel_for(raster->pool, (size_t) raster->tiles_x * raster->tiles_y, 1, df_raster_tiles, raster);
+}
+
+void df_raster_run_tiles(df_raster_t *raster, uint32_t begin, uint32_t end) {
+    df_raster_tiles(raster, begin, end);
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+typedef struct {
+    float position[4];
+    float color[4];
+} df_raster_test_vertex_t;
+
+static void df_raster_test_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const df_raster_test_vertex_t *in = (const df_raster_test_vertex_t *) vertex;
+    (void) uniforms;
+    memcpy(position, in->position, sizeof(in->position));
+    memcpy(varyings, in->color, sizeof(in->color));
+}
+
+static bool df_raster_test_fragment(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    (void) depth;
+    if (uniforms) {
+        __atomic_fetch_add((uint32_t *) uniforms, 1, __ATOMIC_RELAXED);
+    }
+    memcpy(color, varyings, 4 * sizeof(float));
+    return true;
+}
+
+// Discards half the fragments and pushes the rest back
+static bool df_raster_test_fragment_depth(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    df_raster_test_fragment(varyings, uniforms, color, depth);
+    *depth = *depth * 0.5f + 0.5f;
+    return varyings[1] < 0.5f;
+}
+
+// Red is the colour's change along x, green 0.5 plus its change along y,
+// both per 256 pixels
+static bool df_raster_test_fragment_derivatives(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    (void) uniforms;
+    (void) depth;
+    color[0] = varyings[4] * 256;
+    color[1] = 0.5f + varyings[8] * 256;
+    color[2] = 0;
+    color[3] = 1;
+    return true;
+}
+
+// Pixel coordinates (y down) on a 128x128 target to clip space
+static df_raster_test_vertex_t df_raster_test_at(float x, float y, float z, float r, float g) {
+    return (df_raster_test_vertex_t) { { x / 64 - 1, 1 - y / 64, z, 1 }, { r, g, 0, 1 } };
+}
+
+static uint32_t df_raster_test_count(const df_render_target_t *target, int channel) {
+    uint32_t count = 0;
+    for (uint32_t y = 0; y < target->color.height; y++) {
+        for (uint32_t x = 0; x < target->color.width; x++) {
+            count += target->color.data[y * target->color.bytes_per_row + x * 4 + channel] != 0;
+        }
+    }
+    return count;
+}
+
+void df_raster_test(void) {
+    df_render_target_t target;
+    df_render_target_init(&target, 128, 128, 1, true, false);
+    df_raster_t raster;
+    assert(df_raster_init(&raster, NULL));
+
+    df_raster_pipeline_t pipeline = { df_raster_test_vertex, df_raster_test_fragment, 4, false, DFCompareAlways, false };
+    df_render_pass_t pass = { &target, DFLoadActionClear, { 0, 0, 0, 0 }, DFLoadActionClear, 1, DFStoreActionStore };
+
+    // A square split along its diagonal, with every edge through pixel
+    // centres and across a tile boundary: both windings cover each of its
+    // 64x64 pixels exactly once
+    for (int winding = 0; winding < 2; winding++) {
+        df_raster_test_vertex_t a[3] = {
+            df_raster_test_at(8.5f, 8.5f, 0.5f, 1, 0), df_raster_test_at(72.5f, 8.5f, 0.5f, 1, 0), df_raster_test_at(72.5f, 72.5f, 0.5f, 1, 0),
+        };
+        df_raster_test_vertex_t b[3] = {
+            df_raster_test_at(8.5f, 8.5f, 0.5f, 0, 1), df_raster_test_at(72.5f, 72.5f, 0.5f, 0, 1), df_raster_test_at(8.5f, 72.5f, 0.5f, 0, 1),
+        };
+        if (winding) {
+            df_raster_test_vertex_t s = a[1]; a[1] = a[2]; a[2] = s;
+            s = b[1]; b[1] = b[2]; b[2] = s;
+        }
+
+        assert(df_raster_begin(&raster, &pass));
+        df_raster_draw(&raster, &pipeline, a, sizeof(a[0]), 0, 3, NULL, NULL);
+        df_raster_draw(&raster, &pipeline, b, sizeof(b[0]), 0, 3, NULL, NULL);
+        df_raster_end(&raster);
+
+        uint32_t red = df_raster_test_count(&target, 0), green = df_raster_test_count(&target, 1);
+        assert(red + green == 64 * 64);
+        assert(red == 64 * 65 / 2 - 64 || red == 64 * 65 / 2);
+        for (uint32_t y = 0; y < 128; y++) {
+            for (uint32_t x = 0; x < 128; x++) {
+                bool inside = x >= 8 && x < 72 && y >= 8 && y < 72;
+                assert((target.color.data[y * target.color.bytes_per_row + x * 4 + 3] != 0) == inside);
+            }
+        }
+    }
+
+    // Block traversal against the edge functions at every pixel, for small
+    // triangles and for ones too big for the 32-bit path
+    uint32_t seed = 7;
+    for (int i = 0; i < 300; i++) {
+        float v[6];
+        for (int j = 0; j < 6; j++) {
+            seed = seed * 1664525 + 1013904223;
+            v[j] = (seed >> 8) / 16777216.0f;
+        }
+        float extent = i < 200 ? 160 : 12000;
+        df_raster_test_vertex_t tri[3] = {
+            df_raster_test_at(v[0] * extent - extent / 2 + 64, v[1] * extent - extent / 2 + 64, 0.5f, 1, 1),
+            df_raster_test_at(v[2] * extent - extent / 2 + 64, v[3] * extent - extent / 2 + 64, 0.5f, 1, 1),
+            df_raster_test_at(v[4] * extent - extent / 2 + 64, v[5] * extent - extent / 2 + 64, 0.5f, 1, 1),
+        };
+        df_raster_begin(&raster, &pass);
+        df_raster_draw(&raster, &pipeline, tri, sizeof(tri[0]), 0, 3, NULL, NULL);
+        df_raster_end(&raster);
+        if (raster.num_triangles == 0) {
+            assert(df_raster_test_count(&target, 3) == 0);
+            continue;
+        }
+
+        df_raster_edges_t edges;
+        df_raster_edges(&raster.triangles[0], 0, &edges);
+        assert(edges.narrow == (i < 200));
+        for (int y = 0; y < 128; y++) {
+            for (int x = 0; x < 128; x++) {
+                bool inside = true;
+                for (int e = 0; e < 3; e++) {
+                    inside = inside && edges.c[e] + x * edges.step_x[e] + y * edges.step_y[e] + edges.bias[e] >= 0;
+                }
+                assert((target.color.data[y * target.color.bytes_per_row + x * 4 + 3] != 0) == inside);
+            }
+        }
+    }
+
+    // LessEqual keeps the nearer triangle whatever the draw order, and the
+    // colour varying interpolates to the expected value at a pixel centre
+    pipeline.depth_test = true;
+    pipeline.depth_compare = DFCompareLessEqual;
+    pipeline.depth_write = true;
+    df_raster_test_vertex_t near[3] = {
+        df_raster_test_at(0, 0, 0.25f, 0, 0), df_raster_test_at(256, 0, 0.25f, 1, 0), df_raster_test_at(0, 256, 0.25f, 0, 0),
+    };
+    df_raster_test_vertex_t far[3] = {
+        df_raster_test_at(0, 0, 0.75f, 0, 1), df_raster_test_at(256, 0, 0.75f, 0, 1), df_raster_test_at(0, 256, 0.75f, 0, 1),
+    };
+    df_raster_begin(&raster, &pass);
+    df_raster_draw(&raster, &pipeline, near, sizeof(near[0]), 0, 3, NULL, NULL);
+    df_raster_draw(&raster, &pipeline, far, sizeof(far[0]), 0, 3, NULL, NULL);
+    df_raster_end(&raster);
+    assert(df_raster_test_count(&target, 1) == 0);
+    const uint8_t *p = target.color.data + 20 * target.color.bytes_per_row + 100 * 4;
+    assert(abs(p[0] - (int) (100.5f / 256 * 255 + 0.5f)) <= 1);
+    assert(target.depth[20 * 128 + 100] == 0.25f);
+
+    // Derivatives of the red ramp: 1 / 256 per pixel along x, 0 along y
+    df_raster_pipeline_t derivatives = { df_raster_test_vertex, df_raster_test_fragment_derivatives, 4 };
+    derivatives.derivatives = true;
+    df_raster_begin(&raster, &pass);
+    df_raster_draw(&raster, &derivatives, near, sizeof(near[0]), 0, 3, NULL, NULL);
+    df_raster_end(&raster);
+    p = target.color.data + 20 * target.color.bytes_per_row + 100 * 4;
+    assert(p[0] == 255 && p[1] == 128);
+
+    // Indexed grid against the same triangles flat, with a base vertex:
+    // every vertex transformed at least once, shared ones mostly once
+    enum { G = 24 };
+    df_raster_test_vertex_t *grid = (df_raster_test_vertex_t *) malloc((G * G + 5) * sizeof(df_raster_test_vertex_t));
+    df_raster_test_vertex_t *flat = (df_raster_test_vertex_t *) malloc(6 * (G - 1) * (G - 1) * sizeof(df_raster_test_vertex_t));
+    uint16_t *indices = (uint16_t *) malloc(6 * (G - 1) * (G - 1) * sizeof(uint16_t));
+    for (int i = 0; i < G * G; i++) {
+        grid[5 + i] = df_raster_test_at(i % G * 5.3f + 3, i / G * 5.3f + 3, 0.5f, (i % 7) / 6.0f, (i % 5) / 4.0f);
+    }
+    uint32_t index_count = 0;
+    for (int y = 0; y + 1 < G; y++) {
+        for (int x = 0; x + 1 < G; x++) {
+            uint16_t quad[6] = { y * G + x, y * G + x + 1, (y + 1) * G + x + 1, y * G + x, (y + 1) * G + x + 1, (y + 1) * G + x };
+            for (int k = 0; k < 6; k++) {
+                flat[index_count] = grid[5 + quad[k]];
+                indices[index_count++] = quad[k];
+            }
+        }
+    }
+    df_raster_begin(&raster, &pass);
+    df_raster_draw(&raster, &pipeline, flat, sizeof(flat[0]), 0, index_count, NULL, NULL);
+    df_raster_end(&raster);
+    df_cpu_texture_t drawn;
+    df_cpu_texture_init(&drawn, 128, 128);
+    memcpy(drawn.data, target.color.data, drawn.bytes_per_row * 128);
+    df_raster_begin(&raster, &pass);
+    df_raster_draw_indexed(&raster, &pipeline, grid, sizeof(grid[0]), indices, index_count, 5, NULL, NULL);
+    df_raster_end(&raster);
+    assert(memcmp(drawn.data, target.color.data, drawn.bytes_per_row * 128) == 0);
+    assert(raster.cache_hits + raster.cache_misses == index_count);
+    assert(raster.cache_misses >= G * G && raster.cache_misses < 2 * G * G);
+
+    // Two triangles sharing an edge: 4 vertices transformed, 2 hits
+    uint16_t shared[6] = { 0, 1, 2, 0, 2, 3 };
+    df_raster_begin(&raster, &pass);
+    df_raster_draw_indexed(&raster, &pipeline, grid, sizeof(grid[0]), shared, 6, 5, NULL, NULL);
+    df_raster_end(&raster);
+    assert(raster.cache_hits == 2 && raster.cache_misses == 4);
+
+    // Culling: a counter-clockwise triangle is front-facing with
+    // DFWindingCounterClockwise, a clockwise one with the default
+    df_raster_pipeline_t cull = pipeline;
+    cull.depth_test = false;
+    df_raster_test_vertex_t ccw[3] = {
+        df_raster_test_at(10, 10, 0.5f, 1, 0), df_raster_test_at(10, 50, 0.5f, 1, 0), df_raster_test_at(50, 50, 0.5f, 1, 0),
+    };
+    df_raster_test_vertex_t cw[3] = { ccw[0], ccw[2], ccw[1] };
+    for (int mode = DFCullModeNone; mode <= DFCullModeBack; mode++) {
+        for (int winding = DFWindingClockwise; winding <= DFWindingCounterClockwise; winding++) {
+            cull.cull_mode = (df_cull_mode) mode;
+            cull.front_facing = (df_winding) winding;
+            for (int order = 0; order < 2; order++) {
+                df_raster_begin(&raster, &pass);
+                df_raster_draw(&raster, &cull, order ? cw : ccw, sizeof(ccw[0]), 0, 3, NULL, NULL);
+                df_raster_end(&raster);
+                bool front = (order == 0) == (winding == DFWindingCounterClockwise);
+                bool drawn = mode == DFCullModeNone || (mode == DFCullModeBack) == front;
+                assert((df_raster_test_count(&target, 3) != 0) == drawn);
+            }
+        }
+    }
+
+    // A triangle far past the guard band is clipped to it, not dropped, and
+    // its varyings stay linear
+    df_raster_test_vertex_t huge[3] = {
+        df_raster_test_at(-100000, -100000, 0.5f, 0, 0), df_raster_test_at(200000, -100000, 0.5f, 1, 0), df_raster_test_at(-100000, 200000, 0.5f, 0, 0),
+    };
+    cull.cull_mode = DFCullModeNone;
+    df_raster_begin(&raster, &pass);
+    df_raster_draw(&raster, &cull, huge, sizeof(huge[0]), 0, 3, NULL, NULL);
+    df_raster_end(&raster);
+    assert(df_raster_test_count(&target, 3) == 128 * 128);
+    p = target.color.data + 70 * target.color.bytes_per_row + 64 * 4;
+    assert(abs(p[0] - (int) (100064.5f / 300000 * 255 + 0.5f)) <= 1);
+
+    // Near plane: with z going from -1 to 1 across x, only pixels from the
+    // middle on are drawn, at their interpolated depth
+    df_raster_test_vertex_t crossing[3] = {
+        df_raster_test_at(0, 0, -1, 1, 0), df_raster_test_at(128, 0, 1, 1, 0), df_raster_test_at(0, 128, -1, 1, 0),
+    };
+    df_raster_begin(&raster, &pass);
+    df_raster_draw(&raster, &pipeline, crossing, sizeof(crossing[0]), 0, 3, NULL, NULL);
+    df_raster_end(&raster);
+    for (int y = 0; y < 128; y++) {
+        for (int x = 0; x < 128; x++) {
+            bool drawn = target.color.data[y * target.color.bytes_per_row + x * 4 + 3] != 0;
+            assert(!drawn || x >= 64);
+            assert(drawn || x < 64 || x + y >= 126);
+            assert(!drawn || fabsf(target.depth[y * 128 + x] - ((x + 0.5f) / 64 - 1)) < 1e-4f);
+        }
+    }
+
+    // A vertex behind the eye, w < 0: clipped at w = 0 and the guard band,
+    // covering the target above the other two vertices
+    df_raster_test_vertex_t behind[3] = { { { -0.5f, -0.5f, 0.5f, 1 }, { 1, 0, 0, 1 } }, { { 0.5f, -0.5f, 0.5f, 1 }, { 1, 0, 0, 1 } }, { { 0, 1, 0.25f, -1 }, { 1, 0, 0, 1 } } };
+    df_raster_begin(&raster, &pass);
+    df_raster_draw(&raster, &cull, behind, sizeof(behind[0]), 0, 3, NULL, NULL);
+    df_raster_end(&raster);
+    for (int y = 0; y < 128; y++) {
+        for (int x = 0; x < 128; x++) {
+            bool drawn = target.color.data[y * target.color.bytes_per_row + x * 4 + 3] != 0;
+            assert(!drawn || y < 96);
+        }
+    }
+    assert(df_raster_test_count(&target, 3) != 0);
+
+    // Lines, never culled: a shallow line covers one pixel per column from
+    // its first vertex to before its last, both ways
+    cull.cull_mode = DFCullModeBack;
+    for (int reverse = 0; reverse < 2; reverse++) {
+        df_raster_test_vertex_t line[2] = { df_raster_test_at(8.5f, 8.5f, 0.5f, 1, 0), df_raster_test_at(72.5f, 40.5f, 0.5f, 1, 0) };
+        if (reverse) {
+            df_raster_test_vertex_t s = line[0]; line[0] = line[1]; line[1] = s;
+        }
+        df_raster_begin(&raster, &pass);
+        df_raster_draw_primitives(&raster, &cull, DFPrimitiveTypeLine, line, sizeof(line[0]), 0, 2, NULL, NULL);
+        df_raster_end(&raster);
+        for (int x = 0; x < 128; x++) {
+            uint32_t column = 0;
+            for (int y = 0; y < 128; y++) {
+                column += target.color.data[y * target.color.bytes_per_row + x * 4 + 3] != 0;
+            }
+            assert(column == (reverse ? x >= 9 && x <= 72 : x >= 8 && x < 72));
+        }
+    }
+
+    // A closed strip around a 21x11 rectangle covers its outline once
+    df_raster_test_vertex_t outline[5] = {
+        df_raster_test_at(10.5f, 10.5f, 0.5f, 1, 0), df_raster_test_at(30.5f, 10.5f, 0.5f, 1, 0), df_raster_test_at(30.5f, 20.5f, 0.5f, 1, 0),
+        df_raster_test_at(10.5f, 20.5f, 0.5f, 1, 0), df_raster_test_at(10.5f, 10.5f, 0.5f, 1, 0),
+    };
+    uint32_t fragments = 0;
+    df_raster_begin(&raster, &pass);
+    df_raster_draw_primitives(&raster, &cull, DFPrimitiveTypeLineStrip, outline, sizeof(outline[0]), 0, 5, NULL, &fragments);
+    df_raster_end(&raster);
+    assert(fragments == 2 * 21 + 2 * 9);
+    for (int y = 0; y < 128; y++) {
+        for (int x = 0; x < 128; x++) {
+            bool edge = (x == 10 || x == 30 || y == 10 || y == 20) && x >= 10 && x <= 30 && y >= 10 && y <= 20;
+            assert((target.color.data[y * target.color.bytes_per_row + x * 4 + 3] != 0) == edge);
+        }
+    }
+    assert(raster.num_triangles == 8);
+
+    df_cpu_texture_free(&drawn);
+    free(indices);
+    free(flat);
+    free(grid);
+
+    // Many overlapping triangles: the result doesn't depend on the thread count
+    enum { N = 3000 };
+    df_raster_test_vertex_t *soup = (df_raster_test_vertex_t *) malloc(3 * N * sizeof(df_raster_test_vertex_t));
+    for (int i = 0; i < 3 * N; i++) {
+        float v[5];
+        for (int j = 0; j < 5; j++) {
+            seed = seed * 1664525 + 1013904223;
+            v[j] = (seed >> 8) / 16777216.0f;
+        }
+        soup[i] = df_raster_test_at(v[0] * 160 - 16, v[1] * 160 - 16, v[2], v[3], v[4]);
+    }
+
+    df_cpu_texture_t reference;
+    df_cpu_texture_init(&reference, 128, 128);
+    df_thread_pool_t single;
+    assert(df_thread_pool_init(&single, 1));
+    df_raster_t serial;
+    assert(df_raster_init(&serial, &single));
+    df_raster_begin(&serial, &pass);
+    df_raster_draw(&serial, &pipeline, soup, sizeof(soup[0]), 0, 3 * N, NULL, NULL);
+    df_raster_end(&serial);
+    memcpy(reference.data, target.color.data, reference.bytes_per_row * 128);
+
+    df_thread_pool_t pool;
+    assert(df_thread_pool_init(&pool, 4));
+    df_raster_t parallel;
+    assert(df_raster_init(&parallel, &pool));
+    df_raster_begin(&parallel, &pass);
+    df_raster_draw(&parallel, &pipeline, soup, sizeof(soup[0]), 0, 3 * N, NULL, NULL);
+    df_raster_end(&parallel);
+    assert(memcmp(reference.data, target.color.data, reference.bytes_per_row * 128) == 0);
+
+    // Hi-Z only skips work: same colour and depth without it, also with
+    // depth-writing and discarding draws in between and a Greater compare
+    df_raster_pipeline_t late = pipeline;
+    late.fragment = df_raster_test_fragment_depth;
+    late.writes_depth = true;
+    df_raster_pipeline_t greater = pipeline;
+    greater.depth_compare = DFCompareGreaterEqual;
+    float *depth = (float *) malloc(128 * 128 * sizeof(float));
+    for (int hiz = 0; hiz < 2; hiz++) {
+        serial.hiz_disabled = hiz == 0;
+        df_raster_begin(&serial, &pass);
+        df_raster_draw(&serial, &pipeline, soup, sizeof(soup[0]), 0, 3 * N / 2, NULL, NULL);
+        df_raster_draw(&serial, &late, soup, sizeof(soup[0]), 3 * N / 2, 3 * N / 4, NULL, NULL);
+        df_raster_draw(&serial, &pipeline, soup, sizeof(soup[0]), 9 * N / 4, 3 * N / 4, NULL, NULL);
+        df_raster_end(&serial);
+        if (hiz == 0) {
+            memcpy(reference.data, target.color.data, reference.bytes_per_row * 128);
+            memcpy(depth, target.depth, 128 * 128 * sizeof(float));
+        } else {
+            assert(memcmp(reference.data, target.color.data, reference.bytes_per_row * 128) == 0);
+            assert(memcmp(depth, target.depth, 128 * 128 * sizeof(float)) == 0);
+        }
+    }
+
+    // Depth that isn't stored stays in the tile: same colour, and the
+    // target's depth is left alone
+    df_render_pass_t memoryless = pass;
+    memoryless.depth_store = DFStoreActionDontCare;
+    for (int i = 0; i < 128 * 128; i++) {
+        target.depth[i] = 7;
+    }
+    df_raster_begin(&serial, &memoryless);
+    df_raster_draw(&serial, &pipeline, soup, sizeof(soup[0]), 0, 3 * N / 2, NULL, NULL);
+    df_raster_draw(&serial, &late, soup, sizeof(soup[0]), 3 * N / 2, 3 * N / 4, NULL, NULL);
+    df_raster_draw(&serial, &pipeline, soup, sizeof(soup[0]), 9 * N / 4, 3 * N / 4, NULL, NULL);
+    df_raster_end(&serial);
+    assert(memcmp(reference.data, target.color.data, reference.bytes_per_row * 128) == 0);
+    for (int i = 0; i < 128 * 128; i++) {
+        assert(target.depth[i] == 7);
+    }
+
+    df_render_pass_t reversed = pass;
+    reversed.clear_depth = 0;
+    for (int hiz = 0; hiz < 2; hiz++) {
+        serial.hiz_disabled = hiz == 0;
+        df_raster_begin(&serial, &reversed);
+        df_raster_draw(&serial, &greater, soup, sizeof(soup[0]), 0, 3 * N, NULL, NULL);
+        df_raster_end(&serial);
+        if (hiz == 0) {
+            memcpy(reference.data, target.color.data, reference.bytes_per_row * 128);
+        } else {
+            assert(memcmp(reference.data, target.color.data, reference.bytes_per_row * 128) == 0);
+        }
+    }
+
+    // Early-Z: a triangle behind an opaque one never reaches the fragment
+    // stage, with or without Hi-Z. Late-Z has to run it everywhere.
+    for (int mode = 0; mode < 3; mode++) {
+        uint32_t fragments = 0;
+        serial.hiz_disabled = mode == 1;
+        df_raster_begin(&serial, &pass);
+        df_raster_draw(&serial, &pipeline, near, sizeof(near[0]), 0, 3, NULL, NULL);
+        df_raster_draw(&serial, mode == 2 ? &late : &pipeline, far, sizeof(far[0]), 0, 3, NULL, &fragments);
+        df_raster_end(&serial);
+        assert(mode == 2 ? fragments == 128 * 128 : fragments == 0);
+    }
+
+    // 4x MSAA: each sample of a random triangle lands where its edge
+    // functions say, through the block, 32-bit and small triangle paths
+    df_render_target_t msaa;
+    df_render_target_init(&msaa, 128, 128, 4, true, false);
+    df_render_pass_t msaa_pass = pass;
+    msaa_pass.target = &msaa;
+    pipeline.depth_test = false;
+    for (int i = 0; i < 150; i++) {
+        float v[6];
+        for (int j = 0; j < 6; j++) {
+            seed = seed * 1664525 + 1013904223;
+            v[j] = (seed >> 8) / 16777216.0f;
+        }
+        float extent = i < 50 ? 6 : i < 100 ? 160 : 12000;
+        float cx = v[0] * 128, cy = v[1] * 128;
+        df_raster_test_vertex_t tri[3] = {
+            df_raster_test_at(cx, cy, 0.5f, 1, 1),
+            df_raster_test_at(cx + (v[2] - 0.5f) * extent, cy + (v[3] - 0.5f) * extent, 0.5f, 1, 1),
+            df_raster_test_at(cx + (v[4] - 0.5f) * extent, cy + (v[5] - 0.5f) * extent, 0.5f, 1, 1),
+        };
+        df_raster_begin(&serial, &msaa_pass);
+        df_raster_draw(&serial, &pipeline, tri, sizeof(tri[0]), 0, 3, NULL, NULL);
+        df_raster_end(&serial);
+        if (serial.num_triangles == 0) {
+            assert(df_raster_test_count(&msaa, 3) == 0);
+            continue;
+        }
+
+        df_raster_edges_t edges;
+        df_raster_edges(&serial.triangles[0], DF_RASTER_SAMPLE_REACH, &edges);
+        for (int y = 0; y < 128; y++) {
+            for (int x = 0; x < 128; x++) {
+                int covered = 0;
+                for (int k = 0; k < 4; k++) {
+                    bool inside = true;
+                    for (int e = 0; e < 3; e++) {
+                        inside = inside && edges.c[e] + x * edges.step_x[e] + y * edges.step_y[e] + edges.sample[e][k] + edges.bias[e] >= 0;
+                    }
+                    covered += inside;
+                }
+                assert(msaa.color.data[y * msaa.color.bytes_per_row + x * 4 + 3] == (covered * 255 + 2) / 4);
+            }
+        }
+    }
+
+    // Two triangles sharing a diagonal: the square's pixels resolve to the
+    // mix of both, and only blocks along the diagonal need their samples
+    df_raster_test_vertex_t square[6] = {
+        df_raster_test_at(8, 8, 0.5f, 1, 0), df_raster_test_at(72, 8, 0.5f, 1, 0), df_raster_test_at(72, 72, 0.5f, 1, 0),
+        df_raster_test_at(8, 8, 0.5f, 0, 1), df_raster_test_at(72, 72, 0.5f, 0, 1), df_raster_test_at(8, 72, 0.5f, 0, 1),
+    };
+    df_raster_begin(&serial, &msaa_pass);
+    df_raster_draw(&serial, &pipeline, square, sizeof(square[0]), 0, 6, NULL, NULL);
+    df_raster_end(&serial);
+    uint32_t mixed = 0, expanded = 0;
+    for (uint32_t y = 0; y < 128; y++) {
+        for (uint32_t x = 0; x < 128; x++) {
+            const uint8_t *q = msaa.color.data + y * msaa.color.bytes_per_row + x * 4;
+            bool inside = x >= 8 && x < 72 && y >= 8 && y < 72;
+            assert(q[3] == (inside ? 255 : 0));
+            assert(!inside || abs(q[0] + q[1] - 255) <= 1);
+            mixed += q[0] && q[1];
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        expanded += msaa.msaa[i].count;
+    }
+    assert(mixed >= 64 && expanded > 0 && expanded <= 2 * 64 / 8 + 2);
+
+    // A draw covering everything compresses every block again
+    df_render_pass_t load = msaa_pass;
+    load.color_load = DFLoadActionLoad;
+    df_raster_test_vertex_t cover[3] = {
+        df_raster_test_at(-8, -8, 0.5f, 0, 0), df_raster_test_at(300, -8, 0.5f, 0, 0), df_raster_test_at(-8, 300, 0.5f, 0, 0),
+    };
+    df_raster_begin(&serial, &load);
+    df_raster_draw(&serial, &pipeline, cover, sizeof(cover[0]), 0, 3, NULL, NULL);
+    df_raster_end(&serial);
+    assert(df_raster_test_count(&msaa, 0) == 0 && df_raster_test_count(&msaa, 3) == 128 * 128);
+    for (int i = 0; i < 4; i++) {
+        assert(msaa.msaa[i].count == 0);
+    }
+
+    // Per-sample depth with Hi-Z gives the same image as without
+    pipeline.depth_test = true;
+    float *msaa_depth = (float *) malloc(4 * 128 * 128 * sizeof(float));
+    for (int hiz = 0; hiz < 2; hiz++) {
+        serial.hiz_disabled = hiz == 0;
+        df_raster_begin(&serial, &msaa_pass);
+        df_raster_draw(&serial, &pipeline, soup, sizeof(soup[0]), 0, 3 * N / 2, NULL, NULL);
+        df_raster_draw(&serial, &late, soup, sizeof(soup[0]), 3 * N / 2, 3 * N / 2, NULL, NULL);
+        df_raster_end(&serial);
+        if (hiz == 0) {
+            memcpy(reference.data, msaa.color.data, reference.bytes_per_row * 128);
+            memcpy(msaa_depth, msaa.depth, 4 * 128 * 128 * sizeof(float));
+        } else {
+            assert(memcmp(reference.data, msaa.color.data, reference.bytes_per_row * 128) == 0);
+            assert(memcmp(msaa_depth, msaa.depth, 4 * 128 * 128 * sizeof(float)) == 0);
+        }
+    }
+
+    free(msaa_depth);
+    df_render_target_free(&msaa);
+    free(depth);
+    df_raster_deinit(&serial);
+    df_raster_deinit(&parallel);
+    df_thread_pool_deinit(&single);
+    df_thread_pool_deinit(&pool);
+    df_cpu_texture_free(&reference);
+    free(soup);
+    df_raster_deinit(&raster);
+    df_render_target_free(&target);
+
+    printf("raster: passed!\n");
+}
+#endif
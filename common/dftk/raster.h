@@ -0,0 +1,241 @@
+#if !defined(DFTK_RASTER_H)
+#define DFTK_RASTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu_texture.h"
+#include "thread_pool.h"
+
+// CPU rasterizer with the samples' draw model: triangles assembled from an
+// interleaved vertex buffer, a vertex stage producing clip-space positions
+// (Metal conventions: y up, z in [0, w]) and a fragment stage returning a
+// colour. Draws are transformed and binned into 64x64 screen tiles as they
+// are submitted; df_raster_end() then rasterizes the tiles in parallel, each
+// tile walking its bin in submission order, so the result does not depend on
+// the number of threads.
+//
+// Primitive assembly culls faces and zero-area triangles four at a time.
+// Only triangles reaching behind the near plane, or past a guard band far
+// outside the target, are clipped.
+//
+// Lines are one pixel wide, drawn as thin quads: a segment covers one pixel
+// per column, or per row when steeper, from its first vertex up to but not
+// including its last, so a closed line strip covers each pixel once. Lines
+// are never culled.
+//
+// Targets can have 4 samples per pixel, at the standard 4x positions. Edges
+// and depth are then evaluated per sample but the fragment stage still runs
+// once per pixel, and each tile is resolved into the colour texture when it
+// is done.
+
+#define DF_RASTER_TILE_SIZE 64
+#define DF_RASTER_BLOCK_SIZE 8
+#define DF_RASTER_SUBPIXEL_BITS 8
+#define DF_RASTER_MAX_VARYINGS 16
+#define DF_RASTER_MAX_SAMPLES 4
+#define DF_RASTER_VERTEX_BATCH 64
+#define DF_RASTER_TILE_BLOCKS ((DF_RASTER_TILE_SIZE / DF_RASTER_BLOCK_SIZE) * (DF_RASTER_TILE_SIZE / DF_RASTER_BLOCK_SIZE))
+
+typedef enum {
+    DFLoadActionDontCare,
+    DFLoadActionLoad,
+    DFLoadActionClear,
+} df_load_action;
+
+// Same values as MTLStoreAction, for depth: depth that is neither loaded
+// nor stored stays in tile-local memory. Colour is always stored, since the
+// target is what later passes and the caller read.
+typedef enum {
+    DFStoreActionDontCare,
+    DFStoreActionStore,
+} df_store_action;
+
+// Same order as MTLCompareFunction
+typedef enum {
+    DFCompareNever,
+    DFCompareLess,
+    DFCompareEqual,
+    DFCompareLessEqual,
+    DFCompareGreater,
+    DFCompareNotEqual,
+    DFCompareGreaterEqual,
+    DFCompareAlways,
+} df_compare_function;
+
+// Same values as MTLPrimitiveType, for the ones the rasterizer draws
+typedef enum {
+    DFPrimitiveTypeLine = 1,
+    DFPrimitiveTypeLineStrip = 2,
+    DFPrimitiveTypeTriangle = 3,
+} df_primitive_type;
+
+// Same values as MTLCullMode
+typedef enum {
+    DFCullModeNone,
+    DFCullModeFront,
+    DFCullModeBack,
+} df_cull_mode;
+
+// Same values as MTLWinding
+typedef enum {
+    DFWindingClockwise,
+    DFWindingCounterClockwise,
+} df_winding;
+
+// Reads one vertex and writes its clip-space position and `num_varyings`
+// floats for the fragment stage
+typedef void (*df_vertex_fn)(const void *vertex, const void *uniforms, float position[4], float *varyings);
+
+// Gets the perspective-correct interpolated varyings and writes RGBA in
+// [0, 1]. Returning false discards the fragment, like discard_fragment().
+// `depth` comes in interpolated; pipelines with `writes_depth` may change it.
+// Pipelines with `derivatives` get the varyings followed by their change
+// one pixel right and one pixel down, like dfdx() / dfdy(), for texture LOD.
+typedef bool (*df_fragment_fn)(const float *varyings, const void *uniforms, float color[4], float *depth);
+
+// Multisampled colour of one tile. An 8x8 block is stored compressed while
+// the samples of each of its pixels agree: the colour texture then holds
+// them. A partly covered pixel gives its block per-sample storage, and the
+// resolve compresses blocks whose samples agree again.
+typedef struct {
+    uint32_t *samples;        // 4 RGBA8 samples per pixel, 64 pixels per expanded block
+    uint32_t count;           // Expanded blocks
+    uint32_t capacity;
+    uint8_t slot[DF_RASTER_TILE_BLOCKS]; // 0 if compressed, else 1 + index in samples
+} df_msaa_tile_t;
+
+typedef struct {
+    df_cpu_texture_t color;   // RGBA8, resolved with multisampling
+    float *depth;             // NULL without a depth attachment, else one float per sample
+    bool srgb;                // Colour writes are sRGB-encoded, like a *_sRGB pixel format
+    uint32_t sample_count;    // 1 or 4
+    df_msaa_tile_t *msaa;     // Per 64x64 tile, with 4 samples
+} df_render_target_t;
+
+typedef struct {
+    df_render_target_t *target;
+    df_load_action color_load;
+    float clear_color[4];
+    df_load_action depth_load;
+    float clear_depth;
+    df_store_action depth_store;
+} df_render_pass_t;
+
+typedef struct {
+    df_vertex_fn vertex;
+    df_fragment_fn fragment;
+    int num_varyings;
+    bool depth_test;          // Ignored without a depth attachment
+    df_compare_function depth_compare;
+    bool depth_write;
+    bool writes_depth;        // The fragment stage outputs depth, so the test runs after it
+    bool derivatives;         // The fragment stage gets 3 * num_varyings floats
+    df_cull_mode cull_mode;
+    df_winding front_facing;  // Winding of front faces on screen
+} df_raster_pipeline_t;
+
+// Uniform pointers must stay valid until df_raster_end()
+typedef struct {
+    const df_raster_pipeline_t *pipeline;
+    const void *vertex_uniforms;
+    const void *fragment_uniforms;
+    df_cull_mode cull_mode;   // The pipeline's, DFCullModeNone for lines
+} df_raster_draw_t;
+
+// A triangle after the viewport transform. Varyings are stored already
+// divided by w at `varyings`, 3 * num_varyings floats.
+typedef struct {
+    int32_t x[3];             // Pixels, DF_RASTER_SUBPIXEL_BITS of fraction
+    int32_t y[3];
+    float z[3];
+    float inv_w[3];
+    uint32_t draw;
+    uint32_t varyings;
+} df_raster_triangle_t;
+
+typedef struct {
+    uint32_t *triangles;
+    uint32_t count;
+    uint32_t capacity;
+} df_raster_bin_t;
+
+typedef struct {
+    df_thread_pool_t *pool;
+    df_render_pass_t pass;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    df_raster_bin_t *bins;
+    uint32_t bins_capacity;
+
+    df_raster_draw_t *draws;
+    uint32_t num_draws;
+    size_t draws_capacity;
+    df_raster_triangle_t *triangles;
+    uint32_t num_triangles;
+    size_t triangles_capacity;
+    float *varyings;
+    size_t num_varyings;
+    size_t varyings_capacity;
+
+    float *vertices;          // Vertex stage output for the current draw
+    size_t vertices_capacity;
+    uint32_t *assembled;      // Triangles of the current draw left after culling
+    size_t assembled_capacity;
+
+    // Post-transform vertex cache of indexed draws. Triangles are taken in
+    // batches of up to DF_RASTER_VERTEX_BATCH distinct vertices, like GPU
+    // vertex batches, and each vertex is transformed once per batch: a hit
+    // is an index already transformed in its batch.
+    uint32_t *cache_batch;    // Per uint16 index, the batch that last used it
+    uint32_t *cache_slot;     // Per uint16 index, its output in that batch
+    uint32_t batch;
+    uint32_t *fetch;          // Vertex read by each transformed slot
+    size_t fetch_capacity;
+    uint32_t *slots;          // Transformed slot of each index of the draw
+    size_t slots_capacity;
+    uint64_t cache_hits;      // Since df_raster_begin()
+    uint64_t cache_misses;
+
+    // Hi-Z: min and max depth of each 8x8 block of the target, rebuilt for
+    // each pass and kept conservative as fragments write depth
+    float *hiz;
+    size_t hiz_capacity;
+    uint32_t hiz_stride;      // Blocks per row
+    bool hiz_disabled;        // Turns Hi-Z off, for benchmarks
+} df_raster_t;
+
+bool df_render_target_init(df_render_target_t *target, uint32_t width, uint32_t height, uint32_t sample_count, bool depth, bool srgb);
+void df_render_target_free(df_render_target_t *target);
+
+// A NULL pool uses the shared one. Don't call df_raster_end() from a job
+// running on the same pool.
+bool df_raster_init(df_raster_t *raster, df_thread_pool_t *pool);
+void df_raster_deinit(df_raster_t *raster);
+
+bool df_raster_begin(df_raster_t *raster, const df_render_pass_t *pass);
+void df_raster_draw(df_raster_t *raster, const df_raster_pipeline_t *pipeline,
+                    const void *vertices, size_t stride, uint32_t vertex_start, uint32_t vertex_count,
+                    const void *vertex_uniforms, const void *fragment_uniforms);
+// Like drawPrimitives; df_raster_draw() draws DFPrimitiveTypeTriangle
+void df_raster_draw_primitives(df_raster_t *raster, const df_raster_pipeline_t *pipeline, df_primitive_type type,
+                               const void *vertices, size_t stride, uint32_t vertex_start, uint32_t vertex_count,
+                               const void *vertex_uniforms, const void *fragment_uniforms);
+
+// Like drawIndexedPrimitives with MTLIndexTypeUInt16: triangle i is made of
+// vertices base_vertex + indices[3 * i + k]
+void df_raster_draw_indexed(df_raster_t *raster, const df_raster_pipeline_t *pipeline,
+                            const void *vertices, size_t stride, const uint16_t *indices, uint32_t index_count, uint32_t base_vertex,
+                            const void *vertex_uniforms, const void *fragment_uniforms);
+void df_raster_end(df_raster_t *raster);
+
+// df_raster_end() in pieces, for schedulers such as df_render_graph_t:
+// clears and rasterizes tiles [begin, end) of the pass, row-major. Each
+// tile must run exactly once, and tiles can run in parallel.
+void df_raster_run_tiles(df_raster_t *raster, uint32_t begin, uint32_t end);
+
+#ifdef TEST
+void df_raster_test(void);
+#endif
+
+#endif
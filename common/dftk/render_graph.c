@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <string.h>
+#include "render_graph.h"
+
+void df_render_graph_init(df_render_graph_t *graph, df_thread_pool_t *pool) {
+    memset(graph, 0, sizeof(*graph));
+    graph->pool = pool ? pool : df_thread_pool_shared();
+}
+
+void df_render_graph_deinit(df_render_graph_t *graph) {
+    free(graph->tiles);
+    free(graph->edges);
+    free(graph->pairs);
+    memset(graph, 0, sizeof(*graph));
+}
+
+bool df_render_graph_add(df_render_graph_t *graph, df_raster_t *raster) {
+    if (graph->num_passes >= DF_RENDER_GRAPH_MAX_PASSES) {
+        return false;
+    }
+    df_render_graph_pass_t *pass = &graph->passes[graph->num_passes++];
+    pass->raster = raster;
+    pass->num_reads = 0;
+    return true;
+}
+
+bool df_render_graph_read(df_render_graph_t *graph, const df_render_target_t *target, int radius) {
+    if (graph->num_passes == 0) {
+        return false;
+    }
+    df_render_graph_pass_t *pass = &graph->passes[graph->num_passes - 1];
+
+    // Reading the same target twice keeps the wider read
+    for (int i = 0; i < pass->num_reads; i++) {
+        df_render_graph_read_t *read = &pass->reads[i];
+        if (read->target == target) {
+            if (read->radius != DF_RENDER_GRAPH_READ_ALL && (radius == DF_RENDER_GRAPH_READ_ALL || radius > read->radius)) {
+                read->radius = radius;
+            }
+            return true;
+        }
+    }
+    if (pass->num_reads >= DF_RENDER_GRAPH_MAX_READS) {
+        return false;
+    }
+    pass->reads[pass->num_reads++] = (df_render_graph_read_t) { target, radius };
+    return true;
+}
+
+static bool df_render_graph_reserve(void **data, size_t *capacity, size_t count, size_t size) {
+    if (count <= *capacity) {
+        return true;
+    }
+    size_t n = *capacity ? *capacity : 64;
+    while (n < count) {
+        n *= 2;
+    }
+    void *p = realloc(*data, n * size);
+    if (!p) {
+        return false;
+    }
+    *data = p;
+    *capacity = n;
+    return true;
+}
+
+static const df_render_target_t *df_render_graph_target(const df_render_graph_t *graph, int pass) {
+    return graph->passes[pass].raster->pass.target;
+}
+
+static uint32_t df_render_graph_num_tiles(const df_render_graph_t *graph, int pass) {
+    const df_raster_t *raster = graph->passes[pass].raster;
+    return raster->tiles_x * raster->tiles_y;
+}
+
+// The last pass before `pass` writing `target`, or -1
+static int df_render_graph_writer(const df_render_graph_t *graph, int pass, const df_render_target_t *target) {
+    for (int p = pass - 1; p >= 0; p--) {
+        if (df_render_graph_target(graph, p) == target) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+static bool df_render_graph_edge(df_render_graph_t *graph, uint32_t producer, uint32_t consumer) {
+    if (!df_render_graph_reserve((void **) &graph->pairs, &graph->pairs_capacity, 2 * ((size_t) graph->num_pairs + 1), sizeof(uint32_t))) {
+        return false;
+    }
+    graph->pairs[2 * graph->num_pairs] = producer;
+    graph->pairs[2 * graph->num_pairs + 1] = consumer;
+    graph->num_pairs++;
+    return true;
+}
+
+// Tile edges into pass q from producer pass p: each tile from the same tile
+// of p for a write after write, from the tiles under it for a read
+static bool df_render_graph_tile_edges(df_render_graph_t *graph, int p, int q, int radius, bool skip_empty) {
+    const df_raster_t *producer = graph->passes[p].raster, *consumer = graph->passes[q].raster;
+    const df_cpu_texture_t *src = &producer->pass.target->color, *dst = &consumer->pass.target->color;
+    uint32_t src_first = graph->passes[p].first_tile, dst_first = graph->passes[q].first_tile;
+
+    for (uint32_t ty = 0; ty < consumer->tiles_y; ty++) {
+        for (uint32_t tx = 0; tx < consumer->tiles_x; tx++) {
+            uint32_t tile = ty * consumer->tiles_x + tx;
+            if (skip_empty && consumer->bins[tile].count == 0) {
+                continue;
+            }
+
+            // The tile's rectangle in producer texels, grown by the radius
+            int64_t x0 = (int64_t) tx * DF_RASTER_TILE_SIZE * src->width / dst->width - radius;
+            int64_t y0 = (int64_t) ty * DF_RASTER_TILE_SIZE * src->height / dst->height - radius;
+            uint32_t tx1 = (tx + 1) * DF_RASTER_TILE_SIZE < dst->width ? (tx + 1) * DF_RASTER_TILE_SIZE : dst->width;
+            uint32_t ty1 = (ty + 1) * DF_RASTER_TILE_SIZE < dst->height ? (ty + 1) * DF_RASTER_TILE_SIZE : dst->height;
+            int64_t x1 = ((int64_t) tx1 * src->width + dst->width - 1) / dst->width + radius;
+            int64_t y1 = ((int64_t) ty1 * src->height + dst->height - 1) / dst->height + radius;
+            x0 = x0 < 0 ? 0 : x0;
+            y0 = y0 < 0 ? 0 : y0;
+            x1 = x1 > src->width ? src->width : x1;
+            y1 = y1 > src->height ? src->height : y1;
+            if (x0 >= x1 || y0 >= y1) {
+                continue;
+            }
+
+            for (int64_t sy = y0 / DF_RASTER_TILE_SIZE; sy <= (y1 - 1) / DF_RASTER_TILE_SIZE; sy++) {
+                for (int64_t sx = x0 / DF_RASTER_TILE_SIZE; sx <= (x1 - 1) / DF_RASTER_TILE_SIZE; sx++) {
+                    uint32_t from = src_first + (uint32_t) (sy * producer->tiles_x + sx);
+                    if (!df_render_graph_edge(graph, from, dst_first + tile)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// How many times tile `tile` of pass q waits for the whole of pass p
+static uint32_t df_render_graph_waits(const df_render_graph_t *graph, int p, int q, uint32_t tile) {
+    const df_render_graph_pass_t *producer = &graph->passes[p];
+    return ((producer->consumers >> q) & 1) + (((producer->readers >> q) & 1) && graph->passes[q].raster->bins[tile].count > 0);
+}
+
+// Finds the dependencies of every tile. Edges between tiles go into a
+// compressed list per producer tile; a pass waiting for all of another
+// keeps a bit in the producer's `consumers` or `readers` instead of an
+// edge per pair.
+static bool df_render_graph_build(df_render_graph_t *graph) {
+    uint32_t num_tiles = 0;
+    for (int q = 0; q < graph->num_passes; q++) {
+        graph->passes[q].first_tile = num_tiles;
+        graph->passes[q].consumers = 0;
+        graph->passes[q].readers = 0;
+        num_tiles += df_render_graph_num_tiles(graph, q);
+    }
+    if (!df_render_graph_reserve((void **) &graph->tiles, &graph->tiles_capacity, num_tiles, sizeof(df_render_graph_tile_t))) {
+        return false;
+    }
+    graph->num_pairs = 0;
+
+    for (int q = 0; q < graph->num_passes; q++) {
+        const df_render_graph_pass_t *pass = &graph->passes[q];
+        const df_render_target_t *target = df_render_graph_target(graph, q);
+
+        // Write after write, then write after read by the passes since
+        int writer = df_render_graph_writer(graph, q, target);
+        if (writer >= 0 && !df_render_graph_tile_edges(graph, writer, q, 0, false)) {
+            return false;
+        }
+        for (int p = writer + 1; p < q; p++) {
+            for (int i = 0; i < graph->passes[p].num_reads; i++) {
+                if (graph->passes[p].reads[i].target == target) {
+                    graph->passes[p].consumers |= 1u << q;
+                }
+            }
+        }
+
+        // Read after write
+        for (int i = 0; i < pass->num_reads; i++) {
+            if (pass->reads[i].target == target) {
+                continue;
+            }
+            int p = df_render_graph_writer(graph, q, pass->reads[i].target);
+            if (p < 0) {
+                continue;
+            }
+            if (pass->reads[i].radius == DF_RENDER_GRAPH_READ_ALL) {
+                graph->passes[p].readers |= 1u << q;
+            } else if (!df_render_graph_tile_edges(graph, p, q, pass->reads[i].radius, true)) {
+                return false;
+            }
+        }
+    }
+
+    // Counting sort of the edges by producer tile
+    if (!df_render_graph_reserve((void **) &graph->edges, &graph->edges_capacity, graph->num_pairs, sizeof(uint32_t))) {
+        return false;
+    }
+    for (int q = 0; q < graph->num_passes; q++) {
+        uint32_t first = graph->passes[q].first_tile;
+        for (uint32_t t = first; t < first + df_render_graph_num_tiles(graph, q); t++) {
+            uint32_t passes = 0;
+            for (int p = 0; p < q; p++) {
+                passes += df_render_graph_waits(graph, p, q, t - first);
+            }
+            graph->tiles[t] = (df_render_graph_tile_t) { graph, (uint32_t) q, 0, 0, passes };
+        }
+    }
+    for (uint32_t i = 0; i < graph->num_pairs; i++) {
+        graph->tiles[graph->pairs[2 * i]].num_edges++;
+        graph->tiles[graph->pairs[2 * i + 1]].dependencies++;
+    }
+    uint32_t offset = 0;
+    for (uint32_t t = 0; t < num_tiles; t++) {
+        graph->tiles[t].edges = offset;
+        offset += graph->tiles[t].num_edges;
+        graph->tiles[t].num_edges = 0;
+    }
+    for (uint32_t i = 0; i < graph->num_pairs; i++) {
+        df_render_graph_tile_t *tile = &graph->tiles[graph->pairs[2 * i]];
+        graph->edges[tile->edges + tile->num_edges++] = graph->pairs[2 * i + 1];
+    }
+    return true;
+}
+
+static void df_render_graph_tile_job(void *arg);
+
+static void df_render_graph_release(df_render_graph_t *graph, uint32_t tile) {
+    if (atomic_fetch_sub(&graph->tiles[tile].waiting, 1) == 1) {
+        df_thread_pool_submit(graph->pool, df_render_graph_tile_job, &graph->tiles[tile]);
+    }
+}
+
+static void df_render_graph_tile_job(void *arg) {
+    df_render_graph_tile_t *tile = (df_render_graph_tile_t *) arg;
+    df_render_graph_t *graph = tile->graph;
+    df_render_graph_pass_t *pass = &graph->passes[tile->pass];
+    uint32_t index = (uint32_t) (tile - graph->tiles);
+
+    df_raster_run_tiles(pass->raster, index - pass->first_tile, index - pass->first_tile + 1);
+
+    for (uint32_t i = 0; i < tile->num_edges; i++) {
+        df_render_graph_release(graph, graph->edges[tile->edges + i]);
+    }
+    if (atomic_fetch_sub(&pass->remaining, 1) == 1) {
+        for (int q = (int) tile->pass + 1; q < graph->num_passes; q++) {
+            if (!(((pass->consumers | pass->readers) >> q) & 1)) {
+                continue;
+            }
+            uint32_t first = graph->passes[q].first_tile;
+            for (uint32_t t = first; t < first + df_render_graph_num_tiles(graph, q); t++) {
+                for (uint32_t n = df_render_graph_waits(graph, (int) tile->pass, q, t - first); n > 0; n--) {
+                    df_render_graph_release(graph, t);
+                }
+            }
+        }
+    }
+}
+
+void df_render_graph_run(df_render_graph_t *graph) {
+    if (!graph->pool || !df_render_graph_build(graph)) {
+        // No pool or out of memory for the schedule: run the passes one
+        // after another
+        for (int q = 0; q < graph->num_passes; q++) {
+            df_raster_end(graph->passes[q].raster);
+        }
+        graph->num_passes = 0;
+        return;
+    }
+
+    // Every counter is set before the first job can release one
+    uint32_t num_tiles = 0;
+    for (int q = 0; q < graph->num_passes; q++) {
+        uint32_t n = df_render_graph_num_tiles(graph, q);
+        atomic_store(&graph->passes[q].remaining, n);
+        for (uint32_t t = num_tiles; t < num_tiles + n; t++) {
+            atomic_store(&graph->tiles[t].waiting, graph->tiles[t].dependencies);
+        }
+        num_tiles += n;
+    }
+    for (uint32_t t = 0; t < num_tiles; t++) {
+        if (graph->tiles[t].dependencies == 0) {
+            df_thread_pool_submit(graph->pool, df_render_graph_tile_job, &graph->tiles[t]);
+        }
+    }
+    df_thread_pool_wait(graph->pool);
+    graph->num_passes = 0;
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+#include "sampler.h"
+
+typedef struct {
+    float position[2];
+    float texcoord[2];
+} df_render_graph_test_vertex_t;
+
+typedef struct {
+    const df_texture2d_t *texture;
+    const df_sampler_t *sampler;
+} df_render_graph_test_uniforms_t;
+
+static void df_render_graph_test_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const df_render_graph_test_vertex_t *v = (const df_render_graph_test_vertex_t *) vertex;
+    (void) uniforms;
+    position[0] = v->position[0];
+    position[1] = v->position[1];
+    position[2] = 0.5f;
+    position[3] = 1;
+    varyings[0] = v->texcoord[0];
+    varyings[1] = v->texcoord[1];
+}
+
+// Colour from the texture coordinate, for passes that draw from scratch
+static bool df_render_graph_test_gradient(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    (void) uniforms;
+    (void) depth;
+    color[0] = varyings[0];
+    color[1] = varyings[1];
+    color[2] = 1 - varyings[0];
+    color[3] = 1;
+    return true;
+}
+
+static bool df_render_graph_test_textured(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    const df_render_graph_test_uniforms_t *u = (const df_render_graph_test_uniforms_t *) uniforms;
+    (void) depth;
+    df_texture2d_sample(u->texture, u->sampler, varyings[0], varyings[1], 0, color);
+    return true;
+}
+
+static bool df_render_graph_test_equal(const df_render_target_t *a, const df_render_target_t *b) {
+    for (uint32_t y = 0; y < a->color.height; y++) {
+        if (memcmp(a->color.data + y * a->color.bytes_per_row, b->color.data + y * b->color.bytes_per_row, a->color.width * 4) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void df_render_graph_test(void) {
+    df_thread_pool_t pool;
+    assert(df_thread_pool_init(&pool, 4));
+    df_raster_t rasters[3];
+    for (int i = 0; i < 3; i++) {
+        assert(df_raster_init(&rasters[i], &pool));
+    }
+    df_render_graph_t graph;
+    df_render_graph_init(&graph, &pool);
+
+    // An offscreen target drawn, then copied onto the screen with a
+    // full-screen quad at a different size, then drawn over again. Each
+    // target is rendered twice, one pass at a time and through the graph.
+    df_render_target_t offscreen[2], screen[2];
+    for (int i = 0; i < 2; i++) {
+        df_render_target_init(&offscreen[i], 150, 100, 1, false, false);
+        df_render_target_init(&screen[i], 200, 140, 1, false, false);
+    }
+    df_raster_pipeline_t gradient = { df_render_graph_test_vertex, df_render_graph_test_gradient, 2 };
+    df_raster_pipeline_t textured = { df_render_graph_test_vertex, df_render_graph_test_textured, 2 };
+    df_render_graph_test_vertex_t triangle[3] = { { { -0.9f, -0.8f }, { 0, 0 } }, { { 0.7f, -0.9f }, { 1, 0 } }, { { 0.1f, 0.9f }, { 0.5f, 1 } } };
+    df_render_graph_test_vertex_t other[3] = { { { -0.2f, 0.9f }, { 1, 1 } }, { { -0.9f, 0.1f }, { 0, 1 } }, { { 0.9f, 0.5f }, { 0, 0 } } };
+    df_render_graph_test_vertex_t quad[6] = {
+        { { -1, -1 }, { 0, 1 } }, { { 1, -1 }, { 1, 1 } }, { { 1, 1 }, { 1, 0 } },
+        { { -1, -1 }, { 0, 1 } }, { { 1, 1 }, { 1, 0 } }, { { -1, 1 }, { 0, 0 } },
+    };
+    df_sampler_t linear = { DFSamplerFilterLinear, DFSamplerFilterLinear, DFSamplerMipFilterNotMipmapped,
+                            DFSamplerAddressClampToEdge, DFSamplerAddressClampToEdge };
+
+    for (int radius = DF_RENDER_GRAPH_READ_ALL; radius <= 1; radius++) {
+        for (int run = 0; run < 20; run++) {
+            for (int i = 0; i < 2; i++) {
+                df_texture2d_t view;
+                assert(df_texture2d_view(&view, &offscreen[i].color, false));
+                df_render_graph_test_uniforms_t uniforms = { &view, &linear };
+
+                df_render_pass_t first = { &offscreen[i], DFLoadActionClear, { 0.2f, 0.2f, 0.2f, 1 } };
+                df_render_pass_t copy = { &screen[i], DFLoadActionClear, { 1, 1, 1, 1 } };
+                df_render_pass_t over = { &offscreen[i], DFLoadActionLoad };
+                df_raster_begin(&rasters[0], &first);
+                df_raster_draw(&rasters[0], &gradient, triangle, sizeof(triangle[0]), 0, 3, NULL, NULL);
+                df_raster_begin(&rasters[1], &copy);
+                df_raster_draw(&rasters[1], &textured, quad, sizeof(quad[0]), 0, 6, NULL, &uniforms);
+                df_raster_begin(&rasters[2], &over);
+                df_raster_draw(&rasters[2], &gradient, other, sizeof(other[0]), 0, 3, NULL, NULL);
+
+                if (i == 0) {
+                    for (int p = 0; p < 3; p++) {
+                        df_raster_end(&rasters[p]);
+                    }
+                } else {
+                    for (int p = 0; p < 3; p++) {
+                        assert(df_render_graph_add(&graph, &rasters[p]));
+                        if (p == 1) {
+                            assert(df_render_graph_read(&graph, &offscreen[i], radius));
+                        }
+                    }
+                    df_render_graph_run(&graph);
+                    assert(graph.num_passes == 0);
+                }
+                df_texture2d_free(&view);
+            }
+            assert(df_render_graph_test_equal(&offscreen[0], &offscreen[1]));
+            assert(df_render_graph_test_equal(&screen[0], &screen[1]));
+        }
+    }
+
+    // Passes of unrelated targets have no dependencies at all, and a
+    // read of a target no earlier pass writes waits for nothing
+    df_render_pass_t a = { &offscreen[1], DFLoadActionClear }, b = { &screen[1], DFLoadActionClear };
+    df_raster_begin(&rasters[0], &a);
+    df_raster_begin(&rasters[1], &b);
+    df_render_graph_add(&graph, &rasters[0]);
+    df_render_graph_add(&graph, &rasters[1]);
+    assert(df_render_graph_read(&graph, &offscreen[0], 0));
+    assert(df_render_graph_build(&graph) && graph.num_pairs == 0 && graph.passes[0].consumers == 0 && graph.passes[0].readers == 0);
+    graph.num_passes = 0;
+
+    // A copy with radius 1 waits for the producer tiles under each of its
+    // own: the 150x100 target is 3x2 tiles, the screen 4x3
+    df_raster_begin(&rasters[1], &b);
+    df_raster_draw(&rasters[1], &textured, quad, sizeof(quad[0]), 0, 6, NULL, NULL);
+    df_render_graph_add(&graph, &rasters[0]);
+    df_render_graph_add(&graph, &rasters[1]);
+    assert(df_render_graph_read(&graph, &offscreen[1], 1));
+    assert(df_render_graph_build(&graph));
+    // Screen tile (0, 0) reads texels [0, 49) x [0, 47), and (3, 2) the last ones
+    assert(graph.tiles[6].dependencies == 1 && graph.tiles[6 + 11].dependencies == 1);
+    // Screen tile (1, 1) reads [47, 97) x [44, 93), across four tiles
+    assert(graph.tiles[6 + 5].dependencies == 4);
+    graph.num_passes = 0;
+
+    // Reading all of it, tiles without triangles still don't wait
+    df_raster_begin(&rasters[1], &b);
+    df_render_graph_test_vertex_t corner[3] = { { { -1, 1 }, { 0, 0 } }, { { -0.8f, 1 }, { 0, 0 } }, { { -1, 0.8f }, { 0, 0 } } };
+    df_raster_draw(&rasters[1], &textured, corner, sizeof(corner[0]), 0, 3, NULL, NULL);
+    df_render_graph_add(&graph, &rasters[0]);
+    df_render_graph_add(&graph, &rasters[1]);
+    assert(df_render_graph_read(&graph, &offscreen[1], DF_RENDER_GRAPH_READ_ALL));
+    assert(df_render_graph_build(&graph) && graph.num_pairs == 0 && graph.passes[0].readers == 2);
+    uint32_t waiting = 0;
+    for (uint32_t t = 0; t < 12; t++) {
+        waiting += graph.tiles[6 + t].dependencies;
+        assert(graph.tiles[6 + t].dependencies == (rasters[1].bins[t].count > 0));
+    }
+    assert(waiting == 1 && graph.tiles[6].dependencies == 1);
+    graph.num_passes = 0;
+
+    df_render_graph_deinit(&graph);
+    for (int i = 0; i < 2; i++) {
+        df_render_target_free(&offscreen[i]);
+        df_render_target_free(&screen[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        df_raster_deinit(&rasters[i]);
+    }
+    df_thread_pool_deinit(&pool);
+    printf("render_graph: passed!\n");
+}
+
+#endif
@@ -0,0 +1,92 @@
+#if !defined(DFTK_RENDER_GRAPH_H)
+#define DFTK_RENDER_GRAPH_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "raster.h"
+#include "thread_pool.h"
+
+// Schedules the tiles of several CPU render passes, such as an offscreen
+// pass and the screen pass sampling it, on one thread pool. Each pass is a
+// df_raster_t that has been begun and drawn but not ended. Dependencies
+// come from the order passes are added and the targets they write and
+// read, like a command buffer's hazard tracking:
+//
+//  - a pass reading a target waits for the last earlier pass writing it
+//  - a pass writing a target waits for the last earlier pass writing it,
+//    tile by tile, and for every pass that read it since
+//
+// Reads name the texels used: a consumer tile reading with a radius only
+// waits for the producer tiles under its own rectangle, scaled to the
+// producer's size and grown by the radius, so a full-screen effect can
+// start before its input is finished. DF_RENDER_GRAPH_READ_ALL waits for
+// the whole producer pass. Tiles without triangles read nothing.
+
+#define DF_RENDER_GRAPH_MAX_PASSES 32
+#define DF_RENDER_GRAPH_MAX_READS 8
+#define DF_RENDER_GRAPH_READ_ALL -1
+
+typedef struct {
+    const df_render_target_t *target;
+    int radius;                  // Texels, or DF_RENDER_GRAPH_READ_ALL
+} df_render_graph_read_t;
+
+typedef struct {
+    df_raster_t *raster;
+    df_render_graph_read_t reads[DF_RENDER_GRAPH_MAX_READS];
+    int num_reads;
+    uint32_t first_tile;         // Index of its first tile in the graph
+    uint32_t consumers;          // Bit per later pass waiting for all of this one
+    uint32_t readers;            // Same, for the tiles with triangles only
+    _Atomic uint32_t remaining;  // Tiles left to run
+} df_render_graph_pass_t;
+
+struct df_render_graph;
+
+typedef struct {
+    struct df_render_graph *graph;
+    uint32_t pass;
+    uint32_t edges;              // First consumer tile in graph->edges
+    uint32_t num_edges;
+    uint32_t dependencies;       // Producer tiles and passes to wait for
+    _Atomic uint32_t waiting;
+} df_render_graph_tile_t;
+
+typedef struct df_render_graph {
+    df_thread_pool_t *pool;
+    df_render_graph_pass_t passes[DF_RENDER_GRAPH_MAX_PASSES];
+    int num_passes;
+
+    // Built by df_render_graph_run(), storage kept from frame to frame
+    df_render_graph_tile_t *tiles;
+    size_t tiles_capacity;
+    uint32_t *edges;             // Consumer tiles of each tile, in tile order
+    size_t edges_capacity;
+    uint32_t *pairs;             // Producer and consumer tile of each edge
+    size_t pairs_capacity;
+    uint32_t num_pairs;
+} df_render_graph_t;
+
+// A NULL pool uses the shared one
+void df_render_graph_init(df_render_graph_t *graph, df_thread_pool_t *pool);
+void df_render_graph_deinit(df_render_graph_t *graph);
+
+// Adds a pass after those already added. The raster must stay alive, and
+// not be ended, until df_render_graph_run().
+bool df_render_graph_add(df_render_graph_t *graph, df_raster_t *raster);
+
+// The last pass added samples `target` within `radius` texels of its own
+// pixels, or anywhere with DF_RENDER_GRAPH_READ_ALL
+bool df_render_graph_read(df_render_graph_t *graph, const df_render_target_t *target, int radius);
+
+// Runs every pass and waits for them, then empties the graph. Don't call it
+// from a job running on the graph's pool.
+void df_render_graph_run(df_render_graph_t *graph);
+
+#ifdef TEST
+void df_render_graph_test(void);
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mipmap.h"
+#include "resample.h"
+#include "simd.h"
+
+#define DF_RESAMPLE_ROWS 8
+#define DF_RESAMPLE_TILE_WIDTH 64
+#define DF_RESAMPLE_TILE_HEIGHT 16
+
+// Per destination pixel, `taps` weights for the source pixels
+// [first, first + taps). Taps that fall outside the image are folded onto
+// the edge pixel, so the run is always in bounds and the inner loop never
+// clamps an index.
+typedef struct {
+    int taps;
+    int *first;       // dst_size
+    float *weights;   // dst_size * taps
+} df_resample_weights_t;
+
+static float df_resample_radius(df_resample_filter filter) {
+    switch (filter) {
+        case DFResampleBilinear: return 1;
+        case DFResampleBicubic: return 2;
+        case DFResampleLanczos3: return 3;
+    }
+    return 1;
+}
+
+static float df_resample_kernel(df_resample_filter filter, float t) {
+    t = fabsf(t);
+    switch (filter) {
+        case DFResampleBilinear:
+            return t < 1 ? 1 - t : 0;
+
+        case DFResampleBicubic:
+            if (t < 1) return (1.5f * t - 2.5f) * t * t + 1;
+            if (t < 2) return ((-0.5f * t + 2.5f) * t - 4) * t + 2;
+            return 0;
+
+        case DFResampleLanczos3: {
+            if (t < 1e-6f) return 1;
+            if (t >= 3) return 0;
+            float x = (float) M_PI * t;
+            return 3 * sinf(x) * sinf(x / 3) / (x * x);
+        }
+    }
+    return 0;
+}
+
+static void df_resample_weights_free(df_resample_weights_t *w) {
+    free(w->first);
+    free(w->weights);
+    w->first = NULL;
+    w->weights = NULL;
+}
+
+static bool df_resample_weights_init(df_resample_weights_t *w, uint32_t src_size, uint32_t dst_size, df_resample_filter filter) {
+    float scale = (float) src_size / dst_size;
+    float filter_scale = scale > 1 ? scale : 1;   // Widen the kernel when minifying
+    float support = df_resample_radius(filter) * filter_scale;
+
+    int raw_taps = (int) ceilf(2 * support) + 1;
+    w->taps = raw_taps < (int) src_size ? raw_taps : (int) src_size;
+    w->first = (int *) malloc(dst_size * sizeof(int));
+    w->weights = (float *) calloc((size_t) dst_size * w->taps, sizeof(float));
+    if (!w->first || !w->weights) {
+        df_resample_weights_free(w);
+        return false;
+    }
+
+    for (uint32_t x = 0; x < dst_size; x++) {
+        float center = (x + 0.5f) * scale;
+        int lo = (int) floorf(center - support);
+        int first = lo < 0 ? 0 : (lo > (int) src_size - w->taps ? (int) src_size - w->taps : lo);
+        float *weights = w->weights + (size_t) x * w->taps;
+        float total = 0;
+
+        for (int k = 0; k < raw_taps; k++) {
+            int i = lo + k;
+            float weight = df_resample_kernel(filter, (i + 0.5f - center) / filter_scale);
+            int clamped = i < 0 ? 0 : (i >= (int) src_size ? (int) src_size - 1 : i);
+            weights[clamped - first] += weight;
+            total += weight;
+        }
+
+        for (int k = 0; k < w->taps; k++) {
+            weights[k] /= total;
+        }
+        w->first[x] = first;
+    }
+    return true;
+}
+
+typedef struct {
+    const df_cpu_texture_t *src;
+    df_cpu_texture_t *dst;
+    uint32_t flags;
+    const float *to_linear;
+    const uint8_t *to_srgb;
+    df_resample_weights_t horizontal;
+    df_resample_weights_t vertical;
+    float *tmp;       // src height rows of dst width float RGBA
+    _Atomic bool failed;  // A row buffer couldn't be allocated
+} df_resample_job_t;
+
+// RGBA8 -> float, linear and premultiplied as requested
+static void df_resample_load_row(const df_resample_job_t *job, const uint8_t *in, float *out, uint32_t width) {
+    bool srgb = job->flags & DFResampleSRGB;
+    bool premultiply = !(job->flags & DFResamplePremultiplied);
+
+    for (uint32_t x = 0; x < width; x++, in += 4, out += 4) {
+        float a = in[3] * (1.0f / 255.0f);
+        df_f32x4 v = srgb
+            ? df_f32x4_set(job->to_linear[in[0]], job->to_linear[in[1]], job->to_linear[in[2]], 1)
+            : df_f32x4_set(in[0] * (1.0f / 255.0f), in[1] * (1.0f / 255.0f), in[2] * (1.0f / 255.0f), 1);
+        v = df_f32x4_mul(v, premultiply ? df_f32x4_splat(a) : df_f32x4_set(1, 1, 1, a));
+        df_f32x4_store(out, v);
+    }
+}
+
+static void df_resample_store_row(const df_resample_job_t *job, const float *in, uint8_t *out, uint32_t width) {
+    bool srgb = job->flags & DFResampleSRGB;
+    bool unpremultiply = !(job->flags & DFResamplePremultiplied);
+
+    for (uint32_t x = 0; x < width; x++, in += 4, out += 4) {
+        df_f32x4 v = df_f32x4_min(df_f32x4_max(df_f32x4_load(in), df_f32x4_splat(0)), df_f32x4_splat(1));
+        float c[4];
+        df_f32x4_store(c, v);
+
+        if (unpremultiply && c[3] > 0) {
+            float inv = 1 / c[3];
+            for (int i = 0; i < 3; i++) {
+                c[i] = fminf(c[i] * inv, 1.0f);
+            }
+        }
+
+        for (int i = 0; i < 3; i++) {
+            out[i] = srgb ? job->to_srgb[(int) (c[i] * 65535.0f + 0.5f)] : (uint8_t) (c[i] * 255.0f + 0.5f);
+        }
+        out[3] = (uint8_t) (c[3] * 255.0f + 0.5f);
+    }
+}
+
+// Groups are DF_RESAMPLE_ROWS full source rows, each converted once and
+// filtered to the destination width
+static void df_resample_h_group(const df_threadgroup_t *group, void *data) {
+    df_resample_job_t *job = (df_resample_job_t *) data;
+    const df_resample_weights_t *w = &job->horizontal;
+    uint32_t src_width = job->src->width, dst_width = job->dst->width;
+    float *row = (float *) malloc((size_t) src_width * 4 * sizeof(float));
+    if (!row) {
+        atomic_store(&job->failed, true);
+        return;
+    }
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        df_resample_load_row(job, job->src->data + y * job->src->bytes_per_row, row, src_width);
+
+        float *out = job->tmp + (size_t) y * dst_width * 4;
+        for (uint32_t x = 0; x < dst_width; x++) {
+            const float *p = row + 4 * w->first[x];
+            const float *weights = w->weights + (size_t) x * w->taps;
+            df_f32x4 acc = df_f32x4_splat(0);
+            for (int k = 0; k < w->taps; k++) {
+                acc = df_f32x4_madd(df_f32x4_load(p + 4 * k), df_f32x4_splat(weights[k]), acc);
+            }
+            df_f32x4_store(out + 4 * x, acc);
+        }
+    }
+
+    free(row);
+}
+
+// Tap-outer over a 64 pixel wide row segment, so each intermediate row is
+// streamed through once per output row
+static void df_resample_v_group(const df_threadgroup_t *group, void *data) {
+    df_resample_job_t *job = (df_resample_job_t *) data;
+    const df_resample_weights_t *w = &job->vertical;
+    uint32_t dst_width = job->dst->width;
+    uint32_t x0 = group->origin.width, n = group->size.width;
+    float acc[DF_RESAMPLE_TILE_WIDTH * 4];
+
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        const float *weights = w->weights + (size_t) y * w->taps;
+        for (uint32_t x = 0; x < n; x++) {
+            df_f32x4_store(acc + 4 * x, df_f32x4_splat(0));
+        }
+
+        for (int k = 0; k < w->taps; k++) {
+            const float *in = job->tmp + ((size_t) (w->first[y] + k) * dst_width + x0) * 4;
+            df_f32x4 weight = df_f32x4_splat(weights[k]);
+            for (uint32_t x = 0; x < n; x++) {
+                df_f32x4_store(acc + 4 * x, df_f32x4_madd(df_f32x4_load(in + 4 * x), weight, df_f32x4_load(acc + 4 * x)));
+            }
+        }
+
+        df_resample_store_row(job, acc, job->dst->data + y * job->dst->bytes_per_row + x0 * 4, n);
+    }
+}
+
+bool df_resample(const df_cpu_texture_t *src, df_cpu_texture_t *dst, df_resample_filter filter, uint32_t flags, df_dispatcher_t *dispatcher) {
+    if (src->width == 0 || src->height == 0 || dst->width == 0 || dst->height == 0) {
+        return true;
+    }
+
+    df_resample_job_t job = { src, dst, flags };
+    atomic_init(&job.failed, false);
+    if (flags & DFResampleSRGB) {
+        job.to_linear = df_srgb_to_linear_lut();
+        job.to_srgb = df_linear_to_srgb_lut();
+    }
+    bool ok = df_resample_weights_init(&job.horizontal, src->width, dst->width, filter);
+    ok = df_resample_weights_init(&job.vertical, src->height, dst->height, filter) && ok;
+    job.tmp = (float *) malloc((size_t) src->height * dst->width * 4 * sizeof(float));
+    ok = ok && job.tmp;
+
+    if (ok) {
+        df_dispatch_threads(dispatcher, df_size3(1, src->height, 1), df_size3(1, DF_RESAMPLE_ROWS, 1), df_resample_h_group, &job);
+        ok = !atomic_load(&job.failed);
+    }
+    if (ok) {
+        df_dispatch_threads(dispatcher, df_size3(dst->width, dst->height, 1), df_size3(DF_RESAMPLE_TILE_WIDTH, DF_RESAMPLE_TILE_HEIGHT, 1), df_resample_v_group, &job);
+    }
+
+    free(job.tmp);
+    df_resample_weights_free(&job.horizontal);
+    df_resample_weights_free(&job.vertical);
+    return ok;
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+void df_resample_test(void) {
+    df_cpu_texture_t src, dst;
+    df_cpu_texture_init(&src, 97, 61);
+    for (size_t i = 0; i < src.bytes_per_row * src.height; i++) {
+        src.data[i] = (uint8_t) (i * 7 + i / 13);
+    }
+
+    // Bilinear at the same size is the identity
+    df_cpu_texture_init(&dst, 97, 61);
+    assert(df_resample(&src, &dst, DFResampleBilinear, DFResamplePremultiplied, NULL));
+    assert(memcmp(src.data, dst.data, src.bytes_per_row * src.height) == 0);
+    df_cpu_texture_free(&dst);
+
+    // Left half opaque red, right half transparent green: no green may
+    // leak into the result, whatever the filter and direction
+    for (uint32_t y = 0; y < src.height; y++) {
+        for (uint32_t x = 0; x < src.width; x++) {
+            uint8_t *p = src.data + y * src.bytes_per_row + x * 4;
+            bool left = x < src.width / 2;
+            p[0] = left ? 255 : 0;
+            p[1] = left ? 0 : 255;
+            p[2] = 0;
+            p[3] = left ? 255 : 0;
+        }
+    }
+
+    uint32_t sizes[3][2] = { { 31, 17 }, { 200, 150 }, { 97, 5 } };
+    for (int f = DFResampleBilinear; f <= DFResampleLanczos3; f++) {
+        for (int s = 0; s < 3; s++) {
+            df_cpu_texture_init(&dst, sizes[s][0], sizes[s][1]);
+            assert(df_resample(&src, &dst, (df_resample_filter) f, DFResampleSRGB, NULL));
+            for (uint32_t y = 0; y < dst.height; y++) {
+                for (uint32_t x = 0; x < dst.width; x++) {
+                    const uint8_t *p = dst.data + y * dst.bytes_per_row + x * 4;
+                    assert(p[3] == 0 || (p[0] == 255 && p[1] == 0 && p[2] == 0));
+                }
+            }
+            df_cpu_texture_free(&dst);
+        }
+    }
+
+    // A flat colour stays flat
+    memset(src.data, 0x80, src.bytes_per_row * src.height);
+    df_cpu_texture_init(&dst, 40, 90);
+    assert(df_resample(&src, &dst, DFResampleLanczos3, DFResampleSRGB, NULL));
+    for (size_t i = 0; i < dst.bytes_per_row * dst.height; i++) {
+        assert(dst.data[i] == 0x80);
+    }
+    df_cpu_texture_free(&dst);
+
+    df_cpu_texture_free(&src);
+
+    printf("resample: passed!\n");
+}
+#endif
@@ -0,0 +1,33 @@
+#if !defined(DFTK_RESAMPLE_H)
+#define DFTK_RESAMPLE_H
+
+#include <stdbool.h>
+#include "cpu_texture.h"
+#include "dispatch.h"
+
+// Separable RGBA8 resampler for thumbnails and previews, up or down. Pixels
+// are filtered as premultiplied alpha in linear light (for sRGB data), so
+// transparent pixels don't bleed their colour and gradients keep their
+// brightness. Weight tables are built once per axis; each output pixel
+// reads a contiguous run of source pixels.
+
+typedef enum {
+    DFResampleBilinear,   // Triangle, radius 1
+    DFResampleBicubic,    // Catmull-Rom, radius 2
+    DFResampleLanczos3,   // Lanczos, radius 3
+} df_resample_filter;
+
+typedef enum {
+    DFResampleSRGB = 1 << 0,          // RGB is sRGB encoded
+    DFResamplePremultiplied = 1 << 1, // Data is already premultiplied, keep it that way
+} df_resample_flags;
+
+// Resizes `src` to `dst`'s size; `dst` must be allocated. False when out
+// of memory.
+bool df_resample(const df_cpu_texture_t *src, df_cpu_texture_t *dst, df_resample_filter filter, uint32_t flags, df_dispatcher_t *dispatcher);
+
+#ifdef TEST
+void df_resample_test(void);
+#endif
+
+#endif
@@ -0,0 +1,413 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "half.h"
+#include "mipmap.h"
+#include "sampler.h"
+#include "simd.h"
+
+#define DF_TEXTURE2D_BLOCK 4
+
+static inline size_t df_texture2d_index(const df_texture2d_level_t *level, uint32_t x, uint32_t y) {
+    if (level->pitch) {
+        return level->offset + (size_t) y * level->pitch + x;
+    }
+    return level->offset + ((size_t) (y / DF_TEXTURE2D_BLOCK) * level->blocks_per_row + x / DF_TEXTURE2D_BLOCK) * DF_TEXTURE2D_BLOCK * DF_TEXTURE2D_BLOCK +
+           (y % DF_TEXTURE2D_BLOCK) * DF_TEXTURE2D_BLOCK + x % DF_TEXTURE2D_BLOCK;
+}
+
+bool df_texture2d_init(df_texture2d_t *texture, df_pixel_format format, const df_texture_level_t *levels, uint32_t level_count) {
+    memset(texture, 0, sizeof(*texture));
+    uint32_t bpp = df_pixel_format_bytes_per_pixel(format);
+    if (bpp == 0 || level_count == 0 || level_count > DF_TEXTURE2D_MAX_LEVELS) {
+        return false;
+    }
+
+    size_t texels = 0;
+    for (uint32_t i = 0; i < level_count; i++) {
+        df_texture2d_level_t *level = &texture->levels[i];
+        if (levels[i].width == 0 || levels[i].height == 0) {
+            return false;
+        }
+        level->offset = texels;
+        level->width = levels[i].width;
+        level->height = levels[i].height;
+        level->blocks_per_row = (levels[i].width + DF_TEXTURE2D_BLOCK - 1) / DF_TEXTURE2D_BLOCK;
+        texels += (size_t) level->blocks_per_row * ((levels[i].height + DF_TEXTURE2D_BLOCK - 1) / DF_TEXTURE2D_BLOCK) *
+                  DF_TEXTURE2D_BLOCK * DF_TEXTURE2D_BLOCK;
+    }
+
+    texture->data = calloc(texels, bpp);
+    if (!texture->data) {
+        return false;
+    }
+    texture->format = format;
+    texture->half = format == DFPixelFormatRGBA16Float;
+    texture->srgb = format == DFPixelFormatRGBA8Unorm_sRGB || format == DFPixelFormatBGRA8Unorm_sRGB;
+    texture->level_count = level_count;
+
+    bool bgra = format == DFPixelFormatBGRA8Unorm || format == DFPixelFormatBGRA8Unorm_sRGB;
+    for (uint32_t i = 0; i < level_count; i++) {
+        const df_texture2d_level_t *level = &texture->levels[i];
+        for (uint32_t y = 0; y < level->height; y++) {
+            const uint8_t *row = levels[i].data + (size_t) y * levels[i].bytes_per_row;
+            for (uint32_t x = 0; x < level->width; x++) {
+                size_t index = df_texture2d_index(level, x, y);
+                if (texture->half) {
+                    memcpy((df_half *) texture->data + 4 * index, row + (size_t) x * 8, 8);
+                    continue;
+                }
+                uint32_t p;
+                memcpy(&p, row + (size_t) x * 4, 4);
+                if (bgra) {
+                    p = (p & 0xff00ff00u) | ((p >> 16) & 0xffu) | ((p & 0xffu) << 16);
+                }
+                ((uint32_t *) texture->data)[index] = p;
+            }
+        }
+    }
+    return true;
+}
+
+bool df_texture2d_view(df_texture2d_t *texture, const df_cpu_texture_t *color, bool srgb) {
+    memset(texture, 0, sizeof(*texture));
+    if (!color->data || color->width == 0 || color->height == 0 || color->bytes_per_row % 4 != 0) {
+        return false;
+    }
+    texture->data = color->data;
+    texture->format = srgb ? DFPixelFormatRGBA8Unorm_sRGB : DFPixelFormatRGBA8Unorm;
+    texture->srgb = srgb;
+    texture->view = true;
+    texture->level_count = 1;
+    texture->levels[0] = (df_texture2d_level_t) { 0, color->width, color->height, 0, (uint32_t) (color->bytes_per_row / 4) };
+    return true;
+}
+
+void df_texture2d_free(df_texture2d_t *texture) {
+    if (!texture->view) {
+        free(texture->data);
+    }
+    texture->data = NULL;
+}
+
+float df_texture2d_lod(const df_texture2d_t *texture, const float dx[2], const float dy[2]) {
+    float w = (float) texture->levels[0].width, h = (float) texture->levels[0].height;
+    float x = (dx[0] * w) * (dx[0] * w) + (dx[1] * h) * (dx[1] * h);
+    float y = (dy[0] * w) * (dy[0] * w) + (dy[1] * h) * (dy[1] * h);
+    return 0.5f * log2f(x > y ? x : y);
+}
+
+static inline df_f32x4 df_texture2d_fetch(const df_texture2d_t *texture, size_t index, const float *to_linear) {
+    if (texture->half) {
+        const df_half *h = (const df_half *) texture->data + 4 * index;
+        return df_f32x4_set(df_half_to_float(h[0]), df_half_to_float(h[1]), df_half_to_float(h[2]), df_half_to_float(h[3]));
+    }
+
+    uint32_t p = ((const uint32_t *) texture->data)[index];
+    if (to_linear) {
+        return df_f32x4_set(to_linear[p & 0xff], to_linear[(p >> 8) & 0xff], to_linear[(p >> 16) & 0xff], (p >> 24) * (1.0f / 255));
+    }
+    return df_f32x4_from_unorm8(p);
+}
+
+static inline uint32_t df_texture2d_wrap(int32_t i, uint32_t size, df_sampler_address mode) {
+    if (mode == DFSamplerAddressRepeat) {
+        return i < 0 ? (uint32_t) (i + (int32_t) size) : (i >= (int32_t) size ? (uint32_t) (i - (int32_t) size) : (uint32_t) i);
+    }
+    return i < 0 ? 0 : (i >= (int32_t) size ? size - 1 : (uint32_t) i);
+}
+
+// Texel-space coordinates of 4 samples on one level: the integer part of
+// x and y and the fraction for the bilinear weights. Repeat only needs one
+// period either way of [0, size) afterwards, clamp anything past the edge.
+typedef struct {
+    int32_t x[4];
+    int32_t y[4];
+    float fx[4];
+    float fy[4];
+} df_texture2d_coords_t;
+
+static inline void df_texture2d_coords(const df_texture2d_level_t *level, const df_sampler_t *sampler, df_sampler_filter filter,
+                                       df_f32x4 u, df_f32x4 v, df_texture2d_coords_t *c) {
+    if (sampler->address_s == DFSamplerAddressRepeat) {
+        u = df_f32x4_sub(u, df_f32x4_floor(u));
+    } else {
+        u = df_f32x4_min(df_f32x4_max(u, df_f32x4_splat(-1)), df_f32x4_splat(2));
+    }
+    if (sampler->address_t == DFSamplerAddressRepeat) {
+        v = df_f32x4_sub(v, df_f32x4_floor(v));
+    } else {
+        v = df_f32x4_min(df_f32x4_max(v, df_f32x4_splat(-1)), df_f32x4_splat(2));
+    }
+
+    df_f32x4 half = df_f32x4_splat(filter == DFSamplerFilterLinear ? 0.5f : 0);
+    df_f32x4 x = df_f32x4_sub(df_f32x4_mul(u, df_f32x4_splat((float) level->width)), half);
+    df_f32x4 y = df_f32x4_sub(df_f32x4_mul(v, df_f32x4_splat((float) level->height)), half);
+    df_f32x4 x0 = df_f32x4_floor(x), y0 = df_f32x4_floor(y);
+    df_f32x4_store(c->fx, df_f32x4_sub(x, x0));
+    df_f32x4_store(c->fy, df_f32x4_sub(y, y0));
+
+    float xi[4], yi[4];
+    df_f32x4_store(xi, x0);
+    df_f32x4_store(yi, y0);
+    for (int i = 0; i < 4; i++) {
+        c->x[i] = (int32_t) xi[i];
+        c->y[i] = (int32_t) yi[i];
+    }
+}
+
+// Sample i of `c` on one level
+static inline df_f32x4 df_texture2d_filter(const df_texture2d_t *texture, const df_texture2d_level_t *level, const df_sampler_t *sampler,
+                                           df_sampler_filter filter, const df_texture2d_coords_t *c, int i, const float *to_linear) {
+    uint32_t x0 = df_texture2d_wrap(c->x[i], level->width, sampler->address_s);
+    uint32_t y0 = df_texture2d_wrap(c->y[i], level->height, sampler->address_t);
+    if (filter == DFSamplerFilterNearest) {
+        return df_texture2d_fetch(texture, df_texture2d_index(level, x0, y0), to_linear);
+    }
+
+    uint32_t x1 = df_texture2d_wrap(c->x[i] + 1, level->width, sampler->address_s);
+    uint32_t y1 = df_texture2d_wrap(c->y[i] + 1, level->height, sampler->address_t);
+    df_f32x4 t00 = df_texture2d_fetch(texture, df_texture2d_index(level, x0, y0), to_linear);
+    df_f32x4 t10 = df_texture2d_fetch(texture, df_texture2d_index(level, x1, y0), to_linear);
+    df_f32x4 t01 = df_texture2d_fetch(texture, df_texture2d_index(level, x0, y1), to_linear);
+    df_f32x4 t11 = df_texture2d_fetch(texture, df_texture2d_index(level, x1, y1), to_linear);
+    df_f32x4 fx = df_f32x4_splat(c->fx[i]);
+    df_f32x4 top = df_f32x4_madd(df_f32x4_sub(t10, t00), fx, t00);
+    df_f32x4 bottom = df_f32x4_madd(df_f32x4_sub(t11, t01), fx, t01);
+    return df_f32x4_madd(df_f32x4_sub(bottom, top), df_f32x4_splat(c->fy[i]), top);
+}
+
+// The levels and weight a LOD selects
+typedef struct {
+    df_sampler_filter filter;
+    uint32_t level0;
+    uint32_t level1;
+    float weight;             // Of level1
+} df_texture2d_mip_t;
+
+static inline df_texture2d_mip_t df_texture2d_mip(const df_texture2d_t *texture, const df_sampler_t *sampler, float lod) {
+    df_texture2d_mip_t mip = { lod > 0 ? sampler->min_filter : sampler->mag_filter, 0, 0, 0 };
+    if (sampler->mip_filter == DFSamplerMipFilterNotMipmapped || !(lod > 0)) {
+        return mip;
+    }
+
+    float top = (float) (texture->level_count - 1);
+    lod = lod < top ? lod : top;
+    if (sampler->mip_filter == DFSamplerMipFilterNearest) {
+        mip.level0 = mip.level1 = (uint32_t) (lod + 0.5f);
+    } else {
+        mip.level0 = (uint32_t) lod;
+        mip.level1 = mip.level0 + 1 < texture->level_count ? mip.level0 + 1 : mip.level0;
+        mip.weight = lod - (float) mip.level0;
+    }
+    return mip;
+}
+
+// Samples sharing `mip`, `count` of them, written to out
+static void df_texture2d_sample_mip(const df_texture2d_t *texture, const df_sampler_t *sampler, const df_texture2d_mip_t *mip,
+                                    df_f32x4 u, df_f32x4 v, int count, float out[][4]) {
+    const float *to_linear = texture->srgb ? df_srgb_to_linear_lut() : NULL;
+    const df_texture2d_level_t *level0 = &texture->levels[mip->level0];
+    df_texture2d_coords_t c0;
+    df_texture2d_coords(level0, sampler, mip->filter, u, v, &c0);
+
+    if (mip->weight == 0) {
+        for (int i = 0; i < count; i++) {
+            df_f32x4_store(out[i], df_texture2d_filter(texture, level0, sampler, mip->filter, &c0, i, to_linear));
+        }
+        return;
+    }
+
+    const df_texture2d_level_t *level1 = &texture->levels[mip->level1];
+    df_texture2d_coords_t c1;
+    df_texture2d_coords(level1, sampler, mip->filter, u, v, &c1);
+    df_f32x4 weight = df_f32x4_splat(mip->weight);
+    for (int i = 0; i < count; i++) {
+        df_f32x4 a = df_texture2d_filter(texture, level0, sampler, mip->filter, &c0, i, to_linear);
+        df_f32x4 b = df_texture2d_filter(texture, level1, sampler, mip->filter, &c1, i, to_linear);
+        df_f32x4_store(out[i], df_f32x4_madd(df_f32x4_sub(b, a), weight, a));
+    }
+}
+
+void df_texture2d_sample(const df_texture2d_t *texture, const df_sampler_t *sampler, float u, float v, float lod, float out[4]) {
+    df_texture2d_mip_t mip = df_texture2d_mip(texture, sampler, lod);
+    float result[1][4];
+    df_texture2d_sample_mip(texture, sampler, &mip, df_f32x4_splat(u), df_f32x4_splat(v), 1, result);
+    memcpy(out, result[0], sizeof(result[0]));
+}
+
+void df_texture2d_sample_grad(const df_texture2d_t *texture, const df_sampler_t *sampler, float u, float v,
+                              const float dx[2], const float dy[2], float out[4]) {
+    df_texture2d_sample(texture, sampler, u, v, df_texture2d_lod(texture, dx, dy), out);
+}
+
+void df_texture2d_sample4(const df_texture2d_t *texture, const df_sampler_t *sampler, const float u[4], const float v[4],
+                          const float lod[4], float out[4][4]) {
+    df_texture2d_mip_t mip = df_texture2d_mip(texture, sampler, lod[0]);
+    bool shared = true;
+    for (int i = 1; i < 4; i++) {
+        df_texture2d_mip_t other = df_texture2d_mip(texture, sampler, lod[i]);
+        shared = shared && other.filter == mip.filter && other.level0 == mip.level0 && other.level1 == mip.level1 && other.weight == mip.weight;
+    }
+
+    if (shared) {
+        df_texture2d_sample_mip(texture, sampler, &mip, df_f32x4_load(u), df_f32x4_load(v), 4, out);
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        df_texture2d_sample(texture, sampler, u[i], v[i], lod[i], out[i]);
+    }
+}
+
+void df_texture2d_sample_quad(const df_texture2d_t *texture, const df_sampler_t *sampler, const float u[4], const float v[4], float out[4][4]) {
+    float dx[2] = { u[1] - u[0], v[1] - v[0] };
+    float dy[2] = { u[2] - u[0], v[2] - v[0] };
+    float lod = df_texture2d_lod(texture, dx, dy);
+    df_texture2d_mip_t mip = df_texture2d_mip(texture, sampler, lod);
+    df_texture2d_sample_mip(texture, sampler, &mip, df_f32x4_load(u), df_f32x4_load(v), 4, out);
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+static bool df_sampler_test_near(const float *a, const float *b, float tolerance) {
+    for (int i = 0; i < 4; i++) {
+        if (fabsf(a[i] - b[i]) > tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void df_sampler_test(void) {
+    // 6x5 RGBA8 with a known value per texel, plus its 3x2 and 1x1 mips
+    uint8_t texels[5][6][4];
+    for (int y = 0; y < 5; y++) {
+        for (int x = 0; x < 6; x++) {
+            texels[y][x][0] = (uint8_t) (x * 40);
+            texels[y][x][1] = (uint8_t) (y * 50);
+            texels[y][x][2] = (uint8_t) (x == 0 ? 255 : 0);
+            texels[y][x][3] = 255;
+        }
+    }
+    uint8_t mip1[2][3][4], mip2[4] = { 100, 100, 100, 255 };
+    memset(mip1, 200, sizeof(mip1));
+    df_texture_level_t levels[3] = {
+        { &texels[0][0][0], 6, 5, 6 * 4 }, { &mip1[0][0][0], 3, 2, 3 * 4 }, { mip2, 1, 1, 4 },
+    };
+
+    df_texture2d_t texture;
+    assert(df_texture2d_init(&texture, DFPixelFormatRGBA8Unorm, levels, 3));
+    df_sampler_t nearest = { DFSamplerFilterNearest, DFSamplerFilterNearest, DFSamplerMipFilterNotMipmapped,
+                             DFSamplerAddressClampToEdge, DFSamplerAddressClampToEdge };
+    df_sampler_t linear = { DFSamplerFilterLinear, DFSamplerFilterLinear, DFSamplerMipFilterLinear,
+                            DFSamplerAddressClampToEdge, DFSamplerAddressClampToEdge };
+    float out[4];
+
+    // Nearest returns each texel exactly at its centre, and clamps outside
+    for (int y = 0; y < 5; y++) {
+        for (int x = 0; x < 6; x++) {
+            df_texture2d_sample(&texture, &nearest, (x + 0.5f) / 6, (y + 0.5f) / 5, 0, out);
+            float expected[4] = { x * 40 / 255.0f, y * 50 / 255.0f, x == 0 ? 1.0f : 0, 1 };
+            assert(df_sampler_test_near(out, expected, 1e-6f));
+        }
+    }
+    df_texture2d_sample(&texture, &nearest, -3.0f, 7.0f, 0, out);
+    assert(out[0] == 0 && fabsf(out[1] - 200 / 255.0f) < 1e-6f);
+
+    // Bilinear halfway between texel centres; clamp keeps the edge texel,
+    // repeat blends with the other side
+    df_texture2d_sample(&texture, &linear, 2.0f / 6, 2.5f / 5, 0, out);
+    assert(fabsf(out[0] - 60 / 255.0f) < 1e-6f && fabsf(out[1] - 100 / 255.0f) < 1e-6f);
+    df_texture2d_sample(&texture, &linear, 0, 0.5f / 5, 0, out);
+    assert(out[0] == 0 && out[2] == 1);
+    df_sampler_t repeat = linear;
+    repeat.address_s = DFSamplerAddressRepeat;
+    df_texture2d_sample(&texture, &repeat, 0, 0.5f / 5, 0, out);
+    assert(fabsf(out[0] - 100 / 255.0f) < 1e-6f && fabsf(out[2] - 0.5f) < 1e-6f);
+    df_texture2d_sample(&texture, &repeat, 7 + 0.5f / 6, 0.5f / 5, 0, out);
+    assert(fabsf(out[0]) < 1e-4f && fabsf(out[2] - 1) < 1e-4f);
+
+    // LOD picks and blends levels: halfway between level 1 and 2 with
+    // trilinear, level 1 only when rounding to the nearest level
+    df_texture2d_sample(&texture, &linear, 0.5f, 0.5f, 1.5f, out);
+    assert(fabsf(out[0] - 150 / 255.0f) < 1e-6f);
+    df_sampler_t mip_nearest = linear;
+    mip_nearest.mip_filter = DFSamplerMipFilterNearest;
+    df_texture2d_sample(&texture, &mip_nearest, 0.5f, 0.5f, 1.4f, out);
+    assert(fabsf(out[0] - 200 / 255.0f) < 1e-6f);
+    df_texture2d_sample(&texture, &linear, 0.5f, 0.5f, 9, out);
+    assert(fabsf(out[0] - 100 / 255.0f) < 1e-6f);
+
+    // A quad one texel apart is level 0; four texels apart is level 2
+    float u[4] = { 0.1f, 0.1f + 1.0f / 6, 0.1f, 0.1f + 1.0f / 6 }, v[4] = { 0.1f, 0.1f, 0.1f + 1.0f / 5, 0.1f + 1.0f / 5 };
+    float dx[2] = { u[1] - u[0], 0 }, dy[2] = { 0, v[2] - v[0] };
+    assert(fabsf(df_texture2d_lod(&texture, dx, dy)) < 1e-5f);
+    dx[0] *= 4;
+    assert(fabsf(df_texture2d_lod(&texture, dx, dy) - 2) < 1e-5f);
+
+    // 4 wide matches one at a time, with shared and with mixed LODs
+    float quad[4][4];
+    df_texture2d_sample_quad(&texture, &linear, u, v, quad);
+    for (int i = 0; i < 4; i++) {
+        df_texture2d_sample(&texture, &linear, u[i], v[i], 0, out);
+        assert(df_sampler_test_near(out, quad[i], 1e-6f));
+    }
+    float lods[4] = { 0, 0.7f, 1.2f, 3 };
+    df_texture2d_sample4(&texture, &repeat, u, v, lods, quad);
+    for (int i = 0; i < 4; i++) {
+        df_texture2d_sample(&texture, &repeat, u[i], v[i], lods[i], out);
+        assert(df_sampler_test_near(out, quad[i], 1e-6f));
+    }
+    df_texture2d_free(&texture);
+
+    // A view reads the rows in place, past any row padding, and gives the
+    // same samples as the block copy
+    uint8_t padded[5][8][4];
+    memset(padded, 0, sizeof(padded));
+    for (int y = 0; y < 5; y++) {
+        memcpy(padded[y], texels[y], sizeof(texels[y]));
+    }
+    df_cpu_texture_t color = { &padded[0][0][0], 6, 5, sizeof(padded[0]) };
+    df_texture2d_t view, copy;
+    assert(df_texture2d_view(&view, &color, false));
+    assert(df_texture2d_init(&copy, DFPixelFormatRGBA8Unorm, levels, 1));
+    for (float v0 = 0; v0 <= 1; v0 += 0.125f) {
+        for (float u0 = 0; u0 <= 1; u0 += 0.0625f) {
+            float expected[4];
+            df_texture2d_sample(&view, &linear, u0, v0, 0, out);
+            df_texture2d_sample(&copy, &linear, u0, v0, 0, expected);
+            assert(df_sampler_test_near(out, expected, 0));
+        }
+    }
+    padded[2][3][0] = 7;
+    df_texture2d_sample(&view, &nearest, 3.5f / 6, 2.5f / 5, 0, out);
+    assert(fabsf(out[0] - 7 / 255.0f) < 1e-6f);
+    df_texture2d_free(&view);
+    df_texture2d_free(&copy);
+    assert(padded[2][3][0] == 7);
+
+    // BGRA is swizzled, sRGB decoded before filtering, half read as is
+    uint8_t bgra[4] = { 255, 0, 188, 128 };
+    df_texture_level_t level = { bgra, 1, 1, 4 };
+    assert(df_texture2d_init(&texture, DFPixelFormatBGRA8Unorm_sRGB, &level, 1));
+    df_texture2d_sample(&texture, &linear, 0.5f, 0.5f, 0, out);
+    assert(fabsf(out[0] - df_srgb_to_linear_lut()[188]) < 1e-6f && out[1] == 0 && fabsf(out[2] - 1) < 1e-6f && fabsf(out[3] - 128 / 255.0f) < 1e-6f);
+    df_texture2d_free(&texture);
+
+    df_half halves[2][4] = {
+        { df_float_to_half(-2), df_float_to_half(0.25f), df_float_to_half(3), df_float_to_half(1) },
+        { df_float_to_half(2), df_float_to_half(0.75f), df_float_to_half(3), df_float_to_half(1) },
+    };
+    level = (df_texture_level_t) { (const uint8_t *) halves, 2, 1, sizeof(halves) };
+    assert(df_texture2d_init(&texture, DFPixelFormatRGBA16Float, &level, 1));
+    df_texture2d_sample(&texture, &linear, 0.5f, 0.5f, 0, out);
+    float expected[4] = { 0, 0.5f, 3, 1 };
+    assert(df_sampler_test_near(out, expected, 0));
+    df_texture2d_free(&texture);
+
+    printf("sampler: passed!\n");
+}
+#endif
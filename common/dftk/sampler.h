@@ -0,0 +1,98 @@
+#if !defined(DFTK_SAMPLER_H)
+#define DFTK_SAMPLER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu_texture.h"
+#include "texture_file.h"
+
+// Texture sampling for CPU fragment shaders, the counterpart of
+// texture2d::sample() with a constexpr sampler. Textures are RGBA8, BGRA8
+// (sRGB or not) or RGBA16Float with a mip chain. Levels are stored in 4x4
+// texel blocks, so a bilinear footprint is almost always one or two cache
+// lines. Samples come back as float RGBA: BGRA is swizzled and sRGB decoded
+// to linear before filtering, like the GPU does.
+//
+// The LOD is log2 of the texel footprint of a pixel. df_texture2d_sample_quad
+// takes it from the differences across a 2x2 quad, as the GPU does;
+// per-pixel shaders get it from the rasterizer's varying derivatives through
+// df_texture2d_sample_grad.
+//
+// A render target's colour can be sampled in place through
+// df_texture2d_view(), without copying it into blocks.
+
+#define DF_TEXTURE2D_MAX_LEVELS 16
+
+// Same values as MTLSamplerMinMagFilter / MTLSamplerMipFilter
+typedef enum {
+    DFSamplerFilterNearest,
+    DFSamplerFilterLinear,
+} df_sampler_filter;
+
+typedef enum {
+    DFSamplerMipFilterNotMipmapped,
+    DFSamplerMipFilterNearest,
+    DFSamplerMipFilterLinear,
+} df_sampler_mip_filter;
+
+// Same values as MTLSamplerAddressMode
+typedef enum {
+    DFSamplerAddressClampToEdge = 0,
+    DFSamplerAddressRepeat = 2,
+} df_sampler_address;
+
+typedef struct {
+    df_sampler_filter mag_filter;
+    df_sampler_filter min_filter;
+    df_sampler_mip_filter mip_filter;
+    df_sampler_address address_s;
+    df_sampler_address address_t;
+} df_sampler_t;
+
+typedef struct {
+    size_t offset;            // In texels from the start of data
+    uint32_t width;
+    uint32_t height;
+    uint32_t blocks_per_row;
+    uint32_t pitch;           // Texels per row of a view's linear rows, 0 for blocks
+} df_texture2d_level_t;
+
+typedef struct {
+    void *data;               // uint32_t RGBA8 or 4 df_half per texel, every level
+    df_pixel_format format;
+    bool half;
+    bool srgb;
+    bool view;                // Doesn't own data
+    uint32_t level_count;
+    df_texture2d_level_t levels[DF_TEXTURE2D_MAX_LEVELS];
+} df_texture2d_t;
+
+// Copies the levels, linear rows in `format`, into block storage
+bool df_texture2d_init(df_texture2d_t *texture, df_pixel_format format, const df_texture_level_t *levels, uint32_t level_count);
+void df_texture2d_free(df_texture2d_t *texture);
+
+// One level over the RGBA8 rows of `color`, such as a render target's, read
+// in place. The pixels must stay alive as long as the view.
+bool df_texture2d_view(df_texture2d_t *texture, const df_cpu_texture_t *color, bool srgb);
+
+// LOD from the texture coordinate's derivatives along x and y
+float df_texture2d_lod(const df_texture2d_t *texture, const float dx[2], const float dy[2]);
+
+void df_texture2d_sample(const df_texture2d_t *texture, const df_sampler_t *sampler, float u, float v, float lod, float out[4]);
+void df_texture2d_sample_grad(const df_texture2d_t *texture, const df_sampler_t *sampler, float u, float v,
+                              const float dx[2], const float dy[2], float out[4]);
+
+// Four samples at once, coordinates and weights computed 4 wide
+void df_texture2d_sample4(const df_texture2d_t *texture, const df_sampler_t *sampler, const float u[4], const float v[4],
+                          const float lod[4], float out[4][4]);
+
+// A 2x2 quad of samples, top-left, top-right, bottom-left, bottom-right,
+// sharing the LOD of their differences
+void df_texture2d_sample_quad(const df_texture2d_t *texture, const df_sampler_t *sampler, const float u[4], const float v[4], float out[4][4]);
+
+#ifdef TEST
+void df_sampler_test(void);
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+#if !defined(DFTK_SIMD_H)
+#define DFTK_SIMD_H
+
+#include <math.h>
+#include <stdint.h>
+
+// A minimal 4-wide float vector used by the CPU image code to process one
+// RGBA pixel per operation. Maps to SSE on x86, NEON on ARM and plain
+// scalar code everywhere else. df_f32x4_transpose turns four RGBA pixels
+// into R, G, B and A vectors (and back) for kernels that work per channel.
+// df_i32x4 has just the integer operations the rasterizer's edge functions
+// need; df_i32x4_sign_mask packs the four sign bits, lane 0 in bit 0, and
+// df_f32x4_less_mask / df_f32x4_less_equal_mask pack a comparison the same way.
+// df_f32x4_floor is exact for |x| < 2^31.
+// df_f32x4_to_unorm8 clamps to [0, 1] and packs an RGBA8 pixel, lane 0 in
+// the low byte; df_f32x4_from_unorm8 unpacks one.
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DF_SIMD_SSE2 1
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DF_SIMD_NEON 1
+#endif
+
+#if defined(DF_SIMD_SSE2)
+
+typedef __m128 df_f32x4;
+
+static inline df_f32x4 df_f32x4_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void df_f32x4_store(float *p, df_f32x4 v) { _mm_storeu_ps(p, v); }
+static inline df_f32x4 df_f32x4_splat(float x) { return _mm_set1_ps(x); }
+static inline df_f32x4 df_f32x4_set(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+static inline df_f32x4 df_f32x4_add(df_f32x4 a, df_f32x4 b) { return _mm_add_ps(a, b); }
+static inline df_f32x4 df_f32x4_sub(df_f32x4 a, df_f32x4 b) { return _mm_sub_ps(a, b); }
+static inline df_f32x4 df_f32x4_mul(df_f32x4 a, df_f32x4 b) { return _mm_mul_ps(a, b); }
+static inline df_f32x4 df_f32x4_madd(df_f32x4 a, df_f32x4 b, df_f32x4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+static inline df_f32x4 df_f32x4_min(df_f32x4 a, df_f32x4 b) { return _mm_min_ps(a, b); }
+static inline df_f32x4 df_f32x4_max(df_f32x4 a, df_f32x4 b) { return _mm_max_ps(a, b); }
+static inline df_f32x4 df_f32x4_floor(df_f32x4 v) {
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1)));
+}
+static inline void df_f32x4_transpose(df_f32x4 *a, df_f32x4 *b, df_f32x4 *c, df_f32x4 *d) { _MM_TRANSPOSE4_PS(*a, *b, *c, *d); }
+static inline uint32_t df_f32x4_to_unorm8(df_f32x4 v) {
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1));
+    __m128i i = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255)), _mm_set1_ps(0.5f)));
+    i = _mm_packs_epi32(i, i);
+    return (uint32_t) _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+}
+
+static inline df_f32x4 df_f32x4_from_unorm8(uint32_t pixel) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int) pixel), zero), zero);
+    return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f / 255));
+}
+
+typedef __m128i df_i32x4;
+
+static inline df_i32x4 df_i32x4_splat(int32_t x) { return _mm_set1_epi32(x); }
+static inline df_i32x4 df_i32x4_set(int32_t x, int32_t y, int32_t z, int32_t w) { return _mm_setr_epi32(x, y, z, w); }
+static inline df_i32x4 df_i32x4_add(df_i32x4 a, df_i32x4 b) { return _mm_add_epi32(a, b); }
+static inline df_i32x4 df_i32x4_or(df_i32x4 a, df_i32x4 b) { return _mm_or_si128(a, b); }
+static inline int df_i32x4_sign_mask(df_i32x4 v) { return _mm_movemask_ps(_mm_castsi128_ps(v)); }
+static inline int df_f32x4_less_mask(df_f32x4 a, df_f32x4 b) { return _mm_movemask_ps(_mm_cmplt_ps(a, b)); }
+static inline int df_f32x4_less_equal_mask(df_f32x4 a, df_f32x4 b) { return _mm_movemask_ps(_mm_cmple_ps(a, b)); }
+
+#elif defined(DF_SIMD_NEON)
+
+typedef float32x4_t df_f32x4;
+
+static inline df_f32x4 df_f32x4_load(const float *p) { return vld1q_f32(p); }
+static inline void df_f32x4_store(float *p, df_f32x4 v) { vst1q_f32(p, v); }
+static inline df_f32x4 df_f32x4_splat(float x) { return vdupq_n_f32(x); }
+static inline df_f32x4 df_f32x4_set(float x, float y, float z, float w) { float v[4] = { x, y, z, w }; return vld1q_f32(v); }
+static inline df_f32x4 df_f32x4_add(df_f32x4 a, df_f32x4 b) { return vaddq_f32(a, b); }
+static inline df_f32x4 df_f32x4_sub(df_f32x4 a, df_f32x4 b) { return vsubq_f32(a, b); }
+static inline df_f32x4 df_f32x4_mul(df_f32x4 a, df_f32x4 b) { return vmulq_f32(a, b); }
+static inline df_f32x4 df_f32x4_madd(df_f32x4 a, df_f32x4 b, df_f32x4 c) { return vmlaq_f32(c, a, b); }
+static inline df_f32x4 df_f32x4_min(df_f32x4 a, df_f32x4 b) { return vminq_f32(a, b); }
+static inline df_f32x4 df_f32x4_max(df_f32x4 a, df_f32x4 b) { return vmaxq_f32(a, b); }
+static inline df_f32x4 df_f32x4_floor(df_f32x4 v) { return vrndmq_f32(v); }
+static inline void df_f32x4_transpose(df_f32x4 *a, df_f32x4 *b, df_f32x4 *c, df_f32x4 *d) {
+    float32x4x2_t ab = vtrnq_f32(*a, *b), cd = vtrnq_f32(*c, *d);
+    *a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    *b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    *c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    *d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+static inline uint32_t df_f32x4_to_unorm8(df_f32x4 v) {
+    v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0)), vdupq_n_f32(1));
+    uint16x4_t h = vmovn_u32(vcvtq_u32_f32(vmlaq_f32(vdupq_n_f32(0.5f), v, vdupq_n_f32(255))));
+    return vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(h, h))), 0);
+}
+
+static inline df_f32x4 df_f32x4_from_unorm8(uint32_t pixel) {
+    uint32x4_t v = vmovl_u16(vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(pixel)))));
+    return vmulq_f32(vcvtq_f32_u32(v), vdupq_n_f32(1.0f / 255));
+}
+
+typedef int32x4_t df_i32x4;
+
+static inline df_i32x4 df_i32x4_splat(int32_t x) { return vdupq_n_s32(x); }
+static inline df_i32x4 df_i32x4_set(int32_t x, int32_t y, int32_t z, int32_t w) { int32_t v[4] = { x, y, z, w }; return vld1q_s32(v); }
+static inline df_i32x4 df_i32x4_add(df_i32x4 a, df_i32x4 b) { return vaddq_s32(a, b); }
+static inline df_i32x4 df_i32x4_or(df_i32x4 a, df_i32x4 b) { return vorrq_s32(a, b); }
+static inline int df_i32x4_sign_mask(df_i32x4 v) {
+    uint32x4_t s = vshrq_n_u32(vreinterpretq_u32_s32(v), 31);
+    return (int) (vgetq_lane_u32(s, 0) | vgetq_lane_u32(s, 1) << 1 | vgetq_lane_u32(s, 2) << 2 | vgetq_lane_u32(s, 3) << 3);
+}
+static inline int df_f32x4_less_mask(df_f32x4 a, df_f32x4 b) { return df_i32x4_sign_mask(vreinterpretq_s32_u32(vcltq_f32(a, b))); }
+static inline int df_f32x4_less_equal_mask(df_f32x4 a, df_f32x4 b) { return df_i32x4_sign_mask(vreinterpretq_s32_u32(vcleq_f32(a, b))); }
+
+#else
+
+typedef struct { float v[4]; } df_f32x4;
+
+static inline df_f32x4 df_f32x4_load(const float *p) { df_f32x4 r = {{ p[0], p[1], p[2], p[3] }}; return r; }
+static inline void df_f32x4_store(float *p, df_f32x4 v) { for (int i = 0; i < 4; i++) p[i] = v.v[i]; }
+static inline df_f32x4 df_f32x4_splat(float x) { df_f32x4 r = {{ x, x, x, x }}; return r; }
+static inline df_f32x4 df_f32x4_set(float x, float y, float z, float w) { df_f32x4 r = {{ x, y, z, w }}; return r; }
+static inline df_f32x4 df_f32x4_add(df_f32x4 a, df_f32x4 b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+static inline df_f32x4 df_f32x4_sub(df_f32x4 a, df_f32x4 b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+static inline df_f32x4 df_f32x4_mul(df_f32x4 a, df_f32x4 b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+static inline df_f32x4 df_f32x4_madd(df_f32x4 a, df_f32x4 b, df_f32x4 c) { for (int i = 0; i < 4; i++) c.v[i] += a.v[i] * b.v[i]; return c; }
+static inline df_f32x4 df_f32x4_min(df_f32x4 a, df_f32x4 b) { for (int i = 0; i < 4; i++) a.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return a; }
+static inline df_f32x4 df_f32x4_max(df_f32x4 a, df_f32x4 b) { for (int i = 0; i < 4; i++) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return a; }
+static inline df_f32x4 df_f32x4_floor(df_f32x4 v) { for (int i = 0; i < 4; i++) v.v[i] = floorf(v.v[i]); return v; }
+static inline void df_f32x4_transpose(df_f32x4 *a, df_f32x4 *b, df_f32x4 *c, df_f32x4 *d) {
+    df_f32x4 *rows[4] = { a, b, c, d };
+    for (int i = 0; i < 4; i++) {
+        for (int j = i + 1; j < 4; j++) {
+            float t = rows[i]->v[j]; rows[i]->v[j] = rows[j]->v[i]; rows[j]->v[i] = t;
+        }
+    }
+}
+static inline uint32_t df_f32x4_to_unorm8(df_f32x4 v) {
+    uint32_t pixel = 0;
+    for (int i = 0; i < 4; i++) {
+        float c = v.v[i] > 0 ? (v.v[i] < 1 ? v.v[i] : 1) : 0;
+        pixel |= (uint32_t) (c * 255.0f + 0.5f) << (8 * i);
+    }
+    return pixel;
+}
+
+static inline df_f32x4 df_f32x4_from_unorm8(uint32_t pixel) {
+    df_f32x4 r;
+    for (int i = 0; i < 4; i++) r.v[i] = ((pixel >> (8 * i)) & 0xff) * (1.0f / 255);
+    return r;
+}
+
+typedef struct { int32_t v[4]; } df_i32x4;
+
+static inline df_i32x4 df_i32x4_splat(int32_t x) { df_i32x4 r = {{ x, x, x, x }}; return r; }
+static inline df_i32x4 df_i32x4_set(int32_t x, int32_t y, int32_t z, int32_t w) { df_i32x4 r = {{ x, y, z, w }}; return r; }
+static inline df_i32x4 df_i32x4_add(df_i32x4 a, df_i32x4 b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+static inline df_i32x4 df_i32x4_or(df_i32x4 a, df_i32x4 b) { for (int i = 0; i < 4; i++) a.v[i] |= b.v[i]; return a; }
+static inline int df_i32x4_sign_mask(df_i32x4 v) {
+    int mask = 0;
+    for (int i = 0; i < 4; i++) mask |= (v.v[i] < 0) << i;
+    return mask;
+}
+static inline int df_f32x4_less_mask(df_f32x4 a, df_f32x4 b) {
+    int mask = 0;
+    for (int i = 0; i < 4; i++) mask |= (a.v[i] < b.v[i]) << i;
+    return mask;
+}
+static inline int df_f32x4_less_equal_mask(df_f32x4 a, df_f32x4 b) {
+    int mask = 0;
+    for (int i = 0; i < 4; i++) mask |= (a.v[i] <= b.v[i]) << i;
+    return mask;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "texture_cache.h"
+
+#define DF_CACHE_BUCKETS 256
+
+void df_texture_cache_init(df_texture_cache_t *cache, size_t budget, void (*release_fn)(void *value, void *user), void *user) {
+    memset(cache, 0, sizeof(*cache));
+    cache->num_buckets = DF_CACHE_BUCKETS;
+    cache->buckets = (df_cache_entry_t **) calloc(cache->num_buckets, sizeof(df_cache_entry_t *));
+    cache->num_path_buckets = DF_CACHE_BUCKETS;
+    cache->path_buckets = (df_cache_path_t **) calloc(cache->num_path_buckets, sizeof(df_cache_path_t *));
+    cache->budget = budget;
+    cache->release_fn = release_fn;
+    cache->user = user;
+}
+
+static void df_lru_unlink(df_texture_cache_t *cache, df_cache_entry_t *entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else cache->lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else cache->lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void df_lru_push_front(df_texture_cache_t *cache, df_cache_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) cache->lru_head->lru_prev = entry;
+    else cache->lru_tail = entry;
+    cache->lru_head = entry;
+}
+
+static void df_texture_cache_remove(df_texture_cache_t *cache, df_cache_entry_t *entry) {
+    df_cache_entry_t **link = &cache->buckets[entry->key % cache->num_buckets];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    cache->bytes -= entry->bytes;
+    if (cache->release_fn) {
+        cache->release_fn(entry->value, cache->user);
+    }
+    free(entry);
+}
+
+// Takes a reference to the entry for `key`, or returns NULL on a miss
+df_cache_entry_t *df_texture_cache_acquire(df_texture_cache_t *cache, uint64_t key) {
+    for (df_cache_entry_t *entry = cache->buckets[key % cache->num_buckets]; entry; entry = entry->next) {
+        if (entry->key == key) {
+            if (entry->ref_count++ == 0) {
+                df_lru_unlink(cache, entry);
+            }
+            cache->hits++;
+            return entry;
+        }
+    }
+
+    cache->misses++;
+    return NULL;
+}
+
+// Adds a new entry holding one reference. The caller must have checked
+// that `key` is not cached yet.
+df_cache_entry_t *df_texture_cache_insert(df_texture_cache_t *cache, uint64_t key, void *value, size_t bytes) {
+    df_cache_entry_t *entry = (df_cache_entry_t *) calloc(1, sizeof(df_cache_entry_t));
+    entry->key = key;
+    entry->value = value;
+    entry->bytes = bytes;
+    entry->ref_count = 1;
+
+    df_cache_entry_t **bucket = &cache->buckets[key % cache->num_buckets];
+    entry->next = *bucket;
+    *bucket = entry;
+    cache->bytes += bytes;
+
+    df_texture_cache_trim(cache);
+
+    return entry;
+}
+
+void df_texture_cache_release(df_texture_cache_t *cache, df_cache_entry_t *entry) {
+    if (--entry->ref_count == 0) {
+        df_lru_push_front(cache, entry);
+        df_texture_cache_trim(cache);
+    }
+}
+
+// Evicts unreferenced entries, oldest first, until the cache fits its
+// budget. Referenced entries are never evicted, so the cache can stay over
+// budget while they are in use.
+void df_texture_cache_trim(df_texture_cache_t *cache) {
+    while (cache->bytes > cache->budget && cache->lru_tail) {
+        df_cache_entry_t *entry = cache->lru_tail;
+        df_lru_unlink(cache, entry);
+        df_texture_cache_remove(cache, entry);
+        cache->evictions++;
+    }
+}
+
+static size_t df_path_bucket(df_texture_cache_t *cache, const char *path) {
+    return df_hash64(path, strlen(path), 0) % cache->num_path_buckets;
+}
+
+// Fast path: the content key seen last time for this exact file version
+// loaded with this many mip levels
+bool df_texture_cache_lookup_path(df_texture_cache_t *cache, const char *path, int64_t mtime, int64_t size, uint32_t levels, uint64_t *key) {
+    for (df_cache_path_t *p = cache->path_buckets[df_path_bucket(cache, path)]; p; p = p->next) {
+        if (p->levels == levels && strcmp(p->path, path) == 0) {
+            if (p->mtime != mtime || p->size != size) {
+                return false;
+            }
+            *key = p->key;
+            return true;
+        }
+    }
+    return false;
+}
+
+void df_texture_cache_remember_path(df_texture_cache_t *cache, const char *path, int64_t mtime, int64_t size, uint32_t levels, uint64_t key) {
+    df_cache_path_t **bucket = &cache->path_buckets[df_path_bucket(cache, path)];
+
+    df_cache_path_t *p = *bucket;
+    while (p && (p->levels != levels || strcmp(p->path, path) != 0)) {
+        p = p->next;
+    }
+
+    if (!p) {
+        p = (df_cache_path_t *) calloc(1, sizeof(df_cache_path_t));
+        p->path = strdup(path);
+        p->levels = levels;
+        p->next = *bucket;
+        *bucket = p;
+    }
+
+    p->mtime = mtime;
+    p->size = size;
+    p->key = key;
+}
+
+// Releases every entry, referenced or not
+void df_texture_cache_deinit(df_texture_cache_t *cache) {
+    for (size_t i = 0; i < cache->num_buckets; i++) {
+        while (cache->buckets[i]) {
+            df_texture_cache_remove(cache, cache->buckets[i]);
+        }
+    }
+
+    for (size_t i = 0; i < cache->num_path_buckets; i++) {
+        df_cache_path_t *p = cache->path_buckets[i];
+        while (p) {
+            df_cache_path_t *next = p->next;
+            free(p->path);
+            free(p);
+            p = next;
+        }
+    }
+
+    free(cache->buckets);
+    free(cache->path_buckets);
+    memset(cache, 0, sizeof(*cache));
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+static void df_texture_cache_test_release(void *value, void *user) {
+    (*(int *) user)++;
+}
+
+void df_texture_cache_test(void) {
+    int released = 0;
+    df_texture_cache_t cache;
+    df_texture_cache_init(&cache, 100, df_texture_cache_test_release, &released);
+
+    df_cache_entry_t *a = df_texture_cache_insert(&cache, 1, NULL, 60);
+    df_cache_entry_t *b = df_texture_cache_insert(&cache, 2, NULL, 60);
+    assert(released == 0 && cache.bytes == 120);   // Both referenced, over budget
+
+    assert(df_texture_cache_acquire(&cache, 1) == a);
+    df_texture_cache_release(&cache, a);
+    df_texture_cache_release(&cache, a);
+    assert(released == 1 && cache.bytes == 60);    // a evicted once unreferenced
+    assert(!df_texture_cache_acquire(&cache, 1));
+
+    df_texture_cache_release(&cache, b);
+    assert(released == 1);                          // b fits the budget, stays resident
+    assert(df_texture_cache_acquire(&cache, 2) == b);
+    df_texture_cache_release(&cache, b);
+
+    uint64_t key;
+    df_texture_cache_remember_path(&cache, "Image.jpg", 10, 20, 1, 2);
+    assert(df_texture_cache_lookup_path(&cache, "Image.jpg", 10, 20, 1, &key) && key == 2);
+    assert(!df_texture_cache_lookup_path(&cache, "Image.jpg", 11, 20, 1, &key));
+
+    // The same path with a full mip chain is a different texture, and
+    // neither load hands out the other's key
+    assert(!df_texture_cache_lookup_path(&cache, "Image.jpg", 10, 20, 9, &key));
+    df_texture_cache_remember_path(&cache, "Image.jpg", 10, 20, 9, 3);
+    assert(df_texture_cache_lookup_path(&cache, "Image.jpg", 10, 20, 9, &key) && key == 3);
+    assert(df_texture_cache_lookup_path(&cache, "Image.jpg", 10, 20, 1, &key) && key == 2);
+
+    // An edited file updates only the record of the level count reloaded
+    df_texture_cache_remember_path(&cache, "Image.jpg", 11, 24, 9, 4);
+    assert(df_texture_cache_lookup_path(&cache, "Image.jpg", 11, 24, 9, &key) && key == 4);
+    assert(!df_texture_cache_lookup_path(&cache, "Image.jpg", 11, 24, 1, &key));
+    assert(df_texture_cache_lookup_path(&cache, "Image.jpg", 10, 20, 1, &key) && key == 2);
+
+    df_texture_cache_deinit(&cache);
+    assert(released == 2);
+
+    printf("texture_cache: passed!\n");
+}
+#endif
@@ -0,0 +1,65 @@
+#if !defined(DFTK_TEXTURE_CACHE_H)
+#define DFTK_TEXTURE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Reference counted cache of loaded textures keyed by the hash of their
+// file contents. Entries nobody references stay resident until the total
+// size goes over the budget, then the least recently used ones are
+// evicted. A second table maps path + mtime + size + requested mip levels
+// to the content key so unchanged files don't need re-hashing; the levels
+// are part of the content key, so one path loaded with different level
+// counts has one record per count. The cached value is opaque; the
+// owner frees it in `release_fn`.
+
+typedef struct df_cache_entry_t {
+    uint64_t key;                     // Content key
+    void *value;                      // The cached object
+    size_t bytes;                     // Memory accounted against the budget
+    int ref_count;
+    struct df_cache_entry_t *next;    // Next entry in the same bucket
+    struct df_cache_entry_t *lru_prev; // Unreferenced entries, most recently used first
+    struct df_cache_entry_t *lru_next;
+} df_cache_entry_t;
+
+typedef struct df_cache_path_t {
+    char *path;
+    int64_t mtime;
+    int64_t size;
+    uint32_t levels;                  // Mip levels requested
+    uint64_t key;
+    struct df_cache_path_t *next;
+} df_cache_path_t;
+
+typedef struct {
+    df_cache_entry_t **buckets;
+    size_t num_buckets;
+    df_cache_path_t **path_buckets;
+    size_t num_path_buckets;
+    df_cache_entry_t *lru_head;
+    df_cache_entry_t *lru_tail;
+    size_t bytes;                     // Total size of every resident entry
+    size_t budget;                    // Eviction starts above this
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    void (*release_fn)(void *value, void *user);
+    void *user;
+} df_texture_cache_t;
+
+void df_texture_cache_init(df_texture_cache_t *cache, size_t budget, void (*release_fn)(void *value, void *user), void *user);
+df_cache_entry_t *df_texture_cache_acquire(df_texture_cache_t *cache, uint64_t key);
+df_cache_entry_t *df_texture_cache_insert(df_texture_cache_t *cache, uint64_t key, void *value, size_t bytes);
+void df_texture_cache_release(df_texture_cache_t *cache, df_cache_entry_t *entry);
+bool df_texture_cache_lookup_path(df_texture_cache_t *cache, const char *path, int64_t mtime, int64_t size, uint32_t levels, uint64_t *key);
+void df_texture_cache_remember_path(df_texture_cache_t *cache, const char *path, int64_t mtime, int64_t size, uint32_t levels, uint64_t key);
+void df_texture_cache_trim(df_texture_cache_t *cache);
+void df_texture_cache_deinit(df_texture_cache_t *cache);
+
+#ifdef TEST
+void df_texture_cache_test(void);
+#endif
+
+#endif
@@ -0,0 +1,277 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lz4.h"
+#include "texture_file.h"
+
+uint32_t df_pixel_format_bytes_per_pixel(df_pixel_format format) {
+    switch (format) {
+        case DFPixelFormatRGBA8Unorm:
+        case DFPixelFormatRGBA8Unorm_sRGB:
+        case DFPixelFormatBGRA8Unorm:
+        case DFPixelFormatBGRA8Unorm_sRGB:
+            return 4;
+        case DFPixelFormatRGBA16Float:
+            return 8;
+    }
+    return 0;
+}
+
+static uint64_t df_align_up(uint64_t x, uint64_t alignment) {
+    return (x + alignment - 1) / alignment * alignment;
+}
+
+static bool df_write_padding(FILE *f, uint64_t *offset, uint64_t alignment) {
+    static const uint8_t zeroes[DF_TEXTURE_FILE_DATA_ALIGNMENT] = {0};
+    uint64_t padding = df_align_up(*offset, alignment) - *offset;
+    *offset += padding;
+    return fwrite(zeroes, 1, padding, f) == padding;
+}
+
+// Writes `levels` (level 0 first) re-pitched to `row_alignment` bytes.
+// With DFTextureFileCompressionLZ4 a level is only stored compressed if
+// that actually makes it smaller. The file is written next to `path` and
+// renamed into place, so an interrupted write never leaves a truncated
+// file under `path`.
+bool df_texture_file_write(const char *path, df_pixel_format format, const df_texture_level_t *levels, uint32_t level_count, uint32_t row_alignment, df_texture_file_compression compression) {
+    uint32_t bpp = df_pixel_format_bytes_per_pixel(format);
+    if (bpp == 0 || level_count == 0 || level_count > DF_TEXTURE_FILE_MAX_LEVELS) {
+        return false;
+    }
+    if (row_alignment == 0) {
+        row_alignment = 1;
+    }
+
+    size_t tmp_size = strlen(path) + 32;
+    char *tmp_path = (char *) malloc(tmp_size);
+    if (!tmp_path) {
+        return false;
+    }
+    snprintf(tmp_path, tmp_size, "%s.%ld.tmp", path, (long) getpid());
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        free(tmp_path);
+        return false;
+    }
+
+    df_texture_file_header_t header = {0};
+    header.magic = DF_TEXTURE_FILE_MAGIC;
+    header.version = DF_TEXTURE_FILE_VERSION;
+    header.pixel_format = format;
+    header.width = levels[0].width;
+    header.height = levels[0].height;
+    header.level_count = level_count;
+    header.row_alignment = row_alignment;
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    uint64_t offset = sizeof(header);
+
+    for (uint32_t i = 0; i < level_count && ok; i++) {
+        const df_texture_level_t *src = &levels[i];
+        df_texture_file_level_t *level = &header.levels[i];
+
+        level->width = src->width;
+        level->height = src->height;
+        level->bytes_per_row = (uint32_t) df_align_up(src->width * bpp, row_alignment);
+
+        size_t size = (size_t) level->bytes_per_row * level->height;
+        uint8_t *packed = (uint8_t *) calloc(1, size);
+        if (!packed) {
+            ok = false;
+            break;
+        }
+        for (uint32_t y = 0; y < src->height; y++) {
+            memcpy(packed + (size_t) y * level->bytes_per_row, src->data + (size_t) y * src->bytes_per_row, src->width * bpp);
+        }
+
+        const uint8_t *stored = packed;
+        uint8_t *compressed = NULL;
+        level->stored_size = size;
+        level->compression = DFTextureFileCompressionNone;
+
+        if (compression == DFTextureFileCompressionLZ4) {
+            size_t bound = df_lz4_compress_bound(size);
+            compressed = (uint8_t *) malloc(bound);
+            size_t compressed_size = compressed ? df_lz4_compress(packed, size, compressed, bound) : 0;
+            if (compressed_size > 0 && compressed_size < size) {
+                stored = compressed;
+                level->stored_size = compressed_size;
+                level->compression = DFTextureFileCompressionLZ4;
+            }
+        }
+
+        ok = df_write_padding(f, &offset, DF_TEXTURE_FILE_DATA_ALIGNMENT);
+        level->offset = offset;
+        ok = ok && fwrite(stored, 1, level->stored_size, f) == level->stored_size;
+        offset += level->stored_size;
+
+        free(compressed);
+        free(packed);
+    }
+
+    // Now that the offsets are known, rewrite the header
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) {
+        unlink(tmp_path);
+    }
+
+    free(tmp_path);
+    return ok;
+}
+
+static bool df_texture_file_validate(const df_texture_file_t *file) {
+    const df_texture_file_header_t *h = file->header;
+
+    if (file->size < sizeof(*h) || h->magic != DF_TEXTURE_FILE_MAGIC || h->version != DF_TEXTURE_FILE_VERSION) {
+        return false;
+    }
+
+    uint32_t bpp = df_pixel_format_bytes_per_pixel((df_pixel_format) h->pixel_format);
+    if (bpp == 0 || h->level_count == 0 || h->level_count > DF_TEXTURE_FILE_MAX_LEVELS) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < h->level_count; i++) {
+        const df_texture_file_level_t *level = &h->levels[i];
+        if (level->offset > file->size || level->stored_size > file->size - level->offset) {
+            return false;
+        }
+        if (level->bytes_per_row < (uint64_t) level->width * bpp) {
+            return false;
+        }
+        if (level->compression == DFTextureFileCompressionNone && level->stored_size != df_texture_file_level_size(file, i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool df_texture_file_open(const char *path, df_texture_file_t *file) {
+    memset(file, 0, sizeof(*file));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(df_texture_file_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    file->mapping = (const uint8_t *) mapping;
+    file->size = st.st_size;
+    file->header = (const df_texture_file_header_t *) mapping;
+
+    if (!df_texture_file_validate(file)) {
+        df_texture_file_close(file);
+        return false;
+    }
+
+    return true;
+}
+
+// Size of the level once decompressed: bytes_per_row * height
+size_t df_texture_file_level_size(const df_texture_file_t *file, uint32_t level) {
+    const df_texture_file_level_t *l = &file->header->levels[level];
+    return (size_t) l->bytes_per_row * l->height;
+}
+
+// Returns the level's pixels. Uncompressed levels point straight into the
+// mapping; compressed ones are decoded into `scratch` (which must hold
+// df_texture_file_level_size bytes). Returns NULL on corrupt data.
+const uint8_t *df_texture_file_level_data(const df_texture_file_t *file, uint32_t level, uint8_t *scratch) {
+    const df_texture_file_level_t *l = &file->header->levels[level];
+    const uint8_t *stored = file->mapping + l->offset;
+
+    if (l->compression == DFTextureFileCompressionNone) {
+        return stored;
+    }
+
+    size_t size = df_texture_file_level_size(file, level);
+    if (l->compression != DFTextureFileCompressionLZ4 || !scratch) {
+        return NULL;
+    }
+    if (df_lz4_decompress(stored, l->stored_size, scratch, size) != (long) size) {
+        return NULL;
+    }
+
+    return scratch;
+}
+
+void df_texture_file_close(df_texture_file_t *file) {
+    if (file->mapping) {
+        munmap((void *) file->mapping, file->size);
+    }
+    memset(file, 0, sizeof(*file));
+}
+
+#ifdef TEST
+
+#include <assert.h>
+
+void df_texture_file_test(void) {
+    const char *path = "/tmp/df_texture_file_test.dftx";
+
+    uint32_t w = 37, h = 23;
+    uint8_t *pixels = (uint8_t *) malloc(w * h * 4);
+    assert(pixels);
+    for (uint32_t i = 0; i < w * h * 4; i++) {
+        pixels[i] = (uint8_t) ((i / 64) * 7);
+    }
+
+    for (int c = 0; c < 2; c++) {
+        df_texture_file_compression compression = c ? DFTextureFileCompressionLZ4 : DFTextureFileCompressionNone;
+        df_texture_level_t level = { pixels, w, h, w * 4 };
+        assert(df_texture_file_write(path, DFPixelFormatRGBA8Unorm, &level, 1, 256, compression));
+
+        df_texture_file_t file;
+        assert(df_texture_file_open(path, &file));
+        assert(file.header->width == w && file.header->height == h);
+        assert(file.header->levels[0].bytes_per_row == 256);
+        assert(file.header->levels[0].compression == (uint32_t) compression);
+
+        uint8_t *scratch = (uint8_t *) malloc(df_texture_file_level_size(&file, 0));
+        assert(scratch);
+        const uint8_t *data = df_texture_file_level_data(&file, 0, scratch);
+        assert(data);
+        for (uint32_t y = 0; y < h; y++) {
+            assert(memcmp(data + y * 256, pixels + y * w * 4, w * 4) == 0);
+        }
+
+        free(scratch);
+        df_texture_file_close(&file);
+    }
+
+    // A failed write leaves the previous file alone and no temporary behind
+    df_texture_level_t bad = { pixels, w, h, w * 4 };
+    assert(!df_texture_file_write("/tmp/df_texture_file_test_missing/x.dftx", DFPixelFormatRGBA8Unorm, &bad, 1, 256, DFTextureFileCompressionNone));
+    assert(!df_texture_file_write(path, DFPixelFormatRGBA8Unorm, &bad, 0, 256, DFTextureFileCompressionNone));
+    df_texture_file_t file;
+    assert(df_texture_file_open(path, &file));
+    df_texture_file_close(&file);
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long) getpid());
+    assert(access(tmp_path, F_OK) != 0);
+
+    free(pixels);
+    unlink(path);
+
+    printf("texture_file: passed!\n");
+}
+#endif
@@ -0,0 +1,80 @@
+#if !defined(DFTK_TEXTURE_FILE_H)
+#define DFTK_TEXTURE_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A precompiled texture container (.dftx). The header is followed by every
+// mip level, already in the final pixel format and row alignment, so that
+// the loader can mmap the file and hand the pixels straight to
+// replaceRegion. Levels may be individually LZ4 compressed. All fields are
+// little-endian.
+
+#define DF_TEXTURE_FILE_MAGIC 0x58544644 // "DFTX"
+#define DF_TEXTURE_FILE_VERSION 1
+#define DF_TEXTURE_FILE_MAX_LEVELS 16
+#define DF_TEXTURE_FILE_DATA_ALIGNMENT 256
+
+// Same values as the matching MTLPixelFormat
+typedef enum {
+    DFPixelFormatRGBA8Unorm = 70,
+    DFPixelFormatRGBA8Unorm_sRGB = 71,
+    DFPixelFormatBGRA8Unorm = 80,
+    DFPixelFormatBGRA8Unorm_sRGB = 81,
+    DFPixelFormatRGBA16Float = 115,
+} df_pixel_format;
+
+typedef enum {
+    DFTextureFileCompressionNone = 0,
+    DFTextureFileCompressionLZ4 = 1,
+} df_texture_file_compression;
+
+typedef struct {
+    uint64_t offset;          // Offset of the level's data from the start of the file
+    uint64_t stored_size;     // Size in the file (compressed size for LZ4 levels)
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes_per_row;   // Row pitch, a multiple of the header's row_alignment
+    uint32_t compression;     // A df_texture_file_compression
+} df_texture_file_level_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pixel_format;    // A df_pixel_format
+    uint32_t width;
+    uint32_t height;
+    uint32_t level_count;
+    uint32_t row_alignment;
+    uint32_t reserved;
+    df_texture_file_level_t levels[DF_TEXTURE_FILE_MAX_LEVELS];
+} df_texture_file_header_t;
+
+// Source pixels for one level when writing a file
+typedef struct {
+    const uint8_t *data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes_per_row;
+} df_texture_level_t;
+
+// An opened (memory mapped) texture file
+typedef struct {
+    const uint8_t *mapping;
+    size_t size;
+    const df_texture_file_header_t *header;
+} df_texture_file_t;
+
+uint32_t df_pixel_format_bytes_per_pixel(df_pixel_format format);
+bool df_texture_file_write(const char *path, df_pixel_format format, const df_texture_level_t *levels, uint32_t level_count, uint32_t row_alignment, df_texture_file_compression compression);
+bool df_texture_file_open(const char *path, df_texture_file_t *file);
+size_t df_texture_file_level_size(const df_texture_file_t *file, uint32_t level);
+const uint8_t *df_texture_file_level_data(const df_texture_file_t *file, uint32_t level, uint8_t *scratch);
+void df_texture_file_close(df_texture_file_t *file);
+
+#ifdef TEST
+void df_texture_file_test(void);
+#endif
+
+#endif
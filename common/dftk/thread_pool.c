@@ -0,0 +1,391 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "thread_pool.h"
+
+int df_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+static void *df_thread_pool_worker(void *data) {
+    df_thread_pool_t *pool = (df_thread_pool_t *) data;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (pool->count == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->job_available, &pool->mutex);
+        }
+
+        if (pool->count == 0 && pool->stop) {
+            break;
+        }
+
+        df_job_t job = pool->jobs[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+
+        pthread_mutex_unlock(&pool->mutex);
+        job.fn(job.arg);
+        pthread_mutex_lock(&pool->mutex);
+
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+// Starts `num_threads` workers, or one per core when `num_threads` <= 0
+bool df_thread_pool_init(df_thread_pool_t *pool, int num_threads) {
+    memset(pool, 0, sizeof(*pool));
+
+    if (num_threads <= 0) {
+        num_threads = df_cpu_count();
+    }
+
+    pool->capacity = 64;
+    pool->jobs = (df_job_t *) malloc(pool->capacity * sizeof(df_job_t));
+    pool->threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+    if (!pool->jobs || !pool->threads) {
+        free(pool->jobs);
+        free(pool->threads);
+        return false;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->job_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, df_thread_pool_worker, pool) != 0) {
+            break;
+        }
+        pool->num_threads++;
+    }
+
+    if (pool->num_threads == 0) {
+        df_thread_pool_deinit(pool);
+        return false;
+    }
+
+    return true;
+}
+
+void df_thread_pool_submit(df_thread_pool_t *pool, df_job_fn fn, void *arg) {
+    pthread_mutex_lock(&pool->mutex);
+
+    if (pool->count == pool->capacity) {
+        size_t capacity = 2 * pool->capacity;
+        df_job_t *jobs = (df_job_t *) malloc(capacity * sizeof(df_job_t));
+        if (!jobs) {
+            // The queue can't grow: run the job on the caller's thread
+            pthread_mutex_unlock(&pool->mutex);
+            fn(arg);
+            return;
+        }
+        for (size_t i = 0; i < pool->count; i++) {
+            jobs[i] = pool->jobs[(pool->head + i) % pool->capacity];
+        }
+        free(pool->jobs);
+        pool->jobs = jobs;
+        pool->capacity = capacity;
+        pool->head = 0;
+    }
+
+    pool->jobs[(pool->head + pool->count) % pool->capacity] = (df_job_t) { fn, arg };
+    pool->count++;
+    pool->pending++;
+
+    pthread_cond_signal(&pool->job_available);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Blocks until every job submitted so far has finished running
+void df_thread_pool_wait(df_thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Runs the remaining queued jobs, then joins the workers
+void df_thread_pool_deinit(df_thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->job_available);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->job_available);
+    pthread_cond_destroy(&pool->all_done);
+
+    free(pool->threads);
+    free(pool->jobs);
+    memset(pool, 0, sizeof(*pool));
+}
+
+static df_thread_pool_t df_shared_pool;
+static bool df_shared_pool_ok;
+static pthread_once_t df_shared_pool_once = PTHREAD_ONCE_INIT;
+
+static void df_shared_pool_create(void) {
+    df_shared_pool_ok = df_thread_pool_init(&df_shared_pool, 0);
+}
+
+// A process-wide pool with one worker per core, created on first use.
+// Returns NULL if no worker could be started.
+df_thread_pool_t *df_thread_pool_shared(void) {
+    pthread_once(&df_shared_pool_once, df_shared_pool_create);
+    return df_shared_pool_ok ? &df_shared_pool : NULL;
+}
+
+// Completion of one df_parallel_for call, so it doesn't wait for unrelated
+// jobs on the same pool
+typedef struct {
+    size_t remaining;
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+} df_range_batch_t;
+
+typedef struct {
+    df_range_fn fn;
+    void *ctx;
+    size_t begin;
+    size_t end;
+    df_range_batch_t *batch;
+} df_range_job_t;
+
+static void df_range_job_run(void *arg) {
+    df_range_job_t *job = (df_range_job_t *) arg;
+    job->fn(job->ctx, job->begin, job->end);
+
+    df_range_batch_t *batch = job->batch;
+    pthread_mutex_lock(&batch->mutex);
+    if (--batch->remaining == 0) {
+        pthread_cond_signal(&batch->done);
+    }
+    pthread_mutex_unlock(&batch->mutex);
+}
+
+// Splits [0, count) into chunks of at least `grain` items, runs them on
+// `pool` (NULL means the shared pool) and waits for those chunks only. Runs
+// on the calling thread when there is no pool. Must not be called from a
+// job running on the same pool.
+void df_parallel_for(df_thread_pool_t *pool, size_t count, size_t grain, df_range_fn fn, void *ctx) {
+    if (count == 0) {
+        return;
+    }
+    if (!pool) {
+        pool = df_thread_pool_shared();
+    }
+    if (!pool || pool->num_threads <= 1) {
+        fn(ctx, 0, count);
+        return;
+    }
+    if (grain == 0) {
+        grain = 1;
+    }
+
+    // A few chunks per worker so uneven rows still balance out
+    size_t chunks = (size_t) pool->num_threads * 4;
+    size_t chunk = (count + chunks - 1) / chunks;
+    if (chunk < grain) {
+        chunk = grain;
+    }
+
+    size_t num_jobs = (count + chunk - 1) / chunk;
+    if (num_jobs <= 1) {
+        fn(ctx, 0, count);
+        return;
+    }
+
+    df_range_job_t *jobs = (df_range_job_t *) malloc(num_jobs * sizeof(df_range_job_t));
+    if (!jobs) {
+        fn(ctx, 0, count);
+        return;
+    }
+
+    df_range_batch_t batch = { .remaining = num_jobs };
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.done, NULL);
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        size_t begin = i * chunk;
+        size_t end = begin + chunk < count ? begin + chunk : count;
+        jobs[i] = (df_range_job_t) { fn, ctx, begin, end, &batch };
+        df_thread_pool_submit(pool, df_range_job_run, &jobs[i]);
+    }
+
+    pthread_mutex_lock(&batch.mutex);
+    while (batch.remaining > 0) {
+        pthread_cond_wait(&batch.done, &batch.mutex);
+    }
+    pthread_mutex_unlock(&batch.mutex);
+
+    pthread_mutex_destroy(&batch.mutex);
+    pthread_cond_destroy(&batch.done);
+    free(jobs);
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+typedef struct {
+    pthread_mutex_t mutex;
+    int order[256];
+    int count;
+} df_pool_test_log_t;
+
+typedef struct {
+    df_pool_test_log_t *log;
+    df_thread_pool_t *pool;
+    int id;
+    int children;
+} df_pool_test_job_t;
+
+static void df_pool_test_record(void *arg) {
+    df_pool_test_job_t *job = (df_pool_test_job_t *) arg;
+    pthread_mutex_lock(&job->log->mutex);
+    job->log->order[job->log->count++] = job->id;
+    pthread_mutex_unlock(&job->log->mutex);
+
+    // Jobs submitted from a worker are waited for too
+    for (int i = 0; i < job->children; i++) {
+        df_thread_pool_submit(job->pool, df_pool_test_record, job + 1 + i);
+    }
+}
+
+typedef struct {
+    _Atomic int *hits;
+    size_t grain;
+    _Atomic int short_chunks;
+} df_pool_test_range_t;
+
+static void df_pool_test_block(void *arg) {
+    while (!atomic_load((_Atomic bool *) arg)) {
+        sched_yield();
+    }
+}
+
+static void df_pool_test_range(void *ctx, size_t begin, size_t end) {
+    df_pool_test_range_t *r = (df_pool_test_range_t *) ctx;
+    assert(begin < end);
+    if (end - begin < r->grain) {
+        atomic_fetch_add(&r->short_chunks, 1);
+    }
+    for (size_t i = begin; i < end; i++) {
+        atomic_fetch_add(&r->hits[i], 1);
+    }
+}
+
+void df_thread_pool_test(void) {
+    df_pool_test_log_t log = { .count = 0 };
+    pthread_mutex_init(&log.mutex, NULL);
+    df_pool_test_job_t jobs[256];
+
+    // One worker runs jobs in submission order, through queue growth
+    df_thread_pool_t pool;
+    assert(df_thread_pool_init(&pool, 1) && pool.num_threads == 1);
+    for (int i = 0; i < 200; i++) {
+        jobs[i] = (df_pool_test_job_t) { &log, &pool, i, 0 };
+        df_thread_pool_submit(&pool, df_pool_test_record, &jobs[i]);
+    }
+    df_thread_pool_wait(&pool);
+    assert(log.count == 200 && pool.pending == 0);
+    for (int i = 0; i < 200; i++) {
+        assert(log.order[i] == i);
+    }
+    df_thread_pool_deinit(&pool);
+
+    // Jobs submitting jobs on 4 workers: wait returns after the last child
+    log.count = 0;
+    assert(df_thread_pool_init(&pool, 4) && pool.num_threads == 4);
+    for (int round = 0; round < 20; round++) {
+        log.count = 0;
+        for (int i = 0; i < 8; i++) {
+            df_pool_test_job_t *job = &jobs[i * 4];
+            job[0] = (df_pool_test_job_t) { &log, &pool, i * 4, 3 };
+            for (int j = 1; j < 4; j++) {
+                job[j] = (df_pool_test_job_t) { &log, &pool, i * 4 + j, 0 };
+            }
+            df_thread_pool_submit(&pool, df_pool_test_record, job);
+        }
+        df_thread_pool_wait(&pool);
+        assert(log.count == 32);
+        int seen[32] = { 0 };
+        for (int i = 0; i < 32; i++) {
+            seen[log.order[i]]++;
+        }
+        for (int i = 0; i < 32; i++) {
+            assert(seen[i] == 1);
+        }
+    }
+
+    // df_parallel_for covers every index once, in chunks of at least grain
+    // except the last
+    _Atomic int hits[1000];
+    size_t counts[] = { 1, 7, 999, 1000 };
+    size_t grains[] = { 0, 1, 7, 64, 2000 };
+    for (int c = 0; c < 4; c++) {
+        for (int g = 0; g < 5; g++) {
+            for (size_t i = 0; i < counts[c]; i++) {
+                atomic_init(&hits[i], 0);
+            }
+            df_pool_test_range_t r = { hits, grains[g] ? grains[g] : 1, 0 };
+            atomic_init(&r.short_chunks, 0);
+            df_parallel_for(&pool, counts[c], grains[g], df_pool_test_range, &r);
+            for (size_t i = 0; i < counts[c]; i++) {
+                assert(atomic_load(&hits[i]) == 1);
+            }
+            assert(atomic_load(&r.short_chunks) <= 1);
+        }
+    }
+    df_parallel_for(&pool, 0, 1, df_pool_test_range, NULL);
+    df_thread_pool_deinit(&pool);
+
+    // df_parallel_for only waits for its own chunks: it returns while an
+    // unrelated job is still blocked on the other worker
+    _Atomic bool release;
+    atomic_init(&release, false);
+    assert(df_thread_pool_init(&pool, 2));
+    df_thread_pool_submit(&pool, df_pool_test_block, &release);
+    for (size_t i = 0; i < 1000; i++) {
+        atomic_init(&hits[i], 0);
+    }
+    df_pool_test_range_t r = { hits, 1, 0 };
+    atomic_init(&r.short_chunks, 0);
+    df_parallel_for(&pool, 1000, 1, df_pool_test_range, &r);
+    for (size_t i = 0; i < 1000; i++) {
+        assert(atomic_load(&hits[i]) == 1);
+    }
+    atomic_store(&release, true);
+    df_thread_pool_wait(&pool);
+    df_thread_pool_deinit(&pool);
+
+    // A pool without workers (a failed init) runs the range inline
+    memset(&pool, 0, sizeof(pool));
+    for (size_t i = 0; i < 1000; i++) {
+        atomic_init(&hits[i], 0);
+    }
+    df_parallel_for(&pool, 1000, 1, df_pool_test_range, &r);
+    for (size_t i = 0; i < 1000; i++) {
+        assert(atomic_load(&hits[i]) == 1);
+    }
+
+    pthread_mutex_destroy(&log.mutex);
+    printf("thread_pool: passed!\n");
+}
+
+#endif
@@ -0,0 +1,43 @@
+#if !defined(DFTK_THREAD_POOL_H)
+#define DFTK_THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+typedef void (*df_job_fn)(void *arg);
+typedef void (*df_range_fn)(void *ctx, size_t begin, size_t end);
+
+typedef struct {
+    df_job_fn fn;
+    void *arg;
+} df_job_t;
+
+// A fixed set of worker threads consuming jobs from a shared FIFO queue
+typedef struct {
+    pthread_t *threads;            // The worker threads
+    int num_threads;               // How many workers were started
+    df_job_t *jobs;                // Ring buffer of queued jobs
+    size_t capacity;               // Ring buffer capacity (grows as needed)
+    size_t head;                   // Index of the next job to run
+    size_t count;                  // Number of queued jobs
+    size_t pending;                // Queued + running jobs
+    bool stop;                     // Set on deinit to make the workers exit
+    pthread_mutex_t mutex;
+    pthread_cond_t job_available;
+    pthread_cond_t all_done;
+} df_thread_pool_t;
+
+int df_cpu_count(void);
+bool df_thread_pool_init(df_thread_pool_t *pool, int num_threads);
+void df_thread_pool_submit(df_thread_pool_t *pool, df_job_fn fn, void *arg);
+void df_thread_pool_wait(df_thread_pool_t *pool);
+void df_thread_pool_deinit(df_thread_pool_t *pool);
+df_thread_pool_t *df_thread_pool_shared(void);
+void df_parallel_for(df_thread_pool_t *pool, size_t count, size_t grain, df_range_fn fn, void *ctx);
+
+#ifdef TEST
+void df_thread_pool_test(void);
+#endif
+
+#endif
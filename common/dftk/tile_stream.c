@@ -0,0 +1,270 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "texture_file.h"
+#include "tile_stream.h"
+
+// Row-major pixels at a fixed offset in a file, read with pread so nothing
+// outside the requested region is ever resident
+typedef struct {
+    int fd;
+    uint64_t offset;          // Offset of the first pixel
+    uint64_t bytes_per_row;
+    uint32_t bytes_per_pixel; // 3 (RGB, expanded to RGBA) or 4
+    bool swap_rb;             // Stored as BGRA
+} df_file_source_t;
+
+static bool df_file_source_read(void *ctx, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t *dst, size_t dst_pitch) {
+    df_file_source_t *src = (df_file_source_t *) ctx;
+    size_t row_size = (size_t) w * src->bytes_per_pixel;
+
+    for (uint32_t row = 0; row < h; row++) {
+        uint8_t *out = dst + row * dst_pitch;
+        off_t offset = (off_t) (src->offset + (y + row) * src->bytes_per_row + (uint64_t) x * src->bytes_per_pixel);
+        if (pread(src->fd, out, row_size, offset) != (ssize_t) row_size) {
+            return false;
+        }
+
+        // Expand RGB to RGBA in place, back to front
+        if (src->bytes_per_pixel == 3) {
+            for (int i = (int) w - 1; i >= 0; i--) {
+                out[4*i+3] = 255;
+                out[4*i+2] = out[3*i+2];
+                out[4*i+1] = out[3*i+1];
+                out[4*i+0] = out[3*i+0];
+            }
+        }
+
+        if (src->swap_rb) {
+            for (uint32_t i = 0; i < w; i++) {
+                uint8_t r = out[4*i];
+                out[4*i] = out[4*i+2];
+                out[4*i+2] = r;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void df_file_source_close(void *ctx) {
+    df_file_source_t *src = (df_file_source_t *) ctx;
+    close(src->fd);
+    free(src);
+}
+
+static void df_file_source_attach(df_tile_source_t *source, int fd, uint32_t width, uint32_t height, uint64_t offset, uint64_t bytes_per_row, uint32_t bytes_per_pixel, bool swap_rb) {
+    df_file_source_t *src = (df_file_source_t *) malloc(sizeof(df_file_source_t));
+    *src = (df_file_source_t) { fd, offset, bytes_per_row, bytes_per_pixel, swap_rb };
+
+    source->width = width;
+    source->height = height;
+    source->srgb = false;
+    source->read = df_file_source_read;
+    source->close = df_file_source_close;
+    source->ctx = src;
+}
+
+// An uncompressed level of a .dftx file. LZ4 levels can only be decoded
+// as a whole, so they are rejected.
+bool df_tile_source_open_texture_file(df_tile_source_t *source, const char *path, uint32_t level) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    df_texture_file_header_t header;
+    bool ok = pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header)
+           && header.magic == DF_TEXTURE_FILE_MAGIC
+           && header.version == DF_TEXTURE_FILE_VERSION
+           && df_pixel_format_bytes_per_pixel((df_pixel_format) header.pixel_format) == 4
+           && level < header.level_count
+           && level < DF_TEXTURE_FILE_MAX_LEVELS
+           && header.levels[level].compression == DFTextureFileCompressionNone;
+
+    if (!ok) {
+        close(fd);
+        return false;
+    }
+
+    const df_texture_file_level_t *l = &header.levels[level];
+    bool bgra = header.pixel_format == DFPixelFormatBGRA8Unorm || header.pixel_format == DFPixelFormatBGRA8Unorm_sRGB;
+    df_file_source_attach(source, fd, l->width, l->height, l->offset, l->bytes_per_row, 4, bgra);
+    source->srgb = header.pixel_format == DFPixelFormatRGBA8Unorm_sRGB || header.pixel_format == DFPixelFormatBGRA8Unorm_sRGB;
+
+    return true;
+}
+
+static bool df_pnm_read_token(FILE *f, char *buf, size_t size) {
+    int c = fgetc(f);
+    for (;;) {
+        while (c == ' ' || c == '\t' || c == '\n' || c == '\r') c = fgetc(f);
+        if (c != '#') break;
+        while (c != '\n' && c != EOF) c = fgetc(f);
+    }
+
+    size_t n = 0;
+    while (c != EOF && c != ' ' && c != '\t' && c != '\n' && c != '\r' && n + 1 < size) {
+        buf[n++] = (char) c;
+        c = fgetc(f);
+    }
+    buf[n] = 0;
+
+    return n > 0;
+}
+
+// Binary PPM (P6, 8-bit RGB). Unlike JPEG/PNG through stb_image, PPM rows
+// can be read independently, which makes it the format to use for scans
+// that do not fit in memory.
+bool df_tile_source_open_pnm(df_tile_source_t *source, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    char magic[4], w[16], h[16], maxval[16];
+    bool ok = df_pnm_read_token(f, magic, sizeof(magic)) && strcmp(magic, "P6") == 0
+           && df_pnm_read_token(f, w, sizeof(w))
+           && df_pnm_read_token(f, h, sizeof(h))
+           && df_pnm_read_token(f, maxval, sizeof(maxval)) && atoi(maxval) == 255;
+
+    // The single whitespace byte after maxval has already been consumed
+    long offset = ftell(f);
+    fclose(f);
+
+    int width = ok ? atoi(w) : 0, height = ok ? atoi(h) : 0;
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    df_file_source_attach(source, fd, (uint32_t) width, (uint32_t) height, (uint64_t) offset, (uint64_t) width * 3, 3, false);
+    return true;
+}
+
+void df_tile_source_close(df_tile_source_t *source) {
+    if (source->close) {
+        source->close(source->ctx);
+    }
+    memset(source, 0, sizeof(*source));
+}
+
+// Streams the whole source into `sink` in row-major tile order
+bool df_tile_stream(df_tile_source_t *source, df_tile_sink_t *sink, uint32_t tile_width, uint32_t tile_height) {
+    if (tile_width == 0 || tile_height == 0) {
+        return false;
+    }
+
+    size_t pitch = (size_t) tile_width * 4;
+    uint8_t *staging = (uint8_t *) malloc(pitch * tile_height);
+    if (!staging) {
+        return false;
+    }
+
+    bool ok = true;
+    for (uint32_t y = 0; y < source->height && ok; y += tile_height) {
+        uint32_t h = source->height - y < tile_height ? source->height - y : tile_height;
+        for (uint32_t x = 0; x < source->width && ok; x += tile_width) {
+            uint32_t w = source->width - x < tile_width ? source->width - x : tile_width;
+            ok = source->read(source->ctx, x, y, w, h, staging, pitch)
+              && sink->write(sink->ctx, x, y, w, h, staging, pitch);
+        }
+    }
+
+    free(staging);
+    return ok;
+}
+
+static bool df_cpu_texture_write(void *ctx, uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint8_t *src, size_t src_pitch) {
+    df_cpu_texture_t *texture = (df_cpu_texture_t *) ctx;
+    if (x + w > texture->width || y + h > texture->height) {
+        return false;
+    }
+
+    for (uint32_t row = 0; row < h; row++) {
+        memcpy(texture->data + (y + row) * texture->bytes_per_row + (size_t) x * 4, src + row * src_pitch, (size_t) w * 4);
+    }
+    return true;
+}
+
+df_tile_sink_t df_cpu_texture_sink(df_cpu_texture_t *texture) {
+    return (df_tile_sink_t) { df_cpu_texture_write, texture };
+}
+
+#ifdef TEST
+
+#include <assert.h>
+
+void df_tile_stream_test(void) {
+    const char *dftx_path = "/tmp/df_tile_stream_test.dftx";
+    const char *ppm_path = "/tmp/df_tile_stream_test.ppm";
+    uint32_t w = 300, h = 170;
+
+    uint8_t *pixels = (uint8_t *) malloc(w * h * 4);
+    for (uint32_t i = 0; i < w * h; i++) {
+        pixels[4*i+0] = (uint8_t) i;
+        pixels[4*i+1] = (uint8_t) (i >> 8);
+        pixels[4*i+2] = (uint8_t) (i * 7);
+        pixels[4*i+3] = 255;
+    }
+
+    df_texture_level_t level = { pixels, w, h, w * 4 };
+    assert(df_texture_file_write(dftx_path, DFPixelFormatRGBA8Unorm, &level, 1, 256, DFTextureFileCompressionNone));
+
+    FILE *f = fopen(ppm_path, "wb");
+    fprintf(f, "P6\n# test\n%u %u\n255\n", w, h);
+    for (uint32_t i = 0; i < w * h; i++) fwrite(pixels + 4 * i, 1, 3, f);
+    fclose(f);
+
+    for (int format = 0; format < 2; format++) {
+        df_tile_source_t source;
+        assert(format == 0 ? df_tile_source_open_texture_file(&source, dftx_path, 0) : df_tile_source_open_pnm(&source, ppm_path));
+        assert(source.width == w && source.height == h && !source.srgb);
+
+        df_cpu_texture_t texture;
+        df_cpu_texture_init(&texture, w, h);
+        df_tile_sink_t sink = df_cpu_texture_sink(&texture);
+
+        // Tile sizes that do not divide the image exercise the edge tiles
+        assert(df_tile_stream(&source, &sink, 64, 48));
+        assert(memcmp(texture.data, pixels, w * h * 4) == 0);
+
+        df_cpu_texture_free(&texture);
+        df_tile_source_close(&source);
+    }
+
+    // sRGB BGRA comes back as RGBA, flagged sRGB
+    uint8_t *bgra = (uint8_t *) malloc(w * h * 4);
+    for (uint32_t i = 0; i < w * h; i++) {
+        bgra[4*i+0] = pixels[4*i+2];
+        bgra[4*i+1] = pixels[4*i+1];
+        bgra[4*i+2] = pixels[4*i+0];
+        bgra[4*i+3] = pixels[4*i+3];
+    }
+    level.data = bgra;
+    assert(df_texture_file_write(dftx_path, DFPixelFormatBGRA8Unorm_sRGB, &level, 1, 256, DFTextureFileCompressionNone));
+
+    df_tile_source_t source;
+    assert(df_tile_source_open_texture_file(&source, dftx_path, 0) && source.srgb);
+    df_cpu_texture_t texture;
+    df_cpu_texture_init(&texture, w, h);
+    df_tile_sink_t sink = df_cpu_texture_sink(&texture);
+    assert(df_tile_stream(&source, &sink, 64, 48));
+    assert(memcmp(texture.data, pixels, w * h * 4) == 0);
+    df_cpu_texture_free(&texture);
+    df_tile_source_close(&source);
+    free(bgra);
+
+    free(pixels);
+    unlink(dftx_path);
+    unlink(ppm_path);
+
+    printf("tile_stream: passed!\n");
+}
+#endif
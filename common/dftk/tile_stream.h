@@ -0,0 +1,40 @@
+#if !defined(DFTK_TILE_STREAM_H)
+#define DFTK_TILE_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu_texture.h"
+
+// Moves an image from a random-access source to a destination texture one
+// tile at a time through a single staging buffer, so peak memory is one
+// tile no matter how large the image is.
+
+// Where the pixels come from. `read` fills a w x h RGBA8 region.
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    bool srgb;                // The pixels are sRGB-encoded
+    bool (*read)(void *ctx, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t *dst, size_t dst_pitch);
+    void (*close)(void *ctx);
+    void *ctx;
+} df_tile_source_t;
+
+// Where the tiles go (e.g. replaceRegion on a MTLTexture)
+typedef struct {
+    bool (*write)(void *ctx, uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint8_t *src, size_t src_pitch);
+    void *ctx;
+} df_tile_sink_t;
+
+bool df_tile_source_open_texture_file(df_tile_source_t *source, const char *path, uint32_t level);
+bool df_tile_source_open_pnm(df_tile_source_t *source, const char *path);
+void df_tile_source_close(df_tile_source_t *source);
+bool df_tile_stream(df_tile_source_t *source, df_tile_sink_t *sink, uint32_t tile_width, uint32_t tile_height);
+
+df_tile_sink_t df_cpu_texture_sink(df_cpu_texture_t *texture);
+
+#ifdef TEST
+void df_tile_stream_test(void);
+#endif
+
+#endif
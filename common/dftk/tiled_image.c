@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tiled_image.h"
+
+#define DF_TILED_IMAGE_STRIP 256      // Rows per group of a column pass
+#define DF_TILED_IMAGE_MAX_RADIUS 32767
+
+bool df_tiled_image_init(df_tiled_image_t *image, uint32_t width, uint32_t height, df_image_layout layout) {
+    image->width = width;
+    image->height = height;
+    image->layout = layout;
+    image->tile_shift = layout == DFImageLayoutLinear ? 0 : (layout == DFImageLayoutTiled8 ? 3 : 4);
+
+    uint32_t tile = 1u << image->tile_shift;
+    image->tiles_per_row = (width + tile - 1) / tile;
+    size_t tile_rows = (height + tile - 1) / tile;
+    image->data = (uint32_t *) calloc((size_t) image->tiles_per_row * tile_rows << (2 * image->tile_shift), sizeof(uint32_t));
+    return image->data != NULL;
+}
+
+void df_tiled_image_free(df_tiled_image_t *image) {
+    free(image->data);
+    memset(image, 0, sizeof(*image));
+}
+
+void df_tiled_image_from_texture(df_tiled_image_t *image, const df_cpu_texture_t *texture) {
+    for (uint32_t y = 0; y < image->height; y++) {
+        df_tiled_image_store_span(image, 0, y, image->width, (const uint32_t *) (texture->data + y * texture->bytes_per_row));
+    }
+}
+
+void df_tiled_image_to_texture(const df_tiled_image_t *image, df_cpu_texture_t *texture) {
+    for (uint32_t y = 0; y < image->height; y++) {
+        df_tiled_image_load_span(image, 0, y, image->width, (uint32_t *) (texture->data + y * texture->bytes_per_row));
+    }
+}
+
+// Copies of a kernel body with the layout as a constant, so the span
+// accessors fold to the right copy loop with no per-span branch
+#define DF_TILED_IMAGE_SPECIALIZE(name, args_type)                                            \
+    static void name##_group(const df_threadgroup_t *group, void *data) {                     \
+        const args_type *a = (const args_type *) data;                                        \
+        switch (a->in->layout) {                                                              \
+            case DFImageLayoutLinear: name##_body(group, a, DFImageLayoutLinear); break;      \
+            case DFImageLayoutTiled8: name##_body(group, a, DFImageLayoutTiled8); break;      \
+            case DFImageLayoutTiled16: name##_body(group, a, DFImageLayoutTiled16); break;    \
+            case DFImageLayoutMorton: name##_body(group, a, DFImageLayoutMorton); break;      \
+        }                                                                                     \
+    }
+
+// `image` with a constant layout and tile size, for the accessors to fold
+static inline __attribute__((always_inline)) df_tiled_image_t df_tiled_view(const df_tiled_image_t *image, df_image_layout layout) {
+    df_tiled_image_t view = *image;
+    view.layout = layout;
+    view.tile_shift = layout == DFImageLayoutLinear ? 0 : (layout == DFImageLayoutTiled8 ? 3 : 4);
+    return view;
+}
+
+typedef struct {
+    const df_tiled_image_t *in;
+    df_tiled_image_t *out;
+    int radius;
+    uint32_t scale;           // 2^24 / (2 * radius + 1), rounded
+} df_tiled_image_args_t;
+
+// out(x, y) = in(y, x). A group reads a 16x16 block as 16 spans down the
+// columns of `in`, which in a tiled layout are one or a few whole tiles.
+static inline __attribute__((always_inline)) void df_tiled_transpose_body(const df_threadgroup_t *group, const df_tiled_image_args_t *a, const df_image_layout layout) {
+    df_tiled_image_t in = df_tiled_view(a->in, layout), out = df_tiled_view(a->out, layout);
+    uint32_t x0 = group->origin.width, y0 = group->origin.height, w = group->size.width, h = group->size.height;
+    uint32_t block[DF_TILED_IMAGE_MAX_TILE][DF_TILED_IMAGE_MAX_TILE];
+    uint32_t column[DF_TILED_IMAGE_MAX_TILE];
+
+    for (uint32_t i = 0; i < w; i++) {
+        df_tiled_image_load_span(&in, y0, x0 + i, h, block[i]);
+    }
+    for (uint32_t j = 0; j < h; j++) {
+        for (uint32_t i = 0; i < w; i++) {
+            column[i] = block[i][j];
+        }
+        df_tiled_image_store_span(&out, x0, y0 + j, w, column);
+    }
+}
+
+DF_TILED_IMAGE_SPECIALIZE(df_tiled_transpose, df_tiled_image_args_t)
+
+// `out` must be in->height x in->width
+void df_tiled_image_transpose(const df_tiled_image_t *in, df_tiled_image_t *out, df_dispatcher_t *dispatcher) {
+    df_tiled_image_args_t args = { in, out };
+    df_dispatch_threads(dispatcher, df_size3(out->width, out->height, 1), df_size3(DF_TILED_IMAGE_MAX_TILE, DF_TILED_IMAGE_MAX_TILE, 1), df_tiled_transpose_group, &args);
+}
+
+// sum * scale stays under 2^32 for any radius up to the maximum
+static inline uint32_t df_tiled_box_average(uint32_t sum, uint32_t scale) {
+    return (sum * scale + (1u << 23)) >> 24;
+}
+
+// A 16-pixel strip of running sums, one plane per channel, slides down the
+// group's rows: one span added and one subtracted per output row. The sums
+// always have 16 lanes so the loops vectorize; lanes past the edge of the
+// image are computed and dropped.
+static inline __attribute__((always_inline)) void df_tiled_box_v_body(const df_threadgroup_t *group, const df_tiled_image_args_t *a, const df_image_layout layout) {
+    df_tiled_image_t in = df_tiled_view(a->in, layout), out = df_tiled_view(a->out, layout);
+    int r = a->radius, h = (int) in.height;
+    uint32_t x0 = group->origin.width, n = group->size.width;
+    int y0 = (int) group->origin.height, y1 = y0 + (int) group->size.height;
+    uint32_t sum[4][DF_TILED_IMAGE_MAX_TILE] = { { 0 } };
+    uint32_t add[DF_TILED_IMAGE_MAX_TILE] = { 0 }, sub[DF_TILED_IMAGE_MAX_TILE] = { 0 };
+
+#define DF_ROW(y) ((uint32_t) ((y) < 0 ? 0 : ((y) >= h ? h - 1 : (y))))
+
+    for (int k = y0 - r; k <= y0 + r; k++) {
+        df_tiled_image_load_span(&in, x0, DF_ROW(k), n, add);
+        for (int c = 0; c < 4; c++) {
+            for (uint32_t x = 0; x < DF_TILED_IMAGE_MAX_TILE; x++) {
+                sum[c][x] += (add[x] >> (8 * c)) & 0xff;
+            }
+        }
+    }
+
+    for (int y = y0; y < y1; y++) {
+        uint32_t pixels[DF_TILED_IMAGE_MAX_TILE];
+        for (uint32_t x = 0; x < DF_TILED_IMAGE_MAX_TILE; x++) {
+            pixels[x] = df_tiled_box_average(sum[0][x], a->scale) | df_tiled_box_average(sum[1][x], a->scale) << 8 |
+                        df_tiled_box_average(sum[2][x], a->scale) << 16 | df_tiled_box_average(sum[3][x], a->scale) << 24;
+        }
+        df_tiled_image_store_span(&out, x0, (uint32_t) y, n, pixels);
+
+        df_tiled_image_load_span(&in, x0, DF_ROW(y + r + 1), n, add);
+        df_tiled_image_load_span(&in, x0, DF_ROW(y - r), n, sub);
+        for (int c = 0; c < 4; c++) {
+            for (uint32_t x = 0; x < DF_TILED_IMAGE_MAX_TILE; x++) {
+                sum[c][x] += ((add[x] >> (8 * c)) & 0xff) - ((sub[x] >> (8 * c)) & 0xff);
+            }
+        }
+    }
+
+#undef DF_ROW
+}
+
+DF_TILED_IMAGE_SPECIALIZE(df_tiled_box_v, df_tiled_image_args_t)
+
+// Vertical box of size 2 * radius + 1, edges clamped: the column pass of a
+// separable box blur. Groups are 16-column strips of 256 rows. False, with
+// `out` untouched, for a radius outside [0, 32767]. `out` must have the
+// size of `in`.
+bool df_tiled_image_box_v(const df_tiled_image_t *in, df_tiled_image_t *out, int radius, df_dispatcher_t *dispatcher) {
+    if (radius < 0 || radius > DF_TILED_IMAGE_MAX_RADIUS) {
+        return false;
+    }
+
+    uint32_t area = 2 * (uint32_t) radius + 1;
+    df_tiled_image_args_t args = { in, out, radius, ((1u << 24) + area / 2) / area };
+    df_dispatch_threads(dispatcher, df_size3(in->width, in->height, 1), df_size3(DF_TILED_IMAGE_MAX_TILE, DF_TILED_IMAGE_STRIP, 1), df_tiled_box_v_group, &args);
+    return true;
+}
+
+#ifdef TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+void df_tiled_image_test(void) {
+    // Taller than one strip, and neither side a multiple of a tile
+    uint32_t w = 45, h = 300;
+    int radius = 3;
+    df_cpu_texture_t texture, back;
+    df_cpu_texture_init(&texture, w, h);
+    df_cpu_texture_init(&back, w, h);
+    for (size_t i = 0; i < texture.bytes_per_row * h; i++) {
+        texture.data[i] = (uint8_t) (i * 5 + i / 7);
+    }
+
+    df_tiled_image_t linear, linear_box, linear_transposed;
+    assert(df_tiled_image_init(&linear, w, h, DFImageLayoutLinear));
+    assert(df_tiled_image_init(&linear_box, w, h, DFImageLayoutLinear));
+    assert(df_tiled_image_init(&linear_transposed, h, w, DFImageLayoutLinear));
+    df_tiled_image_from_texture(&linear, &texture);
+    assert(df_tiled_image_box_v(&linear, &linear_box, radius, NULL));
+    df_tiled_image_transpose(&linear, &linear_transposed, NULL);
+    assert(!df_tiled_image_box_v(&linear, &linear_box, -1, NULL));
+
+    // Against the definitions
+    uint32_t area = 2 * radius + 1, scale = ((1u << 24) + area / 2) / area;
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            assert(df_tiled_image_get(&linear_transposed, y, x) == df_tiled_image_get(&linear, x, y));
+
+            uint32_t sum[4] = { 0, 0, 0, 0 }, expected = 0;
+            for (int j = (int) y - radius; j <= (int) y + radius; j++) {
+                uint32_t p = df_tiled_image_get(&linear, x, (uint32_t) (j < 0 ? 0 : (j >= (int) h ? (int) h - 1 : j)));
+                for (int c = 0; c < 4; c++) {
+                    sum[c] += (p >> (8 * c)) & 0xff;
+                }
+            }
+            for (int c = 0; c < 4; c++) {
+                expected |= df_tiled_box_average(sum[c], scale) << (8 * c);
+            }
+            assert(df_tiled_image_get(&linear_box, x, y) == expected);
+        }
+    }
+
+    // Every layout round-trips and computes the same as linear
+    for (int layout = DFImageLayoutTiled8; layout <= DFImageLayoutMorton; layout++) {
+        df_tiled_image_t image, box, transposed;
+        assert(df_tiled_image_init(&image, w, h, (df_image_layout) layout));
+        assert(df_tiled_image_init(&box, w, h, (df_image_layout) layout));
+        assert(df_tiled_image_init(&transposed, h, w, (df_image_layout) layout));
+
+        df_tiled_image_from_texture(&image, &texture);
+        df_tiled_image_to_texture(&image, &back);
+        assert(memcmp(texture.data, back.data, texture.bytes_per_row * h) == 0);
+
+        // A span starting and ending mid-tile
+        uint32_t span[40];
+        df_tiled_image_load_span(&image, 3, 17, 40, span);
+        for (uint32_t i = 0; i < 40; i++) {
+            assert(span[i] == df_tiled_image_get(&linear, 3 + i, 17));
+        }
+
+        assert(df_tiled_image_box_v(&image, &box, radius, NULL));
+        df_tiled_image_transpose(&image, &transposed, NULL);
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                assert(df_tiled_image_get(&box, x, y) == df_tiled_image_get(&linear_box, x, y));
+                assert(df_tiled_image_get(&transposed, y, x) == df_tiled_image_get(&linear_transposed, y, x));
+            }
+        }
+
+        df_tiled_image_free(&image);
+        df_tiled_image_free(&box);
+        df_tiled_image_free(&transposed);
+    }
+
+    df_tiled_image_free(&linear);
+    df_tiled_image_free(&linear_box);
+    df_tiled_image_free(&linear_transposed);
+    df_cpu_texture_free(&texture);
+    df_cpu_texture_free(&back);
+
+    printf("tiled_image: passed!\n");
+}
+#endif
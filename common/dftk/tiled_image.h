@@ -0,0 +1,135 @@
+#if !defined(DFTK_TILED_IMAGE_H)
+#define DFTK_TILED_IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "cpu_texture.h"
+#include "dispatch.h"
+
+// RGBA8 image with a choice of memory layout. Tiled layouts store square
+// tiles contiguously (tiles in row-major order), so a 2D neighbourhood or a
+// column walk touches a few cache lines and pages instead of one per row.
+// In the Morton layout each 16x16 tile is further Z-ordered, which puts
+// every 4x4 block in one 64-byte cache line, like a GPU's swizzled texture.
+// Edge tiles are padded; the padding is never read.
+//
+// Kernels should move whole spans of a row at a time: the per-pixel
+// accessors work out a tile address for every pixel, the span accessors
+// once per tile.
+
+#define DF_TILED_IMAGE_MAX_TILE 16
+
+typedef enum {
+    DFImageLayoutLinear,      // Row-major, the baseline
+    DFImageLayoutTiled8,      // 8x8 tiles, rows within a tile
+    DFImageLayoutTiled16,     // 16x16 tiles, rows within a tile
+    DFImageLayoutMorton,      // 16x16 tiles, Z-order within a tile
+} df_image_layout;
+
+typedef struct {
+    uint32_t *data;           // One RGBA8 pixel per element
+    uint32_t width;
+    uint32_t height;
+    df_image_layout layout;
+    uint32_t tile_shift;      // log2 of the tile size, 0 when linear
+    uint32_t tiles_per_row;
+} df_tiled_image_t;
+
+// Interleaves the 4 bits of a tile coordinate with zeros: x bits land on
+// even positions, y bits (shifted by one) on odd positions
+static const uint8_t df_morton_bits[16] = { 0, 1, 4, 5, 16, 17, 20, 21, 64, 65, 68, 69, 80, 81, 84, 85 };
+
+// Tile (tx, ty) of a tiled or Morton image, 1 << (2 * tile_shift) pixels
+static inline uint32_t *df_tiled_image_tile(const df_tiled_image_t *image, uint32_t tx, uint32_t ty) {
+    return image->data + (((size_t) ty * image->tiles_per_row + tx) << (2 * image->tile_shift));
+}
+
+static inline size_t df_tiled_image_offset(const df_tiled_image_t *image, uint32_t x, uint32_t y) {
+    if (image->layout == DFImageLayoutLinear) {
+        return (size_t) y * image->width + x;
+    }
+
+    uint32_t s = image->tile_shift, mask = (1u << s) - 1;
+    size_t tile = ((size_t) (y >> s) * image->tiles_per_row + (x >> s)) << (2 * s);
+    if (image->layout == DFImageLayoutMorton) {
+        return tile | df_morton_bits[x & mask] | ((size_t) df_morton_bits[y & mask] << 1);
+    }
+    return tile | ((y & mask) << s) | (x & mask);
+}
+
+static inline uint32_t df_tiled_image_get(const df_tiled_image_t *image, uint32_t x, uint32_t y) {
+    return image->data[df_tiled_image_offset(image, x, y)];
+}
+
+static inline void df_tiled_image_set(df_tiled_image_t *image, uint32_t x, uint32_t y, uint32_t pixel) {
+    image->data[df_tiled_image_offset(image, x, y)] = pixel;
+}
+
+// Copies pixels [x, x + n) of row `y` to `dst`, one memcpy per tile crossed
+// (per pair of pixels in Morton order)
+static inline void df_tiled_image_load_span(const df_tiled_image_t *image, uint32_t x, uint32_t y, uint32_t n, uint32_t *dst) {
+    if (image->layout == DFImageLayoutLinear) {
+        memcpy(dst, image->data + (size_t) y * image->width + x, (size_t) n * 4);
+        return;
+    }
+
+    uint32_t s = image->tile_shift, mask = (1u << s) - 1;
+    while (n > 0) {
+        const uint32_t *tile = df_tiled_image_tile(image, x >> s, y >> s);
+        uint32_t i = x & mask, count = (1u << s) - i < n ? (1u << s) - i : n;
+        if (image->layout == DFImageLayoutMorton) {
+            const uint32_t *row = tile + ((size_t) df_morton_bits[y & mask] << 1);
+            for (uint32_t k = 0; k < count; k++) {
+                dst[k] = row[df_morton_bits[i + k]];
+            }
+        } else {
+            memcpy(dst, tile + ((y & mask) << s) + i, (size_t) count * 4);
+        }
+        x += count;
+        dst += count;
+        n -= count;
+    }
+}
+
+static inline void df_tiled_image_store_span(df_tiled_image_t *image, uint32_t x, uint32_t y, uint32_t n, const uint32_t *src) {
+    if (image->layout == DFImageLayoutLinear) {
+        memcpy(image->data + (size_t) y * image->width + x, src, (size_t) n * 4);
+        return;
+    }
+
+    uint32_t s = image->tile_shift, mask = (1u << s) - 1;
+    while (n > 0) {
+        uint32_t *tile = df_tiled_image_tile(image, x >> s, y >> s);
+        uint32_t i = x & mask, count = (1u << s) - i < n ? (1u << s) - i : n;
+        if (image->layout == DFImageLayoutMorton) {
+            uint32_t *row = tile + ((size_t) df_morton_bits[y & mask] << 1);
+            for (uint32_t k = 0; k < count; k++) {
+                row[df_morton_bits[i + k]] = src[k];
+            }
+        } else {
+            memcpy(tile + ((y & mask) << s) + i, src, (size_t) count * 4);
+        }
+        x += count;
+        src += count;
+        n -= count;
+    }
+}
+
+bool df_tiled_image_init(df_tiled_image_t *image, uint32_t width, uint32_t height, df_image_layout layout);
+void df_tiled_image_free(df_tiled_image_t *image);
+// Both must have the same size
+void df_tiled_image_from_texture(df_tiled_image_t *image, const df_cpu_texture_t *texture);
+void df_tiled_image_to_texture(const df_tiled_image_t *image, df_cpu_texture_t *texture);
+
+// Column-walking kernels, one specialization per layout. `out` must have
+// the layout of `in` and must not alias it.
+void df_tiled_image_transpose(const df_tiled_image_t *in, df_tiled_image_t *out, df_dispatcher_t *dispatcher);
+bool df_tiled_image_box_v(const df_tiled_image_t *in, df_tiled_image_t *out, int radius, df_dispatcher_t *dispatcher);
+
+#ifdef TEST
+void df_tiled_image_test(void);
+#endif
+
+#endif
@@ -2,9 +2,44 @@
 #define UTILS_H
 
 #import <Metal/Metal.h>
+#include <sys/stat.h>
 #include "./stb_image.h"
+#include "./dftk/dftk.h"
+
+// Textures are loaded with a full box-filtered mip chain when the
+// descriptor passed in has `mipmapLevelCount` > 1.
+
+// An in-flight `load_texture_async` request. `texture` is only valid after
+// `load_texture_wait_all` returns; take it with `texture_load_take`.
+typedef struct TextureLoad {
+    char *path;
+    MTLTextureDescriptor *texture_desc;
+    unsigned char *data;
+    int width;
+    int height;
+    int channels;
+    df_texture_level_t levels[DF_TEXTURE_FILE_MAX_LEVELS];
+    uint32_t level_count;
+    id<MTLTexture> texture;
+    struct TextureLoad *next;
+} TextureLoad;
+
+// Deduplicating front end for load_texture, see texture_cache_load
+typedef struct {
+    df_texture_cache_t cache;
+    char *disk_dir;       // Decoded .dftx copies are kept here when set
+} TextureCache;
 
 id<MTLTexture> load_texture(id<MTLDevice> device, MTLTextureDescriptor *texture_desc, const char *path);
+id<MTLTexture> load_texture_file(id<MTLDevice> device, MTLTextureDescriptor *texture_desc, const char *path);
+id<MTLTexture> load_texture_streamed(id<MTLDevice> device, MTLTextureDescriptor *texture_desc, const char *path, uint32_t tile_size);
+TextureLoad *load_texture_async(MTLTextureDescriptor *texture_desc, const char *path);
+void load_texture_wait_all(id<MTLDevice> device);
+id<MTLTexture> texture_load_take(TextureLoad *load);
+void texture_cache_init(TextureCache *cache, size_t budget_bytes, const char *disk_dir);
+df_cache_entry_t *texture_cache_load(TextureCache *cache, id<MTLDevice> device, MTLTextureDescriptor *texture_desc, const char *path);
+void texture_cache_release(TextureCache *cache, df_cache_entry_t *entry);
+void texture_cache_deinit(TextureCache *cache);
 void exitWith(id obj);
 
 #if defined(UTILS_H_IMPLEMENTATION)
@@ -14,42 +49,377 @@ void exitWith(id obj) {
     exit(1);
 }
 
+// Number of mip levels to build for a `width` x `height` image: a
+// `texture_desc.mipmapLevelCount` above 1 asks for a mip chain, clamped to
+// what the size allows.
+static uint32_t texture_level_count(MTLTextureDescriptor *texture_desc, int width, int height) {
+    uint32_t requested = texture_desc ? (uint32_t) texture_desc.mipmapLevelCount : 1;
+    uint32_t max_levels = df_mip_level_count(width, height);
+    if (max_levels > DF_TEXTURE_FILE_MAX_LEVELS) max_levels = DF_TEXTURE_FILE_MAX_LEVELS;
+    return requested < 1 ? 1 : (requested > max_levels ? max_levels : requested);
+}
+
+// Creates a RGBA8 texture from `texture_desc` and uploads already decoded mip levels
+static id<MTLTexture> upload_texture(id<MTLDevice> device, MTLTextureDescriptor *texture_desc, const df_texture_level_t *levels, uint32_t level_count) {
+    bool owns_texture_desc = false;
+    if (!texture_desc) {
+        texture_desc = [[MTLTextureDescriptor alloc]init];
+        owns_texture_desc = true;
+    }
+
+    texture_desc.width = levels[0].width;
+    texture_desc.height = levels[0].height;
+    texture_desc.pixelFormat = MTLPixelFormatRGBA8Unorm;
+    texture_desc.textureType = MTLTextureType2D;
+    texture_desc.mipmapLevelCount = level_count;
+
+    id<MTLTexture> texture = [device newTextureWithDescriptor:texture_desc];
+
+    for (uint32_t i = 0; i < level_count; i++) {
+        MTLRegion region = {0};
+        region.origin = (MTLOrigin) { 0, 0, 0 };
+        region.size = (MTLSize) { .width = levels[i].width, .height = levels[i].height, .depth = 1 };
+
+        [texture replaceRegion:region mipmapLevel:i withBytes:levels[i].data bytesPerRow:levels[i].bytes_per_row];
+    }
+
+    if (owns_texture_desc) {
+        [texture_desc release];
+    }
+
+    return texture;
+}
+
 // Load a texture using stb_image
 id<MTLTexture> load_texture(id<MTLDevice> device, MTLTextureDescriptor *texture_desc, const char *path) {
 
     int width, height, n;
     unsigned char *data = stbi_load(path, &width, &height, &n, 4);
-    
+    if (!data) {
+        return nil;
+    }
+
+    NSLog(@"texture: %d, %d, %d", width, height, n);
+
+    df_texture_level_t levels[DF_TEXTURE_FILE_MAX_LEVELS] = {{ data, (uint32_t) width, (uint32_t) height, (uint32_t) width * 4 }};
+    uint32_t level_count = texture_level_count(texture_desc, width, height);
+    if (!df_mipmap_generate(levels, level_count, false, DFMipFilterBox, NULL)) {
+        level_count = 1;
+    }
+
+    id<MTLTexture> texture = upload_texture(device, texture_desc, levels, level_count);
+    df_mipmap_free(levels, level_count);
+    stbi_image_free(data);
+
+    return texture;
+}
+
+// Load a precompiled .dftx texture (see tools/texconv). The pixels are
+// already in their final layout, so each level is uploaded straight from
+// the mapped file with no decoding.
+id<MTLTexture> load_texture_file(id<MTLDevice> device, MTLTextureDescriptor *texture_desc, const char *path) {
+    df_texture_file_t file;
+    if (!df_texture_file_open(path, &file)) {
+        return nil;
+    }
+
+    const df_texture_file_header_t *header = file.header;
+
     bool owns_texture_desc = false;
     if (!texture_desc) {
         texture_desc = [[MTLTextureDescriptor alloc]init];
         owns_texture_desc = true;
     }
-        
 
-    NSLog(@"texture: %d, %d, %d", width, height, n);
+    texture_desc.width = header->width;
+    texture_desc.height = header->height;
+    texture_desc.pixelFormat = (MTLPixelFormat) header->pixel_format;
+    texture_desc.textureType = MTLTextureType2D;
+    texture_desc.mipmapLevelCount = header->level_count;
 
-    texture_desc.width = width;
-    texture_desc.height = height;
-    texture_desc.pixelFormat = MTLPixelFormatRGBA8Unorm;
+    id<MTLTexture> texture = [device newTextureWithDescriptor:texture_desc];
+
+    uint8_t *scratch = NULL;
+    for (uint32_t i = 0; i < header->level_count && texture; i++) {
+        const df_texture_file_level_t *level = &header->levels[i];
+
+        if (level->compression != DFTextureFileCompressionNone && !scratch) {
+            scratch = (uint8_t *) malloc(df_texture_file_level_size(&file, 0));
+        }
+
+        const uint8_t *data = df_texture_file_level_data(&file, i, scratch);
+        if (!data) {
+            [texture release];
+            texture = nil;
+            break;
+        }
+
+        MTLRegion region = MTLRegionMake2D(0, 0, level->width, level->height);
+        [texture replaceRegion:region mipmapLevel:i withBytes:data bytesPerRow:level->bytes_per_row];
+    }
+
+    free(scratch);
+    df_texture_file_close(&file);
+
+    if (owns_texture_desc) {
+        [texture_desc release];
+    }
+
+    return texture;
+}
+
+static bool texture_tile_write(void *ctx, uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint8_t *src, size_t src_pitch) {
+    id<MTLTexture> texture = (id<MTLTexture>) ctx;
+    [texture replaceRegion:MTLRegionMake2D(x, y, w, h) mipmapLevel:0 withBytes:src bytesPerRow:src_pitch];
+    return true;
+}
+
+// Load a very large image without ever holding all of it in memory: the
+// pixels are read and uploaded `tile_size` x `tile_size` at a time. Only
+// row-addressable files can be streamed, i.e. binary PPM (.ppm) or an
+// uncompressed .dftx; anything else goes through load_texture. An sRGB
+// .dftx gives an RGBA8Unorm_sRGB texture, so it samples the same as through
+// load_texture_file.
+id<MTLTexture> load_texture_streamed(id<MTLDevice> device, MTLTextureDescriptor *texture_desc, const char *path, uint32_t tile_size) {
+    df_tile_source_t source;
+    if (!df_tile_source_open_pnm(&source, path) && !df_tile_source_open_texture_file(&source, path, 0)) {
+        return load_texture(device, texture_desc, path);
+    }
+
+    bool owns_texture_desc = false;
+    if (!texture_desc) {
+        texture_desc = [[MTLTextureDescriptor alloc]init];
+        owns_texture_desc = true;
+    }
+
+    texture_desc.width = source.width;
+    texture_desc.height = source.height;
+    texture_desc.pixelFormat = source.srgb ? MTLPixelFormatRGBA8Unorm_sRGB : MTLPixelFormatRGBA8Unorm;
     texture_desc.textureType = MTLTextureType2D;
+    texture_desc.mipmapLevelCount = 1;
 
     id<MTLTexture> texture = [device newTextureWithDescriptor:texture_desc];
 
-    MTLRegion region = {0};
-    region.origin = (MTLOrigin) { 0, 0, 0 };
-    region.size = (MTLSize) { .width = (unsigned int) width, .height = (unsigned int) height, .depth = 1 };
+    // replaceRegion copies synchronously, so one staging tile is enough
+    df_tile_sink_t sink = { texture_tile_write, texture };
+    if (texture && !df_tile_stream(&source, &sink, tile_size, tile_size)) {
+        [texture release];
+        texture = nil;
+    }
 
-    NSUInteger bytesPerRow = 4 * width;
-    
-    [texture replaceRegion:region mipmapLevel:0 withBytes:data bytesPerRow:bytesPerRow];
+    df_tile_source_close(&source);
 
     if (owns_texture_desc) {
         [texture_desc release];
     }
-    
+
+    return texture;
+}
+
+// Decoding happens on a private pool so that `load_texture_wait_all` only
+// waits for texture loads, not for unrelated work on the shared pool.
+static df_thread_pool_t texture_load_pool;
+static bool texture_load_pool_ok;
+static pthread_once_t texture_load_pool_once = PTHREAD_ONCE_INIT;
+static TextureLoad *texture_loads_pending;
+
+static void texture_load_pool_create(void) {
+    texture_load_pool_ok = df_thread_pool_init(&texture_load_pool, 0);
+}
+
+static void texture_load_decode(void *arg) {
+    TextureLoad *load = (TextureLoad *) arg;
+    load->data = stbi_load(load->path, &load->width, &load->height, &load->channels, 4);
+    if (!load->data) {
+        return;
+    }
+
+    // Build the mip chain here too, so the owning thread only uploads
+    load->levels[0] = (df_texture_level_t) { load->data, (uint32_t) load->width, (uint32_t) load->height, (uint32_t) load->width * 4 };
+    load->level_count = texture_level_count(load->texture_desc, load->width, load->height);
+    if (!df_mipmap_generate(load->levels, load->level_count, false, DFMipFilterBox, NULL)) {
+        load->level_count = 1;
+    }
+}
+
+// Queue `path` for decoding on a worker thread. Must be called from the
+// thread that later calls `load_texture_wait_all`.
+TextureLoad *load_texture_async(MTLTextureDescriptor *texture_desc, const char *path) {
+    pthread_once(&texture_load_pool_once, texture_load_pool_create);
+
+    TextureLoad *load = (TextureLoad *) calloc(1, sizeof(TextureLoad));
+    load->path = strdup(path);
+    load->texture_desc = texture_desc ? [texture_desc copy] : nil;
+    load->next = texture_loads_pending;
+    texture_loads_pending = load;
+
+    // Without workers, decode right away and let wait_all upload
+    if (texture_load_pool_ok) {
+        df_thread_pool_submit(&texture_load_pool, texture_load_decode, load);
+    } else {
+        texture_load_decode(load);
+    }
+
+    return load;
+}
+
+// Wait for every pending decode, then create and upload all of the textures
+// in one go on the calling thread.
+void load_texture_wait_all(id<MTLDevice> device) {
+    if (!texture_loads_pending) {
+        return;
+    }
+
+    if (texture_load_pool_ok) {
+        df_thread_pool_wait(&texture_load_pool);
+    }
+
+    for (TextureLoad *load = texture_loads_pending; load; load = load->next) {
+        if (load->data) {
+            NSLog(@"texture: %s: %d, %d, %d", load->path, load->width, load->height, load->channels);
+            load->texture = upload_texture(device, load->texture_desc, load->levels, load->level_count);
+            df_mipmap_free(load->levels, load->level_count);
+            stbi_image_free(load->data);
+            load->data = NULL;
+        }
+
+        [load->texture_desc release];
+        load->texture_desc = nil;
+    }
+
+    texture_loads_pending = NULL;
+}
+
+// Returns the loaded texture (nil if decoding failed) and frees the handle
+id<MTLTexture> texture_load_take(TextureLoad *load) {
+    id<MTLTexture> texture = load->texture;
+    free(load->path);
+    free(load);
     return texture;
 }
+
+static void texture_cache_release_texture(void *value, void *user) {
+    [(id<MTLTexture>) value release];
+}
+
+// `budget_bytes` bounds the GPU memory held by textures nobody references
+// anymore. `disk_dir` (may be NULL) must already exist.
+void texture_cache_init(TextureCache *cache, size_t budget_bytes, const char *disk_dir) {
+    df_texture_cache_init(&cache->cache, budget_bytes, texture_cache_release_texture, NULL);
+    cache->disk_dir = disk_dir ? strdup(disk_dir) : NULL;
+}
+
+static size_t texture_bytes(id<MTLTexture> texture) {
+    size_t bytes = 0;
+    for (NSUInteger i = 0; i < texture.mipmapLevelCount; i++) {
+        size_t w = texture.width >> i, h = texture.height >> i;
+        bytes += (w ? w : 1) * (h ? h : 1) * 4;
+    }
+    return bytes;
+}
+
+// Load `path` through the cache and return an entry whose `value` is the
+// texture; hand it back with texture_cache_release. Files with identical
+// contents share one texture. The key is the hash of the encoded file plus
+// the number of mip levels, so the first load's descriptor settings (usage,
+// storage mode) apply to every later hit.
+df_cache_entry_t *texture_cache_load(TextureCache *cache, id<MTLDevice> device, MTLTextureDescriptor *texture_desc, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return NULL;
+    }
+
+    uint64_t key;
+    unsigned char *contents = NULL;
+    uint32_t requested_levels = texture_desc ? (uint32_t) texture_desc.mipmapLevelCount : 1;
+
+    if (!df_texture_cache_lookup_path(&cache->cache, path, (int64_t) st.st_mtime, (int64_t) st.st_size, requested_levels, &key)) {
+        FILE *f = fopen(path, "rb");
+        if (!f) {
+            return NULL;
+        }
+        contents = (unsigned char *) malloc(st.st_size);
+        bool ok = fread(contents, 1, st.st_size, f) == (size_t) st.st_size;
+        fclose(f);
+        if (!ok) {
+            free(contents);
+            return NULL;
+        }
+
+        key = df_hash64(contents, st.st_size, requested_levels);
+        df_texture_cache_remember_path(&cache->cache, path, (int64_t) st.st_mtime, (int64_t) st.st_size, requested_levels, key);
+    }
+
+    df_cache_entry_t *entry = df_texture_cache_acquire(&cache->cache, key);
+    if (entry) {
+        free(contents);
+        return entry;
+    }
+
+    char disk_path[1024] = {0};
+    id<MTLTexture> texture = nil;
+
+    if (cache->disk_dir) {
+        snprintf(disk_path, sizeof(disk_path), "%s/%016llx.dftx", cache->disk_dir, (unsigned long long) key);
+        texture = load_texture_file(device, texture_desc, disk_path);
+    }
+
+    if (!texture) {
+        if (!contents) {
+            // Path fast path hit, but the texture itself was evicted
+            contents = (unsigned char *) malloc(st.st_size);
+            FILE *f = fopen(path, "rb");
+            bool ok = contents && f && fread(contents, 1, st.st_size, f) == (size_t) st.st_size;
+            if (f) fclose(f);
+            if (!ok) {
+                free(contents);
+                return NULL;
+            }
+        }
+
+        int width, height, n;
+        unsigned char *data = stbi_load_from_memory(contents, (int) st.st_size, &width, &height, &n, 4);
+        if (!data) {
+            free(contents);
+            return NULL;
+        }
+
+        df_texture_level_t levels[DF_TEXTURE_FILE_MAX_LEVELS] = {{ data, (uint32_t) width, (uint32_t) height, (uint32_t) width * 4 }};
+        uint32_t level_count = texture_level_count(texture_desc, width, height);
+        if (!df_mipmap_generate(levels, level_count, false, DFMipFilterBox, NULL)) {
+            level_count = 1;
+        }
+
+        texture = upload_texture(device, texture_desc, levels, level_count);
+
+        // Written to a temporary and renamed, so an interrupted run never
+        // leaves a truncated file for the next one to load
+        if (cache->disk_dir) {
+            df_texture_file_write(disk_path, DFPixelFormatRGBA8Unorm, levels, level_count, 256, DFTextureFileCompressionNone);
+        }
+
+        df_mipmap_free(levels, level_count);
+        stbi_image_free(data);
+    }
+
+    free(contents);
+
+    if (!texture) {
+        return NULL;
+    }
+
+    return df_texture_cache_insert(&cache->cache, key, texture, texture_bytes(texture));
+}
+
+void texture_cache_release(TextureCache *cache, df_cache_entry_t *entry) {
+    df_texture_cache_release(&cache->cache, entry);
+}
+
+void texture_cache_deinit(TextureCache *cache) {
+    df_texture_cache_deinit(&cache->cache);
+    free(cache->disk_dir);
+    cache->disk_dir = NULL;
+}
 #endif
 
 
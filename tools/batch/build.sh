@@ -0,0 +1,2 @@
+#!/usr/bin/env bash
+clang main.c -o batch -Wall -O2 -lpthread -lm
@@ -0,0 +1,532 @@
+// Headless batch runner for the dftk image filters: the CPU side of
+// 07-compute-image-processing applied to whole directories.
+//
+//   batch [-o dir] [-format png|jpg|bmp|tga] [-decoders N] [-processors N]
+//         [-encoders N] [-fit N] [-f chain] input...
+//
+// -fit N first scales each image (Lanczos, sRGB-correct) so its longer side
+// is N pixels, for thumbnails. Inputs are image files, directories (not recursive) or @list files with
+// one path per line. The chain is a comma-separated list of filters:
+//
+//   grayscale[:bias] bias:b threshold:t blur:radius saturation:s
+//   hue:degrees sepia levels[:clip]
+//
+// Images flow through three thread pools: decode -> process -> encode. A
+// decoder picks up the next file as soon as it has handed an image over,
+// so disk and codec time overlap with filtering. Each processor owns a
+// dispatcher with its share of the cores, so small images are filtered
+// side by side and large ones still use several cores.
+//
+// Outputs are named after the input's file name, so two inputs with the
+// same name in different directories (a/x.png and b/x.jpg) are refused
+// rather than silently overwriting each other.
+
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../../common/stb_image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../../common/stb_image_write.h"
+
+#define DFTK_IMPLEMENTATION
+#include "../../common/dftk/dftk.h"
+
+#define PI 3.14159265359
+
+typedef enum {
+    BatchFilterGraph,     // A df_filter_t, added as is
+    BatchFilterLevels,    // Auto levels from the image's histogram
+} batch_filter_kind;
+
+typedef struct {
+    batch_filter_kind kind;
+    df_filter_t filter;
+    float clip;
+} batch_filter_t;
+
+typedef struct batch_item {
+    char *input;
+    char *output;
+    df_cpu_texture_t image;
+    df_cpu_texture_t result;
+    size_t input_bytes;
+    size_t output_bytes;
+    bool failed;
+} batch_item_t;
+
+typedef struct {
+    batch_item_t *items;
+    size_t count;
+    size_t capacity;
+
+    batch_filter_t filters[DF_FILTER_GRAPH_MAX_NODES];
+    int num_filters;
+    const char *output_dir;
+    const char *format;
+    uint32_t fit;                 // Longer side after scaling, 0 to keep the size
+
+    df_thread_pool_t decode_pool;
+    df_thread_pool_t process_pool;
+    df_thread_pool_t encode_pool;
+
+    // Dispatchers handed out to process jobs, one per processor thread
+    df_dispatcher_t *dispatchers;
+    bool *dispatcher_busy;
+    int num_dispatchers;
+
+    // Bounds the decoded images in flight so a big directory does not end
+    // up fully decoded in memory waiting for the encoders
+    int in_flight;
+    int max_in_flight;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+
+    // Seconds spent in each stage, summed over threads
+    double decode_time;
+    double process_time;
+    double encode_time;
+} batch_t;
+
+static batch_t batch;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: batch [-o dir] [-format png|jpg|bmp|tga] [-decoders N] [-processors N] [-encoders N] [-fit N] [-f chain] input...\n");
+    exit(1);
+}
+
+static void add_stage_time(double *stage, double seconds) {
+    pthread_mutex_lock(&batch.mutex);
+    *stage += seconds;
+    pthread_mutex_unlock(&batch.mutex);
+}
+
+static bool has_image_extension(const char *path) {
+    static const char *extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".psd", ".gif", ".hdr", ".pic", ".ppm", ".pgm" };
+    const char *dot = strrchr(path, '.');
+    if (!dot) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (strcasecmp(dot, extensions[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add_file(const char *path) {
+    if (batch.count == batch.capacity) {
+        batch.capacity = batch.capacity ? batch.capacity * 2 : 64;
+        batch.items = (batch_item_t *) realloc(batch.items, batch.capacity * sizeof(batch_item_t));
+    }
+
+    batch_item_t *item = &batch.items[batch.count++];
+    memset(item, 0, sizeof(*item));
+    item->input = strdup(path);
+
+    // <output_dir>/<basename without extension>.<format>
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char *dot = strrchr(base, '.');
+    int stem = dot ? (int) (dot - base) : (int) strlen(base);
+    size_t size = strlen(batch.output_dir) + strlen(base) + strlen(batch.format) + 3;
+    item->output = (char *) malloc(size);
+    snprintf(item->output, size, "%s/%.*s.%s", batch.output_dir, stem, base, batch.format);
+}
+
+static void add_input(const char *arg) {
+    if (arg[0] == '@') {
+        FILE *list = fopen(arg + 1, "r");
+        if (!list) {
+            fprintf(stderr, "batch: cannot open list %s\n", arg + 1);
+            exit(1);
+        }
+        char line[4096];
+        while (fgets(line, sizeof(line), list)) {
+            line[strcspn(line, "\r\n")] = 0;
+            if (line[0]) {
+                add_file(line);
+            }
+        }
+        fclose(list);
+        return;
+    }
+
+    struct stat st;
+    if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(arg);
+        struct dirent *entry;
+        while (dir && (entry = readdir(dir))) {
+            if (entry->d_name[0] != '.' && has_image_extension(entry->d_name)) {
+                char path[4096];
+                snprintf(path, sizeof(path), "%s/%s", arg, entry->d_name);
+                add_file(path);
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+        return;
+    }
+
+    add_file(arg);
+}
+
+static bool parse_filter(const char *spec, batch_filter_t *f) {
+    char name[32];
+    float value = 0;
+    int n = sscanf(spec, "%31[a-z]:%f", name, &value);
+    bool has_value = n == 2;
+
+    memset(f, 0, sizeof(*f));
+    f->kind = BatchFilterGraph;
+
+    if (strcmp(name, "grayscale") == 0) {
+        f->filter = (df_filter_t) { .type = DFFilterGrayscale, .bias = value };
+    } else if (strcmp(name, "bias") == 0 && has_value) {
+        f->filter = (df_filter_t) { .type = DFFilterBias, .bias = value };
+    } else if (strcmp(name, "threshold") == 0 && has_value) {
+        f->filter = (df_filter_t) { .type = DFFilterThreshold, .threshold = value };
+    } else if (strcmp(name, "blur") == 0 && has_value && value >= 0) {
+        f->filter = (df_filter_t) { .type = DFFilterBoxBlur, .radius = (int) value };
+    } else if (strcmp(name, "saturation") == 0 && has_value) {
+        f->filter.type = DFFilterColorMatrix;
+        df_color_matrix_saturation(&f->filter.color_matrix, value);
+    } else if (strcmp(name, "hue") == 0 && has_value) {
+        f->filter.type = DFFilterColorMatrix;
+        df_color_matrix_hue_rotate(&f->filter.color_matrix, (float) (value * PI / 180));
+    } else if (strcmp(name, "sepia") == 0) {
+        f->filter.type = DFFilterColorMatrix;
+        df_color_matrix_sepia(&f->filter.color_matrix);
+    } else if (strcmp(name, "levels") == 0) {
+        f->kind = BatchFilterLevels;
+        f->clip = has_value ? value : 0.005f;
+    } else {
+        return false;
+    }
+
+    if (f->filter.type == DFFilterColorMatrix) {
+        f->filter.color_matrix_kind = df_color_matrix_classify(&f->filter.color_matrix);
+    }
+    return true;
+}
+
+static void parse_chain(const char *chain) {
+    char *copy = strdup(chain);
+    for (char *spec = strtok(copy, ","); spec; spec = strtok(NULL, ",")) {
+        if (batch.num_filters == DF_FILTER_GRAPH_MAX_NODES || !parse_filter(spec, &batch.filters[batch.num_filters])) {
+            fprintf(stderr, "batch: bad filter '%s'\n", spec);
+            exit(1);
+        }
+        batch.num_filters++;
+    }
+    free(copy);
+}
+
+static df_dispatcher_t *acquire_dispatcher(void) {
+    pthread_mutex_lock(&batch.mutex);
+    for (;;) {
+        for (int i = 0; i < batch.num_dispatchers; i++) {
+            if (!batch.dispatcher_busy[i]) {
+                batch.dispatcher_busy[i] = true;
+                pthread_mutex_unlock(&batch.mutex);
+                return &batch.dispatchers[i];
+            }
+        }
+        pthread_cond_wait(&batch.changed, &batch.mutex);
+    }
+}
+
+static void release_dispatcher(df_dispatcher_t *dispatcher) {
+    pthread_mutex_lock(&batch.mutex);
+    batch.dispatcher_busy[dispatcher - batch.dispatchers] = false;
+    pthread_cond_broadcast(&batch.changed);
+    pthread_mutex_unlock(&batch.mutex);
+}
+
+// Gives up on an item between stages, releasing its slot in flight
+static void fail_item(batch_item_t *item, const char *message) {
+    fprintf(stderr, "batch: %s: %s\n", item->input, message);
+    item->failed = true;
+    df_cpu_texture_free(&item->image);
+    df_cpu_texture_free(&item->result);
+
+    pthread_mutex_lock(&batch.mutex);
+    batch.in_flight--;
+    pthread_cond_broadcast(&batch.changed);
+    pthread_mutex_unlock(&batch.mutex);
+}
+
+static int compare_outputs(const void *a, const void *b) {
+    return strcmp((*(const batch_item_t * const *) a)->output, (*(const batch_item_t * const *) b)->output);
+}
+
+// Fails if two inputs would be written to the same output file
+static bool check_output_collisions(void) {
+    batch_item_t **sorted = (batch_item_t **) malloc(batch.count * sizeof(batch_item_t *));
+    if (!sorted) {
+        return false;
+    }
+    for (size_t i = 0; i < batch.count; i++) {
+        sorted[i] = &batch.items[i];
+    }
+    qsort(sorted, batch.count, sizeof(batch_item_t *), compare_outputs);
+
+    bool ok = true;
+    for (size_t i = 1; i < batch.count; i++) {
+        if (strcmp(sorted[i - 1]->output, sorted[i]->output) == 0) {
+            fprintf(stderr, "batch: %s and %s would both be written to %s\n", sorted[i - 1]->input, sorted[i]->input, sorted[i]->output);
+            ok = false;
+        }
+    }
+    free(sorted);
+    return ok;
+}
+
+static void encode_job(void *arg) {
+    batch_item_t *item = (batch_item_t *) arg;
+    double start = now();
+
+    const df_cpu_texture_t *r = &item->result;
+    int ok;
+    if (strcmp(batch.format, "jpg") == 0) {
+        ok = stbi_write_jpg(item->output, (int) r->width, (int) r->height, 4, r->data, 90);
+    } else if (strcmp(batch.format, "bmp") == 0) {
+        ok = stbi_write_bmp(item->output, (int) r->width, (int) r->height, 4, r->data);
+    } else if (strcmp(batch.format, "tga") == 0) {
+        ok = stbi_write_tga(item->output, (int) r->width, (int) r->height, 4, r->data);
+    } else {
+        ok = stbi_write_png(item->output, (int) r->width, (int) r->height, 4, r->data, (int) r->bytes_per_row);
+    }
+
+    struct stat st;
+    if (ok && stat(item->output, &st) == 0) {
+        item->output_bytes = (size_t) st.st_size;
+    } else {
+        fprintf(stderr, "batch: failed to write %s\n", item->output);
+        item->failed = true;
+    }
+    df_cpu_texture_free(&item->result);
+
+    add_stage_time(&batch.encode_time, now() - start);
+
+    pthread_mutex_lock(&batch.mutex);
+    batch.in_flight--;
+    pthread_cond_broadcast(&batch.changed);
+    pthread_mutex_unlock(&batch.mutex);
+}
+
+static void process_job(void *arg) {
+    batch_item_t *item = (batch_item_t *) arg;
+    df_dispatcher_t *dispatcher = acquire_dispatcher();
+    double start = now();
+
+    bool ok = true;
+    uint32_t longer = item->image.width > item->image.height ? item->image.width : item->image.height;
+    if (batch.fit && longer != batch.fit) {
+        df_cpu_texture_t scaled;
+        uint32_t w = (uint32_t) ((uint64_t) item->image.width * batch.fit / longer);
+        uint32_t h = (uint32_t) ((uint64_t) item->image.height * batch.fit / longer);
+        ok = df_cpu_texture_init(&scaled, w ? w : 1, h ? h : 1);
+        if (ok && !df_resample(&item->image, &scaled, DFResampleLanczos3, DFResampleSRGB, dispatcher)) {
+            df_cpu_texture_free(&scaled);
+            ok = false;
+        }
+        if (ok) {
+            df_cpu_texture_free(&item->image);
+            item->image = scaled;
+        }
+    }
+
+    df_filter_graph_t graph;
+    df_filter_graph_init(&graph);
+    for (int i = 0; i < batch.num_filters && ok; i++) {
+        const batch_filter_t *f = &batch.filters[i];
+        if (f->kind == BatchFilterLevels) {
+            df_image_stats_t stats;
+            ok = df_image_stats(&item->image, &stats, dispatcher);
+            if (ok) {
+                df_filter_t levels = { .type = DFFilterColorMatrix };
+                df_image_stats_levels(&stats, f->clip, &levels.color_matrix);
+                levels.color_matrix_kind = df_color_matrix_classify(&levels.color_matrix);
+                ok = df_filter_graph_add(&graph, levels);
+            }
+        } else {
+            ok = df_filter_graph_add(&graph, f->filter);
+        }
+    }
+
+    ok = ok && df_cpu_texture_init(&item->result, item->image.width, item->image.height);
+    ok = ok && df_filter_graph_run(&graph, &item->image, &item->result, dispatcher);
+    df_cpu_texture_free(&item->image);
+
+    add_stage_time(&batch.process_time, now() - start);
+    release_dispatcher(dispatcher);
+
+    if (!ok) {
+        fail_item(item, "out of memory while filtering");
+        return;
+    }
+    df_thread_pool_submit(&batch.encode_pool, encode_job, item);
+}
+
+static void decode_job(void *arg) {
+    batch_item_t *item = (batch_item_t *) arg;
+
+    pthread_mutex_lock(&batch.mutex);
+    while (batch.in_flight >= batch.max_in_flight) {
+        pthread_cond_wait(&batch.changed, &batch.mutex);
+    }
+    batch.in_flight++;
+    pthread_mutex_unlock(&batch.mutex);
+
+    double start = now();
+    int width, height, channels;
+    uint8_t *data = stbi_load(item->input, &width, &height, &channels, 4);
+    struct stat st;
+    if (data && stat(item->input, &st) == 0) {
+        item->input_bytes = (size_t) st.st_size;
+    }
+    add_stage_time(&batch.decode_time, now() - start);
+
+    if (!data) {
+        fail_item(item, stbi_failure_reason());
+        return;
+    }
+
+    // stb's tightly packed RGBA is already a df_cpu_texture_t layout
+    item->image = (df_cpu_texture_t) { data, (uint32_t) width, (uint32_t) height, (size_t) width * 4 };
+    df_thread_pool_submit(&batch.process_pool, process_job, item);
+}
+
+int main(int argc, char *argv[]) {
+    int cores = df_cpu_count();
+    int decoders = cores, processors = cores > 1 ? cores / 2 : 1, encoders = cores;
+    const char *chain = "grayscale";
+    const char *inputs[4096];
+    int num_inputs = 0;
+
+    batch.output_dir = "out";
+    batch.format = "png";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            batch.output_dir = argv[++i];
+        } else if (strcmp(argv[i], "-format") == 0 && i + 1 < argc) {
+            batch.format = argv[++i];
+        } else if (strcmp(argv[i], "-decoders") == 0 && i + 1 < argc) {
+            decoders = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-processors") == 0 && i + 1 < argc) {
+            processors = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-encoders") == 0 && i + 1 < argc) {
+            encoders = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-fit") == 0 && i + 1 < argc) {
+            batch.fit = (uint32_t) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            chain = argv[++i];
+        } else if (argv[i][0] == '-' || num_inputs == 4096) {
+            usage();
+        } else {
+            inputs[num_inputs++] = argv[i];
+        }
+    }
+
+    if (num_inputs == 0 || decoders < 1 || processors < 1 || encoders < 1) {
+        usage();
+    }
+    if (strcmp(batch.format, "png") != 0 && strcmp(batch.format, "jpg") != 0 && strcmp(batch.format, "bmp") != 0 && strcmp(batch.format, "tga") != 0) {
+        usage();
+    }
+
+    parse_chain(chain);
+    for (int i = 0; i < num_inputs; i++) {
+        add_input(inputs[i]);
+    }
+    if (batch.count == 0) {
+        fprintf(stderr, "batch: no images found\n");
+        return 1;
+    }
+    if (!check_output_collisions()) {
+        return 1;
+    }
+    mkdir(batch.output_dir, 0755);
+
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.changed, NULL);
+    batch.max_in_flight = 2 * (decoders + processors + encoders);
+
+    batch.dispatchers = (df_dispatcher_t *) calloc(processors, sizeof(df_dispatcher_t));
+    batch.dispatcher_busy = (bool *) calloc(processors, sizeof(bool));
+    bool ok = batch.dispatchers && batch.dispatcher_busy;
+    for (int i = 0; i < processors && ok; i++) {
+        int workers = cores / processors;
+        ok = df_dispatcher_init(&batch.dispatchers[i], workers > 0 ? workers : 1);
+        batch.num_dispatchers += ok;
+    }
+
+    ok = ok && df_thread_pool_init(&batch.decode_pool, decoders);
+    ok = ok && df_thread_pool_init(&batch.process_pool, processors);
+    ok = ok && df_thread_pool_init(&batch.encode_pool, encoders);
+    if (!ok) {
+        fprintf(stderr, "batch: cannot start the worker threads\n");
+        return 1;
+    }
+
+    double start = now();
+
+    for (size_t i = 0; i < batch.count; i++) {
+        df_thread_pool_submit(&batch.decode_pool, decode_job, &batch.items[i]);
+    }
+
+    // Each stage only submits to the next, so draining them in order means
+    // everything is done
+    df_thread_pool_wait(&batch.decode_pool);
+    df_thread_pool_wait(&batch.process_pool);
+    df_thread_pool_wait(&batch.encode_pool);
+
+    double elapsed = now() - start;
+
+    size_t done = 0, input_bytes = 0, output_bytes = 0;
+    for (size_t i = 0; i < batch.count; i++) {
+        if (!batch.items[i].failed) {
+            done++;
+            input_bytes += batch.items[i].input_bytes;
+            output_bytes += batch.items[i].output_bytes;
+        }
+    }
+
+    printf("%zu of %zu images in %.3f s: %.1f images/s, %.1f MB/s in, %.1f MB/s out\n", done, batch.count, elapsed,
+           done / elapsed, input_bytes / elapsed * 1e-6, output_bytes / elapsed * 1e-6);
+    printf("busy time: decode %.3f s (%d threads), process %.3f s (%d x %d cores), encode %.3f s (%d threads)\n",
+           batch.decode_time, decoders, batch.process_time, processors, batch.dispatchers[0].num_workers, batch.encode_time, encoders);
+
+    df_thread_pool_deinit(&batch.decode_pool);
+    df_thread_pool_deinit(&batch.process_pool);
+    df_thread_pool_deinit(&batch.encode_pool);
+    for (int i = 0; i < batch.num_dispatchers; i++) {
+        df_dispatcher_deinit(&batch.dispatchers[i]);
+    }
+    for (size_t i = 0; i < batch.count; i++) {
+        free(batch.items[i].input);
+        free(batch.items[i].output);
+    }
+    free(batch.items);
+    free(batch.dispatchers);
+    free(batch.dispatcher_busy);
+
+    return done == batch.count ? 0 : 1;
+}
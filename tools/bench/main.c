@@ -0,0 +1,218 @@
+// Micro-benchmarks for the CPU kernels in common/dftk, each next to the
+// naive version it replaces.
+//
+//   bench [-size N] [-runs N] [name...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DFTK_IMPLEMENTATION
+#include "../../common/dftk/dftk.h"
+
+typedef struct {
+    uint32_t size;
+    df_cpu_texture_t texture;     // size x size RGBA8, photo-like content
+    df_image_f32_t image_f32;     // The same content as float and half
+    df_image_f32_t out_f32;
+    df_image_f16_t image_f16;
+    df_image_f16_t out_f16;
+    df_color_matrix_t sepia;
+    df_tiled_image_t tall[4];     // size / 4 x size * 4, the texture's pixels in each df_image_layout
+    df_tiled_image_t tall_box[4];
+    df_tiled_image_t tall_transposed[4];
+} bench_context_t;
+
+typedef void (*bench_fn)(bench_context_t *ctx);
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_stats(bench_context_t *ctx) {
+    df_image_stats_t stats;
+    df_image_stats(&ctx->texture, &stats, NULL);
+}
+
+static void bench_stats_atomic(bench_context_t *ctx) {
+    df_image_stats_t stats;
+    df_image_stats_atomic(&ctx->texture, &stats, NULL);
+}
+
+typedef struct {
+    const df_image_f32_t *in;
+    df_image_f32_t *out;
+    const df_color_matrix_t *cm;
+} bench_color_matrix_f32_args_t;
+
+static void bench_color_matrix_f32_group(const df_threadgroup_t *group, void *data) {
+    bench_color_matrix_f32_args_t *a = (bench_color_matrix_f32_args_t *) data;
+    for (uint32_t y = group->origin.height; y < group->origin.height + group->size.height; y++) {
+        size_t offset = ((size_t) y * a->in->width + group->origin.width) * 4;
+        memcpy(a->out->data + offset, a->in->data + offset, group->size.width * 4 * sizeof(float));
+        df_color_matrix_apply(a->cm, DFColorMatrixIdentityAlpha, a->out->data + offset, group->size.width);
+    }
+}
+
+// The same filter over fp32 storage, the baseline for the fp16 path
+static void bench_color_matrix_f32(bench_context_t *ctx) {
+    bench_color_matrix_f32_args_t args = { &ctx->image_f32, &ctx->out_f32, &ctx->sepia };
+    df_dispatch_threads(NULL, df_size3(ctx->size, ctx->size, 1), df_size3(64, 16, 1), bench_color_matrix_f32_group, &args);
+}
+
+static void bench_color_matrix_f16(bench_context_t *ctx) {
+    df_color_matrix_f16(&ctx->image_f16, &ctx->out_f16, &ctx->sepia, NULL);
+}
+
+// 4:1 downscale, the thumbnail case
+static void bench_resample(bench_context_t *ctx, df_resample_filter filter) {
+    df_cpu_texture_t dst;
+    df_cpu_texture_init(&dst, ctx->size / 4, ctx->size / 4);
+    df_resample(&ctx->texture, &dst, filter, DFResampleSRGB, NULL);
+    df_cpu_texture_free(&dst);
+}
+
+static void bench_resample_bilinear(bench_context_t *ctx) {
+    bench_resample(ctx, DFResampleBilinear);
+}
+
+static void bench_resample_lanczos(bench_context_t *ctx) {
+    bench_resample(ctx, DFResampleLanczos3);
+}
+
+// Column-walking passes on a tall image over each memory layout
+#define BENCH_LAYOUT(layout, suffix)                                                                  \
+    static void bench_box_v_##suffix(bench_context_t *ctx) {                                          \
+        df_tiled_image_box_v(&ctx->tall[layout], &ctx->tall_box[layout], 8, NULL);                    \
+    }                                                                                                 \
+    static void bench_transpose_##suffix(bench_context_t *ctx) {                                      \
+        df_tiled_image_transpose(&ctx->tall[layout], &ctx->tall_transposed[layout], NULL);            \
+    }
+
+BENCH_LAYOUT(DFImageLayoutLinear, linear)
+BENCH_LAYOUT(DFImageLayoutTiled8, tiled8)
+BENCH_LAYOUT(DFImageLayoutTiled16, tiled16)
+BENCH_LAYOUT(DFImageLayoutMorton, morton)
+
+typedef struct {
+    const char *name;
+    bench_fn fn;
+    double bytes_per_pixel;       // Memory traffic, for the bandwidth column
+} bench_t;
+
+static const bench_t benches[] = {
+    { "stats", bench_stats, 4 },
+    { "stats_atomic", bench_stats_atomic, 4 },
+    { "color_matrix_f32", bench_color_matrix_f32, 32 },
+    { "color_matrix_f16", bench_color_matrix_f16, 16 },
+    { "resample_bilinear", bench_resample_bilinear, 4 },
+    { "resample_lanczos", bench_resample_lanczos, 4 },
+    { "box_v_linear", bench_box_v_linear, 8 },
+    { "box_v_tiled8", bench_box_v_tiled8, 8 },
+    { "box_v_tiled16", bench_box_v_tiled16, 8 },
+    { "box_v_morton", bench_box_v_morton, 8 },
+    { "transpose_linear", bench_transpose_linear, 8 },
+    { "transpose_tiled8", bench_transpose_tiled8, 8 },
+    { "transpose_tiled16", bench_transpose_tiled16, 8 },
+    { "transpose_morton", bench_transpose_morton, 8 },
+};
+
+static void usage(void) {
+    fprintf(stderr, "usage: bench [-size N] [-runs N] [name...]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    bench_context_t ctx = { 2048 };
+    int runs = 10;
+    const char *names[64];
+    int num_names = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
+            ctx.size = (uint32_t) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (argv[i][0] == '-' || num_names == 64) {
+            usage();
+        } else {
+            names[num_names++] = argv[i];
+        }
+    }
+
+    // Smooth gradients with a little noise: histograms that are neither flat
+    // nor a single spike
+    df_cpu_texture_init(&ctx.texture, ctx.size, ctx.size);
+    uint32_t seed = 1;
+    for (uint32_t y = 0; y < ctx.size; y++) {
+        for (uint32_t x = 0; x < ctx.size; x++) {
+            uint8_t *p = ctx.texture.data + y * ctx.texture.bytes_per_row + x * 4;
+            seed = seed * 1664525u + 1013904223u;
+            p[0] = (uint8_t) (x * 255 / ctx.size + (seed >> 29));
+            p[1] = (uint8_t) (y * 255 / ctx.size + (seed >> 30));
+            p[2] = (uint8_t) ((x + y) * 127 / ctx.size);
+            p[3] = 255;
+        }
+    }
+
+    df_image_f32_init(&ctx.image_f32, ctx.size, ctx.size);
+    df_image_f32_init(&ctx.out_f32, ctx.size, ctx.size);
+    df_image_f16_init(&ctx.image_f16, ctx.size, ctx.size);
+    df_image_f16_init(&ctx.out_f16, ctx.size, ctx.size);
+    df_image_f32_from_texture(&ctx.image_f32, &ctx.texture);
+    df_image_f16_from_texture(&ctx.image_f16, &ctx.texture);
+    df_color_matrix_sepia(&ctx.sepia);
+
+    // The same pixels reshaped 16:1, so columns are 16 times longer than
+    // the square image's
+    uint32_t tall_width = ctx.size / 4, tall_height = ctx.size * 4;
+    df_cpu_texture_t tall;
+    df_cpu_texture_init(&tall, tall_width, tall_height);
+    memcpy(tall.data, ctx.texture.data, (size_t) ctx.size * ctx.size * 4);
+    for (int i = 0; i < 4; i++) {
+        df_tiled_image_init(&ctx.tall[i], tall_width, tall_height, (df_image_layout) i);
+        df_tiled_image_init(&ctx.tall_box[i], tall_width, tall_height, (df_image_layout) i);
+        df_tiled_image_init(&ctx.tall_transposed[i], tall_height, tall_width, (df_image_layout) i);
+        df_tiled_image_from_texture(&ctx.tall[i], &tall);
+    }
+    df_cpu_texture_free(&tall);
+
+    printf("%-20s %10s %10s\n", "benchmark", "ms", "GB/s");
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        bool selected = num_names == 0;
+        for (int i = 0; i < num_names; i++) {
+            selected = selected || strcmp(names[i], benches[b].name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+
+        benches[b].fn(&ctx);      // Warm up caches and thread pools
+
+        double best = 1e30;
+        for (int r = 0; r < runs; r++) {
+            double start = now();
+            benches[b].fn(&ctx);
+            double elapsed = now() - start;
+            best = elapsed < best ? elapsed : best;
+        }
+
+        double bytes = benches[b].bytes_per_pixel * ctx.size * ctx.size;
+        printf("%-20s %10.3f %10.2f\n", benches[b].name, best * 1e3, bytes / best * 1e-9);
+    }
+
+    df_cpu_texture_free(&ctx.texture);
+    df_image_f32_free(&ctx.image_f32);
+    df_image_f32_free(&ctx.out_f32);
+    df_image_f16_free(&ctx.image_f16);
+    df_image_f16_free(&ctx.out_f16);
+    for (int i = 0; i < 4; i++) {
+        df_tiled_image_free(&ctx.tall[i]);
+        df_tiled_image_free(&ctx.tall_box[i]);
+        df_tiled_image_free(&ctx.tall_transposed[i]);
+    }
+    return 0;
+}
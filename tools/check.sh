@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+# Builds and runs the dftk unit tests and the golden-image suite, the way
+# CI runs them. Fails on the first failure.
+set -e
+cd "$(dirname "$0")"
+(cd test && ./build.sh && ./test)
+(cd render && ./build.sh && ./render -golden golden)
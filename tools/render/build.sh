@@ -0,0 +1,2 @@
+#!/usr/bin/env bash
+clang main.c -o render -Wall -O2 -lpthread -lm
@@ -0,0 +1,1094 @@
+// Headless renderer for the samples' scenes on the dftk CPU rasterizer.
+// Renders a number of frames, reports the time per frame and optionally
+// writes the last frame as a PNG.
+//
+//   render [-scene name] [-width N] [-height N] [-n N] [-size S]
+//          [-frames N] [-threads N] [-samples N] [-nohiz] [-nograph]
+//          [-texture path] [-o out.png]
+//
+// Scenes:
+//
+//   triangles   06-gpu-cpu-sync: -n triangles (50) of -size pixels (50)
+//               bobbing along a sine
+//   cubes       10-cube: -n cubes in a ball, depth tested, heavy overdraw
+//   quad        04-creating-and-sampling-textures: a 500x500 textured quad,
+//               bilinear, plus trilinear mips; -texture picks the image
+//   selection   08-drawable-texture-read: the gradient quad under a
+//               selection outline and -n debug boxes of -size pixels, all
+//               batched into one overlay line draw
+//   offscreen   03-render-pass-offscreen: a triangle rendered to a texture,
+//               then sampled on a quad, the passes scheduled by tile
+//   triangle    01-triangle: one red triangle from a vertex buffer
+//   colors      02-triangle-colors and 02b: per-vertex colours
+//   interleaved 02c-triangle-colors-interleaved: one interleaved buffer
+//   depth       05-depth-testing: a quad behind a triangle, depth tested
+//   grayscale   07-compute-image-processing: the texture converted to grey
+//               and shown on a quad
+//   checker     09-checker-test: a 100x100 checkerboard
+//   cube        10-cube: one rotating vertex-coloured cube
+//
+// Golden mode renders every sample at a fixed time and compares it with
+// its PNG in the directory, by the CIE76 delta E of each pixel in CIELAB:
+// a sample fails when more than -tolerance (0.1%) of its pixels differ by
+// more than a just noticeable difference. Run it from tools/render:
+//
+//   render -golden golden [-update] [-tolerance F] [-csv times.csv] [-o dir]
+//
+// -update rewrites the goldens, -csv appends each sample's time per frame
+// and diff for tracking over commits, -o writes failing renders there.
+//
+// -samples 4 renders with 4x MSAA, like 10-cube's sampleCount, and reports
+// how many 8x8 blocks needed per-sample storage. Indexed scenes report the
+// post-transform vertex cache's hit rate and transforms per triangle. -nohiz turns off
+// hierarchical depth rejection, to measure what it saves, and -nograph runs
+// render graph passes one after the other.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../../common/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../../common/stb_image_write.h"
+
+#define DFTK_IMPLEMENTATION
+#include "../../common/dftk/dftk.h"
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t count;           // Scene-specific size, e.g. the number of triangles
+    float size;               // Scene-specific, e.g. the size of each triangle
+    double time;
+    df_raster_t raster;
+    df_render_target_t target;
+    void *vertices;
+} render_context_t;
+
+typedef struct {
+    const char *name;
+    bool (*init)(render_context_t *ctx);      // Optional, like deinit
+    void (*frame)(render_context_t *ctx);
+    void (*deinit)(render_context_t *ctx); // Frees what init made, besides ctx->vertices
+} scene_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// 06-gpu-cpu-sync
+
+typedef struct {
+    float position[2];
+    float color[4];
+} TriangleVertex;
+
+static const float triangle_colors[6][4] = {
+    { 1.0, 0.0, 0.0, 1.0 },
+    { 0.0, 1.0, 0.0, 1.0 },
+    { 0.0, 0.0, 1.0, 1.0 },
+    { 1.0, 0.0, 1.0, 1.0 },
+    { 0.0, 1.0, 1.0, 1.0 },
+    { 1.0, 1.0, 0.0, 1.0 },
+};
+
+// vertex_shader: positions in pixels, origin bottom left
+static void triangles_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const TriangleVertex *in = (const TriangleVertex *) vertex;
+    const uint32_t *viewport_size = (const uint32_t *) uniforms;
+    position[0] = in->position[0] / (viewport_size[0] / 2.0f) - 1;
+    position[1] = in->position[1] / (viewport_size[1] / 2.0f) - 1;
+    position[2] = 0;
+    position[3] = 1;
+    memcpy(varyings, in->color, sizeof(in->color));
+}
+
+// fragment_shader
+static bool color_fragment(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    (void) uniforms;
+    (void) depth;
+    memcpy(color, varyings, 4 * sizeof(float));
+    return true;
+}
+
+static const df_raster_pipeline_t triangles_pipeline = { triangles_vertex, color_fragment, 4 };
+
+static bool triangles_init(render_context_t *ctx) {
+    ctx->vertices = malloc((size_t) ctx->count * 3 * sizeof(TriangleVertex));
+    return ctx->vertices != NULL;
+}
+
+// update_triangles(), stretched to the target size
+static void triangles_frame(render_context_t *ctx) {
+    const float amplitude = 80.0f * ctx->height / 600;
+    const float size = ctx->size;
+    TriangleVertex *v = (TriangleVertex *) ctx->vertices;
+    for (uint32_t i = 0; i < ctx->count; i++) {
+        float x = ((ctx->width - 70.0f) / ctx->count) * i;
+        float y = (ctx->height / 2.0f - amplitude / 2 - size / 2) + amplitude * (1 + sinf(x / 300 * (float) ctx->time));
+        const float *c = triangle_colors[i % 6];
+        v[3 * i + 0] = (TriangleVertex) { { x, y }, { c[0], c[1], c[2], 1 } };
+        v[3 * i + 1] = (TriangleVertex) { { x + size, y }, { c[0], c[1], c[2], 1 } };
+        v[3 * i + 2] = (TriangleVertex) { { x + 0.5f * size, y + 0.8860f * size }, { c[0], c[1], c[2], 1 } };
+    }
+
+    uint32_t viewport[2] = { ctx->width, ctx->height };
+    df_render_pass_t pass = { &ctx->target, DFLoadActionClear, { 0, 0, 0, 1 } };
+    df_raster_begin(&ctx->raster, &pass);
+    df_raster_draw(&ctx->raster, &triangles_pipeline, v, sizeof(TriangleVertex), 0, 3 * ctx->count, viewport, NULL);
+    df_raster_end(&ctx->raster);
+}
+
+// 10-cube, -n cubes scattered in a ball and seen from an orbiting camera:
+// lots of overlap, drawn in no particular order. Like 10-cube each cube is 8
+// vertices and 36 uint16 indices, drawn indexed so shared corners are
+// transformed once, with counter-clockwise front faces and back faces culled.
+
+typedef struct {
+    float position[3];
+    float color[4];
+} CubeVertex;
+
+typedef struct {
+    df_matrix_4x4_t view_matrix;
+    df_matrix_4x4_t proj_matrix;
+} CubeUniforms;
+
+// build_cube_vertices()
+static const CubeVertex cube_vertices[8] = {
+    { { -1, -1, -1 }, { 0, 0, 0, 1 } },
+    { { -1, -1,  1 }, { 0, 1, 0, 1 } },
+    { {  1, -1,  1 }, { 0, 1, 1, 1 } },
+    { {  1, -1, -1 }, { 0, 0, 1, 1 } },
+    { { -1,  1, -1 }, { 1, 0, 0, 1 } },
+    { { -1,  1,  1 }, { 1, 1, 0, 1 } },
+    { {  1,  1,  1 }, { 1, 1, 1, 1 } },
+    { {  1,  1, -1 }, { 1, 0, 1, 1 } },
+};
+static const uint16_t cube_indices[36] = {
+    0, 1, 2, 0, 2, 3,
+    4, 6, 5, 4, 7, 6,
+    0, 7, 4, 0, 3, 7,
+    1, 0, 4, 1, 4, 5,
+    2, 1, 5, 2, 5, 6,
+    3, 2, 6, 3, 6, 7,
+};
+
+static void transform(const df_matrix_4x4_t *m, const float in[4], float out[4]) {
+    for (int r = 0; r < 4; r++) {
+        out[r] = m->data[0][r] * in[0] + m->data[1][r] * in[1] + m->data[2][r] * in[2] + m->data[3][r] * in[3];
+    }
+}
+
+// vertex_shader: proj_matrix * view_matrix * position
+static void cube_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const CubeVertex *in = (const CubeVertex *) vertex;
+    const CubeUniforms *u = (const CubeUniforms *) uniforms;
+    float p[4] = { in->position[0], in->position[1], in->position[2], 1 }, view[4];
+    transform(&u->view_matrix, p, view);
+    transform(&u->proj_matrix, view, position);
+    memcpy(varyings, in->color, sizeof(in->color));
+}
+
+static const df_raster_pipeline_t cubes_pipeline = {
+    cube_vertex, color_fragment, 4, true, DFCompareLessEqual, true, false, false, DFCullModeBack, DFWindingCounterClockwise,
+};
+
+// Cubes per indexed draw, as far as uint16 indices reach
+#define CUBES_PER_DRAW (65536 / 8)
+
+static df_orbit_camera_t cubes_camera;
+static float cubes_radius;
+static uint16_t *cubes_indices;
+
+static bool cubes_init(render_context_t *ctx) {
+    uint32_t per_draw = ctx->count < CUBES_PER_DRAW ? ctx->count : CUBES_PER_DRAW;
+    CubeVertex *v = (CubeVertex *) malloc((size_t) ctx->count * 8 * sizeof(CubeVertex));
+    cubes_indices = (uint16_t *) malloc((size_t) per_draw * 36 * sizeof(uint16_t));
+    if (!v || !cubes_indices) {
+        free(v);
+        return false;
+    }
+    for (uint32_t c = 0; c < per_draw; c++) {
+        for (int i = 0; i < 36; i++) {
+            cubes_indices[c * 36 + i] = (uint16_t) (c * 8 + cube_indices[i]);
+        }
+    }
+
+    // Half-size 0.5 cubes, as in 10-cube, at about one per unit volume
+    cubes_radius = cbrtf((float) ctx->count) * 0.62f + 1;
+    uint32_t seed = 1;
+    for (uint32_t c = 0; c < ctx->count; c++) {
+        float center[3];
+        do {
+            for (int k = 0; k < 3; k++) {
+                seed = seed * 1664525 + 1013904223;
+                center[k] = ((seed >> 8) / 16777216.0f * 2 - 1) * cubes_radius;
+            }
+        } while (center[0] * center[0] + center[1] * center[1] + center[2] * center[2] > cubes_radius * cubes_radius);
+
+        for (int i = 0; i < 8; i++) {
+            CubeVertex *out = &v[c * 8 + i];
+            *out = cube_vertices[i];
+            for (int k = 0; k < 3; k++) {
+                out->position[k] = center[k] + 0.5f * out->position[k];
+            }
+        }
+    }
+    ctx->vertices = v;
+
+    cubes_camera = (df_orbit_camera_t) {
+        .camera = { .fov = 55 * DFTK_PI / 180, .near = 0.1f, .far = 100 + 4 * cubes_radius, .aspect = (float) ctx->width / ctx->height },
+        .target = {{ 0, 0, 0 }},
+        .radius = 2.2f * cubes_radius,
+        .polar_angle = 60 * DFTK_PI / 180,
+        .polar_min = 15 * DFTK_PI / 180,
+        .polar_max = 120 * DFTK_PI / 180,
+    };
+    return true;
+}
+
+static void cubes_deinit(render_context_t *ctx) {
+    (void) ctx;
+    free(cubes_indices);
+    cubes_indices = NULL;
+}
+
+static void cubes_frame(render_context_t *ctx) {
+    CubeUniforms u;
+    cubes_camera.azimuth_angle = (float) ctx->time;
+    df_orbit_camera_update(&cubes_camera);
+    df_orbit_camera_view_mat(&cubes_camera, &u.view_matrix);
+    df_orbit_camera_projection_mat(&cubes_camera, &u.proj_matrix);
+
+    df_render_pass_t pass = { &ctx->target, DFLoadActionClear, { 0.12f, 0.12f, 0.12f, 1 }, DFLoadActionClear, 1 };
+    df_raster_begin(&ctx->raster, &pass);
+    for (uint32_t first = 0; first < ctx->count; first += CUBES_PER_DRAW) {
+        uint32_t count = ctx->count - first < CUBES_PER_DRAW ? ctx->count - first : CUBES_PER_DRAW;
+        df_raster_draw_indexed(&ctx->raster, &cubes_pipeline, ctx->vertices, sizeof(CubeVertex), cubes_indices, 36 * count, 8 * first, &u, NULL);
+    }
+    df_raster_end(&ctx->raster);
+}
+
+// 04-creating-and-sampling-textures
+
+typedef struct {
+    float position[2];
+    float texcoord[2];
+} QuadVertex;
+
+static const QuadVertex quad_vertices[6] = {
+    { {  250, -250 }, { 1, 1 } },
+    { { -250, -250 }, { 0, 1 } },
+    { { -250,  250 }, { 0, 0 } },
+
+    { {  250, -250 }, { 1, 1 } },
+    { { -250,  250 }, { 0, 0 } },
+    { {  250,  250 }, { 1, 0 } },
+};
+
+static const char *quad_texture_path = "../../04-creating-and-sampling-textures/Image.tga";
+static df_texture2d_t quad_texture;
+
+// vertex_shader: positions in pixels from the centre
+static void quad_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const QuadVertex *in = (const QuadVertex *) vertex;
+    const uint32_t *viewport_size = (const uint32_t *) uniforms;
+    position[0] = in->position[0] / (viewport_size[0] / 2.0f);
+    position[1] = in->position[1] / (viewport_size[1] / 2.0f);
+    position[2] = 0;
+    position[3] = 1;
+    memcpy(varyings, in->texcoord, sizeof(in->texcoord));
+}
+
+// fragment_shader: texture.sample(s, in.texcoord), with the mip chain 04
+// doesn't have
+static bool quad_fragment(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    static const df_sampler_t sampler = {
+        DFSamplerFilterLinear, DFSamplerFilterLinear, DFSamplerMipFilterLinear, DFSamplerAddressClampToEdge, DFSamplerAddressClampToEdge,
+    };
+    (void) depth;
+    df_texture2d_sample_grad((const df_texture2d_t *) uniforms, &sampler, varyings[0], varyings[1], varyings + 2, varyings + 4, color);
+    return true;
+}
+
+static const df_raster_pipeline_t quad_pipeline = {
+    quad_vertex, quad_fragment, 2, false, DFCompareAlways, false, false, true,
+};
+
+static bool quad_init(render_context_t *ctx) {
+    int width, height, n;
+    uint8_t *data = stbi_load(quad_texture_path, &width, &height, &n, 4);
+    if (!data) {
+        fprintf(stderr, "render: can't load %s\n", quad_texture_path);
+        return false;
+    }
+
+    df_texture_level_t levels[DF_TEXTURE2D_MAX_LEVELS] = {{ data, (uint32_t) width, (uint32_t) height, (uint32_t) width * 4 }};
+    uint32_t level_count = df_mip_level_count((uint32_t) width, (uint32_t) height);
+    level_count = level_count < DF_TEXTURE2D_MAX_LEVELS ? level_count : DF_TEXTURE2D_MAX_LEVELS;
+    if (!df_mipmap_generate(levels, level_count, false, DFMipFilterBox, NULL)) {
+        level_count = 1;
+    }
+    bool ok = df_texture2d_init(&quad_texture, DFPixelFormatRGBA8Unorm, levels, level_count);
+    df_mipmap_free(levels, level_count);
+    stbi_image_free(data);
+
+    ctx->vertices = malloc(sizeof(quad_vertices));
+    if (!ok || !ctx->vertices) {
+        return false;
+    }
+    memcpy(ctx->vertices, quad_vertices, sizeof(quad_vertices));
+    return true;
+}
+
+static void quad_deinit(render_context_t *ctx) {
+    (void) ctx;
+    df_texture2d_free(&quad_texture);
+}
+
+static void quad_frame(render_context_t *ctx) {
+    uint32_t viewport[2] = { ctx->width, ctx->height };
+    df_render_pass_t pass = { &ctx->target, DFLoadActionClear, { 254.0f / 255, 245.0f / 255, 225.0f / 255, 1 } };
+    df_raster_begin(&ctx->raster, &pass);
+    df_raster_draw(&ctx->raster, &quad_pipeline, ctx->vertices, sizeof(QuadVertex), 0, 6, viewport, &quad_texture);
+    df_raster_end(&ctx->raster);
+}
+
+// 08-drawable-texture-read, with its one selection rectangle grown into a
+// frame's worth of debug boxes
+
+static const TriangleVertex selection_quad[6] = {
+    { { 0, 0 }, { 1, 0, 0, 1 } },
+    { { 1, 0 }, { 0, 1, 0, 1 } },
+    { { 1, 1 }, { 0, 0, 1, 1 } },
+    { { 1, 1 }, { 0, 0, 1, 1 } },
+    { { 0, 1 }, { 1, 1, 1, 1 } },
+    { { 0, 0 }, { 1, 0, 0, 1 } },
+};
+
+// vertex_shader: positions in pixels, origin top left. The quad's corners
+// are in units of the viewport.
+static void selection_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const TriangleVertex *in = (const TriangleVertex *) vertex;
+    position[0] = in->position[0] * 2 - 1;
+    position[1] = 1 - in->position[1] * 2;
+    position[2] = 0;
+    position[3] = 1;
+    memcpy(varyings, in->color, sizeof(in->color));
+    (void) uniforms;
+}
+
+static const df_raster_pipeline_t selection_pipeline = { selection_vertex, color_fragment, 4 };
+
+static df_overlay_t selection_overlay;
+
+static bool selection_init(render_context_t *ctx) {
+    (void) ctx;
+    df_overlay_init(&selection_overlay);
+    return true;
+}
+
+static void selection_deinit(render_context_t *ctx) {
+    (void) ctx;
+    df_overlay_free(&selection_overlay);
+}
+
+static void selection_frame(render_context_t *ctx) {
+    const float white[4] = { 1, 1, 1, 1 }, black[4] = { 0, 0, 0, 1 };
+    float w = (float) ctx->width, h = (float) ctx->height, t = (float) ctx->time;
+
+    // The selection, dragged out from a fixed corner, and boxes drifting
+    // along Lissajous paths
+    df_overlay_reset(&selection_overlay);
+    df_overlay_rect(&selection_overlay, w * 0.1f, h * 0.1f, w * (0.4f + 0.3f * sinf(t)), h * (0.4f + 0.3f * cosf(t)), white);
+    for (uint32_t i = 0; i < ctx->count; i++) {
+        float x = (0.5f + 0.45f * sinf(t * (1 + i % 7) + i)) * (w - ctx->size);
+        float y = (0.5f + 0.45f * cosf(t * (1 + i % 5) + 2.0f * i)) * (h - ctx->size);
+        df_overlay_rect(&selection_overlay, floorf(x) + 0.5f, floorf(y) + 0.5f, ctx->size, ctx->size, black);
+    }
+
+    df_render_pass_t pass = { &ctx->target, DFLoadActionClear, { 1, 1, 1, 1 } };
+    df_raster_begin(&ctx->raster, &pass);
+    df_raster_draw(&ctx->raster, &selection_pipeline, selection_quad, sizeof(TriangleVertex), 0, 6, NULL, NULL);
+    df_overlay_draw(&selection_overlay, &ctx->raster);
+    df_raster_end(&ctx->raster);
+}
+
+// 01-triangle and 02-triangle-colors: one triangle in clip space. The
+// shaders index packed_float3 positions, and in 02 a separate colour
+// buffer, by vertex_id; 02b reads the same two buffers through a vertex
+// descriptor, and 02c interleaves them.
+
+#define col(x) (((float) (x)) / 255.0f)
+
+static const float triangle_positions[9] = {
+     0.0,  1.0, 0.0,
+    -1.0, -1.0, 0.0,
+     1.0, -1.0, 0.0,
+};
+
+static const float triangle_vertex_colors[12] = {
+    col(235), col(114), col(113), 1,
+    col(229), col(155), col(95), 1,
+    col(252), col(218), col(150), 1,
+};
+
+typedef struct {
+    const float *positions;
+    const float *colors;      // NULL in 01
+} TriangleBuffers;
+
+// basic_vertex: vertex_array[vertex_id], with vertex_colors[vertex_id]
+static void buffers_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const float *in = (const float *) vertex;
+    const TriangleBuffers *buffers = (const TriangleBuffers *) uniforms;
+    memcpy(position, in, 3 * sizeof(float));
+    position[3] = 1;
+    if (buffers->colors) {
+        size_t vertex_id = (size_t) (in - buffers->positions) / 3;
+        memcpy(varyings, buffers->colors + 4 * vertex_id, 4 * sizeof(float));
+    }
+}
+
+// basic_fragment in 01
+static bool red_fragment(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    (void) varyings;
+    (void) uniforms;
+    (void) depth;
+    memcpy(color, (float[4]) { 1, 0, 0, 1 }, 4 * sizeof(float));
+    return true;
+}
+
+static const df_raster_pipeline_t triangle_pipeline = { buffers_vertex, red_fragment, 0 };
+static const df_raster_pipeline_t colors_pipeline = { buffers_vertex, color_fragment, 4 };
+
+static void triangle_draw(render_context_t *ctx, const df_raster_pipeline_t *pipeline, const TriangleBuffers *buffers) {
+    df_render_pass_t pass = { &ctx->target, DFLoadActionClear, { 254.0f / 255, 245.0f / 255, 225.0f / 255, 1 } };
+    df_raster_begin(&ctx->raster, &pass);
+    df_raster_draw(&ctx->raster, pipeline, buffers->positions, 3 * sizeof(float), 0, 3, buffers, NULL);
+    df_raster_end(&ctx->raster);
+}
+
+static void triangle_frame(render_context_t *ctx) {
+    TriangleBuffers buffers = { triangle_positions, NULL };
+    triangle_draw(ctx, &triangle_pipeline, &buffers);
+}
+
+static void colors_frame(render_context_t *ctx) {
+    TriangleBuffers buffers = { triangle_positions, triangle_vertex_colors };
+    triangle_draw(ctx, &colors_pipeline, &buffers);
+}
+
+typedef struct {
+    float position[3];
+    float color[4];
+} VertexPC;
+
+static const VertexPC interleaved_vertices[3] = {
+    { {  0,  1, 0 }, { col(235), col(114), col(113), 1 } },
+    { { -1, -1, 0 }, { col(229), col(155), col(95), 1 } },
+    { {  1, -1, 0 }, { col(252), col(218), col(150), 1 } },
+};
+
+// basic_vertex with a vertex descriptor, in 02c and 03
+static void basic_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const VertexPC *in = (const VertexPC *) vertex;
+    memcpy(position, in->position, sizeof(in->position));
+    position[3] = 1;
+    memcpy(varyings, in->color, sizeof(in->color));
+    (void) uniforms;
+}
+
+static const df_raster_pipeline_t basic_pipeline = { basic_vertex, color_fragment, 4 };
+
+static void interleaved_frame(render_context_t *ctx) {
+    df_render_pass_t pass = { &ctx->target, DFLoadActionClear, { 254.0f / 255, 245.0f / 255, 225.0f / 255, 1 } };
+    df_raster_begin(&ctx->raster, &pass);
+    df_raster_draw(&ctx->raster, &basic_pipeline, interleaved_vertices, sizeof(VertexPC), 0, 3, NULL, NULL);
+    df_raster_end(&ctx->raster);
+}
+
+// 03-render-pass-offscreen: a triangle drawn into a 512x512 texture, then
+// the texture on a quad in the screen pass. Both passes go through a render
+// graph, so screen tiles the quad doesn't cover clear while the offscreen
+// pass is still drawing; -nograph ends them one after the other instead.
+
+typedef struct {
+    float position[3];
+    float texcoord[2];
+} VertexPT;
+
+static const VertexPC offscreen_triangle[3] = {
+    { { 0.5f, -0.5f, 0 }, { col(235), col(114), col(113), 1 } },
+    { { -0.5f, -0.5f, 0 }, { col(229), col(155), col(95), 1 } },
+    { { 0, 0.5f, 0 }, { col(252), col(218), col(150), 1 } },
+};
+
+static const VertexPT offscreen_quad[6] = {
+    { { 0.5f, -0.5f, 0 }, { 1, 1 } },
+    { { -0.5f, -0.5f, 0 }, { 0, 1 } },
+    { { -0.5f, 0.5f, 0 }, { 0, 0 } },
+
+    { { 0.5f, -0.5f, 0 }, { 1, 1 } },
+    { { -0.5f, 0.5f, 0 }, { 0, 0 } },
+    { { 0.5f, 0.5f, 0 }, { 1, 0 } },
+};
+
+// texture_vertex_shader
+static void offscreen_texture_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const VertexPT *in = (const VertexPT *) vertex;
+    memcpy(position, in->position, sizeof(in->position));
+    position[3] = 1;
+    memcpy(varyings, in->texcoord, sizeof(in->texcoord));
+    (void) uniforms;
+}
+
+// texture_fragment_shader, with the default sampler: nearest, clamped
+static bool offscreen_texture_fragment(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    static const df_sampler_t sampler = {
+        DFSamplerFilterNearest, DFSamplerFilterNearest, DFSamplerMipFilterNotMipmapped, DFSamplerAddressClampToEdge, DFSamplerAddressClampToEdge,
+    };
+    (void) depth;
+    df_texture2d_sample((const df_texture2d_t *) uniforms, &sampler, varyings[0], varyings[1], 0, color);
+    return true;
+}
+
+static const df_raster_pipeline_t offscreen_texture_pipeline = { offscreen_texture_vertex, offscreen_texture_fragment, 2 };
+
+static df_render_target_t offscreen_target;
+static df_texture2d_t offscreen_texture;
+static df_raster_t offscreen_raster;
+static df_render_graph_t offscreen_graph;
+static bool offscreen_sequential;
+
+static bool offscreen_init(render_context_t *ctx) {
+    if (!df_render_target_init(&offscreen_target, 512, 512, 1, false, false) ||
+        !df_raster_init(&offscreen_raster, ctx->raster.pool)) {
+        return false;
+    }
+    df_render_graph_init(&offscreen_graph, ctx->raster.pool);
+    return df_texture2d_view(&offscreen_texture, &offscreen_target.color, false);
+}
+
+static void offscreen_frame(render_context_t *ctx) {
+    df_render_pass_t offscreen_pass = { &offscreen_target, DFLoadActionClear, { 1, 1, 1, 1 } };
+    df_raster_begin(&offscreen_raster, &offscreen_pass);
+    df_raster_draw(&offscreen_raster, &basic_pipeline, offscreen_triangle, sizeof(VertexPC), 0, 3, NULL, NULL);
+
+    df_render_pass_t screen_pass = { &ctx->target, DFLoadActionClear, { 254.0f / 255, 245.0f / 255, 225.0f / 255, 1 } };
+    df_raster_begin(&ctx->raster, &screen_pass);
+    df_raster_draw(&ctx->raster, &offscreen_texture_pipeline, offscreen_quad, sizeof(VertexPT), 0, 6, NULL, &offscreen_texture);
+
+    if (offscreen_sequential) {
+        df_raster_end(&offscreen_raster);
+        df_raster_end(&ctx->raster);
+        return;
+    }
+    df_render_graph_add(&offscreen_graph, &offscreen_raster);
+    df_render_graph_add(&offscreen_graph, &ctx->raster);
+    df_render_graph_read(&offscreen_graph, &offscreen_target, DF_RENDER_GRAPH_READ_ALL);
+    df_render_graph_run(&offscreen_graph);
+}
+
+static void offscreen_deinit(render_context_t *ctx) {
+    (void) ctx;
+    df_render_graph_deinit(&offscreen_graph);
+    df_raster_deinit(&offscreen_raster);
+    df_render_target_free(&offscreen_target);
+}
+
+// 05-depth-testing: a white triangle with moving vertex depths through a
+// grey quad at depth 0.5. Parts of it go behind the near plane.
+
+static const uint32_t depth_viewport[2] = { 800, 600 };
+
+static const VertexPC depth_quad[6] = {
+    { {     100,     100, 0.5 }, { 0.5, 0.5, 0.5, 1 } },
+    { {     100, 600-100, 0.5 }, { 0.5, 0.5, 0.5, 1 } },
+    { { 800-100, 600-100, 0.5 }, { 0.5, 0.5, 0.5, 1 } },
+
+    { {     100,     100, 0.5 }, { 0.5, 0.5, 0.5, 1 } },
+    { { 800-100, 600-100, 0.5 }, { 0.5, 0.5, 0.5, 1 } },
+    { { 800-100,     100, 0.5 }, { 0.5, 0.5, 0.5, 1 } },
+};
+
+// vertex_shader: positions in pixels, origin top left, z as is
+static void depth_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const VertexPC *in = (const VertexPC *) vertex;
+    const uint32_t *viewport_size = (const uint32_t *) uniforms;
+    position[0] = in->position[0] / (viewport_size[0] / 2.0f) - 1;
+    position[1] = -(in->position[1] / (viewport_size[1] / 2.0f) - 1);
+    position[2] = in->position[2];
+    position[3] = 1;
+    memcpy(varyings, in->color, sizeof(in->color));
+}
+
+static const df_raster_pipeline_t depth_pipeline = { depth_vertex, color_fragment, 4, true, DFCompareLessEqual, true };
+
+static void depth_frame(render_context_t *ctx) {
+    float t = (float) ctx->time, s = sinf(t), c = cosf(t);
+    const VertexPC triangle[3] = {
+        { {        200, 600 - 200, c * 0.25f             }, { 1, 1, 1, 1 } },
+        { {  800 / 2.0f,       200, s * 0.25f            }, { 1, 1, 1, 1 } },
+        { {  800 - 200, 600 - 200, s * c * 0.25f * 0.25f }, { 1, 1, 1, 1 } },
+    };
+
+    df_render_pass_t pass = { &ctx->target, DFLoadActionClear, { 0, 0, 0, 1 }, DFLoadActionClear, 1 };
+    df_raster_begin(&ctx->raster, &pass);
+    df_raster_draw(&ctx->raster, &depth_pipeline, depth_quad, sizeof(VertexPC), 0, 6, depth_viewport, NULL);
+    df_raster_draw(&ctx->raster, &depth_pipeline, triangle, sizeof(VertexPC), 0, 3, depth_viewport, NULL);
+    df_raster_end(&ctx->raster);
+}
+
+// 07-compute-image-processing: grayscale_kernel with a bias swinging
+// along a sine, through df_grayscale, and its output on a 450x600 quad
+
+static const QuadVertex grayscale_quad[6] = {
+    { {  225, -300 }, { 1, 1 } },
+    { { -225, -300 }, { 0, 1 } },
+    { { -225,  300 }, { 0, 0 } },
+
+    { {  225, -300 }, { 1, 1 } },
+    { { -225,  300 }, { 0, 0 } },
+    { {  225,  300 }, { 1, 0 } },
+};
+
+static const char *grayscale_image_path = "../../07-compute-image-processing/out.png";
+static df_cpu_texture_t grayscale_input;
+static df_cpu_texture_t grayscale_output;
+static df_texture2d_t grayscale_texture;
+
+// fragment_shader: linear, without mips
+static bool grayscale_fragment(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    static const df_sampler_t sampler = {
+        DFSamplerFilterLinear, DFSamplerFilterLinear, DFSamplerMipFilterNotMipmapped, DFSamplerAddressClampToEdge, DFSamplerAddressClampToEdge,
+    };
+    (void) depth;
+    df_texture2d_sample((const df_texture2d_t *) uniforms, &sampler, varyings[0], varyings[1], 0, color);
+    return true;
+}
+
+static const df_raster_pipeline_t grayscale_pipeline = { quad_vertex, grayscale_fragment, 2 };
+
+static bool grayscale_init(render_context_t *ctx) {
+    (void) ctx;
+    int width, height, n;
+    uint8_t *data = stbi_load(grayscale_image_path, &width, &height, &n, 4);
+    if (!data) {
+        fprintf(stderr, "render: can't load %s\n", grayscale_image_path);
+        return false;
+    }
+    bool ok = df_cpu_texture_init(&grayscale_input, (uint32_t) width, (uint32_t) height) &&
+              df_cpu_texture_init(&grayscale_output, (uint32_t) width, (uint32_t) height);
+    if (ok) {
+        for (int y = 0; y < height; y++) {
+            memcpy(grayscale_input.data + y * grayscale_input.bytes_per_row, data + (size_t) y * width * 4, (size_t) width * 4);
+        }
+        ok = df_texture2d_view(&grayscale_texture, &grayscale_output, false);
+    }
+    stbi_image_free(data);
+    return ok;
+}
+
+static void grayscale_frame(render_context_t *ctx) {
+    df_grayscale(&grayscale_input, &grayscale_output, (float) (0.5 * sin(ctx->time)), NULL);
+
+    uint32_t viewport[2] = { ctx->width, ctx->height };
+    df_render_pass_t pass = { &ctx->target, DFLoadActionClear, { 0, 0, 0, 1 } };
+    df_raster_begin(&ctx->raster, &pass);
+    df_raster_draw(&ctx->raster, &grayscale_pipeline, grayscale_quad, sizeof(QuadVertex), 0, 6, viewport, &grayscale_texture);
+    df_raster_end(&ctx->raster);
+}
+
+static void grayscale_deinit(render_context_t *ctx) {
+    (void) ctx;
+    df_texture2d_free(&grayscale_texture);
+    df_cpu_texture_free(&grayscale_input);
+    df_cpu_texture_free(&grayscale_output);
+}
+
+// 09-checker-test: a 10x10 checkerboard texture on a 100x100 quad, nearest
+// filtered, so each texel is exactly 10x10 pixels
+
+static const uint32_t checker_viewport[2] = { 100, 100 };
+
+static const QuadVertex checker_quad[6] = {
+    { {   0,   0 }, { 0, 0 } },
+    { { 100,   0 }, { 1, 0 } },
+    { { 100, 100 }, { 1, 1 } },
+
+    { { 100, 100 }, { 1, 1 } },
+    { {   0, 100 }, { 0, 1 } },
+    { {   0,   0 }, { 0, 0 } },
+};
+
+static df_texture2d_t checker_texture;
+
+// vertex_shader: positions in pixels, origin top left
+static void checker_vertex(const void *vertex, const void *uniforms, float position[4], float *varyings) {
+    const QuadVertex *in = (const QuadVertex *) vertex;
+    const uint32_t *viewport_size = (const uint32_t *) uniforms;
+    position[0] = in->position[0] / (viewport_size[0] / 2.0f) - 1;
+    position[1] = -(in->position[1] / (viewport_size[1] / 2.0f) - 1);
+    position[2] = 0;
+    position[3] = 1;
+    memcpy(varyings, in->texcoord, sizeof(in->texcoord));
+}
+
+static bool checker_fragment(const float *varyings, const void *uniforms, float color[4], float *depth) {
+    static const df_sampler_t sampler = {
+        DFSamplerFilterNearest, DFSamplerFilterNearest, DFSamplerMipFilterNotMipmapped, DFSamplerAddressClampToEdge, DFSamplerAddressClampToEdge,
+    };
+    (void) depth;
+    df_texture2d_sample((const df_texture2d_t *) uniforms, &sampler, varyings[0], varyings[1], 0, color);
+    return true;
+}
+
+static const df_raster_pipeline_t checker_pipeline = { checker_vertex, checker_fragment, 2 };
+
+static bool checker_init(render_context_t *ctx) {
+    (void) ctx;
+    uint8_t pixels[10 * 10 * 4];
+    for (int x = 0; x < 10; x++) {
+        for (int y = 0; y < 10; y++) {
+            int offset = y % 2;
+            int idx = y * 10 + x;
+            uint8_t c = (x + offset) % 2 == 0 ? 255 : 0;
+            pixels[4 * idx] = c;
+            pixels[4 * idx + 1] = c;
+            pixels[4 * idx + 2] = c;
+            pixels[4 * idx + 3] = 255;
+        }
+    }
+    df_texture_level_t level = { pixels, 10, 10, 10 * 4 };
+    return df_texture2d_init(&checker_texture, DFPixelFormatRGBA8Unorm, &level, 1);
+}
+
+static void checker_frame(render_context_t *ctx) {
+    df_render_pass_t pass = { &ctx->target, DFLoadActionClear, { 1, 0, 0, 1 } };
+    df_raster_begin(&ctx->raster, &pass);
+    df_raster_draw(&ctx->raster, &checker_pipeline, checker_quad, sizeof(QuadVertex), 0, 6, checker_viewport, &checker_texture);
+    df_raster_end(&ctx->raster);
+}
+
+static void checker_deinit(render_context_t *ctx) {
+    (void) ctx;
+    df_texture2d_free(&checker_texture);
+}
+
+// 10-cube itself: one cube of half-size 0.5 under the sample's initial
+// orbit camera, with 10-cube's 4x MSAA when run with -samples 4
+
+static df_orbit_camera_t cube_camera;
+
+static bool cube_init(render_context_t *ctx) {
+    CubeVertex *v = (CubeVertex *) malloc(sizeof(cube_vertices));
+    if (!v) {
+        return false;
+    }
+    for (int i = 0; i < 8; i++) {
+        v[i] = cube_vertices[i];
+        for (int k = 0; k < 3; k++) {
+            v[i].position[k] *= 0.5f;
+        }
+    }
+    ctx->vertices = v;
+
+    cube_camera = (df_orbit_camera_t) {
+        .camera = { .fov = 55 * DFTK_PI / 180, .near = 0.1f, .far = 100, .aspect = (float) ctx->width / ctx->height },
+        .target = {{ 0, 0, 0 }},
+        .radius = 4,
+        .polar_angle = 45 * DFTK_PI / 180,
+        .azimuth_angle = 45 * DFTK_PI / 180,
+        .polar_min = 15 * DFTK_PI / 180,
+        .polar_max = 120 * DFTK_PI / 180,
+        .radius_min = 1.8f,
+        .radius_max = 10,
+    };
+    return true;
+}
+
+static void cube_frame(render_context_t *ctx) {
+    CubeUniforms u;
+    df_orbit_camera_update(&cube_camera);
+    df_orbit_camera_view_mat(&cube_camera, &u.view_matrix);
+    df_orbit_camera_projection_mat(&cube_camera, &u.proj_matrix);
+
+    df_render_pass_t pass = { &ctx->target, DFLoadActionClear, { 0.12f, 0.12f, 0.12f, 1 }, DFLoadActionClear, 1 };
+    df_raster_begin(&ctx->raster, &pass);
+    df_raster_draw_indexed(&ctx->raster, &cubes_pipeline, ctx->vertices, sizeof(CubeVertex), cube_indices, 36, 0, &u, NULL);
+    df_raster_end(&ctx->raster);
+}
+
+static const scene_t scenes[] = {
+    { "triangles", triangles_init, triangles_frame },
+    { "cubes", cubes_init, cubes_frame, cubes_deinit },
+    { "quad", quad_init, quad_frame, quad_deinit },
+    { "selection", selection_init, selection_frame, selection_deinit },
+    { "offscreen", offscreen_init, offscreen_frame, offscreen_deinit },
+    { "triangle", NULL, triangle_frame },
+    { "colors", NULL, colors_frame },
+    { "interleaved", NULL, interleaved_frame },
+    { "depth", NULL, depth_frame },
+    { "grayscale", grayscale_init, grayscale_frame, grayscale_deinit },
+    { "checker", checker_init, checker_frame, checker_deinit },
+    { "cube", cube_init, cube_frame },
+};
+
+static const scene_t *find_scene(const char *name) {
+    for (size_t i = 0; i < sizeof(scenes) / sizeof(scenes[0]); i++) {
+        if (strcmp(scenes[i].name, name) == 0) {
+            return &scenes[i];
+        }
+    }
+    return NULL;
+}
+
+// Golden images: every numbered sample rendered at a fixed frame, as its
+// window shows it, and compared with tools/render/golden/<sample>.png
+
+#define GOLDEN_FRAME 100
+#define GOLDEN_TOLERANCE 0.001  // Fraction of pixels allowed past a just noticeable difference
+
+typedef struct {
+    const char *sample;       // Directory, and the golden image's name
+    const char *scene;
+    uint32_t width;
+    uint32_t height;
+    uint32_t samples;
+    bool srgb;
+    uint32_t count;
+    float size;
+} golden_t;
+
+static const golden_t goldens[] = {
+    { "01-triangle", "triangle", 800, 600, 1 },
+    { "02-triangle-colors", "colors", 800, 600, 1 },
+    { "02b-triangle-colors-vertex-descriptors", "colors", 800, 600, 1 },
+    { "02c-triangle-colors-interleaved", "interleaved", 800, 600, 1 },
+    { "03-render-pass-offscreen", "offscreen", 800, 600, 1 },
+    { "04-creating-and-sampling-textures", "quad", 800, 600, 1 },
+    { "05-depth-testing", "depth", 800, 600, 1 },
+    { "06-gpu-cpu-sync", "triangles", 800, 600, 1, false, 50, 50 },
+    { "07-compute-image-processing", "grayscale", 800, 600, 1, true },
+    { "08-drawable-texture-read", "selection", 800, 600, 1 },
+    { "09-checker-test", "checker", 100, 100, 1 },
+    { "10-cube", "cube", 800, 600, 4 },
+};
+
+// Renders each sample `frames` times, compares the last frame with its
+// golden image, or replaces the golden with `update`, and reports the time
+// per frame. Failing renders are written to `output` if given. Returns the
+// number of failures.
+static int golden_run(const char *dir, bool update, const char *output, const char *csv, double tolerance, int frames, df_thread_pool_t *pool) {
+    FILE *times = NULL;
+    if (csv) {
+        times = fopen(csv, "a");
+        if (!times) {
+            fprintf(stderr, "render: can't open %s\n", csv);
+            return 1;
+        }
+        fseek(times, 0, SEEK_END);
+        if (ftell(times) == 0) {
+            fprintf(times, "sample,ms_per_frame,best_ms,max_delta_e,over_jnd,result\n");
+        }
+    }
+
+    printf("%-40s %9s %9s %8s %9s\n", "sample", "ms/frame", "best ms", "max dE", "over JND");
+    int failures = 0;
+    for (size_t g = 0; g < sizeof(goldens) / sizeof(goldens[0]); g++) {
+        const golden_t *golden = &goldens[g];
+        const scene_t *scene = find_scene(golden->scene);
+        render_context_t ctx = { golden->width, golden->height, golden->count, golden->size, GOLDEN_FRAME * 0.01 };
+        if (!df_raster_init(&ctx.raster, pool) ||
+            !df_render_target_init(&ctx.target, ctx.width, ctx.height, golden->samples, true, golden->srgb) ||
+            (scene->init && !scene->init(&ctx))) {
+            fprintf(stderr, "render: %s: can't set up the scene\n", golden->sample);
+            return failures + 1;
+        }
+
+        double best = 1e30, total = 0;
+        for (int i = 0; i < frames; i++) {
+            double start = now();
+            scene->frame(&ctx);
+            double elapsed = now() - start;
+            best = elapsed < best ? elapsed : best;
+            total += elapsed;
+        }
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s.png", dir, golden->sample);
+        const df_cpu_texture_t *color = &ctx.target.color;
+        const char *result = "ok";
+        df_image_diff_t diff = {0};
+        if (update) {
+            result = stbi_write_png(path, (int) color->width, (int) color->height, 4, color->data, (int) color->bytes_per_row) ? "updated" : "can't write";
+        } else {
+            int width, height, n;
+            uint8_t *data = stbi_load(path, &width, &height, &n, 4);
+            df_cpu_texture_t expected = { data, (uint32_t) width, (uint32_t) height, (size_t) width * 4 };
+            if (!data) {
+                result = "no golden";
+            } else if (!df_image_diff(color, &expected, DF_IMAGE_DIFF_JND, &diff)) {
+                result = "wrong size";
+            } else if (diff.over > tolerance * diff.count) {
+                result = "FAILED";
+            }
+            stbi_image_free(data);
+        }
+        bool failed = strcmp(result, "ok") != 0 && strcmp(result, "updated") != 0;
+        failures += failed;
+        if (failed && output) {
+            snprintf(path, sizeof(path), "%s/%s.png", output, golden->sample);
+            stbi_write_png(path, (int) color->width, (int) color->height, 4, color->data, (int) color->bytes_per_row);
+        }
+
+        printf("%-40s %9.3f %9.3f %8.2f %9llu %s\n", golden->sample, total / frames * 1e3, best * 1e3,
+               diff.max_delta_e, (unsigned long long) diff.over, result);
+        if (times) {
+            fprintf(times, "%s,%.3f,%.3f,%.2f,%llu,%s\n", golden->sample, total / frames * 1e3, best * 1e3,
+                    diff.max_delta_e, (unsigned long long) diff.over, result);
+        }
+
+        if (scene->deinit) {
+            scene->deinit(&ctx);
+        }
+        free(ctx.vertices);
+        df_render_target_free(&ctx.target);
+        df_raster_deinit(&ctx.raster);
+    }
+
+    if (times) {
+        fclose(times);
+    }
+    printf("%d of %zu samples failed, %d threads\n", failures, sizeof(goldens) / sizeof(goldens[0]), pool->num_threads);
+    return failures;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: render [-scene name] [-width N] [-height N] [-n N] [-size S] [-frames N] [-threads N] [-samples N] [-nohiz] [-nograph] [-texture path] [-o out.png]\n"
+                    "       render -golden dir [-update] [-tolerance F] [-csv times.csv] [-frames N] [-threads N] [-o failed_dir]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    render_context_t ctx = { 800, 600, 50, 50 };
+    const char *scene_name = "triangles";
+    const char *output = NULL;
+    int frames = 100;
+    int threads = 0;
+    uint32_t samples = 1;
+    bool hiz = true;
+    const char *golden_dir = NULL;
+    const char *csv = NULL;
+    bool update = false;
+    double tolerance = GOLDEN_TOLERANCE;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-scene") == 0 && i + 1 < argc) {
+            scene_name = argv[++i];
+        } else if (strcmp(argv[i], "-width") == 0 && i + 1 < argc) {
+            ctx.width = (uint32_t) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-height") == 0 && i + 1 < argc) {
+            ctx.height = (uint32_t) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            ctx.count = (uint32_t) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
+            ctx.size = (float) atof(argv[++i]);
+        } else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-samples") == 0 && i + 1 < argc) {
+            samples = (uint32_t) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-texture") == 0 && i + 1 < argc) {
+            quad_texture_path = argv[++i];
+        } else if (strcmp(argv[i], "-nohiz") == 0) {
+            hiz = false;
+        } else if (strcmp(argv[i], "-nograph") == 0) {
+            offscreen_sequential = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "-golden") == 0 && i + 1 < argc) {
+            golden_dir = argv[++i];
+        } else if (strcmp(argv[i], "-update") == 0) {
+            update = true;
+        } else if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc) {
+            csv = argv[++i];
+        } else {
+            usage();
+        }
+    }
+
+    if (golden_dir) {
+        df_thread_pool_t pool;
+        if (frames < 1 || !df_thread_pool_init(&pool, threads)) {
+            usage();
+        }
+        int failures = golden_run(golden_dir, update, output, csv, tolerance, frames, &pool);
+        df_thread_pool_deinit(&pool);
+        return failures ? 1 : 0;
+    }
+
+    const scene_t *scene = find_scene(scene_name);
+    if (!scene || ctx.width == 0 || ctx.height == 0 || ctx.count == 0 || !(ctx.size > 0) || frames < 1 ||
+        (samples != 1 && samples != DF_RASTER_MAX_SAMPLES)) {
+        usage();
+    }
+
+    df_thread_pool_t pool;
+    if (!df_thread_pool_init(&pool, threads) || !df_raster_init(&ctx.raster, &pool) ||
+        !df_render_target_init(&ctx.target, ctx.width, ctx.height, samples, true, false) || (scene->init && !scene->init(&ctx))) {
+        fprintf(stderr, "render: out of memory\n");
+        return 1;
+    }
+    ctx.raster.hiz_disabled = !hiz;
+
+    // Same time step as the samples' frame()
+    double best = 1e30, total = 0;
+    for (int i = 0; i < frames; i++) {
+        ctx.time += 0.01;
+        double start = now();
+        scene->frame(&ctx);
+        double elapsed = now() - start;
+        best = elapsed < best ? elapsed : best;
+        total += elapsed;
+    }
+    printf("%s: %d frames, %.3f ms/frame (best %.3f ms), %d threads\n",
+           scene->name, frames, total / frames * 1e3, best * 1e3, pool.num_threads);
+    if (ctx.target.msaa) {
+        uint32_t expanded = 0;
+        for (uint32_t i = 0; i < ctx.raster.tiles_x * ctx.raster.tiles_y; i++) {
+            expanded += ctx.target.msaa[i].count;
+        }
+        uint32_t blocks = ((ctx.width + DF_RASTER_BLOCK_SIZE - 1) / DF_RASTER_BLOCK_SIZE) * ((ctx.height + DF_RASTER_BLOCK_SIZE - 1) / DF_RASTER_BLOCK_SIZE);
+        printf("%ux MSAA: %u of %u blocks expanded\n", samples, expanded, blocks);
+    }
+    uint64_t lookups = ctx.raster.cache_hits + ctx.raster.cache_misses;
+    if (lookups) {
+        printf("vertex cache: %.1f%% hits, %.3f vertices per triangle\n",
+               100.0 * ctx.raster.cache_hits / lookups, 3.0 * ctx.raster.cache_misses / lookups);
+    }
+
+    if (output && !stbi_write_png(output, (int) ctx.width, (int) ctx.height, 4, ctx.target.color.data, (int) ctx.target.color.bytes_per_row)) {
+        fprintf(stderr, "render: can't write %s\n", output);
+        return 1;
+    }
+
+    if (scene->deinit) {
+        scene->deinit(&ctx);
+    }
+    free(ctx.vertices);
+    df_render_target_free(&ctx.target);
+    df_raster_deinit(&ctx.raster);
+    df_thread_pool_deinit(&pool);
+    return 0;
+}
@@ -0,0 +1,46 @@
+// Runs the unit tests of common/dftk and common/math.h. Each test asserts
+// and prints "<name>: passed!"; the first failure aborts.
+//
+//   ./build.sh && ./test
+//
+// tools/check.sh runs this and the render tool's golden suite.
+
+#undef NDEBUG
+#define TEST
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MATH_IMPL
+#include "../../common/math.h"
+
+#define DFTK_IMPLEMENTATION
+#include "../../common/dftk/dftk.h"
+
+int main(void) {
+    math_h_test();
+
+    df_thread_pool_test();
+    df_dispatch_test();
+    df_texture_file_test();
+    df_mipmap_test();
+    df_texture_cache_test();
+    df_tile_stream_test();
+    df_image_f16_test();
+    df_grayscale_test();
+    df_convolve_test();
+    df_color_matrix_test();
+    df_filter_graph_test();
+    df_image_stats_test();
+    df_resample_test();
+    df_tiled_image_test();
+    df_raster_test();
+    df_sampler_test();
+    df_overlay_test();
+    df_render_graph_test();
+    df_image_diff_test();
+
+    printf("all tests passed\n");
+    return 0;
+}
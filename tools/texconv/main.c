@@ -0,0 +1,110 @@
+// Offline converter from JPEG/PNG/TGA/... to the precompiled .dftx texture
+// container read by load_texture_file (see common/dftk/texture_file.h).
+//
+//   texconv [-srgb] [-bgra] [-lz4] [-align N] [-mips box|kaiser] input output.dftx
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../../common/stb_image.h"
+
+#define DFTK_IMPLEMENTATION
+#include "../../common/dftk/dftk.h"
+
+static void usage(void) {
+    fprintf(stderr, "usage: texconv [-srgb] [-bgra] [-lz4] [-align N] [-mips box|kaiser] input output.dftx\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    bool srgb = false;
+    bool bgra = false;
+    df_texture_file_compression compression = DFTextureFileCompressionNone;
+    uint32_t row_alignment = 256;
+    bool mips = false;
+    df_mip_filter mip_filter = DFMipFilterBox;
+    const char *input = NULL;
+    const char *output = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-srgb") == 0) {
+            srgb = true;
+        } else if (strcmp(argv[i], "-bgra") == 0) {
+            bgra = true;
+        } else if (strcmp(argv[i], "-lz4") == 0) {
+            compression = DFTextureFileCompressionLZ4;
+        } else if (strcmp(argv[i], "-align") == 0 && i + 1 < argc) {
+            row_alignment = (uint32_t) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-mips") == 0 && i + 1 < argc) {
+            mips = true;
+            i++;
+            if (strcmp(argv[i], "box") == 0) {
+                mip_filter = DFMipFilterBox;
+            } else if (strcmp(argv[i], "kaiser") == 0) {
+                mip_filter = DFMipFilterKaiser;
+            } else {
+                usage();
+            }
+        } else if (!input) {
+            input = argv[i];
+        } else if (!output) {
+            output = argv[i];
+        } else {
+            usage();
+        }
+    }
+
+    if (!input || !output) {
+        usage();
+    }
+
+    int width, height, n;
+    unsigned char *data = stbi_load(input, &width, &height, &n, 4);
+    if (!data) {
+        fprintf(stderr, "texconv: failed to load %s: %s\n", input, stbi_failure_reason());
+        return 1;
+    }
+
+    // Mips are built before the BGRA swizzle; the filters treat R and B the same
+    df_texture_level_t levels[DF_TEXTURE_FILE_MAX_LEVELS] = {{ data, (uint32_t) width, (uint32_t) height, (uint32_t) width * 4 }};
+    uint32_t level_count = 1;
+    if (mips) {
+        level_count = df_mip_level_count(width, height);
+        if (level_count > DF_TEXTURE_FILE_MAX_LEVELS) level_count = DF_TEXTURE_FILE_MAX_LEVELS;
+        if (!df_mipmap_generate(levels, level_count, srgb, mip_filter, NULL)) {
+            fprintf(stderr, "texconv: failed to generate mips\n");
+            return 1;
+        }
+    }
+
+    if (bgra) {
+        for (uint32_t l = 0; l < level_count; l++) {
+            uint8_t *p = (uint8_t *) levels[l].data;
+            for (uint32_t i = 0; i < levels[l].width * levels[l].height; i++) {
+                uint8_t r = p[4*i];
+                p[4*i] = p[4*i+2];
+                p[4*i+2] = r;
+            }
+        }
+    }
+
+    df_pixel_format format;
+    if (bgra) {
+        format = srgb ? DFPixelFormatBGRA8Unorm_sRGB : DFPixelFormatBGRA8Unorm;
+    } else {
+        format = srgb ? DFPixelFormatRGBA8Unorm_sRGB : DFPixelFormatRGBA8Unorm;
+    }
+
+    if (!df_texture_file_write(output, format, levels, level_count, row_alignment, compression)) {
+        fprintf(stderr, "texconv: failed to write %s\n", output);
+        return 1;
+    }
+
+    printf("%s: %dx%d, %u levels -> %s\n", input, width, height, level_count, output);
+
+    df_mipmap_free(levels, level_count);
+    stbi_image_free(data);
+    return 0;
+}